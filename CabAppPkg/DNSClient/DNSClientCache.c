@@ -0,0 +1,669 @@
+#include "DNSClientCache.h"
+
+#define NS_PER_SECOND   1000000000ULL
+#define MAX_WIRE_NAME   255
+
+/**
+  Lower cases a single ASCII character.  Label length octets are always below 64
+  so they pass through untouched.
+ */
+#define DNSCacheToLower(c)   ((((c) >= 'A') && ((c) <= 'Z')) ? ((c) + ('a' - 'A')) : (c))
+
+/**
+  Hashes a wire format name (case insensitive) and QTYPE with FNV-1a.
+
+  @param[in] Name        Wire format name.
+  @param[in] NameLength  Length of Name in bytes.
+  @param[in] QType       The QTYPE.
+
+  @retval UINT32         The hash.
+  */
+STATIC UINT32 DNSCacheHash(CONST UINT8 *Name, UINTN NameLength, UINT16 QType) {
+  UINT32  Hash;
+  UINTN   i;
+
+  Hash = 2166136261U;
+
+  for(i = 0; i < NameLength; ++i) {
+    Hash ^= DNSCacheToLower(Name[i]);
+    Hash *= 16777619U;
+  }
+
+  Hash ^= QType;
+  Hash *= 16777619U;
+
+  return Hash;
+} // End of DNSCacheHash
+
+
+/**
+  Compares two wire format names without regard to case.
+
+  @retval TRUE           The names are equal.
+  */
+STATIC BOOLEAN DNSCacheNameEqual(CONST UINT8 *A, CONST UINT8 *B, UINTN Length) {
+  UINTN   i;
+
+  for(i = 0; i < Length; ++i) {
+    if(DNSCacheToLower(A[i]) != DNSCacheToLower(B[i])) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+} // End of DNSCacheNameEqual
+
+
+/**
+  Checks that Length bytes hold exactly one uncompressed wire format name,
+  its root label being the last byte.
+
+  @retval TRUE           The name is well formed.
+  */
+STATIC BOOLEAN DNSCacheWireNameValid(CONST UINT8 *Name, UINTN Length) {
+  UINTN   i;
+
+  if(Length == 0 || Length > MAX_WIRE_NAME) {
+    return FALSE;
+  }
+
+  for(i = 0; Name[i] != 0; i += Name[i] + 1) {
+    if(Name[i] > 63 || i + Name[i] + 1 >= Length) {
+      return FALSE;
+    }
+  }
+
+  return (BOOLEAN)(i == Length - 1);
+} // End of DNSCacheWireNameValid
+
+
+/**
+  Checks the name and RDATA of a snapshot record against what the resolver
+  itself caches: packed addresses for A and AAAA, and a single wire format
+  name for CNAME and PTR.  Other types are kept as they are.
+
+  @retval TRUE           The record can be restored.
+  */
+STATIC BOOLEAN DNSCacheRecordValid(CONST DNS_CACHE_SNAPSHOT_RECORD *Record) {
+  CONST UINT8   *Name;
+
+  Name = (CONST UINT8*)(Record + 1);
+
+  if(!DNSCacheWireNameValid(Name, Record->NameLength)) {
+    return FALSE;
+  }
+
+  switch(Record->QType) {
+    case 1:
+      return (BOOLEAN)(Record->RDataLength == Record->RecordCount * 4U);
+
+    case 28:
+      return (BOOLEAN)(Record->RDataLength == Record->RecordCount * 16U);
+
+    case 5:
+    case 12:
+      return (BOOLEAN)(Record->RecordCount == 1 && DNSCacheWireNameValid(Name + Record->NameLength, Record->RDataLength));
+
+    default:
+      return TRUE;
+  }
+} // End of DNSCacheRecordValid
+
+
+/**
+  Unlinks an entry from the cache and frees it.  A restored entry is only
+  unlinked, its memory goes with the snapshot.
+
+  @param[in] Cache       The cache the entry belongs to.
+  @param[in] Entry       The entry to remove.
+  */
+STATIC VOID DNSCacheRemove(DNS_CACHE *Cache, DNS_CACHE_ENTRY *Entry) {
+  RemoveEntryList(&Entry->HashLink);
+  RemoveEntryList(&Entry->LruLink);
+
+  Cache->Used -= Entry->Size;
+  --(Cache->Count);
+
+  if(!Entry->Restored) {
+    FreePool(Entry);
+  }
+} // End of DNSCacheRemove
+
+
+/**
+  Finds an entry regardless of whether it has expired.
+
+  @retval NULL             The name is not cached.
+  @retval DNS_CACHE_ENTRY* The cached entry.
+  */
+STATIC DNS_CACHE_ENTRY* DNSCacheFind(DNS_CACHE *Cache, CONST UINT8 *Name, UINTN NameLength, UINT16 QType, UINT32 Hash) {
+  LIST_ENTRY       *Bucket;
+  LIST_ENTRY       *Link;
+  DNS_CACHE_ENTRY  *Entry;
+
+  Bucket = &Cache->Buckets[Hash & (DNS_CACHE_BUCKETS - 1)];
+
+  for(Link = GetFirstNode(Bucket); !IsNull(Bucket, Link); Link = GetNextNode(Bucket, Link)) {
+    Entry = CR(Link, DNS_CACHE_ENTRY, HashLink, DNS_CACHE_ENTRY_SIGNATURE);
+
+    if(Entry->Hash == Hash && Entry->QType == QType && Entry->NameLength == NameLength &&
+       DNSCacheNameEqual(Entry->Name, Name, NameLength)) {
+      return Entry;
+    }
+  }
+
+  return NULL;
+} // End of DNSCacheFind
+
+
+/**
+  Initalizes an empty cache.
+
+  @param[in] Cache         The cache to initalize.
+  @param[in] Budget        Maximum number of bytes the cache may hold.  0 disables the cache.
+
+  @retval EFI_SUCCESS            The cache is ready for use.
+  @retval EFI_INVALID_PARAMETER  Cache is NULL.
+  */
+EFI_STATUS EFIAPI DNSCacheInit(DNS_CACHE *Cache, UINTN Budget) {
+  UINTN   i;
+
+  if(Cache == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  ZeroMem(Cache, sizeof(DNS_CACHE));
+
+  for(i = 0; i < DNS_CACHE_BUCKETS; ++i) {
+    InitializeListHead(&Cache->Buckets[i]);
+  }
+
+  InitializeListHead(&Cache->Lru);
+
+  Cache->Budget = Budget;
+
+  return EFI_SUCCESS;
+} // End of DNSCacheInit
+
+
+/**
+  Removes and frees every entry in the cache.
+
+  @param[in] Cache         The cache to flush.
+  */
+VOID EFIAPI DNSCacheFlush(DNS_CACHE *Cache) {
+  if(Cache == NULL || Cache->Lru.ForwardLink == NULL) {
+    return;
+  }
+
+  while(!IsListEmpty(&Cache->Lru)) {
+    DNSCacheRemove(Cache, CR(GetFirstNode(&Cache->Lru), DNS_CACHE_ENTRY, LruLink, DNS_CACHE_ENTRY_SIGNATURE));
+  }
+
+  if(Cache->Snapshot != NULL) {
+    FreePool(Cache->Snapshot);
+    FreePool(Cache->SnapshotEntries);
+
+    Cache->Snapshot        = NULL;
+    Cache->SnapshotEntries = NULL;
+  }
+} // End of DNSCacheFlush
+
+
+/**
+  Looks up the entry for a name and QTYPE.  A hit is moved to the hot end of the
+  LRU list.  An expired entry is removed and reported as a miss.
+
+  @param[in] Cache         The cache to search.
+  @param[in] Name          Wire format name.
+  @param[in] NameLength    Length of Name in bytes, including the terminating root label.
+  @param[in] QType         The QTYPE (host byte order).
+  @param[in] Now           Current monotonic time in ns.
+
+  @retval NULL             The name is not cached.
+  @retval DNS_CACHE_ENTRY* The cached entry.  Valid until the next insert or flush.
+  */
+DNS_CACHE_ENTRY* EFIAPI DNSCacheLookup(DNS_CACHE *Cache, CONST UINT8 *Name, UINTN NameLength, UINT16 QType, UINT64 Now) {
+  DNS_CACHE_ENTRY  *Entry;
+
+  if(Cache == NULL || Name == NULL || Cache->Budget == 0) {
+    return NULL;
+  }
+
+  Entry = DNSCacheFind(Cache, Name, NameLength, QType, DNSCacheHash(Name, NameLength, QType));
+
+  if(Entry != NULL && Entry->Expires <= Now) {
+    DNSCacheRemove(Cache, Entry);
+    Entry = NULL;
+  }
+
+  if(Entry == NULL) {
+    ++(Cache->Misses);
+    return NULL;
+  }
+
+  //
+  // Move the entry to the hot end of the LRU list.
+  //
+  RemoveEntryList(&Entry->LruLink);
+  InsertTailList(&Cache->Lru, &Entry->LruLink);
+
+  ++(Cache->Hits);
+
+  return Entry;
+} // End of DNSCacheLookup
+
+
+/**
+  Adds (or replaces) the entry for a name and QTYPE, evicting least recently used
+  entries until it fits in the budget.
+
+  @param[in] Cache         The cache to insert into.
+  @param[in] Name          Wire format name.
+  @param[in] NameLength    Length of Name in bytes, including the terminating root label.
+  @param[in] QType         The QTYPE (host byte order).
+  @param[in] Ttl           Time to live in seconds.  0 means the answer is not cached.
+  @param[in] RData         Packed RDATA of the records.
+  @param[in] RDataLength   Length of RData in bytes.
+  @param[in] RecordCount   Number of records packed in RData.
+  @param[in] Now           Current monotonic time in ns.
+
+  @retval EFI_SUCCESS            The entry has been cached.
+  @retval EFI_UNSUPPORTED        The cache is disabled or Ttl is 0.
+  @retval EFI_BUFFER_TOO_SMALL   The entry is larger than the whole budget.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.
+  */
+EFI_STATUS EFIAPI DNSCacheInsert(DNS_CACHE *Cache, CONST UINT8 *Name, UINTN NameLength, UINT16 QType, UINT32 Ttl, CONST VOID *RData, UINTN RDataLength, UINT16 RecordCount, UINT64 Now) {
+  DNS_CACHE_ENTRY  *Entry;
+  UINTN            Size;
+  UINT32           Hash;
+
+  if(Cache == NULL || Name == NULL || (RData == NULL && RDataLength != 0)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if(Cache->Budget == 0 || Ttl == 0) {
+    return EFI_UNSUPPORTED;
+  }
+
+  if(NameLength > 0xFFFF || RDataLength > 0xFFFF) {
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  Size = sizeof(DNS_CACHE_ENTRY) + NameLength + RDataLength;
+
+  if(Size > Cache->Budget) {
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  Hash = DNSCacheHash(Name, NameLength, QType);
+
+  //
+  // A newer answer always replaces the old one.
+  //
+  Entry = DNSCacheFind(Cache, Name, NameLength, QType, Hash);
+
+  if(Entry != NULL) {
+    DNSCacheRemove(Cache, Entry);
+  }
+
+  //
+  // Evict from the cold end of the LRU list until the new entry fits.
+  //
+  while(Cache->Used + Size > Cache->Budget && !IsListEmpty(&Cache->Lru)) {
+    DNSCacheRemove(Cache, CR(GetFirstNode(&Cache->Lru), DNS_CACHE_ENTRY, LruLink, DNS_CACHE_ENTRY_SIGNATURE));
+    ++(Cache->Evictions);
+  }
+
+  Entry = AllocatePool(Size);
+
+  if(Entry == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Entry->Signature   = DNS_CACHE_ENTRY_SIGNATURE;
+  Entry->Hash        = Hash;
+  Entry->QType       = QType;
+  Entry->NameLength  = (UINT16) NameLength;
+  Entry->RDataLength = (UINT16) RDataLength;
+  Entry->RecordCount = RecordCount;
+  Entry->Expires     = Now + MultU64x32(NS_PER_SECOND, Ttl);
+  Entry->Size        = Size;
+  Entry->Restored    = FALSE;
+  Entry->Name        = (UINT8*)(Entry + 1);
+  Entry->RData       = Entry->Name + NameLength;
+
+  CopyMem(Entry->Name, Name, NameLength);
+  CopyMem(Entry->RData, RData, RDataLength);
+
+  InsertTailList(&Cache->Buckets[Hash & (DNS_CACHE_BUCKETS - 1)], &Entry->HashLink);
+  InsertTailList(&Cache->Lru, &Entry->LruLink);
+
+  Cache->Used += Size;
+  ++(Cache->Count);
+
+  return EFI_SUCCESS;
+} // End of DNSCacheInsert
+
+
+/**
+  Removes the entry for a name and QTYPE, whether or not it has expired.
+
+  @param[in] Cache         The cache to remove from.
+  @param[in] Name          Wire format name.
+  @param[in] NameLength    Length of Name in bytes, including the terminating root label.
+  @param[in] QType         The QTYPE (host byte order).
+
+  @retval EFI_SUCCESS            The entry has been removed.
+  @retval EFI_INVALID_PARAMETER  Cache or Name is NULL.
+  @retval EFI_NOT_FOUND          The name is not cached.
+  */
+EFI_STATUS EFIAPI DNSCacheDelete(DNS_CACHE *Cache, CONST UINT8 *Name, UINTN NameLength, UINT16 QType) {
+  DNS_CACHE_ENTRY  *Entry;
+
+  if(Cache == NULL || Name == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Entry = DNSCacheFind(Cache, Name, NameLength, QType, DNSCacheHash(Name, NameLength, QType));
+
+  if(Entry == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  DNSCacheRemove(Cache, Entry);
+
+  return EFI_SUCCESS;
+} // End of DNSCacheDelete
+
+
+/**
+  Returns the number of whole seconds an entry has left to live.
+
+  @param[in] Entry         The entry.
+  @param[in] Now           Current monotonic time in ns.
+  */
+UINT32 EFIAPI DNSCacheRemainingTtl(DNS_CACHE_ENTRY *Entry, UINT64 Now) {
+  if(Entry == NULL || Entry->Expires <= Now) {
+    return 0;
+  }
+
+  return (UINT32) DivU64x32(Entry->Expires - Now, (UINT32) NS_PER_SECOND);
+} // End of DNSCacheRemainingTtl
+
+
+/**
+  Size of a snapshot record together with the name and RDATA following it.
+ */
+#define DNSCacheRecordSize(NameLength, RDataLength) \
+  ALIGN_VALUE(sizeof(DNS_CACHE_SNAPSHOT_RECORD) + (NameLength) + (RDataLength), 8)
+
+
+/**
+  Writes every live entry of the cache to a file with a single write.
+
+  The snapshot is built in one buffer, coldest entry first, so restoring it in
+  file order gives back the same LRU order.
+
+  @param[in] Cache         The cache to save.
+  @param[in] File          The file, opened for writing and empty.
+  @param[in] Now           Current monotonic time in ns.
+  @param[in] WallClock     Current wall clock time in seconds since 1970.
+
+  @retval EFI_SUCCESS            The snapshot has been written.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.
+  @retval other                  Writing the file failed.
+  */
+EFI_STATUS EFIAPI DNSCacheSave(DNS_CACHE *Cache, EFI_FILE_PROTOCOL *File, UINT64 Now, UINT64 WallClock) {
+  EFI_STATUS                  Status;
+  DNS_CACHE_SNAPSHOT_HEADER   *Header;
+  DNS_CACHE_SNAPSHOT_RECORD   *Record;
+  DNS_CACHE_ENTRY             *Entry;
+  LIST_ENTRY                  *Link;
+  UINT8                       *Buffer;
+  UINTN                       Size;
+  UINTN                       Offset;
+
+  if(Cache == NULL || File == NULL || Cache->Lru.ForwardLink == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Size = sizeof(DNS_CACHE_SNAPSHOT_HEADER);
+
+  for(Link = GetFirstNode(&Cache->Lru); !IsNull(&Cache->Lru, Link); Link = GetNextNode(&Cache->Lru, Link)) {
+    Entry = CR(Link, DNS_CACHE_ENTRY, LruLink, DNS_CACHE_ENTRY_SIGNATURE);
+    Size += DNSCacheRecordSize(Entry->NameLength, Entry->RDataLength);
+  }
+
+  Buffer = AllocateZeroPool(Size);
+
+  if(Buffer == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Header = (DNS_CACHE_SNAPSHOT_HEADER*) Buffer;
+  Offset = sizeof(DNS_CACHE_SNAPSHOT_HEADER);
+
+  for(Link = GetFirstNode(&Cache->Lru); !IsNull(&Cache->Lru, Link); Link = GetNextNode(&Cache->Lru, Link)) {
+    Entry = CR(Link, DNS_CACHE_ENTRY, LruLink, DNS_CACHE_ENTRY_SIGNATURE);
+
+    //
+    // Anything with less than a second left would be gone by the next boot.
+    //
+    if(Entry->Expires <= Now + NS_PER_SECOND) {
+      continue;
+    }
+
+    Record = (DNS_CACHE_SNAPSHOT_RECORD*)(Buffer + Offset);
+
+    Record->Expires     = WallClock + DivU64x32(Entry->Expires - Now, (UINT32) NS_PER_SECOND);
+    Record->QType       = Entry->QType;
+    Record->RecordCount = Entry->RecordCount;
+    Record->NameLength  = Entry->NameLength;
+    Record->RDataLength = Entry->RDataLength;
+
+    CopyMem(Record + 1, Entry->Name, Entry->NameLength);
+    CopyMem((UINT8*)(Record + 1) + Entry->NameLength, Entry->RData, Entry->RDataLength);
+
+    Offset += DNSCacheRecordSize(Entry->NameLength, Entry->RDataLength);
+    ++(Header->Count);
+  }
+
+  Header->Signature  = DNS_CACHE_SNAPSHOT_SIGNATURE;
+  Header->Version    = DNS_CACHE_SNAPSHOT_VERSION;
+  Header->HeaderSize = sizeof(DNS_CACHE_SNAPSHOT_HEADER);
+  Header->Size       = (UINT32)(Offset - sizeof(DNS_CACHE_SNAPSHOT_HEADER));
+  Header->Written    = WallClock;
+
+  Size   = Offset;
+  Status = File->Write(File, &Size, Buffer);
+
+  if(!EFI_ERROR(Status) && Size != Offset) {
+    Status = EFI_VOLUME_FULL;
+  }
+
+  FreePool(Buffer);
+
+  return Status;
+} // End of DNSCacheSave
+
+
+/**
+  Restores the entries of a snapshot written by DNSCacheSave into an empty
+  cache.  Entries which have expired since are skipped, and the coldest
+  entries are evicted if the snapshot is larger than the budget.
+
+  The whole file is read with one call into a buffer which is kept for as
+  long as any restored entry may point into it, and the entries themselves
+  come from one array sized by the header.  Nothing is linked until every
+  record has been checked against the size of the file and its contents
+  against its type.
+
+  @param[in] Cache         The cache to restore into.  Must be empty.
+  @param[in] File          The file, opened for reading.
+  @param[in] Now           Current monotonic time in ns.
+  @param[in] WallClock     Current wall clock time in seconds since 1970.
+
+  @retval EFI_SUCCESS            The snapshot has been restored.
+  @retval EFI_UNSUPPORTED        The cache is disabled or not empty.
+  @retval EFI_INCOMPATIBLE_VERSION  The file is a snapshot of another version.
+  @retval EFI_VOLUME_CORRUPTED   The file is not a complete snapshot.  Nothing has been restored.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.
+  @retval other                  Reading the file failed.
+  */
+EFI_STATUS EFIAPI DNSCacheLoad(DNS_CACHE *Cache, EFI_FILE_PROTOCOL *File, UINT64 Now, UINT64 WallClock) {
+  EFI_STATUS                  Status;
+  DNS_CACHE_SNAPSHOT_HEADER   *Header;
+  DNS_CACHE_SNAPSHOT_RECORD   *Record;
+  DNS_CACHE_ENTRY             *Entries;
+  DNS_CACHE_ENTRY             *Entry;
+  UINT8                       *Buffer;
+  UINT64                      FileSize;
+  UINTN                       Size;
+  UINTN                       Offset;
+  UINTN                       Length;
+  UINTN                       i;
+
+  if(Cache == NULL || File == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if(Cache->Budget == 0 || Cache->Count != 0 || Cache->Snapshot != NULL) {
+    return EFI_UNSUPPORTED;
+  }
+
+  //
+  // Seeking to the end gives the size of the file without a FileInfo.
+  //
+  Status = File->SetPosition(File, MAX_UINT64);
+
+  if(!EFI_ERROR(Status)) {
+    Status = File->GetPosition(File, &FileSize);
+  }
+
+  if(!EFI_ERROR(Status)) {
+    Status = File->SetPosition(File, 0);
+  }
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  if(FileSize < sizeof(DNS_CACHE_SNAPSHOT_HEADER) || FileSize > MAX_UINT32) {
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  Size   = (UINTN) FileSize;
+  Buffer = AllocatePool(Size);
+
+  if(Buffer == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Length = Size;
+  Status = File->Read(File, &Length, Buffer);
+
+  if(EFI_ERROR(Status)) {
+    goto ON_ERROR;
+  }
+
+  Header = (DNS_CACHE_SNAPSHOT_HEADER*) Buffer;
+
+  if(Length != Size || Header->Signature != DNS_CACHE_SNAPSHOT_SIGNATURE) {
+    Status = EFI_VOLUME_CORRUPTED;
+    goto ON_ERROR;
+  }
+
+  if(Header->Version != DNS_CACHE_SNAPSHOT_VERSION || Header->HeaderSize != sizeof(DNS_CACHE_SNAPSHOT_HEADER)) {
+    Status = EFI_INCOMPATIBLE_VERSION;
+    goto ON_ERROR;
+  }
+
+  if(Header->Size != Size - sizeof(DNS_CACHE_SNAPSHOT_HEADER) || Header->Count > Header->Size / sizeof(DNS_CACHE_SNAPSHOT_RECORD)) {
+    Status = EFI_VOLUME_CORRUPTED;
+    goto ON_ERROR;
+  }
+
+  //
+  // Every record has to lie within the file before any of them is used.
+  //
+  Offset = sizeof(DNS_CACHE_SNAPSHOT_HEADER);
+
+  for(i = 0; i < Header->Count; ++i) {
+    if(Size - Offset < sizeof(DNS_CACHE_SNAPSHOT_RECORD)) {
+      Status = EFI_VOLUME_CORRUPTED;
+      goto ON_ERROR;
+    }
+
+    Record = (DNS_CACHE_SNAPSHOT_RECORD*)(Buffer + Offset);
+
+    if(Record->NameLength == 0 || DNSCacheRecordSize(Record->NameLength, Record->RDataLength) > Size - Offset || !DNSCacheRecordValid(Record)) {
+      Status = EFI_VOLUME_CORRUPTED;
+      goto ON_ERROR;
+    }
+
+    Offset += DNSCacheRecordSize(Record->NameLength, Record->RDataLength);
+  }
+
+  if(Offset != Size) {
+    Status = EFI_VOLUME_CORRUPTED;
+    goto ON_ERROR;
+  }
+
+  Entries = AllocatePool(MAX(Header->Count, 1) * sizeof(DNS_CACHE_ENTRY));
+
+  if(Entries == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto ON_ERROR;
+  }
+
+  Cache->Snapshot        = Buffer;
+  Cache->SnapshotEntries = Entries;
+
+  Offset = sizeof(DNS_CACHE_SNAPSHOT_HEADER);
+
+  for(i = 0; i < Header->Count; ++i, Offset += DNSCacheRecordSize(Record->NameLength, Record->RDataLength)) {
+    Record = (DNS_CACHE_SNAPSHOT_RECORD*)(Buffer + Offset);
+
+    if(Record->Expires <= WallClock) {
+      continue;
+    }
+
+    Entry = &Entries[Cache->Count];
+
+    Entry->Signature   = DNS_CACHE_ENTRY_SIGNATURE;
+    Entry->Name        = (UINT8*)(Record + 1);
+    Entry->RData       = Entry->Name + Record->NameLength;
+    Entry->NameLength  = Record->NameLength;
+    Entry->RDataLength = Record->RDataLength;
+    Entry->RecordCount = Record->RecordCount;
+    Entry->QType       = Record->QType;
+    Entry->Hash        = DNSCacheHash(Entry->Name, Entry->NameLength, Entry->QType);
+    Entry->Expires     = Now + MultU64x32(NS_PER_SECOND, (UINT32) MIN(Record->Expires - WallClock, MAX_UINT32));
+    Entry->Size        = sizeof(DNS_CACHE_ENTRY) + Entry->NameLength + Entry->RDataLength;
+    Entry->Restored    = TRUE;
+
+    InsertTailList(&Cache->Buckets[Entry->Hash & (DNS_CACHE_BUCKETS - 1)], &Entry->HashLink);
+    InsertTailList(&Cache->Lru, &Entry->LruLink);
+
+    Cache->Used += Entry->Size;
+    ++(Cache->Count);
+    ++(Cache->Restored);
+  }
+
+  //
+  // The budget may have shrunk since the snapshot was written.
+  //
+  while(Cache->Used > Cache->Budget) {
+    DNSCacheRemove(Cache, CR(GetFirstNode(&Cache->Lru), DNS_CACHE_ENTRY, LruLink, DNS_CACHE_ENTRY_SIGNATURE));
+    ++(Cache->Evictions);
+  }
+
+  return EFI_SUCCESS;
+
+ ON_ERROR:
+
+  FreePool(Buffer);
+
+  return Status;
+} // End of DNSCacheLoad
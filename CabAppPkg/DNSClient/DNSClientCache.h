@@ -0,0 +1,218 @@
+/** @file DNSClientCache.h
+  Positive answer cache used by the DNSClient.
+
+  Entries are keyed by the wire (label) format of a name together with the QTYPE
+  that was asked for.  Names are compared without regard to case as required by
+  RFC 1035 section 2.3.3.  Each entry holds the RDATA of every matching record of
+  a response packed back to back, and expires once the smallest TTL of those
+  records has elapsed.
+
+  The cache charges every entry (header, name and RDATA) against a byte budget.
+  When an insert would go over budget the least recently used entries are evicted
+  until it fits.  Expired entries are dropped lazily when they are looked up or
+  reach the cold end of the LRU list.
+
+  The cache can be saved to a file and restored from it on the next boot.  A
+  snapshot is a DNS_CACHE_SNAPSHOT_HEADER followed by one
+  DNS_CACHE_SNAPSHOT_RECORD per entry, coldest first, each followed by the
+  entry's wire format name and RDATA and padded to a multiple of 8 bytes.
+  Expiry times are stored as absolute wall clock seconds, since the
+  monotonic clock starts over at every boot.  A restored entry points
+  straight into the buffer the file was read into, so restoring costs one
+  read and two allocations however many entries there are.
+
+  Copyright (c) 2015, Caleb Bartholomew
+ */
+
+#ifndef __DNSClientCache_h__
+#define __DNSClientCache_h__
+
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+#include <Protocol/SimpleFileSystem.h>
+
+#define DNS_CACHE_ENTRY_SIGNATURE        SIGNATURE_32 ('D','N','S','c')
+
+//
+// Number of hash buckets.  Must be a power of two.
+//
+#define DNS_CACHE_BUCKETS                256
+
+//
+// Most records of one RRset the client will cache together.
+//
+#define DNS_CACHE_MAX_RECORDS            16
+
+#define DNS_CACHE_SNAPSHOT_SIGNATURE     SIGNATURE_32 ('D','N','S','s')
+
+//
+// Bumped whenever the layout of a snapshot changes.  A snapshot of any other
+// version is ignored.
+//
+#define DNS_CACHE_SNAPSHOT_VERSION       1
+
+typedef struct _DNS_CACHE_ENTRY {
+  UINT32                         Signature;
+  LIST_ENTRY                     HashLink;    // Link in the entry's hash bucket.
+  LIST_ENTRY                     LruLink;     // Link in DNS_CACHE.Lru.
+
+  UINT32                         Hash;
+  UINT16                         QType;
+  UINT16                         NameLength;
+  UINT16                         RDataLength; // Total length of all records in RData.
+  UINT16                         RecordCount;
+  UINT64                         Expires;     // Monotonic time (ns) the entry stops being valid.
+  UINTN                          Size;        // Bytes charged against DNS_CACHE.Budget.
+  BOOLEAN                        Restored;    // Lives in DNS_CACHE.Snapshot rather than its own allocation.
+
+  UINT8                          *Name;       // Wire format name, stored after the entry.
+  UINT8                          *RData;      // Packed RDATA, stored after the name.
+} DNS_CACHE_ENTRY;
+
+typedef struct _DNS_CACHE {
+  LIST_ENTRY                     Buckets[DNS_CACHE_BUCKETS];
+  LIST_ENTRY                     Lru;         // Least recently used entry first.
+
+  UINTN                          Budget;      // Maximum bytes.  0 disables the cache.
+  UINTN                          Used;
+  UINTN                          Count;
+
+  UINT64                         Hits;
+  UINT64                         Misses;
+  UINT64                         Evictions;
+
+  VOID                           *Snapshot;   // File the restored entries point into.  Freed by DNSCacheFlush.
+  DNS_CACHE_ENTRY                *SnapshotEntries;
+  UINT64                         Restored;    // Entries restored from a snapshot.
+} DNS_CACHE;
+
+typedef struct _DNS_CACHE_SNAPSHOT_HEADER {
+  UINT32                         Signature;   // DNS_CACHE_SNAPSHOT_SIGNATURE.
+  UINT16                         Version;     // DNS_CACHE_SNAPSHOT_VERSION.
+  UINT16                         HeaderSize;  // sizeof(DNS_CACHE_SNAPSHOT_HEADER).
+  UINT32                         Count;       // Records following the header.
+  UINT32                         Size;        // Bytes of records following the header.
+  UINT64                         Written;     // Wall clock (seconds since 1970) the snapshot was written.
+} DNS_CACHE_SNAPSHOT_HEADER;
+
+typedef struct _DNS_CACHE_SNAPSHOT_RECORD {
+  UINT64                         Expires;     // Wall clock (seconds since 1970) the entry stops being valid.
+  UINT16                         QType;
+  UINT16                         RecordCount;
+  UINT16                         NameLength;
+  UINT16                         RDataLength;
+} DNS_CACHE_SNAPSHOT_RECORD;
+
+/**
+  Initalizes an empty cache.
+
+  @param[in] Cache         The cache to initalize.
+  @param[in] Budget        Maximum number of bytes the cache may hold.  0 disables the cache.
+
+  @retval EFI_SUCCESS            The cache is ready for use.
+  @retval EFI_INVALID_PARAMETER  Cache is NULL.
+  */
+EFI_STATUS EFIAPI DNSCacheInit(DNS_CACHE *Cache, UINTN Budget);
+
+/**
+  Removes and frees every entry in the cache.
+
+  @param[in] Cache         The cache to flush.
+  */
+VOID EFIAPI DNSCacheFlush(DNS_CACHE *Cache);
+
+/**
+  Looks up the entry for a name and QTYPE.  A hit is moved to the hot end of the
+  LRU list.  An expired entry is removed and reported as a miss.
+
+  @param[in] Cache         The cache to search.
+  @param[in] Name          Wire format name.
+  @param[in] NameLength    Length of Name in bytes, including the terminating root label.
+  @param[in] QType         The QTYPE (host byte order).
+  @param[in] Now           Current monotonic time in ns.
+
+  @retval NULL             The name is not cached.
+  @retval DNS_CACHE_ENTRY* The cached entry.  Valid until the next insert or flush.
+  */
+DNS_CACHE_ENTRY* EFIAPI DNSCacheLookup(DNS_CACHE *Cache, CONST UINT8 *Name, UINTN NameLength, UINT16 QType, UINT64 Now);
+
+/**
+  Adds (or replaces) the entry for a name and QTYPE, evicting least recently used
+  entries until it fits in the budget.
+
+  @param[in] Cache         The cache to insert into.
+  @param[in] Name          Wire format name.
+  @param[in] NameLength    Length of Name in bytes, including the terminating root label.
+  @param[in] QType         The QTYPE (host byte order).
+  @param[in] Ttl           Time to live in seconds.  0 means the answer is not cached.
+  @param[in] RData         Packed RDATA of the records.
+  @param[in] RDataLength   Length of RData in bytes.
+  @param[in] RecordCount   Number of records packed in RData.
+  @param[in] Now           Current monotonic time in ns.
+
+  @retval EFI_SUCCESS            The entry has been cached.
+  @retval EFI_UNSUPPORTED        The cache is disabled or Ttl is 0.
+  @retval EFI_BUFFER_TOO_SMALL   The entry is larger than the whole budget.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.
+  */
+EFI_STATUS EFIAPI DNSCacheInsert(DNS_CACHE *Cache, CONST UINT8 *Name, UINTN NameLength, UINT16 QType, UINT32 Ttl, CONST VOID *RData, UINTN RDataLength, UINT16 RecordCount, UINT64 Now);
+
+/**
+  Removes the entry for a name and QTYPE, whether or not it has expired.
+
+  @param[in] Cache         The cache to remove from.
+  @param[in] Name          Wire format name.
+  @param[in] NameLength    Length of Name in bytes, including the terminating root label.
+  @param[in] QType         The QTYPE (host byte order).
+
+  @retval EFI_SUCCESS            The entry has been removed.
+  @retval EFI_INVALID_PARAMETER  Cache or Name is NULL.
+  @retval EFI_NOT_FOUND          The name is not cached.
+  */
+EFI_STATUS EFIAPI DNSCacheDelete(DNS_CACHE *Cache, CONST UINT8 *Name, UINTN NameLength, UINT16 QType);
+
+/**
+  Returns the number of whole seconds an entry has left to live.
+
+  @param[in] Entry         The entry.
+  @param[in] Now           Current monotonic time in ns.
+  */
+UINT32 EFIAPI DNSCacheRemainingTtl(DNS_CACHE_ENTRY *Entry, UINT64 Now);
+
+/**
+  Writes every live entry of the cache to a file with a single write.
+
+  @param[in] Cache         The cache to save.
+  @param[in] File          The file, opened for writing and empty.
+  @param[in] Now           Current monotonic time in ns.
+  @param[in] WallClock     Current wall clock time in seconds since 1970.
+
+  @retval EFI_SUCCESS            The snapshot has been written.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.
+  @retval other                  Writing the file failed.
+  */
+EFI_STATUS EFIAPI DNSCacheSave(DNS_CACHE *Cache, EFI_FILE_PROTOCOL *File, UINT64 Now, UINT64 WallClock);
+
+/**
+  Restores the entries of a snapshot written by DNSCacheSave into an empty
+  cache.  Entries which have expired since are skipped, and the coldest
+  entries are evicted if the snapshot is larger than the budget.
+
+  @param[in] Cache         The cache to restore into.  Must be empty.
+  @param[in] File          The file, opened for reading.
+  @param[in] Now           Current monotonic time in ns.
+  @param[in] WallClock     Current wall clock time in seconds since 1970.
+
+  @retval EFI_SUCCESS            The snapshot has been restored.
+  @retval EFI_UNSUPPORTED        The cache is disabled or not empty.
+  @retval EFI_INCOMPATIBLE_VERSION  The file is a snapshot of another version.
+  @retval EFI_VOLUME_CORRUPTED   The file is not a complete snapshot.  Nothing has been restored.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.
+  @retval other                  Reading the file failed.
+  */
+EFI_STATUS EFIAPI DNSCacheLoad(DNS_CACHE *Cache, EFI_FILE_PROTOCOL *File, UINT64 Now, UINT64 WallClock);
+#endif
@@ -0,0 +1,1064 @@
+#include "DNSClientCodec.h"
+
+UINT64 gDNSClientAllocations = 0;
+
+/**
+  AllocatePool wrapper which counts allocations in gDNSClientAllocations.
+  */
+VOID* EFIAPI DNSAllocatePool(UINTN Size) {
+  ++gDNSClientAllocations;
+
+  return AllocatePool(Size);
+} // End of DNSAllocatePool
+
+
+/**
+  AllocateZeroPool wrapper which counts allocations in gDNSClientAllocations.
+  */
+VOID* EFIAPI DNSAllocateZeroPool(UINTN Size) {
+  ++gDNSClientAllocations;
+
+  return AllocateZeroPool(Size);
+} // End of DNSAllocateZeroPool
+
+
+/**
+  Allocates zeroed memory out of a packet's arena.  Falls back to chaining an
+  extra block if the initial block is exhausted.
+
+  @param[in] Arena         The arena to allocate from.
+  @param[in] Size          Number of bytes.
+
+  @retval NULL             Out of memory.
+  @retval VOID*            The memory.  Freed along with the packet.
+  */
+VOID* EFIAPI DNSArenaAllocate(DNS_ARENA *Arena, UINTN Size) {
+  DNS_ARENA_BLOCK   *Block;
+  UINT8             *Memory;
+  UINTN             BlockSize;
+
+  Size = ALIGN_VALUE(Size, DNS_ARENA_ALIGNMENT);
+
+  if(Arena->Size - Arena->Offset >= Size) {
+    Memory         = Arena->Base + Arena->Offset;
+    Arena->Offset += Size;
+  } else {
+    Block = Arena->Overflow;
+
+    if(Block == NULL || Block->Size - Block->Used < Size) {
+      BlockSize = MAX(Size, Arena->Size);
+      Block     = DNSAllocatePool(ALIGN_VALUE(sizeof(DNS_ARENA_BLOCK), DNS_ARENA_ALIGNMENT) + BlockSize);
+
+      if(Block == NULL) {
+        return NULL;
+      }
+
+      Block->Next     = Arena->Overflow;
+      Block->Size     = BlockSize;
+      Block->Used     = 0;
+      Arena->Overflow = Block;
+    }
+
+    Memory       = (UINT8*)Block + ALIGN_VALUE(sizeof(DNS_ARENA_BLOCK), DNS_ARENA_ALIGNMENT) + Block->Used;
+    Block->Used += Size;
+  }
+
+  Arena->Used += Size;
+
+  ZeroMem(Memory, Size);
+
+  return Memory;
+} // End of DNSArenaAllocate
+
+
+/**
+  Release a DNS_PACKET.
+
+  @param[in] Packet        The Packet to free data on.
+
+  @retval EFI_SUCCESS      Data has been freed.
+  @retval other            An error occured.
+  */
+EFI_STATUS EFIAPI ReleaseDNSPacket(DNS_PACKET *Packet) {
+  DNS_ARENA_BLOCK   *Block;
+
+  if(Packet == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // A decoded packet keeps everything in its arena, which shares the
+  // packet's allocation.  Only overflow blocks need freeing on their own.
+  //
+  if(Packet->Arena.Base != NULL) {
+    while(Packet->Arena.Overflow != NULL) {
+      Block                  = Packet->Arena.Overflow;
+      Packet->Arena.Overflow = Block->Next;
+      FreePool(Block);
+    }
+  } else if(Packet->Data != NULL) {
+    FreePool(Packet->Data);
+  }
+
+  FreePool(Packet);
+
+  return EFI_SUCCESS;
+} // End of ReleaseDNSPacket
+
+
+/**
+  Writes a DNS header for a recursive query.
+
+  @param[out] Buffer     Receives DNS_HEADER_LENGTH bytes.
+  @param[in]  Id         Transaction id (host byte order).
+  @param[in]  QdCount    Number of questions.
+  @param[in]  ArCount    Number of additional records.
+  */
+VOID EFIAPI DNSWriteHeader(UINT8 *Buffer, UINT16 Id, UINT16 QdCount, UINT16 ArCount) {
+  ZeroMem(Buffer, DNS_HEADER_LENGTH);
+
+  Buffer[0]  = (UINT8)(Id >> 8);
+  Buffer[1]  = (UINT8) Id;
+  Buffer[2]  = 0x01;                      // RD
+  Buffer[3]  = 0x20;                      // AD
+  Buffer[4]  = (UINT8)(QdCount >> 8);
+  Buffer[5]  = (UINT8) QdCount;
+  Buffer[10] = (UINT8)(ArCount >> 8);
+  Buffer[11] = (UINT8) ArCount;
+} // End of DNSWriteHeader
+
+
+/**
+  Writes the QTYPE and QCLASS (IN) that follow a QNAME.
+
+  @param[out] Buffer     Receives 4 bytes.
+  @param[in]  QType      The QTYPE (host byte order).
+  */
+VOID EFIAPI DNSWriteQuestionTail(UINT8 *Buffer, UINT16 QType) {
+  Buffer[0] = (UINT8)(QType >> 8);
+  Buffer[1] = (UINT8) QType;
+  Buffer[2] = 0x00;
+  Buffer[3] = 0x01;                       // IN
+} // End of DNSWriteQuestionTail
+
+
+/**
+  Writes the OPT pseudo-RR (RFC 6891) which goes in the additional section
+  of a query.  The extended RCODE, version and flags are all 0 and no
+  options are carried.
+
+  @param[out] Buffer          Receives DNS_OPT_LENGTH bytes.
+  @param[in]  UdpPayloadSize  Largest UDP payload the client can take.
+  */
+VOID EFIAPI DNSWriteOpt(UINT8 *Buffer, UINT16 UdpPayloadSize) {
+  ZeroMem(Buffer, DNS_OPT_LENGTH);
+
+  Buffer[1] = (UINT8)(DNS_TYPE_OPT >> 8); // Owner is the root, Buffer[0].
+  Buffer[2] = (UINT8) DNS_TYPE_OPT;
+  Buffer[3] = (UINT8)(UdpPayloadSize >> 8); // CLASS
+  Buffer[4] = (UINT8) UdpPayloadSize;
+} // End of DNSWriteOpt
+
+
+/**
+  Encodes a hostname into wire (label) format in a single pass.  A trailing
+  dot is accepted and ignored.
+
+  @param[in]  Hostname     A null terminated hostname.
+  @param[out] Buffer       Receives the encoded name.
+  @param[in]  BufferSize   Size of Buffer in bytes.
+  @param[out] Length       Number of bytes written, including the root label.
+
+  @retval EFI_SUCCESS            The name has been encoded.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL, or Hostname has an empty or over long label.
+  @retval EFI_BUFFER_TOO_SMALL   The name does not fit in Buffer or is longer than DNS_MAX_NAME_LENGTH.
+  */
+EFI_STATUS EFIAPI EncodeDNSName(CONST CHAR8 *Hostname, UINT8 *Buffer, UINTN BufferSize, UINTN *Length) {
+  UINTN   LabelStart;
+  UINTN   Position;
+  UINTN   Limit;
+
+  if(Hostname == NULL || Buffer == NULL || Length == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Limit = MIN(BufferSize, DNS_MAX_NAME_LENGTH);
+
+  if(Limit == 0) {
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  //
+  // Each label's length octet is reserved when the label starts and filled in
+  // once its end is reached, so the name is only walked once.
+  //
+  LabelStart = 0;
+  Position   = 1;
+
+  for(; *Hostname != '\0'; ++Hostname) {
+    if(*Hostname == '.') {
+      if(Position - LabelStart - 1 == 0) {
+        return EFI_INVALID_PARAMETER;
+      }
+
+      Buffer[LabelStart] = (UINT8)(Position - LabelStart - 1);
+
+      //
+      // A trailing dot just names the root explicitly.
+      //
+      if(Hostname[1] == '\0') {
+        break;
+      }
+
+      LabelStart = Position++;
+    } else {
+      if(Position - LabelStart - 1 == 63) {
+        return EFI_INVALID_PARAMETER;
+      }
+
+      Buffer[Position++] = *Hostname;
+    }
+
+    if(Position >= Limit) {
+      return EFI_BUFFER_TOO_SMALL;
+    }
+  }
+
+  if(*Hostname == '\0') {
+    //
+    // Close the last label.  An empty hostname is just the root.
+    //
+    if(Position - LabelStart - 1 == 0 && LabelStart != 0) {
+      return EFI_INVALID_PARAMETER;
+    }
+
+    Buffer[LabelStart] = (UINT8)(Position - LabelStart - 1);
+
+    if(Position - LabelStart - 1 == 0) {
+      Position = LabelStart;
+    }
+  }
+
+  Buffer[Position++] = 0;
+  *Length            = Position;
+
+  return EFI_SUCCESS;
+} // End of EncodeDNSName
+
+
+/**
+  Decodes a (possibly compressed) name at the cursor in a single pass.
+  Compression pointers may appear after any label and may lead to further
+  pointers, but each must point before the labels it was found in, so a
+  message can not make the decoder loop.  The cursor is left after the name.
+
+  @param[in]  Cursor       The cursor positioned at the name.
+  @param[out] Buffer       Receives the null terminated dotted name.  NULL only skips the name.
+  @param[in]  BufferSize   Size of Buffer in bytes.  DNS_MAX_NAME_LENGTH is always enough.
+  @param[out] Length       Length of the dotted name, not counting the null.
+
+  @retval EFI_SUCCESS            The name has been decoded.
+  @retval EFI_INVALID_PARAMETER  Cursor or Length is NULL.
+  @retval EFI_BUFFER_TOO_SMALL   The name does not fit in Buffer.
+  @retval EFI_PROTOCOL_ERROR     The name is truncated or malformed.  Cursor->Error is set.
+  */
+EFI_STATUS EFIAPI DecodeDNSName(DNS_CURSOR *Cursor, CHAR8 *Buffer, UINTN BufferSize, UINTN *Length) {
+  UINT32   Limit;       // Pointers must point below this.
+  UINT32   Target;
+  UINT32   Resume;
+  UINTN    WireLength;
+  UINTN    Position;
+  UINTN    Pointers;
+  UINT8    Octet;
+
+  if(Cursor == NULL || Length == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Limit      = Cursor->Position;
+  Resume     = 0;
+  WireLength = 0;
+  Position   = 0;
+  Pointers   = 0;
+
+  for(;;) {
+    Octet = DNSCursorReadUint8(Cursor);
+
+    if(Cursor->Error) {
+      return EFI_PROTOCOL_ERROR;
+    }
+
+    if((Octet & 0xC0) == 0xC0) {
+      Target = ((UINT32)(Octet & 0x3F) << 8) | DNSCursorReadUint8(Cursor);
+
+      //
+      // Only ever moving backwards, to before the labels the pointer ended,
+      // guarantees the walk terminates however the pointers are arranged.
+      //
+      if(Cursor->Error || Target >= Limit || ++Pointers > DNS_MAX_NAME_POINTERS) {
+        Cursor->Error = TRUE;
+        return EFI_PROTOCOL_ERROR;
+      }
+
+      //
+      // The name ends in the message after the first pointer.
+      //
+      if(Pointers == 1) {
+        Resume = Cursor->Position;
+      }
+
+      Limit = Target;
+      DNSCursorSeek(Cursor, Target);
+      continue;
+    }
+
+    //
+    // 0x40 and 0x80 are the obsolete extended and reserved label types.
+    //
+    WireLength += Octet + 1;
+
+    if((Octet & 0xC0) != 0 || WireLength > DNS_MAX_NAME_LENGTH) {
+      Cursor->Error = TRUE;
+      return EFI_PROTOCOL_ERROR;
+    }
+
+    if(Octet == 0) {
+      break;
+    }
+
+    if(Position != 0) {
+      if(Buffer != NULL && Position < BufferSize) {
+        Buffer[Position] = '.';
+      }
+
+      ++Position;
+    }
+
+    //
+    // Label bytes go straight from the datagram to their final place.
+    //
+    if(Buffer != NULL && Position + Octet < BufferSize) {
+      DNSCursorReadBytes(Cursor, &Buffer[Position], Octet);
+    } else {
+      DNSCursorSeek(Cursor, Cursor->Position + Octet);
+    }
+
+    Position += Octet;
+  }
+
+  if(Pointers != 0) {
+    DNSCursorSeek(Cursor, Resume);
+  }
+
+  *Length = Position;
+
+  if(Buffer != NULL) {
+    if(Position >= BufferSize) {
+      return EFI_BUFFER_TOO_SMALL;
+    }
+
+    Buffer[Position] = '\0';
+  }
+
+  return EFI_SUCCESS;
+} // End of DecodeDNSName
+
+
+/**
+  Encodes a complete single question query (header, QNAME, QTYPE and QCLASS)
+  into a buffer in one pass.  Recursion is requested.  An OPT record follows
+  the question if UdpPayloadSize is not 0.
+
+  @param[out] Buffer          Receives the message.
+  @param[in]  BufferSize      Size of Buffer in bytes.
+  @param[in]  Id              Transaction id (host byte order).
+  @param[in]  Hostname        A null terminated hostname.
+  @param[in]  QType           The QTYPE (host byte order).
+  @param[in]  UdpPayloadSize  UDP payload size to advertise, or 0 for no OPT record.
+  @param[out] Length          Number of bytes written.
+
+  @retval EFI_SUCCESS            The query has been encoded.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL or Hostname is malformed.
+  @retval EFI_BUFFER_TOO_SMALL   The query does not fit in Buffer.
+  */
+EFI_STATUS EFIAPI EncodeDNSQuery(UINT8 *Buffer, UINTN BufferSize, UINT16 Id, CONST CHAR8 *Hostname, UINT16 QType, UINT16 UdpPayloadSize, UINTN *Length) {
+  EFI_STATUS   Status;
+  UINTN        NameLength;
+  UINTN        OptLength;
+
+  if(Buffer == NULL || Length == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  OptLength = (UdpPayloadSize != 0) ? DNS_OPT_LENGTH : 0;
+
+  if(BufferSize < DNS_HEADER_LENGTH + 1 + 4 + OptLength) {
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  DNSWriteHeader(Buffer, Id, 1, (OptLength != 0) ? 1 : 0);
+
+  Status = EncodeDNSName(Hostname, Buffer + DNS_HEADER_LENGTH, BufferSize - DNS_HEADER_LENGTH - 4 - OptLength, &NameLength);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  DNSWriteQuestionTail(Buffer + DNS_HEADER_LENGTH + NameLength, QType);
+
+  if(OptLength != 0) {
+    DNSWriteOpt(Buffer + DNS_HEADER_LENGTH + NameLength + 4, UdpPayloadSize);
+  }
+
+  *Length = DNS_HEADER_LENGTH + NameLength + 4 + OptLength;
+
+  return EFI_SUCCESS;
+} // End of EncodeDNSQuery
+
+
+/**
+  Creates a DNS_PACKET based off of the parameters provided.  Must call ReleaseDNSPacket to free up used memory.
+
+  @param[in] Questions     Array of Questions in the dns request.
+  @param[in] NumQuestions  Number of Questions in the array.
+
+  @retval EFI_SUCCESS      Packet data has been successfully created.
+  @retval other            An error occured.
+  */
+DNS_PACKET* EFIAPI CreateDNSPacket(DNS_QUESTION Questions[], UINTN NumQuestions) {
+  DNS_PACKET  *Packet;
+  UINTN       TotalStringSizes;
+  UINTN       i, len;
+
+  Packet      = DNSAllocateZeroPool(sizeof(DNS_PACKET));
+
+  if(Packet == NULL) {
+    return NULL;
+    //return EFI_OUT_OF_RESOURCES;
+  }
+
+  TotalStringSizes = 0;
+
+  for(i = 0; i < NumQuestions; ++i) {
+    TotalStringSizes += Questions[i].QName[0];
+  }
+
+  Packet->DataLength = TotalStringSizes + (sizeof(DNS_QUESTION) - sizeof(CHAR8*)) * NumQuestions;
+
+  Packet->Data = DNSAllocateZeroPool(Packet->DataLength);
+
+  if(Packet->Data == NULL) {
+    SafeRelease(Packet);
+
+    return NULL;
+    //return EFI_OUT_OF_RESOURCES;
+  }
+
+  len = 0;
+
+  for(i = 0; i < NumQuestions; ++i) {
+    CopyMem(Packet->Data + len, &Questions[i].QName[1], Questions[i].QName[0]);
+    len += Questions[i].QName[0];
+
+    CopyMem(Packet->Data + len, &Questions[i].QType, sizeof(DNS_QUESTION) - sizeof(Questions[i].QName));
+    len += sizeof(DNS_QUESTION) - sizeof(Questions[i].QName); 
+  }
+
+  Packet->Header.QdCount = HTONS(NumQuestions);
+
+  return Packet;
+} // End of CreateDNSPacket
+
+
+/**
+  Reads a (possibly compressed) name at the cursor and converts it to a hostname.
+  The cursor is left after the name.
+
+  @param[in] Cursor       The cursor positioned at the name.
+  @param[in] Arena        The arena to allocate the hostname from.
+
+  @retval NULL            The name is malformed or out of memory.
+  @retval CHAR8*          Pointer to newly created string.
+  */
+STATIC CHAR8* DNSCodecReadName(DNS_CURSOR *Cursor, DNS_ARENA *Arena) {
+  CHAR8   Name[DNS_MAX_NAME_LENGTH];
+  CHAR8   *Hostname;
+  UINTN   Length;
+
+  if(EFI_ERROR(DecodeDNSName(Cursor, Name, sizeof(Name), &Length))) {
+    return NULL;
+  }
+
+  Hostname = DNSArenaAllocate(Arena, Length + 1);
+
+  if(Hostname == NULL) {
+    return NULL;
+  }
+
+  CopyMem(Hostname, Name, Length + 1);
+
+  return Hostname;
+} // End of DNSCodecReadName
+
+
+/**
+  Decodes a DNS message from a cursor.
+  Must call ReleaseDNSPacket when done.
+
+  @param[in]  Cursor              Cursor positioned at the start of the message.
+  @param[out] Packet              A pointer to the vairable that will contain the address of the decoded packet.
+
+  @retval EFI_SUCCESS             Packet decoded successfully.
+  @retval EFI_INVALID_PARAMETER   Cursor or Packet is NULL.
+  @retval EFI_OUT_OF_RESOURCES    Out of memory.
+  @retval EFI_PROTOCOL_ERROR      The message is truncated or malformed.
+ */
+EFI_STATUS EFIAPI DecodeDNSPacket(DNS_CURSOR *Cursor, DNS_PACKET **Packet) {
+  EFI_STATUS                    Status;
+  DNS_HEADER                    Header;
+  DNS_ARENA                     *Arena;
+  DNS_PACKET_DATA               *PacketData;
+  DNS_QUESTION                  *Questions;
+  DNS_ANSWER                    *Answers;
+  UINTN                         ArenaSize;
+  UINT32                        RDataStart;
+  UINTN                         NameLength;
+  UINT16                        Type;
+  UINT16                        Class;
+  UINT32                        Ttl;
+  UINT16                        RdLength;
+  UINTN                         i;
+
+  if(Cursor == NULL || Packet == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  *Packet = NULL;
+
+  DNSCursorReadBytes(Cursor, &Header, sizeof(DNS_HEADER));
+
+  Header.Id      = NTOHS(Header.Id);
+  Header.QdCount = NTOHS(Header.QdCount);
+  Header.AnCount = NTOHS(Header.AnCount);
+  Header.NsCount = NTOHS(Header.NsCount);
+  Header.ArCount = NTOHS(Header.ArCount);
+
+  //
+  // A question takes at least 5 bytes and an answer at least 11, so counts
+  // which can not fit in the datagram are rejected before allocating for them.
+  // A truncated message may well claim more answers than it carries, so
+  // only those which can be there are read.
+  //
+  if(Cursor->Error || (UINTN)Header.QdCount * 5 > Cursor->Length) {
+    return EFI_PROTOCOL_ERROR;
+  }
+
+  if((UINTN)Header.QdCount * 5 + (UINTN)Header.AnCount * 11 > Cursor->Length) {
+    if(!Header.Tc) {
+      return EFI_PROTOCOL_ERROR;
+    }
+
+    Header.AnCount = (UINT16)((Cursor->Length - (UINTN)Header.QdCount * 5) / 11);
+  }
+
+  //
+  // Size the arena from the datagram: the record arrays, every RDATA copied
+  // out at most once, and an estimate for each (possibly compressed) name.
+  //
+  ArenaSize = sizeof(DNS_QUESTION) * Header.QdCount +
+              sizeof(DNS_ANSWER)   * Header.AnCount +
+              Cursor->Length +
+              DNS_ARENA_NAME_ESTIMATE * (Header.QdCount + Header.AnCount);
+  ArenaSize = ALIGN_VALUE(ArenaSize, DNS_ARENA_ALIGNMENT);
+
+  *Packet = DNSAllocatePool(ALIGN_VALUE(sizeof(DNS_PACKET), DNS_ARENA_ALIGNMENT) + ArenaSize);
+
+  if(*Packet == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  ZeroMem(*Packet, sizeof(DNS_PACKET));
+
+  CopyMem(&(*Packet)->Header, &Header, sizeof(DNS_HEADER));
+
+  Arena       = &(*Packet)->Arena;
+  Arena->Base = (UINT8*)(*Packet) + ALIGN_VALUE(sizeof(DNS_PACKET), DNS_ARENA_ALIGNMENT);
+  Arena->Size = ArenaSize;
+
+  PacketData = DNSArenaAllocate(
+    Arena,
+    sizeof(DNS_QUESTION) * (*Packet)->Header.QdCount +
+    sizeof(DNS_ANSWER)   * (*Packet)->Header.AnCount
+  );
+
+  if(PacketData == NULL) {
+    GotoStatus(ON_ERROR, EFI_OUT_OF_RESOURCES);
+  }
+
+  (*Packet)->Data = PacketData;
+
+  Questions = (DNS_QUESTION*)(PacketData);
+  Answers   = (DNS_ANSWER*)(PacketData + (*Packet)->Header.QdCount * sizeof(DNS_QUESTION));
+
+  for(i = 0; i < (*Packet)->Header.QdCount; ++i) {
+    Questions[i].QName = DNSCodecReadName(Cursor, Arena);
+
+    if(Questions[i].QName == NULL) {
+      GotoStatus(ON_ERROR, Cursor->Error ? EFI_PROTOCOL_ERROR : EFI_OUT_OF_RESOURCES);
+    }
+
+    Questions[i].QType  = DNSCursorReadUint16(Cursor);
+    Questions[i].QClass = DNSCursorReadUint16(Cursor);
+  }
+
+  for(i = 0; i < (*Packet)->Header.AnCount; ++i) {
+    Answers[i].Name = DNSCodecReadName(Cursor, Arena);
+
+    if(Answers[i].Name == NULL) {
+      if(Cursor->Error) {
+        break;
+      }
+
+      GotoStatus(ON_ERROR, EFI_OUT_OF_RESOURCES);
+    }
+
+    Answers[i].Type     = DNSCursorReadUint16(Cursor);
+    Answers[i].Class    = DNSCursorReadUint16(Cursor);
+    Answers[i].TTL      = DNSCursorReadUint32(Cursor);
+    Answers[i].RdLength = DNSCursorReadUint16(Cursor);
+
+    RDataStart             = Cursor->Position;
+    Answers[i].RDataOffset = RDataStart;
+
+    // Handle RDATA based off of type.
+    // Right now we're only going ot support A, AAAA, CNAME and PTR records.
+    // Other types are left in the message for DNSReadRDataView.
+    switch(Answers[i].Type) {
+      case 1:
+        if(Answers[i].RdLength != sizeof(A_RECORD)) {
+          break;
+        }
+
+        Answers[i].RData = DNSArenaAllocate(Arena, sizeof(A_RECORD));
+
+        if(Answers[i].RData == NULL) {
+          GotoStatus(ON_ERROR, EFI_OUT_OF_RESOURCES);
+        }
+
+        DNSCursorReadBytes(Cursor, Answers[i].RData, sizeof(A_RECORD));
+      break;
+
+      case 28:
+        if(Answers[i].RdLength != sizeof(AAAA_RECORD)) {
+          break;
+        }
+
+        Answers[i].RData = DNSArenaAllocate(Arena, sizeof(AAAA_RECORD));
+
+        if(Answers[i].RData == NULL) {
+          GotoStatus(ON_ERROR, EFI_OUT_OF_RESOURCES);
+        }
+
+        DNSCursorReadBytes(Cursor, Answers[i].RData, sizeof(AAAA_RECORD));
+      break;
+
+      //
+      // PTR_RECORD is laid out as CNAME_RECORD is: a single name.
+      //
+      case 5:
+      case 12:
+        Answers[i].RData = DNSArenaAllocate(Arena, sizeof(CNAME_RECORD));
+
+        if(Answers[i].RData == NULL) {
+          GotoStatus(ON_ERROR, EFI_OUT_OF_RESOURCES);
+        }
+
+        ((CNAME_RECORD*)Answers[i].RData)->Name = DNSCodecReadName(Cursor, Arena);
+
+        if(((CNAME_RECORD*)Answers[i].RData)->Name == NULL) {
+          if(!Cursor->Error) {
+            GotoStatus(ON_ERROR, EFI_OUT_OF_RESOURCES);
+          }
+
+          Answers[i].RData = NULL;
+        }
+
+        //
+        // A target which runs on past its RDATA is not trusted.
+        //
+        if(Cursor->Position > RDataStart + Answers[i].RdLength) {
+          Answers[i].RData = NULL;
+        }
+      break;
+
+      default:
+      break;
+    }
+
+    //
+    // Skip past the RDATA so the next answer is read from the right place.
+    //
+    DNSCursorSeek(Cursor, RDataStart + Answers[i].RdLength);
+
+    if(Cursor->Error) {
+      break;
+    }
+  }
+
+  //
+  // A truncated message keeps the answers which arrived whole and drops the
+  // one it was cut off in.
+  //
+  if(Cursor->Error) {
+    if(!(*Packet)->Header.Tc) {
+      GotoStatus(ON_ERROR, EFI_PROTOCOL_ERROR);
+    }
+
+    (*Packet)->Header.AnCount = (UINT16) i;
+  }
+
+  //
+  // The authority section is skipped and the additional section searched
+  // for the sender's OPT record (RFC 6891 section 6.1.1), whose TTL field
+  // holds the upper 8 bits of the RCODE.  A cut off or malformed record out
+  // here loses nothing but the OPT record.
+  //
+  (*Packet)->ExtendedRCode = (*Packet)->Header.RCode;
+
+  for(i = 0; i < (UINTN)(*Packet)->Header.NsCount + (*Packet)->Header.ArCount && !Cursor->Error; ++i) {
+    if(EFI_ERROR(DecodeDNSName(Cursor, NULL, 0, &NameLength))) {
+      break;
+    }
+
+    Type     = DNSCursorReadUint16(Cursor);
+    Class    = DNSCursorReadUint16(Cursor);
+    Ttl      = DNSCursorReadUint32(Cursor);
+    RdLength = DNSCursorReadUint16(Cursor);
+
+    if(i >= (*Packet)->Header.NsCount && Type == DNS_TYPE_OPT && NameLength == 0 && !Cursor->Error && !(*Packet)->HasOpt) {
+      (*Packet)->HasOpt         = TRUE;
+      (*Packet)->UdpPayloadSize = MAX(Class, DNS_EDNS_MIN_PAYLOAD);
+      (*Packet)->EdnsVersion    = (UINT8)(Ttl >> 16);
+      (*Packet)->ExtendedRCode  = (UINT16)(((Ttl >> 24) << 4) | (*Packet)->Header.RCode);
+    }
+
+    DNSCursorSeek(Cursor, Cursor->Position + RdLength);
+  }
+
+  return EFI_SUCCESS;
+
+ ON_ERROR:
+
+  ReleaseDNSPacket(*Packet);
+  *Packet = NULL;
+
+  return Status;
+} // End of DecodeDNSPacket
+
+
+/**
+  Steps the cursor over a name without following its compression pointers,
+  which DNSViewDecodeName follows if the name is ever decoded.  A malformed
+  label sets Cursor->Error.
+
+  @param[in] Cursor       The cursor positioned at the name.
+  */
+STATIC VOID DNSCodecSkipName(DNS_CURSOR *Cursor) {
+  UINTN   WireLength;
+  UINT8   Octet;
+
+  for(WireLength = 0; !Cursor->Error; ) {
+    Octet = DNSCursorReadUint8(Cursor);
+
+    if((Octet & 0xC0) == 0xC0) {
+      DNSCursorReadUint8(Cursor);
+      break;
+    }
+
+    WireLength += Octet + 1;
+
+    if((Octet & 0xC0) != 0 || WireLength > DNS_MAX_NAME_LENGTH) {
+      Cursor->Error = TRUE;
+      break;
+    }
+
+    if(Octet == 0) {
+      break;
+    }
+
+    DNSCursorSeek(Cursor, Cursor->Position + Octet);
+  }
+} // End of DNSCodecSkipName
+
+
+/**
+  Reads the RDATA of an NS, CNAME, PTR, MX, SOA, SRV or TXT record in place.
+  The fixed fields are read, and every name and string is checked to end
+  within RDATA and recorded by offset, without being decoded or copied.
+  The cursor itself is left untouched.
+
+  @param[in]  Cursor       Cursor over the whole message.
+  @param[in]  Type         TYPE of the record.
+  @param[in]  RDataOffset  Where RDATA starts in the message (DNS_ANSWER.RDataOffset).
+  @param[in]  RdLength     RDLENGTH of the record.
+  @param[out] View         Receives the view.
+
+  @retval EFI_SUCCESS            View has been filled in.
+  @retval EFI_INVALID_PARAMETER  Cursor or View is NULL.
+  @retval EFI_UNSUPPORTED        Type has no view.
+  @retval EFI_PROTOCOL_ERROR     RDATA is truncated or malformed.
+  */
+EFI_STATUS EFIAPI DNSReadRDataView(DNS_CURSOR *Cursor, UINT16 Type, UINT32 RDataOffset, UINT16 RdLength, DNS_RDATA_VIEW *View) {
+  DNS_CURSOR   Local;
+  UINT32       End;
+  UINT8        Length;
+
+  if(Cursor == NULL || View == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  CopyMem(&Local, Cursor, sizeof(DNS_CURSOR));
+
+  Local.Error = FALSE;
+  End         = RDataOffset + RdLength;
+
+  DNSCursorSeek(&Local, RDataOffset);
+
+  switch(Type) {
+    case DNS_TYPE_NS:
+    case DNS_TYPE_CNAME:
+    case DNS_TYPE_PTR:
+      View->Name.Offset = Local.Position;
+      DNSCodecSkipName(&Local);
+    break;
+
+    case DNS_TYPE_MX:
+      View->Mx.Preference      = DNSCursorReadUint16(&Local);
+      View->Mx.Exchange.Offset = Local.Position;
+      DNSCodecSkipName(&Local);
+    break;
+
+    case DNS_TYPE_SOA:
+      View->Soa.PrimaryNS.Offset = Local.Position;
+      DNSCodecSkipName(&Local);
+
+      View->Soa.AdminMB.Offset   = Local.Position;
+      DNSCodecSkipName(&Local);
+
+      View->Soa.SerialNumber     = DNSCursorReadUint32(&Local);
+      View->Soa.RefreshInterval  = DNSCursorReadUint32(&Local);
+      View->Soa.RetryInterval    = DNSCursorReadUint32(&Local);
+      View->Soa.ExpirationLimit  = DNSCursorReadUint32(&Local);
+      View->Soa.MinimumTTL       = DNSCursorReadUint32(&Local);
+    break;
+
+    case DNS_TYPE_SRV:
+      View->Srv.Priority      = DNSCursorReadUint16(&Local);
+      View->Srv.Weight        = DNSCursorReadUint16(&Local);
+      View->Srv.Port          = DNSCursorReadUint16(&Local);
+      View->Srv.Target.Offset = Local.Position;
+      DNSCodecSkipName(&Local);
+    break;
+
+    //
+    // RDATA is one or more <character-string>s, each a length octet and
+    // that many characters, which have to fill it exactly.
+    //
+    case DNS_TYPE_TXT:
+      View->Txt.Offset      = RDataOffset;
+      View->Txt.Length      = RdLength;
+      View->Txt.StringCount = 0;
+
+      do {
+        Length = DNSCursorReadUint8(&Local);
+        DNSCursorSeek(&Local, Local.Position + Length);
+        ++(View->Txt.StringCount);
+      } while(Local.Position < End && !Local.Error);
+    break;
+
+    default:
+      return EFI_UNSUPPORTED;
+  }
+
+  if(Local.Error || Local.Position != End) {
+    return EFI_PROTOCOL_ERROR;
+  }
+
+  return EFI_SUCCESS;
+} // End of DNSReadRDataView
+
+
+/**
+  Decodes a name a view left in the message, following its compression
+  pointers as DecodeDNSName does.  The cursor itself is left untouched.
+
+  @param[in]  Cursor       Cursor over the whole message.
+  @param[in]  Name         The name.
+  @param[out] Buffer       Receives the null terminated dotted name.
+  @param[in]  BufferSize   Size of Buffer in bytes.  DNS_MAX_NAME_LENGTH is always enough.
+  @param[out] Length       Length of the dotted name, not counting the null.
+
+  @retval EFI_SUCCESS      The name has been decoded.
+  @retval other            As DecodeDNSName returns.
+  */
+EFI_STATUS EFIAPI DNSViewDecodeName(DNS_CURSOR *Cursor, CONST DNS_NAME_VIEW *Name, CHAR8 *Buffer, UINTN BufferSize, UINTN *Length) {
+  DNS_CURSOR   Local;
+
+  if(Cursor == NULL || Name == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  CopyMem(&Local, Cursor, sizeof(DNS_CURSOR));
+
+  Local.Error = FALSE;
+
+  DNSCursorSeek(&Local, Name->Offset);
+
+  return DecodeDNSName(&Local, Buffer, BufferSize, Length);
+} // End of DNSViewDecodeName
+
+
+/**
+  Steps through the <character-string>s of a TXT record.  The characters
+  can be read with DNSCursorSeek and DNSCursorReadBytes.  The cursor itself
+  is left untouched.
+
+  @param[in]     Cursor    Cursor over the whole message.
+  @param[in]     View      The TXT record, as DNSReadRDataView read it.
+  @param[in/out] Position  0 for the first string.  Moved on to the next.
+  @param[out]    String    Receives the string.
+
+  @retval EFI_SUCCESS            String has been filled in.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL.
+  @retval EFI_NOT_FOUND          There are no more strings.
+  @retval EFI_PROTOCOL_ERROR     The string runs past RDATA.
+  */
+EFI_STATUS EFIAPI DNSViewNextTxtString(DNS_CURSOR *Cursor, CONST DNS_TXT_VIEW *View, UINT32 *Position, DNS_STRING_VIEW *String) {
+  DNS_CURSOR   Local;
+
+  if(Cursor == NULL || View == NULL || Position == NULL || String == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  *Position = MAX(*Position, View->Offset);
+
+  if(*Position >= View->Offset + View->Length) {
+    return EFI_NOT_FOUND;
+  }
+
+  CopyMem(&Local, Cursor, sizeof(DNS_CURSOR));
+
+  Local.Error = FALSE;
+
+  DNSCursorSeek(&Local, *Position);
+
+  String->Length = DNSCursorReadUint8(&Local);
+  String->Offset = *Position + 1;
+  *Position      = String->Offset + String->Length;
+
+  if(Local.Error || *Position > View->Offset + View->Length) {
+    return EFI_PROTOCOL_ERROR;
+  }
+
+  return EFI_SUCCESS;
+} // End of DNSViewNextTxtString
+
+
+/**
+  Converts a hostname to DNS label format.
+  Must call FreePool when done with the string.
+
+  @param[in] Hostname     The hostname string to convert.
+  @param[in] Length       The length of the Hostname string.
+
+  @retval NULL            Hostname is NULL or out of memory.
+  @retval CHAR8*          Pointer to newly created label format string.
+  */
+CHAR8* EFIAPI HostnameToLabelFormat(CHAR8* Hostname, UINTN Length) {
+  CHAR8* LabelFormat;
+  UINT8  i, len;
+
+  if(Hostname == NULL) {
+    return NULL;
+  }
+
+  LabelFormat = DNSAllocateZeroPool(sizeof(CHAR8) * (Length+3));
+
+  if(LabelFormat == NULL) {
+    return NULL;
+  }
+
+  for(i = Length, len = 0; i > 0; --i) {
+    if(Hostname[i-1] == '.') {
+      LabelFormat[i+1] = len;
+      len = 0;
+      continue;
+    }
+
+    ++len;
+    LabelFormat[i+1] = Hostname[i-1];
+  }
+
+  LabelFormat[Length+2] = (CHAR8)  0;
+  LabelFormat[0]        = Length + 2;
+  LabelFormat[1]        = len;
+
+  return LabelFormat;
+}
+
+
+/**
+  Converts a DNS label format to a Hostname string.  
+  Must call FreePool when done with the string.
+
+  The name is not part of a message, so a compression pointer can not be
+  resolved and is rejected along with any name longer than DNS_MAX_NAME_LENGTH.
+
+  @param[in] LabelFormat  The label format string to convert.
+
+  @retval NULL            LabelFormat is NULL, malformed or out of memory.
+  @retval CHAR8*          Pointer to newly created string.
+  */
+CHAR8* EFIAPI LabelFormatToHostname(CHAR8* LabelFormat) {
+  CHAR8  Name[DNS_MAX_NAME_LENGTH];
+  CHAR8  *Hostname;
+  UINTN  i, j;
+  UINT8  Length;
+
+  if(LabelFormat == NULL) {
+    return NULL;
+  }
+
+  //
+  // Convert into a name sized buffer as the labels are walked, so the input
+  // is only read once and never past its root label.
+  //
+  i = 0;
+  j = 0;
+
+  while((Length = (UINT8) LabelFormat[i]) != 0) {
+    if((Length & 0xC0) != 0 || i + Length + 2 > DNS_MAX_NAME_LENGTH) {
+      return NULL;
+    }
+
+    if(j != 0) {
+      Name[j++] = '.';
+    }
+
+    CopyMem(&Name[j], &LabelFormat[i + 1], Length);
+
+    i += Length + 1;
+    j += Length;
+  }
+
+  Hostname = DNSAllocatePool(j + 1);
+
+  if(Hostname == NULL) {
+    return NULL;
+  }
+
+  CopyMem(Hostname, Name, j);
+  Hostname[j] = '\0';
+
+  return Hostname;
+}
@@ -0,0 +1,712 @@
+/** @file DNSClientCodec.h
+  Defines the DNS wire format and the functions which encode and decode it.
+
+  Nothing in here touches the network or any UEFI protocol.  The codec only
+  needs the memory and byte order helpers of the base libraries, so it can
+  also be built for the host (with DNSCLIENT_HOST_BUILD defined, see
+  Host/DNSClientHost.h) and benchmarked there.
+
+  ************************
+  * DNS Packet Structure *
+  ************************
+
+  +--------------------+
+  |       Header       |
+  +--------------------+
+  |      Question      |
+  +--------------------+
+  |       Answer       |
+  +--------------------+
+  |     Authority      |
+  +--------------------+
+  |     Additional     |
+  +--------------------+
+
+  Header      Message Header.  See following section for details.
+
+  Question    The DNS question being asked (aka Question Section).
+
+  Answer      The Resource Record(s) which answer the question (aka Answer Section)
+
+  Authority   The Resource Record(s) which point to the domain authority (aka Authority Section).
+
+  Additional  The Resource Records(s) which may hod additional information (aka Additional Section).
+
+
+  ************************
+  * DNS Header Structure *
+  ************************
+
+    0  1  2  3  4  5  6  7  8  9 10 11 12 13 14 15
+  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+  |                      ID                       |
+  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+  |QR|   OPCODE  |AA|TC|RD|RA| Z|AD|CD|   RCODE   |
+  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+  |                    QDCOUNT                    |
+  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+  |                    ANCOUNT                    |
+  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+  |                    NSCOUNT                    |
+  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+  |                    ARCOUNT                    |
+  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+
+  ID        A 16 bit identifier assigned by the requesition (the questioner) and reflected
+            back unchanged by the responder (answerer).  Identifies the transaction.
+
+  QR        Query - Response bit.  Set to 0 by the questioner (query) an dto 1 in the response
+            (answer).
+
+  OPCODE    Identifies the request/operation type.  Currently assigned values are:
+              0 - QUERY.  Standard query.
+              1 - IQUERY. Inverse query.  Optional support by DNS.
+              2 - STATUS.  DNS status request.
+
+  AA        Authoritative Answer.  Valid in responses only.  Because of aliases multiple owners
+            may exist so the AA bit corresponds to the name which matches the query name, OR
+            the first owner name in the answer section.
+
+  TC        TrunCation - Specifies taht this message was truncated due to length grater than that
+            permitted on the transmission channel.  Set on all truncated messages except the last
+            one.
+
+  RD        Recursion Desired - This bit may be sest in a query and is copied into the response
+            if recursion supported.  If rejected the resopnse (answer) does not have this bit set.
+            Recursive query support is optional.
+
+  RA        Recursion Available - This bit is valid in a response (answer) and denotes whether
+            recursive support is available (1) or not (0) in the name server.
+
+  Z         Rezerved for future use.  Must be 0.
+
+  RCODE     Response Code - This 4 bit field is set as part of responses.  The values are:
+              0 - No error condition
+              1 - Format error. The name server was unable to interpret the query.
+              2 - Server failure. The name server was unable to process this query due to a
+                  problem with the name server.
+              3 - Name Error.  Meaningful only for responses from an authoritative name server.
+                  This code signifies that the domain name referenced in the query does not exist.
+              4 - Not Implemented.  The name server does not support the requested kind of query.
+              5 - Refused.  The name server refuses to perform the specified operation for policy
+                  reasons.
+
+  QDCOUNT   Unsigned 16 bit integer specifying the nubmer of resource records in the Question Section.
+
+  ANCOUNT   Unsigned 16 bit integer specifying the number of resource records in the Answer Section.
+            May be 0 in which case no answer record is present in the message.
+
+  NSCOUNT   Unsigned 16 bit ingerger specifying the number of name server resource records in the
+            Authority Section.  May be 0 in which case no authority record(s) is(are) present in the
+            message.
+
+  ARCOUNT   Unsigned 16 bit integer specifying the number of name server resource records in the
+            Additional Section.  May be 0 in which case no additional record(s) is(are) present in
+            the message.
+
+
+
+  ************************
+  *     DNS Questions    *
+  ************************
+
+  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+  |                                               |
+  /                     QNAME                     /
+  /                                               /
+  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+  |                     QTYPE                     |
+  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+  |                     QCLASS                    |
+  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+
+  QNAME   A domain name represented as a sequence of labels, where each label
+          consists of a length octet followed by that number of octets.  The
+          domain name terminates with the zero length octet for the null label
+          of the root.
+
+  QTYPE   A two octet code whcich specifies the type of the query.
+
+  QCLASS  A two octet code taht specifies the class of the query.
+
+
+
+  ************************
+  *      DNS Answers     *
+  ************************
+
+    0  1  2  3  4  5  6  7  8  9 10 11 12 13 14 15
+  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+  |                                               |
+  /                                               /
+  /                      NAME                     /
+  |                                               |
+  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+  |                      TYPE                     |
+  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+  |                     CLASS                     |
+  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+  |                      TTL                      |
+  |                                               |
+  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+  |                    RDLENGTH                   |
+  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--|
+  /                     RDATA                     /
+  /                                               /
+  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+
+
+  NAME        The domain name taht was queried.  May take one of TWO formats.
+              The first format is the label format defined for QNAME above.
+              The second format is a pointer (in the interests of data
+              compression which to be fair to the original authors was far
+              more important then than now).  A pointer is an unsigned 16-bit
+              value with the following format (the top two bits of 11 indicate
+              the pointer format):
+
+                  0   1   2   3   4   5   6   7   8   9   10  11  12  13  14  15
+                +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
+                | 1 | 1 |    Offset in bytes from the start of the message.     |
+                +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
+
+              Must point to a label format record to derive name length.
+
+  TYPE        Unsigned 16 bit value.  The resource record types - determines the
+              content of the RDATA field.  These values are assigned by IANA and
+              a complete list of values may be obtained from them.  The following
+              are the most commonly used values:
+                x'0001  (1) = An A record for the domain name
+                x'0002  (2) = A NS record for the domain name
+                x'0005  (5) = A CNAME record for the domain name
+                x'0006  (6) = A SOA record for the domain name
+                x'000B (11) = A WKS record for the domain name
+                x'000C (12) = A PTR record for the domain name
+                x'000F (15) = A MX record for the domain name
+                x'0021 (33) = A SRV record for the domain name
+                x'0026 (38) = An A6 record for the domain name
+
+  CLASS       Unsigned 16 bit value.  The CLASS of resource records be requested,
+              for example, Internet, CHAOS etc.  These values are assigned by IANA
+              and a complete list of values may be obtained from them.  The following
+              are the most commonly used values:
+                x'0001 (1) - IN or Internet
+
+  TTL         Unsigned 32 bit value.  The time in seconds that the record may be
+              cached.  A value of 0 indicates the record should not be cached.
+
+  RDLENGTH    Unsigned 16 bit value that defines the length in bytes of the RDATA
+              record.
+
+  RDATA       Each (or rather most) resoruce record types have a specific RDATA
+              format which reflect their resource record format as defined below:
+                -------------------------------------------------------------------------------
+                SOA
+                  Primary NS       - Variable length.  The name of the Primary Master for
+                                     the domain.  May be a label, pointer or any combination.
+                  Admin MB         - Variable length.  The administrator's mailbox.  May be a
+                                     label, pointer or any combination.
+                  Serial Number    - Unsigned 32-bit integer.
+                  Refresh Interval - Unsigned 32-bit integer.
+                  Retry Interval   - Unsigned 32-bit integer.
+                  Expiration Limit - Unsigned 32-bit integer.
+                  Minimum TTL      - Unsigned 32-bit integer.
+                -------------------------------------------------------------------------------
+                MX
+                  Preference       - A 16-bit integer.
+                  Mail Exchanger   - The name host name that provides the service.  May be a
+                                     label, pointer or any combination.
+                -------------------------------------------------------------------------------
+                A
+                  IP Address       - Unsigned 32-bit value representing the IP address.
+                -------------------------------------------------------------------------------
+                PTR, NS
+                  Name             - The host name that represents the supplied IP address (in 
+                                     the case of a PTR) or the NS name for the supplied domain
+                                     (in the case of NS).  May be a label, pointer or any 
+                                     combintaiton.
+
+
+
+  References:
+  http://www.ccs.neu.edu/home/amislove/teaching/cs4700/fall09/handouts/project1-primer.pdf
+  https://www.ietf.org/rfc/rfc1035.txt
+  http://www.zytrax.com/books/dns/ch15/
+ */
+
+#ifndef __DNSClientCodec_h__
+#define __DNSClientCodec_h__
+
+#ifdef DNSCLIENT_HOST_BUILD
+#include "Host/DNSClientHost.h"
+#else
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/NetLib.h>
+#endif
+
+#include "DNSClientCursor.h"
+
+//
+// Longest name in wire format, including the length octets and root label.
+//
+#define DNS_MAX_NAME_LENGTH              255
+
+//
+// Most compression pointers followed while decoding one name.  Every pointer
+// must also point before the labels it was found in, so this only bounds the
+// work done on a hostile message.
+//
+#define DNS_MAX_NAME_POINTERS            16
+
+//
+// Size of the fixed DNS header on the wire.
+//
+#define DNS_HEADER_LENGTH                12
+
+//
+// Size of the OPT pseudo-RR (RFC 6891 section 6.1.2) a query carries when
+// EDNS is in use: root owner name, TYPE, CLASS, TTL and an empty RDLENGTH.
+//
+#define DNS_OPT_LENGTH                   11
+
+//
+// TYPE of the OPT pseudo-RR.
+//
+#define DNS_TYPE_OPT                     41
+
+//
+// TYPEs of the records DNSReadRDataView reads.
+//
+#define DNS_TYPE_NS                      2
+#define DNS_TYPE_CNAME                   5
+#define DNS_TYPE_SOA                     6
+#define DNS_TYPE_PTR                     12
+#define DNS_TYPE_MX                      15
+#define DNS_TYPE_TXT                     16
+#define DNS_TYPE_SRV                     33
+
+//
+// Smallest UDP payload size an OPT record may advertise.  Anything lower is
+// treated as 512 (RFC 6891 section 6.2.5).
+//
+#define DNS_EDNS_MIN_PAYLOAD             512
+
+/**
+  Safely destroys a pointer if the pointer is not null.
+
+  @param  x  Pointer to free.
+ */
+#define SafeRelease(x)   if(x != NULL){ FreePool(x); x = NULL;}
+
+/**
+  Set status to y and goto x.
+
+  @param  x  Label to go to.
+  @param  y  EFI_STATUS to set Status to.
+ */
+#define GotoStatus(x,y) {Status = y; goto x;}
+
+typedef UINT8 DNS_PACKET_DATA;
+
+typedef struct _SOA_RECORD {
+  CHAR8                          *PrimaryNS;
+  CHAR8                          *AdminMB;
+  UINT32                         SerialNumber;
+  UINT32                         RefreshInterval;
+  UINT32                         RetryInterval;
+  UINT32                         ExpirationLimit;
+  UINT32                         MinimumTTL;
+} SOA_RECORD;
+
+typedef struct _MX_RECORD {
+  UINT16                         Preference;
+  CHAR8                          *MailExchanger;
+} MX_RECORD;
+
+typedef struct _A_RECORD {
+  EFI_IPv4_ADDRESS               IpAddress;
+} A_RECORD;
+
+typedef struct _AAAA_RECORD {
+  EFI_IPv6_ADDRESS               IpAddress;
+} AAAA_RECORD;
+
+typedef struct _PTR_RECORD {
+  CHAR8                          *Name;
+} PTR_RECORD;
+
+typedef struct _NS_RECORD {
+  CHAR8                          *Name;
+} NS_RECORD;
+
+typedef struct _CNAME_RECORD {
+  CHAR8                          *Name;
+} CNAME_RECORD;
+
+typedef struct _DNS_HEADER {
+  UINT16                         Id;         // 16 bit identifer assigned by the client.
+
+  UINT16                         Rd:1;       //
+  UINT16                         Tc:1;
+  UINT16                         Aa:1;
+  UINT16                         Opcode:4;
+  UINT16                         Qr:1;
+
+  UINT16                         RCode:4;
+  UINT16                         Cd:1;
+  UINT16                         Ad:1;
+  UINT16                         Z:1;
+  UINT16                         Ra:1;
+
+  UINT16                         QdCount;
+  UINT16                         AnCount;
+  UINT16                         NsCount;
+  UINT16                         ArCount;
+} DNS_HEADER;
+
+//
+// Initial arena estimate for each decoded name.  Names which are compressed
+// down to a two byte pointer on the wire still expand to their full length.
+//
+#define DNS_ARENA_NAME_ESTIMATE          64
+
+//
+// Alignment of every allocation handed out by an arena.
+//
+#define DNS_ARENA_ALIGNMENT              8
+
+/**
+  Extra block chained onto an arena once its initial block is exhausted.
+  The usable bytes follow the structure.
+ */
+typedef struct _DNS_ARENA_BLOCK {
+  struct _DNS_ARENA_BLOCK        *Next;
+  UINTN                          Size;
+  UINTN                          Used;
+} DNS_ARENA_BLOCK;
+
+/**
+  Bump pointer allocator backing everything decoded out of a single message.
+  Nothing is freed individually, the whole arena goes away with its packet.
+ */
+typedef struct _DNS_ARENA {
+  UINT8                          *Base;      // Initial block.  NULL if the packet has no arena.
+  UINTN                          Size;
+  UINTN                          Offset;     // Next free byte in Base.
+  UINTN                          Used;       // Total bytes handed out, including overflow blocks.
+  DNS_ARENA_BLOCK                *Overflow;  // Most recent overflow block.
+} DNS_ARENA;
+
+typedef struct _DNS_PACKET {
+  DNS_HEADER                     Header;
+
+  BOOLEAN                        HasOpt;         // The additional section held an OPT record.
+  UINT16                         UdpPayloadSize; // Payload size the sender's OPT record advertised.  0 without one.
+  UINT8                          EdnsVersion;
+  UINT16                         ExtendedRCode;  // All 12 bits of RCODE: Header.RCode below the 8 bits from the OPT record.
+
+  UINT16                         DataLength;
+
+  DNS_PACKET_DATA                *Data;
+
+  DNS_ARENA                      Arena;      // Backing store of a decoded packet.
+} DNS_PACKET;
+
+typedef struct _DNS_QUESTION {
+  CHAR8                          *QName;
+  UINT16                         QType;
+  UINT16                         QClass;
+} DNS_QUESTION;
+
+typedef struct _DNS_ANSWER {
+  CHAR8                          *Name;
+  UINT16                         Type;
+  UINT16                         Class;
+  UINT32                         TTL;
+  UINT32                         RdLength;
+  UINT32                         RDataOffset;  // Where RDATA starts in the message, for DNSReadRDataView.
+  VOID*                          RData;
+} DNS_ANSWER;
+
+/**
+  A name left in place in a received message.  Nothing is copied or
+  followed until it is decoded with DNSViewDecodeName.
+ */
+typedef struct _DNS_NAME_VIEW {
+  UINT32                         Offset;       // Where the name starts in the message.
+} DNS_NAME_VIEW;
+
+/**
+  A <character-string> of a TXT record, left in place in the message.
+ */
+typedef struct _DNS_STRING_VIEW {
+  UINT32                         Offset;       // Where the characters start in the message.
+  UINT8                          Length;
+} DNS_STRING_VIEW;
+
+typedef struct _DNS_MX_VIEW {
+  UINT16                         Preference;
+  DNS_NAME_VIEW                  Exchange;
+} DNS_MX_VIEW;
+
+typedef struct _DNS_SOA_VIEW {
+  DNS_NAME_VIEW                  PrimaryNS;
+  DNS_NAME_VIEW                  AdminMB;
+  UINT32                         SerialNumber;
+  UINT32                         RefreshInterval;
+  UINT32                         RetryInterval;
+  UINT32                         ExpirationLimit;
+  UINT32                         MinimumTTL;
+} DNS_SOA_VIEW;
+
+typedef struct _DNS_SRV_VIEW {
+  UINT16                         Priority;
+  UINT16                         Weight;
+  UINT16                         Port;
+  DNS_NAME_VIEW                  Target;
+} DNS_SRV_VIEW;
+
+typedef struct _DNS_TXT_VIEW {
+  UINT32                         Offset;       // Where RDATA starts in the message.
+  UINT16                         Length;       // RDLENGTH.
+  UINT16                         StringCount;  // Number of <character-string>s in RDATA.
+} DNS_TXT_VIEW;
+
+/**
+  The RDATA of one record read in place, as its TYPE says: Name for NS,
+  CNAME and PTR records, and the member of the same name for the rest.
+  Unlike the *_RECORD structures nothing is allocated; every name and
+  string stays in the message, which must be held as long as the view is.
+ */
+typedef union _DNS_RDATA_VIEW {
+  DNS_NAME_VIEW                  Name;
+  DNS_MX_VIEW                    Mx;
+  DNS_SOA_VIEW                   Soa;
+  DNS_SRV_VIEW                   Srv;
+  DNS_TXT_VIEW                   Txt;
+} DNS_RDATA_VIEW;
+
+//
+// Number of pool allocations the client has made.  Used to account for
+// allocations made on the send and receive paths.
+//
+extern UINT64 gDNSClientAllocations;
+
+/**
+  AllocatePool wrapper which counts allocations in gDNSClientAllocations.
+  */
+VOID* EFIAPI DNSAllocatePool(UINTN Size);
+
+/**
+  AllocateZeroPool wrapper which counts allocations in gDNSClientAllocations.
+  */
+VOID* EFIAPI DNSAllocateZeroPool(UINTN Size);
+
+/**
+  Allocates zeroed memory out of a packet's arena.  Falls back to chaining an
+  extra block if the initial block is exhausted.
+
+  @param[in] Arena         The arena to allocate from.
+  @param[in] Size          Number of bytes.
+
+  @retval NULL             Out of memory.
+  @retval VOID*            The memory.  Freed along with the packet.
+  */
+VOID* EFIAPI DNSArenaAllocate(DNS_ARENA *Arena, UINTN Size);
+
+/**
+  Release a DNS_PACKET.
+
+  @param[in] Packet        The Packet to free data on.
+
+  @retval EFI_SUCCESS      Data has been freed.
+  @retval other            An error occured.
+  */
+EFI_STATUS EFIAPI ReleaseDNSPacket(DNS_PACKET *Packet);
+
+/**
+  Writes a DNS header for a recursive query.
+
+  @param[out] Buffer     Receives DNS_HEADER_LENGTH bytes.
+  @param[in]  Id         Transaction id (host byte order).
+  @param[in]  QdCount    Number of questions.
+  @param[in]  ArCount    Number of additional records.
+  */
+VOID EFIAPI DNSWriteHeader(UINT8 *Buffer, UINT16 Id, UINT16 QdCount, UINT16 ArCount);
+
+/**
+  Writes the QTYPE and QCLASS (IN) that follow a QNAME.
+
+  @param[out] Buffer     Receives 4 bytes.
+  @param[in]  QType      The QTYPE (host byte order).
+  */
+VOID EFIAPI DNSWriteQuestionTail(UINT8 *Buffer, UINT16 QType);
+
+/**
+  Writes the OPT pseudo-RR (RFC 6891) which goes in the additional section
+  of a query.  The extended RCODE, version and flags are all 0 and no
+  options are carried.
+
+  @param[out] Buffer          Receives DNS_OPT_LENGTH bytes.
+  @param[in]  UdpPayloadSize  Largest UDP payload the client can take.
+  */
+VOID EFIAPI DNSWriteOpt(UINT8 *Buffer, UINT16 UdpPayloadSize);
+
+/**
+  Encodes a hostname into wire (label) format in a single pass.  A trailing
+  dot is accepted and ignored.
+
+  @param[in]  Hostname     A null terminated hostname.
+  @param[out] Buffer       Receives the encoded name.
+  @param[in]  BufferSize   Size of Buffer in bytes.
+  @param[out] Length       Number of bytes written, including the root label.
+
+  @retval EFI_SUCCESS            The name has been encoded.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL, or Hostname has an empty or over long label.
+  @retval EFI_BUFFER_TOO_SMALL   The name does not fit in Buffer or is longer than DNS_MAX_NAME_LENGTH.
+  */
+EFI_STATUS EFIAPI EncodeDNSName(CONST CHAR8 *Hostname, UINT8 *Buffer, UINTN BufferSize, UINTN *Length);
+
+/**
+  Decodes a (possibly compressed) name at the cursor in a single pass.
+  Compression pointers may appear after any label and may lead to further
+  pointers, but each must point before the labels it was found in, so a
+  message can not make the decoder loop.  The cursor is left after the name.
+
+  @param[in]  Cursor       The cursor positioned at the name.
+  @param[out] Buffer       Receives the null terminated dotted name.  NULL only skips the name.
+  @param[in]  BufferSize   Size of Buffer in bytes.  DNS_MAX_NAME_LENGTH is always enough.
+  @param[out] Length       Length of the dotted name, not counting the null.
+
+  @retval EFI_SUCCESS            The name has been decoded.
+  @retval EFI_INVALID_PARAMETER  Cursor or Length is NULL.
+  @retval EFI_BUFFER_TOO_SMALL   The name does not fit in Buffer.
+  @retval EFI_PROTOCOL_ERROR     The name is truncated or malformed.  Cursor->Error is set.
+  */
+EFI_STATUS EFIAPI DecodeDNSName(DNS_CURSOR *Cursor, CHAR8 *Buffer, UINTN BufferSize, UINTN *Length);
+
+/**
+  Encodes a complete single question query (header, QNAME, QTYPE and QCLASS)
+  into a buffer in one pass.  Recursion is requested.  An OPT record follows
+  the question if UdpPayloadSize is not 0.
+
+  @param[out] Buffer          Receives the message.
+  @param[in]  BufferSize      Size of Buffer in bytes.
+  @param[in]  Id              Transaction id (host byte order).
+  @param[in]  Hostname        A null terminated hostname.
+  @param[in]  QType           The QTYPE (host byte order).
+  @param[in]  UdpPayloadSize  UDP payload size to advertise, or 0 for no OPT record.
+  @param[out] Length          Number of bytes written.
+
+  @retval EFI_SUCCESS            The query has been encoded.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL or Hostname is malformed.
+  @retval EFI_BUFFER_TOO_SMALL   The query does not fit in Buffer.
+  */
+EFI_STATUS EFIAPI EncodeDNSQuery(UINT8 *Buffer, UINTN BufferSize, UINT16 Id, CONST CHAR8 *Hostname, UINT16 QType, UINT16 UdpPayloadSize, UINTN *Length);
+
+/**
+  Creates a DNS_PACKET based off of the parameters provided.  Must call ReleaseDNSPacket to free up used memory.
+
+  @param[in] Questions     Array of Questions in the dns request.
+  @param[in] NumQuestions  Number of Questions in the array.
+
+  @retval EFI_SUCCESS      Packet data has been successfully created.
+  @retval other            An error occured.
+  */
+DNS_PACKET* EFIAPI CreateDNSPacket(DNS_QUESTION Questions[], UINTN NumQuestions);
+
+/**
+  Decodes a DNS message from a cursor.
+  Must call ReleaseDNSPacket when done.
+
+  @param[in]  Cursor              Cursor positioned at the start of the message.
+  @param[out] Packet              A pointer to the vairable that will contain the address of the decoded packet.
+
+  @retval EFI_SUCCESS             Packet decoded successfully.
+  @retval EFI_INVALID_PARAMETER   Cursor or Packet is NULL.
+  @retval EFI_OUT_OF_RESOURCES    Out of memory.
+  @retval EFI_PROTOCOL_ERROR      The message is truncated or malformed.
+ */
+EFI_STATUS EFIAPI DecodeDNSPacket(DNS_CURSOR *Cursor, DNS_PACKET **Packet);
+
+/**
+  Reads the RDATA of an NS, CNAME, PTR, MX, SOA, SRV or TXT record in place.
+  The fixed fields are read, and every name and string is checked to end
+  within RDATA and recorded by offset, without being decoded or copied.
+  The cursor itself is left untouched.
+
+  @param[in]  Cursor       Cursor over the whole message.
+  @param[in]  Type         TYPE of the record.
+  @param[in]  RDataOffset  Where RDATA starts in the message (DNS_ANSWER.RDataOffset).
+  @param[in]  RdLength     RDLENGTH of the record.
+  @param[out] View         Receives the view.
+
+  @retval EFI_SUCCESS            View has been filled in.
+  @retval EFI_INVALID_PARAMETER  Cursor or View is NULL.
+  @retval EFI_UNSUPPORTED        Type has no view.
+  @retval EFI_PROTOCOL_ERROR     RDATA is truncated or malformed.
+  */
+EFI_STATUS EFIAPI DNSReadRDataView(DNS_CURSOR *Cursor, UINT16 Type, UINT32 RDataOffset, UINT16 RdLength, DNS_RDATA_VIEW *View);
+
+/**
+  Decodes a name a view left in the message, following its compression
+  pointers as DecodeDNSName does.  The cursor itself is left untouched.
+
+  @param[in]  Cursor       Cursor over the whole message.
+  @param[in]  Name         The name.
+  @param[out] Buffer       Receives the null terminated dotted name.
+  @param[in]  BufferSize   Size of Buffer in bytes.  DNS_MAX_NAME_LENGTH is always enough.
+  @param[out] Length       Length of the dotted name, not counting the null.
+
+  @retval EFI_SUCCESS      The name has been decoded.
+  @retval other            As DecodeDNSName returns.
+  */
+EFI_STATUS EFIAPI DNSViewDecodeName(DNS_CURSOR *Cursor, CONST DNS_NAME_VIEW *Name, CHAR8 *Buffer, UINTN BufferSize, UINTN *Length);
+
+/**
+  Steps through the <character-string>s of a TXT record.  The characters
+  can be read with DNSCursorSeek and DNSCursorReadBytes.  The cursor itself
+  is left untouched.
+
+  @param[in]     Cursor    Cursor over the whole message.
+  @param[in]     View      The TXT record, as DNSReadRDataView read it.
+  @param[in/out] Position  0 for the first string.  Moved on to the next.
+  @param[out]    String    Receives the string.
+
+  @retval EFI_SUCCESS            String has been filled in.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL.
+  @retval EFI_NOT_FOUND          There are no more strings.
+  @retval EFI_PROTOCOL_ERROR     The string runs past RDATA.
+  */
+EFI_STATUS EFIAPI DNSViewNextTxtString(DNS_CURSOR *Cursor, CONST DNS_TXT_VIEW *View, UINT32 *Position, DNS_STRING_VIEW *String);
+
+/**
+  Converts a hostname to DNS label format.
+  Must call FreePool when done with the string.
+
+  @param[in] Hostname     The hostname string to convert.
+  @param[in] Length       The length of the Hostname string.
+
+  @retval NULL            Hostname is NULL or out of memory.
+  @retval CHAR8*          Pointer to newly created label format string.
+  */
+CHAR8* EFIAPI HostnameToLabelFormat(CHAR8* Hostname, UINTN Length);
+
+/**
+  Converts a DNS label format to a Hostname string.  
+  Must call FreePool when done with the string.
+
+  The name is not part of a message, so a compression pointer can not be
+  resolved and is rejected along with any name longer than DNS_MAX_NAME_LENGTH.
+
+  @param[in] LabelFormat  The label formatted string to convert.
+
+  @retval NULL            LabelFormat is NULL, malformed or out of memory.
+  @retval CHAR8*          Pointer to newly created string.
+  */
+CHAR8* EFIAPI LabelFormatToHostname(CHAR8* LabelFormat);
+
+#endif
@@ -0,0 +1,163 @@
+#include "DNSClientCursor.h"
+
+/**
+  Initalizes a cursor at the start of a fragment table.
+
+  @param[in] Cursor         The cursor to initalize.
+  @param[in] Fragments      The fragment table.
+  @param[in] FragmentCount  Number of entries in Fragments.
+  */
+VOID EFIAPI DNSCursorInit(DNS_CURSOR *Cursor, EFI_UDP4_FRAGMENT_DATA *Fragments, UINT32 FragmentCount) {
+  UINT32   i;
+
+  ZeroMem(Cursor, sizeof(DNS_CURSOR));
+
+  Cursor->Fragments     = Fragments;
+  Cursor->FragmentCount = FragmentCount;
+
+  for(i = 0; i < FragmentCount; ++i) {
+    Cursor->Length += Fragments[i].FragmentLength;
+  }
+
+  //
+  // Step over any empty leading fragments.
+  //
+  DNSCursorSeek(Cursor, 0);
+} // End of DNSCursorInit
+
+
+/**
+  Moves the cursor to an absolute offset.  Seeking past the end sets Error.
+
+  @param[in] Cursor         The cursor.
+  @param[in] Position       Offset from the start of the datagram.
+  */
+VOID EFIAPI DNSCursorSeek(DNS_CURSOR *Cursor, UINT32 Position) {
+  if(Position > Cursor->Length) {
+    Cursor->Error    = TRUE;
+    Cursor->Position = Cursor->Length;
+    return;
+  }
+
+  //
+  // Walk back to the first fragment if seeking backwards (compression
+  // pointers always point backwards), then forwards to the right one.
+  //
+  if(Position < Cursor->FragmentStart) {
+    Cursor->Fragment      = 0;
+    Cursor->FragmentStart = 0;
+  }
+
+  while(Cursor->Fragment < Cursor->FragmentCount &&
+        Position >= Cursor->FragmentStart + Cursor->Fragments[Cursor->Fragment].FragmentLength) {
+    Cursor->FragmentStart += Cursor->Fragments[Cursor->Fragment].FragmentLength;
+    ++(Cursor->Fragment);
+  }
+
+  Cursor->Position = Position;
+} // End of DNSCursorSeek
+
+
+/**
+  Copies bytes out of the datagram and advances the cursor.
+
+  @param[in]  Cursor        The cursor.
+  @param[out] Buffer        Receives the bytes.  Zero filled if the datagram is too short.
+  @param[in]  Length        Number of bytes to read.
+  */
+VOID EFIAPI DNSCursorReadBytes(DNS_CURSOR *Cursor, VOID *Buffer, UINTN Length) {
+  UINT8    *Destination;
+  UINT32   Offset;
+  UINT32   Available;
+
+  Destination = (UINT8*) Buffer;
+
+  if(Length > Cursor->Length - Cursor->Position) {
+    ZeroMem(Buffer, Length);
+    Cursor->Error    = TRUE;
+    Cursor->Position = Cursor->Length;
+    return;
+  }
+
+  while(Length > 0) {
+    Offset    = Cursor->Position - Cursor->FragmentStart;
+    Available = Cursor->Fragments[Cursor->Fragment].FragmentLength - Offset;
+
+    if(Available > Length) {
+      Available = (UINT32) Length;
+    }
+
+    CopyMem(Destination, (UINT8*)Cursor->Fragments[Cursor->Fragment].FragmentBuffer + Offset, Available);
+
+    Destination += Available;
+    Length      -= Available;
+
+    DNSCursorSeek(Cursor, Cursor->Position + Available);
+  }
+} // End of DNSCursorReadBytes
+
+
+/**
+  Reads one octet.
+
+  @param[in] Cursor         The cursor.
+
+  @retval UINT8             The octet, or 0 past the end.
+  */
+UINT8 EFIAPI DNSCursorReadUint8(DNS_CURSOR *Cursor) {
+  UINT8    Value;
+  UINT32   Offset;
+
+  if(Cursor->Position >= Cursor->Length) {
+    Cursor->Error = TRUE;
+    return 0;
+  }
+
+  //
+  // Fast path, the octet is in the current fragment.
+  //
+  Offset = Cursor->Position - Cursor->FragmentStart;
+  Value  = ((UINT8*)Cursor->Fragments[Cursor->Fragment].FragmentBuffer)[Offset];
+
+  if(Offset + 1 < Cursor->Fragments[Cursor->Fragment].FragmentLength) {
+    ++(Cursor->Position);
+  } else {
+    DNSCursorSeek(Cursor, Cursor->Position + 1);
+  }
+
+  return Value;
+} // End of DNSCursorReadUint8
+
+
+/**
+  Reads a 16 bit value in network byte order.
+
+  @param[in] Cursor         The cursor.
+
+  @retval UINT16            The value in host byte order, or 0 past the end.
+  */
+UINT16 EFIAPI DNSCursorReadUint16(DNS_CURSOR *Cursor) {
+  UINT16   Value;
+
+  Value  = (UINT16)(DNSCursorReadUint8(Cursor) << 8);
+  Value |= DNSCursorReadUint8(Cursor);
+
+  return Value;
+} // End of DNSCursorReadUint16
+
+
+/**
+  Reads a 32 bit value in network byte order.
+
+  @param[in] Cursor         The cursor.
+
+  @retval UINT32            The value in host byte order, or 0 past the end.
+  */
+UINT32 EFIAPI DNSCursorReadUint32(DNS_CURSOR *Cursor) {
+  UINT32   Value;
+
+  Value  = ((UINT32) DNSCursorReadUint16(Cursor)) << 16;
+  Value |= DNSCursorReadUint16(Cursor);
+
+  return Value;
+} // End of DNSCursorReadUint32
@@ -0,0 +1,92 @@
+/** @file DNSClientCursor.h
+  A read cursor over the fragment table of a received datagram.
+
+  The Udp4 driver hands a datagram back as a table of fragments which are not
+  necessarily contiguous.  The cursor lets the decoder read the message in place
+  across fragment boundaries, and seek to absolute offsets for compression
+  pointers, without first copying the datagram into one buffer.
+
+  Reads past the end of the datagram return zeros and set the sticky Error flag,
+  so a decoder can read a whole record and check for truncation once.
+
+  Copyright (c) 2015, Caleb Bartholomew
+ */
+
+#ifndef __DNSClientCursor_h__
+#define __DNSClientCursor_h__
+
+#ifdef DNSCLIENT_HOST_BUILD
+#include "Host/DNSClientHost.h"
+#else
+#include <Uefi.h>
+
+#include <Protocol/Udp4.h>
+
+#include <Library/BaseMemoryLib.h>
+#endif
+
+typedef struct _DNS_CURSOR {
+  EFI_UDP4_FRAGMENT_DATA         *Fragments;
+  UINT32                         FragmentCount;
+  UINT32                         Length;          // Total length of all fragments.
+
+  UINT32                         Position;        // Absolute offset of the next byte to read.
+  UINT32                         Fragment;        // Fragment Position falls in.
+  UINT32                         FragmentStart;   // Absolute offset of the first byte of Fragment.
+
+  BOOLEAN                        Error;           // Set once a read ran past the end.
+} DNS_CURSOR;
+
+/**
+  Initalizes a cursor at the start of a fragment table.
+
+  @param[in] Cursor         The cursor to initalize.
+  @param[in] Fragments      The fragment table.
+  @param[in] FragmentCount  Number of entries in Fragments.
+  */
+VOID EFIAPI DNSCursorInit(DNS_CURSOR *Cursor, EFI_UDP4_FRAGMENT_DATA *Fragments, UINT32 FragmentCount);
+
+/**
+  Moves the cursor to an absolute offset.  Seeking past the end sets Error.
+
+  @param[in] Cursor         The cursor.
+  @param[in] Position       Offset from the start of the datagram.
+  */
+VOID EFIAPI DNSCursorSeek(DNS_CURSOR *Cursor, UINT32 Position);
+
+/**
+  Copies bytes out of the datagram and advances the cursor.
+
+  @param[in]  Cursor        The cursor.
+  @param[out] Buffer        Receives the bytes.  Zero filled if the datagram is too short.
+  @param[in]  Length        Number of bytes to read.
+  */
+VOID EFIAPI DNSCursorReadBytes(DNS_CURSOR *Cursor, VOID *Buffer, UINTN Length);
+
+/**
+  Reads one octet.
+
+  @param[in] Cursor         The cursor.
+
+  @retval UINT8             The octet, or 0 past the end.
+  */
+UINT8 EFIAPI DNSCursorReadUint8(DNS_CURSOR *Cursor);
+
+/**
+  Reads a 16 bit value in network byte order.
+
+  @param[in] Cursor         The cursor.
+
+  @retval UINT16            The value in host byte order, or 0 past the end.
+  */
+UINT16 EFIAPI DNSCursorReadUint16(DNS_CURSOR *Cursor);
+
+/**
+  Reads a 32 bit value in network byte order.
+
+  @param[in] Cursor         The cursor.
+
+  @retval UINT32            The value in host byte order, or 0 past the end.
+  */
+UINT32 EFIAPI DNSCursorReadUint32(DNS_CURSOR *Cursor);
+#endif
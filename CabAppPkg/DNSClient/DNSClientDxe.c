@@ -0,0 +1,1071 @@
+#include "DNSClientDxe.h"
+
+//
+// The one service the driver installs, kept for DNSClientDxeUnload.
+//
+STATIC DNSCLIENT_DXE_SERVICE *mService = NULL;
+
+STATIC CONST EFI_DNS4_PROTOCOL mDNSClientDxeDns4 = {
+  DNSClientDxeGetModeData,
+  DNSClientDxeConfigure,
+  DNSClientDxeHostNameToIp,
+  DNSClientDxeIpToHostName,
+  DNSClientDxeGeneralLookUp,
+  DNSClientDxeUpdateDnsCache,
+  DNSClientDxePoll,
+  DNSClientDxeCancel
+};
+
+
+/**
+  Starts the shared resolver unless it is running already.  A failed start
+  leaves nothing behind, so the next child to be configured tries again.
+
+  @param[in] Service     The driver's service.
+
+  @retval EFI_SUCCESS    The resolver is running.
+  @retval EFI_NO_MAPPING There is no network interface to start it on.
+  @retval other          The resolver could not be started.
+  */
+STATIC EFI_STATUS DNSClientDxeStart(DNSCLIENT_DXE_SERVICE *Service) {
+  EFI_STATUS   Status;
+
+  if(Service->Started) {
+    return EFI_SUCCESS;
+  }
+
+  Status = CreateDNSClient(&Service->Private);
+
+  if(EFI_ERROR(Status)) {
+    return (Status == EFI_ABORTED) ? EFI_NO_MAPPING : Status;
+  }
+
+  Service->Started = TRUE;
+
+  return EFI_SUCCESS;
+} // End of DNSClientDxeStart
+
+
+/**
+  Brings the resolver's server list up to date with the DnsServerLists of
+  the configured children, once the resolver has no lookups running.  The
+  servers of every list are added before those of the previous lists are
+  removed, so a server which stays keeps its round trip time.  Called again
+  when a lookup finishes, should the list have changed during it.
+
+  @param[in] Service     The driver's service.
+  */
+STATIC VOID DNSClientDxeSyncServers(DNSCLIENT_DXE_SERVICE *Service) {
+  EFI_TPL                  OldTpl;
+  DNSCLIENT_DXE_INSTANCE   *Child;
+  EFI_IPv4_ADDRESS         *Added;
+  EFI_IP_ADDRESS           Address;
+  LIST_ENTRY               *Link;
+  UINTN                    Count;
+  UINTN                    i, j;
+
+  //
+  // The resolver's engine runs at TPL_CALLBACK.  Above it the change waits
+  // for the next call from below.
+  //
+  if(EfiGetCurrentTpl() > TPL_CALLBACK) {
+    return;
+  }
+
+  OldTpl = gBS->RaiseTPL(TPL_CALLBACK);
+
+  if(!Service->Started || !Service->ServersChanged || !IsListEmpty(&Service->Private.Requests)) {
+    gBS->RestoreTPL(OldTpl);
+    return;
+  }
+
+  Count = 0;
+
+  for(Link = GetFirstNode(&Service->Children); !IsNull(&Service->Children, Link); Link = GetNextNode(&Service->Children, Link)) {
+    Child = DNSCLIENT_DXE_INSTANCE_FROM_LINK(Link);
+
+    if(Child->Configured) {
+      Count += Child->Config.DnsServerListCount;
+    }
+  }
+
+  Added = NULL;
+
+  if(Count != 0) {
+    Added = AllocatePool(Count * sizeof(EFI_IPv4_ADDRESS));
+
+    //
+    // Left as it is, to be tried again after the next lookup.
+    //
+    if(Added == NULL) {
+      gBS->RestoreTPL(OldTpl);
+      return;
+    }
+  }
+
+  ZeroMem(&Address, sizeof(EFI_IP_ADDRESS));
+
+  Count = 0;
+
+  for(Link = GetFirstNode(&Service->Children); !IsNull(&Service->Children, Link); Link = GetNextNode(&Service->Children, Link)) {
+    Child = DNSCLIENT_DXE_INSTANCE_FROM_LINK(Link);
+
+    for(j = 0; Child->Configured && j < Child->Config.DnsServerListCount; ++j) {
+      CopyMem(&Address.v4, &Child->Servers[j], sizeof(EFI_IPv4_ADDRESS));
+
+      //
+      // Only servers which made it onto the list are removed again later.
+      //
+      if(!EFI_ERROR(AddDNSServer(&Service->Private, &Address, FALSE))) {
+        CopyMem(&Added[Count++], &Address.v4, sizeof(EFI_IPv4_ADDRESS));
+      }
+    }
+  }
+
+  for(i = 0; i < Service->AddedCount; ++i) {
+    CopyMem(&Address.v4, &Service->Added[i], sizeof(EFI_IPv4_ADDRESS));
+    RemoveDNSServer(&Service->Private, &Address, FALSE);
+  }
+
+  SafeRelease(Service->Added);
+
+  Service->Added          = Added;
+  Service->AddedCount     = Count;
+  Service->ServersChanged = FALSE;
+
+  gBS->RestoreTPL(OldTpl);
+} // End of DNSClientDxeSyncServers
+
+
+/**
+  Saves the shared cache before a boot option is started, as the driver is
+  normally never unloaded and DestroyDNSClient would not get to.
+
+  @param[in] Event       The ReadyToBoot event.
+  @param[in] Context     The driver's service.
+  */
+STATIC VOID EFIAPI DNSClientDxeReadyToBoot(IN EFI_EVENT Event, IN VOID *Context) {
+  DNSCLIENT_DXE_SERVICE   *Service;
+
+  Service = (DNSCLIENT_DXE_SERVICE*) Context;
+
+  if(Service->Started) {
+    SaveDNSCache(&Service->Private);
+  }
+} // End of DNSClientDxeReadyToBoot
+
+
+/**
+  Narrows a host name to the ASCII the resolver takes.
+
+  @param[in]  HostName   The name.
+  @param[out] Name       Receives the name.  Room for DNS_MAX_NAME_LENGTH + 1 characters.
+
+  @retval EFI_SUCCESS            Name has been filled in.
+  @retval EFI_INVALID_PARAMETER  HostName is empty, too long or not ASCII.
+  */
+STATIC EFI_STATUS DNSClientDxeToAscii(CONST CHAR16 *HostName, CHAR8 *Name) {
+  UINTN   i;
+
+  for(i = 0; HostName[i] != L'\0'; ++i) {
+    if(i == DNS_MAX_NAME_LENGTH || HostName[i] > 0x7F) {
+      return EFI_INVALID_PARAMETER;
+    }
+
+    Name[i] = (CHAR8) HostName[i];
+  }
+
+  Name[i] = '\0';
+
+  return (i == 0) ? EFI_INVALID_PARAMETER : EFI_SUCCESS;
+} // End of DNSClientDxeToAscii
+
+
+/**
+  Hands a finished lookup back to the caller of HostNameToIp: fills in its
+  token, frees the request and signals the token's event.
+
+  @param[in] Request     The request, on its child's Requests list.  No longer running on the resolver.
+  */
+STATIC VOID DNSClientDxeFinishRequest(DNSCLIENT_DXE_REQUEST *Request) {
+  EFI_DNS4_COMPLETION_TOKEN   *Token;
+  DNS_HOST_TO_ADDR_DATA       *Data;
+
+  RemoveEntryList(&Request->Link);
+
+  Token                  = Request->Token;
+  Token->Status          = EFI_ERROR(Request->Resolve.Status) ? Request->Resolve.Status : Request->Lookup.Status;
+  Token->RspData.H2AData = NULL;
+
+  if(!EFI_ERROR(Token->Status)) {
+    Data = AllocatePool(sizeof(DNS_HOST_TO_ADDR_DATA));
+
+    if(Data != NULL) {
+      Data->IpCount = (UINT32) MIN(Request->Lookup.AddressCount, DNSCLIENT_DXE_MAX_ADDRESSES);
+      Data->IpList  = AllocateCopyPool(Data->IpCount * sizeof(EFI_IPv4_ADDRESS), Request->Addresses);
+
+      if(Data->IpList == NULL) {
+        SafeRelease(Data);
+      }
+    }
+
+    if(Data == NULL) {
+      Token->Status = EFI_OUT_OF_RESOURCES;
+    }
+
+    Token->RspData.H2AData = Data;
+  }
+
+  //
+  // Closing the event also drops its notify if that is still queued.
+  //
+  gBS->CloseEvent(Request->Resolve.Event);
+  FreePool(Request);
+
+  gBS->SignalEvent(Token->Event);
+} // End of DNSClientDxeFinishRequest
+
+
+/**
+  Signaled by the resolver once a request's lookup has completed.
+
+  @param[in] Event       The request's resolve event.
+  @param[in] Context     The DNSCLIENT_DXE_REQUEST.
+  */
+STATIC VOID EFIAPI DNSClientDxeRequestDone(IN EFI_EVENT Event, IN VOID *Context) {
+  DNSCLIENT_DXE_SERVICE   *Service;
+
+  Service = ((DNSCLIENT_DXE_REQUEST*) Context)->Instance->Service;
+
+  DNSClientDxeFinishRequest((DNSCLIENT_DXE_REQUEST*) Context);
+  DNSClientDxeSyncServers(Service);
+} // End of DNSClientDxeRequestDone
+
+
+/**
+  Stops a child's lookups.  Each token is signaled with EFI_ABORTED, or
+  with its result if the lookup had completed already.
+
+  @param[in] Instance    The child.
+  @param[in] Token       The lookup to stop, or NULL for all of them.
+
+  @retval EFI_SUCCESS    The lookups have been stopped.
+  @retval EFI_NOT_FOUND  Token is not outstanding.
+  */
+STATIC EFI_STATUS DNSClientDxeCancelRequests(DNSCLIENT_DXE_INSTANCE *Instance, EFI_DNS4_COMPLETION_TOKEN *Token) {
+  EFI_STATUS              Status;
+  EFI_TPL                 OldTpl;
+  DNSCLIENT_DXE_REQUEST   *Request;
+  LIST_ENTRY              *Link, *NextLink;
+
+  Status = (Token == NULL) ? EFI_SUCCESS : EFI_NOT_FOUND;
+  OldTpl = gBS->RaiseTPL(TPL_CALLBACK);
+
+  for(Link = GetFirstNode(&Instance->Requests); !IsNull(&Instance->Requests, Link); Link = NextLink) {
+    NextLink = GetNextNode(&Instance->Requests, Link);
+    Request  = DNSCLIENT_DXE_REQUEST_FROM_LINK(Link);
+
+    if(Token != NULL && Request->Token != Token) {
+      continue;
+    }
+
+    CancelDNSLookups(&Instance->Service->Private, &Request->Resolve);
+    DNSClientDxeFinishRequest(Request);
+
+    Status = EFI_SUCCESS;
+  }
+
+  gBS->RestoreTPL(OldTpl);
+
+  DNSClientDxeSyncServers(Instance->Service);
+
+  return Status;
+} // End of DNSClientDxeCancelRequests
+
+
+/**
+  Entry point of the driver.  Installs the service binding and the engine
+  protocol on a new handle.  The resolver itself is not started yet.
+
+  @param[in] ImageHandle  The firmware allocated handle for the EFI image.
+  @param[in] SystemTable  A pointer to the EFI System Table.
+
+  @retval EFI_SUCCESS            The protocols have been installed.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.
+  @retval other                  The protocols could not be installed.
+  */
+EFI_STATUS EFIAPI DNSClientDxeEntry(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE *SystemTable) {
+  EFI_STATUS              Status;
+  DNSCLIENT_DXE_SERVICE   *Service;
+
+  Service = AllocateZeroPool(sizeof(DNSCLIENT_DXE_SERVICE));
+
+  if(Service == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Service->Signature                   = DNSCLIENT_DXE_SERVICE_SIGNATURE;
+  Service->ServiceBinding.CreateChild  = DNSClientDxeCreateChild;
+  Service->ServiceBinding.DestroyChild = DNSClientDxeDestroyChild;
+  Service->Engine.Revision             = DNSCLIENT_ENGINE_PROTOCOL_REVISION;
+  Service->Engine.Resolve              = DNSClientDxeEngineResolve;
+  Service->Engine.Poll                 = DNSClientDxeEnginePoll;
+  Service->Engine.Cancel               = DNSClientDxeEngineCancel;
+  Service->Private.Signature           = DNSCLIENT_PRIVATE_DATA_SIGNATURE;
+  Service->Private.Image               = ImageHandle;
+
+  InitializeListHead(&Service->Children);
+
+  Status = EfiCreateEventReadyToBootEx(TPL_CALLBACK, DNSClientDxeReadyToBoot, Service, &Service->ReadyToBoot);
+
+  if(EFI_ERROR(Status)) {
+    FreePool(Service);
+    return Status;
+  }
+
+  Status = gBS->InstallMultipleProtocolInterfaces(
+    &Service->Handle,
+    &gEfiDns4ServiceBindingProtocolGuid, &Service->ServiceBinding,
+    &gDnsClientEngineProtocolGuid, &Service->Engine,
+    NULL
+  );
+
+  if(EFI_ERROR(Status)) {
+    gBS->CloseEvent(Service->ReadyToBoot);
+    FreePool(Service);
+    return Status;
+  }
+
+  mService = Service;
+
+  return EFI_SUCCESS;
+} // End of DNSClientDxeEntry
+
+
+/**
+  Unloads the driver, saving the shared cache as DestroyDNSClient does.
+
+  @param[in] ImageHandle  The driver's image handle.
+
+  @retval EFI_SUCCESS            The driver has been unloaded.
+  @retval EFI_ACCESS_DENIED      Children are still open.
+  @retval other                  The protocols could not be uninstalled.
+  */
+EFI_STATUS EFIAPI DNSClientDxeUnload(IN EFI_HANDLE ImageHandle) {
+  EFI_STATUS              Status;
+  DNSCLIENT_DXE_SERVICE   *Service;
+
+  Service = mService;
+
+  if(Service == NULL) {
+    return EFI_SUCCESS;
+  }
+
+  if(Service->ChildCount != 0) {
+    return EFI_ACCESS_DENIED;
+  }
+
+  Status = gBS->UninstallMultipleProtocolInterfaces(
+    Service->Handle,
+    &gEfiDns4ServiceBindingProtocolGuid, &Service->ServiceBinding,
+    &gDnsClientEngineProtocolGuid, &Service->Engine,
+    NULL
+  );
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  gBS->CloseEvent(Service->ReadyToBoot);
+
+  if(Service->Started) {
+    DestroyDNSClient(&Service->Private);
+  }
+
+  SafeRelease(Service->Added);
+  FreePool(Service);
+
+  mService = NULL;
+
+  return EFI_SUCCESS;
+} // End of DNSClientDxeUnload
+
+
+/**
+  EFI_SERVICE_BINDING_PROTOCOL.CreateChild: installs a new EFI_DNS4_PROTOCOL.
+
+  @param[in]     This          The service binding.
+  @param[in/out] ChildHandle   Handle to install on, or NULL to have a new one created.
+
+  @retval EFI_SUCCESS            The child has been created.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.
+  */
+EFI_STATUS EFIAPI DNSClientDxeCreateChild(IN EFI_SERVICE_BINDING_PROTOCOL *This, IN OUT EFI_HANDLE *ChildHandle) {
+  EFI_STATUS               Status;
+  DNSCLIENT_DXE_SERVICE    *Service;
+  DNSCLIENT_DXE_INSTANCE   *Instance;
+
+  if(This == NULL || ChildHandle == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Service  = DNSCLIENT_DXE_SERVICE_FROM_BINDING(This);
+  Instance = AllocateZeroPool(sizeof(DNSCLIENT_DXE_INSTANCE));
+
+  if(Instance == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Instance->Signature = DNSCLIENT_DXE_INSTANCE_SIGNATURE;
+  Instance->Service   = Service;
+
+  InitializeListHead(&Instance->Requests);
+
+  CopyMem(&Instance->Dns4, &mDNSClientDxeDns4, sizeof(EFI_DNS4_PROTOCOL));
+
+  Status = gBS->InstallMultipleProtocolInterfaces(ChildHandle, &gEfiDns4ProtocolGuid, &Instance->Dns4, NULL);
+
+  if(EFI_ERROR(Status)) {
+    FreePool(Instance);
+    return Status;
+  }
+
+  Instance->Handle = *ChildHandle;
+
+  InsertTailList(&Service->Children, &Instance->Link);
+
+  ++(Service->ChildCount);
+
+  return EFI_SUCCESS;
+} // End of DNSClientDxeCreateChild
+
+
+/**
+  EFI_SERVICE_BINDING_PROTOCOL.DestroyChild: uninstalls and frees a child.
+
+  @param[in] This                The service binding.
+  @param[in] ChildHandle         Handle of the child.
+
+  @retval EFI_SUCCESS            The child has been destroyed.
+  @retval EFI_INVALID_PARAMETER  ChildHandle is NULL or belongs to another service.
+  @retval EFI_UNSUPPORTED        ChildHandle carries no EFI_DNS4_PROTOCOL.
+  @retval EFI_ACCESS_DENIED      Called above TPL_CALLBACK.
+  */
+EFI_STATUS EFIAPI DNSClientDxeDestroyChild(IN EFI_SERVICE_BINDING_PROTOCOL *This, IN EFI_HANDLE ChildHandle) {
+  EFI_STATUS               Status;
+  DNSCLIENT_DXE_SERVICE    *Service;
+  DNSCLIENT_DXE_INSTANCE   *Instance;
+  EFI_DNS4_PROTOCOL        *Dns4;
+
+  if(This == NULL || ChildHandle == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Service = DNSCLIENT_DXE_SERVICE_FROM_BINDING(This);
+
+  //
+  // The resolver's engine runs at TPL_CALLBACK.
+  //
+  if(EfiGetCurrentTpl() > TPL_CALLBACK) {
+    return EFI_ACCESS_DENIED;
+  }
+
+  Status = gBS->HandleProtocol(ChildHandle, &gEfiDns4ProtocolGuid, (VOID**) &Dns4);
+
+  if(EFI_ERROR(Status)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  Instance = DNSCLIENT_DXE_INSTANCE_FROM_DNS4(Dns4);
+
+  if(Instance->Service != Service) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = gBS->UninstallMultipleProtocolInterfaces(ChildHandle, &gEfiDns4ProtocolGuid, &Instance->Dns4, NULL);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  DNSClientDxeCancelRequests(Instance, NULL);
+
+  RemoveEntryList(&Instance->Link);
+
+  --(Service->ChildCount);
+
+  if(Instance->Configured && Instance->Config.DnsServerListCount != 0) {
+    Service->ServersChanged = TRUE;
+  }
+
+  SafeRelease(Instance->Servers);
+  FreePool(Instance);
+
+  DNSClientDxeSyncServers(Service);
+
+  return EFI_SUCCESS;
+} // End of DNSClientDxeDestroyChild
+
+
+/**
+  EFI_DNS4_PROTOCOL.GetModeData.  The server list is that of the shared
+  resolver.  The cache holds names in wire format only and is not listed,
+  DnsCacheCount is always 0.
+
+  @param[in]  This               The child.
+  @param[out] DnsModeData        Receives the mode data.  Both server lists are allocated and must be freed with FreePool.
+
+  @retval EFI_SUCCESS            DnsModeData has been filled in.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL.
+  @retval EFI_NOT_STARTED        The child has not been configured.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.
+  */
+EFI_STATUS EFIAPI DNSClientDxeGetModeData(IN EFI_DNS4_PROTOCOL *This, OUT EFI_DNS4_MODE_DATA *DnsModeData) {
+  DNSCLIENT_DXE_INSTANCE   *Instance;
+  DNSCLIENT_PRIVATE_DATA   *Private;
+  EFI_IPv4_ADDRESS         *Configured;
+  EFI_IPv4_ADDRESS         *Servers;
+  UINTN                    Count;
+  UINTN                    i;
+
+  if(This == NULL || DnsModeData == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Instance = DNSCLIENT_DXE_INSTANCE_FROM_DNS4(This);
+  Private  = &Instance->Service->Private;
+
+  if(!Instance->Configured) {
+    return EFI_NOT_STARTED;
+  }
+
+  Configured = NULL;
+  Servers    = NULL;
+  Count      = 0;
+
+  if(Instance->Config.DnsServerListCount != 0) {
+    Configured = AllocateCopyPool(Instance->Config.DnsServerListCount * sizeof(EFI_IPv4_ADDRESS), Instance->Servers);
+  }
+
+  for(i = 0; i < Private->ServerCount; ++i) {
+    if(!Private->Servers[i].IsIp6) {
+      ++Count;
+    }
+  }
+
+  if(Count != 0) {
+    Servers = AllocatePool(Count * sizeof(EFI_IPv4_ADDRESS));
+  }
+
+  if((Configured == NULL && Instance->Config.DnsServerListCount != 0) || (Servers == NULL && Count != 0)) {
+    SafeRelease(Configured);
+    SafeRelease(Servers);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  for(i = 0, Count = 0; i < Private->ServerCount; ++i) {
+    if(!Private->Servers[i].IsIp6) {
+      CopyMem(&Servers[Count++], &Private->Servers[i].Address.v4, sizeof(EFI_IPv4_ADDRESS));
+    }
+  }
+
+  CopyMem(&DnsModeData->DnsConfigData, &Instance->Config, sizeof(EFI_DNS4_CONFIG_DATA));
+
+  DnsModeData->DnsConfigData.DnsServerList = Configured;
+  DnsModeData->DnsServerCount              = (UINT32) Count;
+  DnsModeData->DnsServerList               = Servers;
+  DnsModeData->DnsCacheCount               = 0;
+  DnsModeData->DnsCacheList                = NULL;
+
+  return EFI_SUCCESS;
+} // End of DNSClientDxeGetModeData
+
+
+/**
+  EFI_DNS4_PROTOCOL.Configure.  Starts the shared resolver if it is not
+  running yet.  Servers in DnsServerList join its failover list behind those
+  handed out by DHCP, for every child, until this child is reset or
+  destroyed.  The list is only changed while the resolver has no lookups
+  running, so a change made during one takes effect once it has finished.
+  The station address, port and retry settings are not used, the resolver
+  works out its own.
+
+  @param[in] This                The child.
+  @param[in] DnsConfigData       The configuration, or NULL to reset the child and cancel its lookups.
+
+  @retval EFI_SUCCESS            The child is configured.
+  @retval EFI_INVALID_PARAMETER  This is NULL or DnsServerList is NULL while DnsServerListCount is not 0.
+  @retval EFI_ALREADY_STARTED    The child is configured already and has to be reset first.
+  @retval EFI_ACCESS_DENIED      Called above TPL_CALLBACK.
+  @retval EFI_NO_MAPPING         There is no network interface to start the resolver on.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.
+  */
+EFI_STATUS EFIAPI DNSClientDxeConfigure(IN EFI_DNS4_PROTOCOL *This, IN EFI_DNS4_CONFIG_DATA *DnsConfigData) {
+  EFI_STATUS               Status;
+  DNSCLIENT_DXE_INSTANCE   *Instance;
+  EFI_IPv4_ADDRESS         *Servers;
+
+  if(This == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Instance = DNSCLIENT_DXE_INSTANCE_FROM_DNS4(This);
+
+  //
+  // The resolver's engine runs at TPL_CALLBACK.
+  //
+  if(EfiGetCurrentTpl() > TPL_CALLBACK) {
+    return EFI_ACCESS_DENIED;
+  }
+
+  if(DnsConfigData == NULL) {
+    DNSClientDxeCancelRequests(Instance, NULL);
+
+    if(Instance->Configured && Instance->Config.DnsServerListCount != 0) {
+      Instance->Service->ServersChanged = TRUE;
+    }
+
+    SafeRelease(Instance->Servers);
+    ZeroMem(&Instance->Config, sizeof(EFI_DNS4_CONFIG_DATA));
+
+    Instance->Configured = FALSE;
+
+    DNSClientDxeSyncServers(Instance->Service);
+
+    return EFI_SUCCESS;
+  }
+
+  if(DnsConfigData->DnsServerListCount != 0 && DnsConfigData->DnsServerList == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if(Instance->Configured) {
+    return EFI_ALREADY_STARTED;
+  }
+
+  Status = DNSClientDxeStart(Instance->Service);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  Servers = NULL;
+
+  if(DnsConfigData->DnsServerListCount != 0) {
+    Servers = AllocateCopyPool(DnsConfigData->DnsServerListCount * sizeof(EFI_IPv4_ADDRESS), DnsConfigData->DnsServerList);
+
+    if(Servers == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+  }
+
+  CopyMem(&Instance->Config, DnsConfigData, sizeof(EFI_DNS4_CONFIG_DATA));
+
+  Instance->Config.DnsServerList = Servers;
+  Instance->Servers              = Servers;
+  Instance->Configured           = TRUE;
+
+  if(Instance->Config.DnsServerListCount != 0) {
+    Instance->Service->ServersChanged = TRUE;
+
+    DNSClientDxeSyncServers(Instance->Service);
+  }
+
+  return EFI_SUCCESS;
+} // End of DNSClientDxeConfigure
+
+
+/**
+  EFI_DNS4_PROTOCOL.HostNameToIp.  The lookup is started on the shared
+  resolver and this returns straight away.  Token->Event is signaled once
+  it has completed, which may be before this returns when the name is in
+  the hosts file or the cache.
+
+  @param[in] This                The child.
+  @param[in] HostName            Name to look up.
+  @param[in] Token               Receives the status and, on success, an H2AData whose IpList and itself must be freed with FreePool.
+
+  @retval EFI_SUCCESS            The lookup has been started.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL, Token->Event is NULL or HostName is empty or too long.
+  @retval EFI_NOT_STARTED        The child has not been configured.
+  @retval EFI_ACCESS_DENIED      Called above TPL_CALLBACK.
+  @retval EFI_ALREADY_STARTED    Token is already in use by a lookup of this child.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.
+  */
+EFI_STATUS EFIAPI DNSClientDxeHostNameToIp(IN EFI_DNS4_PROTOCOL *This, IN CHAR16 *HostName, IN EFI_DNS4_COMPLETION_TOKEN *Token) {
+  EFI_STATUS               Status;
+  DNSCLIENT_DXE_INSTANCE   *Instance;
+  DNSCLIENT_DXE_REQUEST    *Request;
+  LIST_ENTRY               *Link;
+
+  if(This == NULL || HostName == NULL || Token == NULL || Token->Event == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Instance = DNSCLIENT_DXE_INSTANCE_FROM_DNS4(This);
+
+  if(!Instance->Configured) {
+    return EFI_NOT_STARTED;
+  }
+
+  //
+  // The resolver's engine runs at TPL_CALLBACK.
+  //
+  if(EfiGetCurrentTpl() > TPL_CALLBACK) {
+    return EFI_ACCESS_DENIED;
+  }
+
+  for(Link = GetFirstNode(&Instance->Requests); !IsNull(&Instance->Requests, Link); Link = GetNextNode(&Instance->Requests, Link)) {
+    if(DNSCLIENT_DXE_REQUEST_FROM_LINK(Link)->Token == Token) {
+      return EFI_ALREADY_STARTED;
+    }
+  }
+
+  Request = AllocateZeroPool(sizeof(DNSCLIENT_DXE_REQUEST));
+
+  if(Request == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status = DNSClientDxeToAscii(HostName, Request->Name);
+
+  if(EFI_ERROR(Status)) {
+    FreePool(Request);
+    return Status;
+  }
+
+  Status = gBS->CreateEvent(EVT_NOTIFY_SIGNAL, TPL_CALLBACK, DNSClientDxeRequestDone, Request, &Request->Resolve.Event);
+
+  if(EFI_ERROR(Status)) {
+    FreePool(Request);
+    return Status;
+  }
+
+  Request->Signature           = DNSCLIENT_DXE_REQUEST_SIGNATURE;
+  Request->Instance            = Instance;
+  Request->Token               = Token;
+  Request->Lookup.Hostname     = Request->Name;
+  Request->Lookup.QType        = 1;
+  Request->Lookup.Addresses    = Request->Addresses;
+  Request->Lookup.MaxAddresses = DNSCLIENT_DXE_MAX_ADDRESSES;
+  Request->Resolve.Lookups     = &Request->Lookup;
+  Request->Resolve.Count       = 1;
+
+  Token->Status          = EFI_NOT_READY;
+  Token->RspData.H2AData = NULL;
+
+  //
+  // A change to the servers held back by an earlier lookup is made before
+  // this one starts, should the resolver have gone idle in between.
+  //
+  DNSClientDxeSyncServers(Instance->Service);
+
+  //
+  // The request is on the list before it can complete.
+  //
+  InsertTailList(&Instance->Requests, &Request->Link);
+
+  Status = ResolveDNSLookupsAsync(&Instance->Service->Private, &Request->Resolve);
+
+  if(EFI_ERROR(Status)) {
+    RemoveEntryList(&Request->Link);
+    gBS->CloseEvent(Request->Resolve.Event);
+    FreePool(Request);
+  }
+
+  return Status;
+} // End of DNSClientDxeHostNameToIp
+
+
+/**
+  EFI_DNS4_PROTOCOL.IpToHostName.  Not supported.
+
+  @retval EFI_UNSUPPORTED        Always.
+  */
+EFI_STATUS EFIAPI DNSClientDxeIpToHostName(IN EFI_DNS4_PROTOCOL *This, IN EFI_IPv4_ADDRESS IpAddress, IN EFI_DNS4_COMPLETION_TOKEN *Token) {
+  return EFI_UNSUPPORTED;
+} // End of DNSClientDxeIpToHostName
+
+
+/**
+  EFI_DNS4_PROTOCOL.GeneralLookUp.  Not supported.
+
+  @retval EFI_UNSUPPORTED        Always.
+  */
+EFI_STATUS EFIAPI DNSClientDxeGeneralLookUp(IN EFI_DNS4_PROTOCOL *This, IN CHAR8 *QName, IN UINT16 QType, IN UINT16 QClass, IN EFI_DNS4_COMPLETION_TOKEN *Token) {
+  return EFI_UNSUPPORTED;
+} // End of DNSClientDxeGeneralLookUp
+
+
+/**
+  EFI_DNS4_PROTOCOL.UpdateDnsCache.  Adds or removes the A records of a
+  name in the shared cache.  An added entry holds the one address given and
+  replaces every address the name had.
+
+  @param[in] This                The child.
+  @param[in] DeleteFlag          TRUE removes the name, FALSE adds it.
+  @param[in] Override            TRUE lets an added entry replace one which is already cached.
+  @param[in] DnsCacheEntry       The name, address and time to live (seconds).
+
+  @retval EFI_SUCCESS            The cache has been updated.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL or the name cannot be encoded.
+  @retval EFI_ACCESS_DENIED      The name is cached and Override is FALSE, or called above TPL_CALLBACK.
+  @retval EFI_NOT_FOUND          DeleteFlag is TRUE and the name is not cached.
+  @retval other                  The resolver could not be started or the entry could not be cached.
+  */
+EFI_STATUS EFIAPI DNSClientDxeUpdateDnsCache(IN EFI_DNS4_PROTOCOL *This, IN BOOLEAN DeleteFlag, IN BOOLEAN Override, IN EFI_DNS4_CACHE_ENTRY DnsCacheEntry) {
+  EFI_STATUS               Status;
+  EFI_TPL                  OldTpl;
+  DNSCLIENT_DXE_INSTANCE   *Instance;
+  DNS_CACHE                *Cache;
+  CHAR8                    Name[DNS_MAX_NAME_LENGTH + 1];
+  UINT8                    WireName[DNS_MAX_NAME_LENGTH];
+  UINTN                    WireLength;
+  UINT64                   Now;
+
+  if(This == NULL || DnsCacheEntry.HostName == NULL || DnsCacheEntry.IpAddress == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Instance = DNSCLIENT_DXE_INSTANCE_FROM_DNS4(This);
+
+  //
+  // The resolver's engine runs at TPL_CALLBACK.
+  //
+  if(EfiGetCurrentTpl() > TPL_CALLBACK) {
+    return EFI_ACCESS_DENIED;
+  }
+
+  Status = DNSClientDxeToAscii(DnsCacheEntry.HostName, Name);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  Status = EncodeDNSName(Name, WireName, sizeof(WireName), &WireLength);
+
+  if(EFI_ERROR(Status)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = DNSClientDxeStart(Instance->Service);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  Cache = &Instance->Service->Private.Cache;
+
+  //
+  // The engine changes the cache from its notify function.
+  //
+  OldTpl = gBS->RaiseTPL(TPL_CALLBACK);
+  Now    = DNSImplGetTimeNs();
+
+  if(DeleteFlag) {
+    Status = DNSCacheDelete(Cache, WireName, WireLength, 1);
+  } else if(!Override && DNSCacheLookup(Cache, WireName, WireLength, 1, Now) != NULL) {
+    Status = EFI_ACCESS_DENIED;
+  } else {
+    Status = DNSCacheInsert(Cache, WireName, WireLength, 1, DnsCacheEntry.Timeout, DnsCacheEntry.IpAddress, sizeof(EFI_IPv4_ADDRESS), 1, Now);
+  }
+
+  gBS->RestoreTPL(OldTpl);
+
+  return Status;
+} // End of DNSClientDxeUpdateDnsCache
+
+
+/**
+  EFI_DNS4_PROTOCOL.Poll.  Polls the shared resolver's network children
+  and moves its lookups along.  Lookups make progress without it, this only
+  speeds them up.
+
+  @retval EFI_SUCCESS            The resolver has been polled.
+  @retval EFI_INVALID_PARAMETER  This is NULL.
+  @retval EFI_NOT_STARTED        The child has not been configured.
+  @retval EFI_ACCESS_DENIED      Called above TPL_CALLBACK.
+  */
+EFI_STATUS EFIAPI DNSClientDxePoll(IN EFI_DNS4_PROTOCOL *This) {
+  DNSCLIENT_DXE_INSTANCE   *Instance;
+
+  if(This == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Instance = DNSCLIENT_DXE_INSTANCE_FROM_DNS4(This);
+
+  if(!Instance->Configured) {
+    return EFI_NOT_STARTED;
+  }
+
+  //
+  // The resolver's engine runs at TPL_CALLBACK.
+  //
+  if(EfiGetCurrentTpl() > TPL_CALLBACK) {
+    return EFI_ACCESS_DENIED;
+  }
+
+  PollDNSClient(&Instance->Service->Private);
+
+  return EFI_SUCCESS;
+} // End of DNSClientDxePoll
+
+
+/**
+  EFI_DNS4_PROTOCOL.Cancel.  Each lookup stopped has its token signaled
+  with EFI_ABORTED.
+
+  @param[in] This                The child.
+  @param[in] Token               The lookup to stop, or NULL for every lookup of the child.
+
+  @retval EFI_SUCCESS            The lookups have been stopped.
+  @retval EFI_INVALID_PARAMETER  This is NULL.
+  @retval EFI_NOT_STARTED        The child has not been configured.
+  @retval EFI_NOT_FOUND          Token is not outstanding.
+  @retval EFI_ACCESS_DENIED      Called above TPL_CALLBACK.
+  */
+EFI_STATUS EFIAPI DNSClientDxeCancel(IN EFI_DNS4_PROTOCOL *This, IN EFI_DNS4_COMPLETION_TOKEN *Token) {
+  DNSCLIENT_DXE_INSTANCE   *Instance;
+
+  if(This == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Instance = DNSCLIENT_DXE_INSTANCE_FROM_DNS4(This);
+
+  if(!Instance->Configured) {
+    return EFI_NOT_STARTED;
+  }
+
+  //
+  // The resolver's engine runs at TPL_CALLBACK.
+  //
+  if(EfiGetCurrentTpl() > TPL_CALLBACK) {
+    return EFI_ACCESS_DENIED;
+  }
+
+  return DNSClientDxeCancelRequests(Instance, Token);
+} // End of DNSClientDxeCancel
+
+
+/**
+  DNSCLIENT_ENGINE_PROTOCOL.Resolve: starts a batch of lookups on the shared
+  resolver, starting it first if need be.
+
+  @param[in]      This           The engine protocol.
+  @param[in/out]  Token          The batch.
+
+  @retval EFI_SUCCESS            The batch has been started.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL.
+  @retval EFI_ACCESS_DENIED      Called above TPL_CALLBACK.
+  @retval EFI_NO_MAPPING         There is no network interface to start the resolver on.
+  */
+EFI_STATUS EFIAPI DNSClientDxeEngineResolve(IN DNSCLIENT_ENGINE_PROTOCOL *This, IN OUT DNS_RESOLVE_TOKEN *Token) {
+  EFI_STATUS               Status;
+  DNSCLIENT_DXE_SERVICE    *Service;
+
+  if(This == NULL || Token == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // The resolver's engine runs at TPL_CALLBACK.
+  //
+  if(EfiGetCurrentTpl() > TPL_CALLBACK) {
+    return EFI_ACCESS_DENIED;
+  }
+
+  Service = DNSCLIENT_DXE_SERVICE_FROM_ENGINE(This);
+
+  Status = DNSClientDxeStart(Service);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  return ResolveDNSLookupsAsync(&Service->Private, Token);
+} // End of DNSClientDxeEngineResolve
+
+
+/**
+  DNSCLIENT_ENGINE_PROTOCOL.Poll: polls the shared resolver.
+
+  @param[in] This                The engine protocol.
+
+  @retval EFI_SUCCESS            The resolver has been polled.
+  @retval EFI_INVALID_PARAMETER  This is NULL.
+  @retval EFI_ACCESS_DENIED      Called above TPL_CALLBACK.
+  @retval EFI_NOT_STARTED        Nothing is open to poll yet.
+  */
+EFI_STATUS EFIAPI DNSClientDxeEnginePoll(IN DNSCLIENT_ENGINE_PROTOCOL *This) {
+  EFI_STATUS               Status;
+  DNSCLIENT_DXE_SERVICE    *Service;
+
+  if(This == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // The resolver's engine runs at TPL_CALLBACK.
+  //
+  if(EfiGetCurrentTpl() > TPL_CALLBACK) {
+    return EFI_ACCESS_DENIED;
+  }
+
+  Service = DNSCLIENT_DXE_SERVICE_FROM_ENGINE(This);
+
+  if(!Service->Started) {
+    return EFI_NOT_STARTED;
+  }
+
+  Status = PollDNSClient(&Service->Private);
+
+  //
+  // A child may have changed the server list while the batch ran.
+  //
+  DNSClientDxeSyncServers(Service);
+
+  return Status;
+} // End of DNSClientDxeEnginePoll
+
+
+/**
+  DNSCLIENT_ENGINE_PROTOCOL.Cancel: stops a batch started with Resolve.
+
+  @param[in] This                The engine protocol.
+  @param[in] Token               The batch.
+
+  @retval EFI_SUCCESS            The batch has been stopped.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL.
+  @retval EFI_ACCESS_DENIED      Called above TPL_CALLBACK.
+  @retval EFI_NOT_FOUND          Token is not running.
+  */
+EFI_STATUS EFIAPI DNSClientDxeEngineCancel(IN DNSCLIENT_ENGINE_PROTOCOL *This, IN DNS_RESOLVE_TOKEN *Token) {
+  EFI_STATUS               Status;
+  DNSCLIENT_DXE_SERVICE    *Service;
+
+  if(This == NULL || Token == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // The resolver's engine runs at TPL_CALLBACK.
+  //
+  if(EfiGetCurrentTpl() > TPL_CALLBACK) {
+    return EFI_ACCESS_DENIED;
+  }
+
+  Service = DNSCLIENT_DXE_SERVICE_FROM_ENGINE(This);
+
+  if(!Service->Started) {
+    return EFI_NOT_FOUND;
+  }
+
+  Status = CancelDNSLookups(&Service->Private, Token);
+
+  DNSClientDxeSyncServers(Service);
+
+  return Status;
+} // End of DNSClientDxeEngineCancel
@@ -0,0 +1,298 @@
+/** @file DNSClientDxe.h
+  Resident form of the DNSClient.  The driver keeps one resolver (one
+  DNSCLIENT_PRIVATE_DATA) for the whole boot and installs
+  EFI_DNS4_SERVICE_BINDING_PROTOCOL in front of it.  Every EFI_DNS4_PROTOCOL
+  child looks names up on that resolver, so all of them share its answer
+  cache, its hosts table, its server list and round trip times, and its
+  Udp4/Udp6 children, which are created once rather than per consumer.
+
+  The service binding lives on a handle of its own rather than on every
+  network controller, as one resolver covers every interface.  The resolver
+  is started by the first child to be configured, or the first batch started
+  through DNSCLIENT_ENGINE_PROTOCOL, rather than when the driver is loaded,
+  as the network stack has usually not been connected by then.
+
+  The driver is normally never unloaded, so the cache is saved to
+  PcdDnsClientCacheFile at ReadyToBoot instead, by which time it holds
+  whatever the boot has looked up.
+
+  HostNameToIp only starts a lookup, on the resolver's event driven engine,
+  and the caller's token is signaled from there once it completes.  It may
+  be called at up to TPL_CALLBACK.  Only A lookups are offered; IpToHostName
+  and GeneralLookUp are unsupported.
+
+  Copyright (c) 2015, Caleb Bartholomew
+ */
+
+#ifndef __DNSClientDxe_h__
+#define __DNSClientDxe_h__
+
+#include "DNSClientImpl.h"
+
+#include <Protocol/Dns4.h>
+#include <Protocol/DnsClientEngine.h>
+
+#include <Library/UefiDriverEntryPoint.h>
+
+#define DNSCLIENT_DXE_SERVICE_SIGNATURE    SIGNATURE_32('D','N','S','d')
+#define DNSCLIENT_DXE_INSTANCE_SIGNATURE   SIGNATURE_32('D','N','S','i')
+#define DNSCLIENT_DXE_REQUEST_SIGNATURE    SIGNATURE_32('D','N','S','r')
+
+//
+// Most addresses HostNameToIp hands back for one name.
+//
+#define DNSCLIENT_DXE_MAX_ADDRESSES        16
+
+typedef struct _DNSCLIENT_DXE_SERVICE {
+  UINT32                         Signature;
+  EFI_HANDLE                     Handle;       // Carries ServiceBinding and Engine.
+  EFI_SERVICE_BINDING_PROTOCOL   ServiceBinding;
+  DNSCLIENT_ENGINE_PROTOCOL      Engine;
+
+  DNSCLIENT_PRIVATE_DATA         Private;      // The resolver every child shares.
+  BOOLEAN                        Started;      // CreateDNSClient has succeeded on Private.
+  EFI_EVENT                      ReadyToBoot;  // Saves the cache before a boot option is started.
+
+  LIST_ENTRY                     Children;     // DNSCLIENT_DXE_INSTANCE.Link
+  UINTN                          ChildCount;
+
+  EFI_IPv4_ADDRESS               *Added;       // Servers of the children's DnsServerLists, each added to Private once per child.
+  UINTN                          AddedCount;
+  BOOLEAN                        ServersChanged; // A child has been configured, reset or destroyed since Added was brought up to date.
+} DNSCLIENT_DXE_SERVICE;
+
+typedef struct _DNSCLIENT_DXE_INSTANCE {
+  UINT32                         Signature;
+  LIST_ENTRY                     Link;         // Link in DNSCLIENT_DXE_SERVICE.Children.
+  EFI_HANDLE                     Handle;
+  EFI_DNS4_PROTOCOL              Dns4;
+  DNSCLIENT_DXE_SERVICE          *Service;
+
+  BOOLEAN                        Configured;
+  EFI_DNS4_CONFIG_DATA           Config;       // As last configured.  DnsServerList points at Servers.
+  EFI_IPv4_ADDRESS               *Servers;
+
+  LIST_ENTRY                     Requests;     // DNSCLIENT_DXE_REQUEST.Link
+} DNSCLIENT_DXE_INSTANCE;
+
+//
+// A HostNameToIp lookup which has not been handed back yet.
+//
+typedef struct _DNSCLIENT_DXE_REQUEST {
+  UINT32                         Signature;
+  LIST_ENTRY                     Link;         // Link in DNSCLIENT_DXE_INSTANCE.Requests.
+  DNSCLIENT_DXE_INSTANCE         *Instance;
+  EFI_DNS4_COMPLETION_TOKEN      *Token;       // The caller's.
+
+  DNS_RESOLVE_TOKEN              Resolve;      // Running on the shared resolver.  Its Event finishes the request.
+  DNS_LOOKUP                     Lookup;
+  CHAR8                          Name[DNS_MAX_NAME_LENGTH + 1];
+  EFI_IPv4_ADDRESS               Addresses[DNSCLIENT_DXE_MAX_ADDRESSES];
+} DNSCLIENT_DXE_REQUEST;
+
+#define DNSCLIENT_DXE_SERVICE_FROM_BINDING(a)  CR(a, DNSCLIENT_DXE_SERVICE, ServiceBinding, DNSCLIENT_DXE_SERVICE_SIGNATURE)
+#define DNSCLIENT_DXE_SERVICE_FROM_ENGINE(a)   CR(a, DNSCLIENT_DXE_SERVICE, Engine, DNSCLIENT_DXE_SERVICE_SIGNATURE)
+#define DNSCLIENT_DXE_INSTANCE_FROM_DNS4(a)    CR(a, DNSCLIENT_DXE_INSTANCE, Dns4, DNSCLIENT_DXE_INSTANCE_SIGNATURE)
+#define DNSCLIENT_DXE_INSTANCE_FROM_LINK(a)    CR(a, DNSCLIENT_DXE_INSTANCE, Link, DNSCLIENT_DXE_INSTANCE_SIGNATURE)
+#define DNSCLIENT_DXE_REQUEST_FROM_LINK(a)     CR(a, DNSCLIENT_DXE_REQUEST, Link, DNSCLIENT_DXE_REQUEST_SIGNATURE)
+
+/**
+  Entry point of the driver.  Installs the service binding and the engine
+  protocol on a new handle.  The resolver itself is not started yet.
+
+  @param[in] ImageHandle  The firmware allocated handle for the EFI image.
+  @param[in] SystemTable  A pointer to the EFI System Table.
+
+  @retval EFI_SUCCESS            The protocols have been installed.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.
+  @retval other                  The protocols could not be installed.
+  */
+EFI_STATUS EFIAPI DNSClientDxeEntry(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE *SystemTable);
+
+/**
+  Unloads the driver, saving the shared cache as DestroyDNSClient does.
+
+  @param[in] ImageHandle  The driver's image handle.
+
+  @retval EFI_SUCCESS            The driver has been unloaded.
+  @retval EFI_ACCESS_DENIED      Children are still open.
+  @retval other                  The protocols could not be uninstalled.
+  */
+EFI_STATUS EFIAPI DNSClientDxeUnload(IN EFI_HANDLE ImageHandle);
+
+/**
+  EFI_SERVICE_BINDING_PROTOCOL.CreateChild: installs a new EFI_DNS4_PROTOCOL.
+
+  @param[in]     This          The service binding.
+  @param[in/out] ChildHandle   Handle to install on, or NULL to have a new one created.
+
+  @retval EFI_SUCCESS            The child has been created.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.
+  */
+EFI_STATUS EFIAPI DNSClientDxeCreateChild(IN EFI_SERVICE_BINDING_PROTOCOL *This, IN OUT EFI_HANDLE *ChildHandle);
+
+/**
+  EFI_SERVICE_BINDING_PROTOCOL.DestroyChild: uninstalls and frees a child.
+
+  @param[in] This                The service binding.
+  @param[in] ChildHandle         Handle of the child.
+
+  @retval EFI_SUCCESS            The child has been destroyed.
+  @retval EFI_INVALID_PARAMETER  ChildHandle is NULL or belongs to another service.
+  @retval EFI_UNSUPPORTED        ChildHandle carries no EFI_DNS4_PROTOCOL.
+  @retval EFI_ACCESS_DENIED      Called above TPL_CALLBACK.
+  */
+EFI_STATUS EFIAPI DNSClientDxeDestroyChild(IN EFI_SERVICE_BINDING_PROTOCOL *This, IN EFI_HANDLE ChildHandle);
+
+/**
+  EFI_DNS4_PROTOCOL.GetModeData.  The server list is that of the shared
+  resolver.  The cache holds names in wire format only and is not listed,
+  DnsCacheCount is always 0.
+
+  @param[in]  This               The child.
+  @param[out] DnsModeData        Receives the mode data.  Both server lists are allocated and must be freed with FreePool.
+
+  @retval EFI_SUCCESS            DnsModeData has been filled in.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL.
+  @retval EFI_NOT_STARTED        The child has not been configured.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.
+  */
+EFI_STATUS EFIAPI DNSClientDxeGetModeData(IN EFI_DNS4_PROTOCOL *This, OUT EFI_DNS4_MODE_DATA *DnsModeData);
+
+/**
+  EFI_DNS4_PROTOCOL.Configure.  Starts the shared resolver if it is not
+  running yet.  Servers in DnsServerList join its failover list behind those
+  handed out by DHCP, for every child, until this child is reset or
+  destroyed.  The list is only changed while the resolver has no lookups
+  running, so a change made during one takes effect once it has finished.
+  The station address, port and retry settings are not used, the resolver
+  works out its own.
+
+  @param[in] This                The child.
+  @param[in] DnsConfigData       The configuration, or NULL to reset the child and cancel its lookups.
+
+  @retval EFI_SUCCESS            The child is configured.
+  @retval EFI_INVALID_PARAMETER  This is NULL or DnsServerList is NULL while DnsServerListCount is not 0.
+  @retval EFI_ALREADY_STARTED    The child is configured already and has to be reset first.
+  @retval EFI_ACCESS_DENIED      Called above TPL_CALLBACK.
+  @retval EFI_NO_MAPPING         There is no network interface to start the resolver on.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.
+  */
+EFI_STATUS EFIAPI DNSClientDxeConfigure(IN EFI_DNS4_PROTOCOL *This, IN EFI_DNS4_CONFIG_DATA *DnsConfigData);
+
+/**
+  EFI_DNS4_PROTOCOL.HostNameToIp.  Starts the lookup on the shared resolver
+  and returns.  Token->Event is signaled once it has completed, possibly
+  before this returns.
+
+  @param[in] This                The child.
+  @param[in] HostName            Name to look up.
+  @param[in] Token               Receives the status and, on success, an H2AData whose IpList and itself must be freed with FreePool.
+
+  @retval EFI_SUCCESS            The lookup has been started.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL, Token->Event is NULL or HostName is empty or too long.
+  @retval EFI_NOT_STARTED        The child has not been configured.
+  @retval EFI_ACCESS_DENIED      Called above TPL_CALLBACK.
+  @retval EFI_ALREADY_STARTED    Token is already in use by a lookup of this child.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.
+  */
+EFI_STATUS EFIAPI DNSClientDxeHostNameToIp(IN EFI_DNS4_PROTOCOL *This, IN CHAR16 *HostName, IN EFI_DNS4_COMPLETION_TOKEN *Token);
+
+/**
+  EFI_DNS4_PROTOCOL.IpToHostName.  Not supported.
+
+  @retval EFI_UNSUPPORTED        Always.
+  */
+EFI_STATUS EFIAPI DNSClientDxeIpToHostName(IN EFI_DNS4_PROTOCOL *This, IN EFI_IPv4_ADDRESS IpAddress, IN EFI_DNS4_COMPLETION_TOKEN *Token);
+
+/**
+  EFI_DNS4_PROTOCOL.GeneralLookUp.  Not supported.
+
+  @retval EFI_UNSUPPORTED        Always.
+  */
+EFI_STATUS EFIAPI DNSClientDxeGeneralLookUp(IN EFI_DNS4_PROTOCOL *This, IN CHAR8 *QName, IN UINT16 QType, IN UINT16 QClass, IN EFI_DNS4_COMPLETION_TOKEN *Token);
+
+/**
+  EFI_DNS4_PROTOCOL.UpdateDnsCache.  Adds or removes the A records of a
+  name in the shared cache.  An added entry holds the one address given and
+  replaces every address the name had.
+
+  @param[in] This                The child.
+  @param[in] DeleteFlag          TRUE removes the name, FALSE adds it.
+  @param[in] Override            TRUE lets an added entry replace one which is already cached.
+  @param[in] DnsCacheEntry       The name, address and time to live (seconds).
+
+  @retval EFI_SUCCESS            The cache has been updated.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL or the name cannot be encoded.
+  @retval EFI_ACCESS_DENIED      The name is cached and Override is FALSE, or called above TPL_CALLBACK.
+  @retval EFI_NOT_FOUND          DeleteFlag is TRUE and the name is not cached.
+  @retval other                  The resolver could not be started or the entry could not be cached.
+  */
+EFI_STATUS EFIAPI DNSClientDxeUpdateDnsCache(IN EFI_DNS4_PROTOCOL *This, IN BOOLEAN DeleteFlag, IN BOOLEAN Override, IN EFI_DNS4_CACHE_ENTRY DnsCacheEntry);
+
+/**
+  EFI_DNS4_PROTOCOL.Poll.  Polls the shared resolver's network children
+  and moves its lookups along.
+
+  @retval EFI_SUCCESS            The resolver has been polled.
+  @retval EFI_INVALID_PARAMETER  This is NULL.
+  @retval EFI_NOT_STARTED        The child has not been configured.
+  @retval EFI_ACCESS_DENIED      Called above TPL_CALLBACK.
+  */
+EFI_STATUS EFIAPI DNSClientDxePoll(IN EFI_DNS4_PROTOCOL *This);
+
+/**
+  EFI_DNS4_PROTOCOL.Cancel.  Stops a lookup, or all of the child's, and
+  signals their tokens with EFI_ABORTED.
+
+  @param[in] This                The child.
+  @param[in] Token               The lookup to stop, or NULL for every lookup of the child.
+
+  @retval EFI_SUCCESS            The lookups have been stopped.
+  @retval EFI_INVALID_PARAMETER  This is NULL.
+  @retval EFI_NOT_STARTED        The child has not been configured.
+  @retval EFI_NOT_FOUND          Token is not outstanding.
+  @retval EFI_ACCESS_DENIED      Called above TPL_CALLBACK.
+  */
+EFI_STATUS EFIAPI DNSClientDxeCancel(IN EFI_DNS4_PROTOCOL *This, IN EFI_DNS4_COMPLETION_TOKEN *Token);
+
+/**
+  DNSCLIENT_ENGINE_PROTOCOL.Resolve: starts a batch of lookups on the shared
+  resolver, starting it first if need be.
+
+  @param[in]      This           The engine protocol.
+  @param[in/out]  Token          The batch.
+
+  @retval EFI_SUCCESS            The batch has been started.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL.
+  @retval EFI_ACCESS_DENIED      Called above TPL_CALLBACK.
+  @retval EFI_NO_MAPPING         There is no network interface to start the resolver on.
+  */
+EFI_STATUS EFIAPI DNSClientDxeEngineResolve(IN DNSCLIENT_ENGINE_PROTOCOL *This, IN OUT DNS_RESOLVE_TOKEN *Token);
+
+/**
+  DNSCLIENT_ENGINE_PROTOCOL.Poll: polls the shared resolver.
+
+  @param[in] This                The engine protocol.
+
+  @retval EFI_SUCCESS            The resolver has been polled.
+  @retval EFI_INVALID_PARAMETER  This is NULL.
+  @retval EFI_ACCESS_DENIED      Called above TPL_CALLBACK.
+  @retval EFI_NOT_STARTED        Nothing is open to poll yet.
+  */
+EFI_STATUS EFIAPI DNSClientDxeEnginePoll(IN DNSCLIENT_ENGINE_PROTOCOL *This);
+
+/**
+  DNSCLIENT_ENGINE_PROTOCOL.Cancel: stops a batch started with Resolve.
+
+  @param[in] This                The engine protocol.
+  @param[in] Token               The batch.
+
+  @retval EFI_SUCCESS            The batch has been stopped.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL.
+  @retval EFI_ACCESS_DENIED      Called above TPL_CALLBACK.
+  @retval EFI_NOT_FOUND          Token is not running.
+  */
+EFI_STATUS EFIAPI DNSClientDxeEngineCancel(IN DNSCLIENT_ENGINE_PROTOCOL *This, IN DNS_RESOLVE_TOKEN *Token);
+#endif
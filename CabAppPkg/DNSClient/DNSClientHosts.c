@@ -0,0 +1,564 @@
+#include "DNSClientHosts.h"
+
+//
+// Longest dotted name (without a trailing dot) the table accepts.
+//
+#define DNS_HOSTS_MAX_NAME   253
+
+/**
+  Lower cases a single ASCII character.
+ */
+#define DNSHostsToLower(c)   ((((c) >= 'A') && ((c) <= 'Z')) ? ((c) + ('a' - 'A')) : (c))
+
+/**
+  Separates the fields of a line.
+ */
+#define DNSHostsIsBlank(c)   ((c) == ' ' || (c) == '\t' || (c) == '\r')
+
+/**
+  Size of an address of the given QTYPE.
+ */
+#define DNSHostsAddressSize(QType)   (((QType) == 28) ? sizeof(EFI_IPv6_ADDRESS) : sizeof(EFI_IPv4_ADDRESS))
+
+/**
+  Hashes a dotted name (case insensitive) and QTYPE with FNV-1a, the same way
+  the answer cache hashes its keys.
+
+  @param[in] Name        Dotted name.
+  @param[in] NameLength  Length of Name in bytes.
+  @param[in] QType       The QTYPE.
+
+  @retval UINT32         The hash.
+  */
+STATIC UINT32 DNSHostsHash(CONST CHAR8 *Name, UINTN NameLength, UINT16 QType) {
+  UINT32  Hash;
+  UINTN   i;
+
+  Hash = 2166136261U;
+
+  for(i = 0; i < NameLength; ++i) {
+    Hash ^= (UINT8) DNSHostsToLower(Name[i]);
+    Hash *= 16777619U;
+  }
+
+  Hash ^= QType;
+  Hash *= 16777619U;
+
+  return Hash;
+} // End of DNSHostsHash
+
+
+/**
+  Finds the slot of a name, or the empty slot it would go in.  The table must
+  have at least one empty slot.
+
+  @retval DNS_HOSTS_SLOT*  The slot holding the name, or an empty slot (Count is 0).
+  */
+STATIC DNS_HOSTS_SLOT* DNSHostsFind(DNS_HOSTS *Hosts, CONST CHAR8 *Name, UINTN NameLength, UINT16 QType, UINT32 Hash) {
+  DNS_HOSTS_SLOT   *Slot;
+  CONST CHAR8      *Stored;
+  UINTN            Index;
+  UINTN            i;
+
+  for(Index = Hash & (Hosts->SlotCount - 1);; Index = (Index + 1) & (Hosts->SlotCount - 1)) {
+    Slot = &Hosts->Slots[Index];
+
+    if(Slot->Count == 0) {
+      return Slot;
+    }
+
+    if(Slot->Hash != Hash || Slot->QType != QType || Slot->NameLength != NameLength) {
+      continue;
+    }
+
+    //
+    // Stored names are already lower case.
+    //
+    Stored = Hosts->Names + Slot->Name;
+
+    for(i = 0; i < NameLength && Stored[i] == DNSHostsToLower(Name[i]); ++i);
+
+    if(i == NameLength) {
+      return Slot;
+    }
+  }
+} // End of DNSHostsFind
+
+
+/**
+  Doubles the number of slots (or allocates the first ones) and puts every
+  name back in its new place.  The stored hashes are reused, no name is hashed
+  again.
+
+  @retval EFI_SUCCESS            The table has grown.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.  The table is unchanged.
+  */
+STATIC EFI_STATUS DNSHostsGrow(DNS_HOSTS *Hosts) {
+  DNS_HOSTS_SLOT   *Old;
+  DNS_HOSTS_SLOT   *Slot;
+  UINTN            OldCount;
+  UINTN            Index;
+  UINTN            i;
+
+  Old      = Hosts->Slots;
+  OldCount = Hosts->SlotCount;
+
+  Hosts->SlotCount = (OldCount == 0) ? DNS_HOSTS_INITIAL_SLOTS : OldCount * 2;
+  Hosts->Slots     = AllocateZeroPool(Hosts->SlotCount * sizeof(DNS_HOSTS_SLOT));
+
+  if(Hosts->Slots == NULL) {
+    Hosts->Slots     = Old;
+    Hosts->SlotCount = OldCount;
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  for(i = 0; i < OldCount; ++i) {
+    if(Old[i].Count == 0) {
+      continue;
+    }
+
+    for(Index = Old[i].Hash & (Hosts->SlotCount - 1); Hosts->Slots[Index].Count != 0; Index = (Index + 1) & (Hosts->SlotCount - 1));
+
+    Slot = &Hosts->Slots[Index];
+
+    CopyMem(Slot, &Old[i], sizeof(DNS_HOSTS_SLOT));
+  }
+
+  if(Old != NULL) {
+    FreePool(Old);
+  }
+
+  return EFI_SUCCESS;
+} // End of DNSHostsGrow
+
+
+/**
+  Makes room for at least Needed more bytes at the end of a buffer, doubling
+  its size as often as it takes.
+
+  @param[in/out] Buffer   The buffer.  Replaced by a larger copy when it grows.
+  @param[in/out] Size     Allocated size of Buffer in bytes.
+  @param[in]     Used     Bytes of Buffer in use.
+  @param[in]     Needed   Bytes about to be added.
+  @param[in]     Initial  Size to start with when Buffer has not been allocated yet.
+
+  @retval EFI_SUCCESS            Buffer has room.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.  Buffer is unchanged.
+  */
+STATIC EFI_STATUS DNSHostsReserve(VOID **Buffer, UINTN *Size, UINTN Used, UINTN Needed, UINTN Initial) {
+  VOID    *Grown;
+  UINTN   NewSize;
+
+  if(Used + Needed <= *Size) {
+    return EFI_SUCCESS;
+  }
+
+  for(NewSize = MAX(*Size, Initial); NewSize < Used + Needed; NewSize *= 2);
+
+  Grown = ReallocatePool(*Size, NewSize, *Buffer);
+
+  if(Grown == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  *Buffer = Grown;
+  *Size   = NewSize;
+
+  return EFI_SUCCESS;
+} // End of DNSHostsReserve
+
+
+/**
+  Adds one address for a name.  An address already listed for the name is
+  not added again.
+
+  @param[in] Hosts       The table.
+  @param[in] Name        Dotted name, without a trailing dot.
+  @param[in] NameLength  Length of Name in bytes.
+  @param[in] QType       1 or 28, the family of Address.
+  @param[in] Address     The address.
+
+  @retval EFI_SUCCESS            The address is in the table.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.
+  */
+STATIC EFI_STATUS DNSHostsAdd(DNS_HOSTS *Hosts, CONST CHAR8 *Name, UINTN NameLength, UINT16 QType, EFI_IP_ADDRESS *Address) {
+  EFI_STATUS         Status;
+  DNS_HOSTS_SLOT     *Slot;
+  DNS_HOSTS_RECORD   *Record;
+  UINT32             Hash;
+  UINT32             Index;
+  UINTN              RecordsBytes;
+  UINTN              i;
+
+  //
+  // Keep the table at most three quarters full so probes stay short.
+  //
+  if((Hosts->Count + 1) * 4 > Hosts->SlotCount * 3) {
+    Status = DNSHostsGrow(Hosts);
+
+    if(EFI_ERROR(Status)) {
+      return Status;
+    }
+  }
+
+  Hash = DNSHostsHash(Name, NameLength, QType);
+  Slot = DNSHostsFind(Hosts, Name, NameLength, QType, Hash);
+
+  for(Index = (Slot->Count == 0) ? DNS_HOSTS_NO_RECORD : Slot->First; Index != DNS_HOSTS_NO_RECORD; Index = Hosts->Records[Index].Next) {
+    if(CompareMem(&Hosts->Records[Index].Address, Address, DNSHostsAddressSize(QType)) == 0) {
+      return EFI_SUCCESS;
+    }
+  }
+
+  RecordsBytes = Hosts->RecordsSize * sizeof(DNS_HOSTS_RECORD);
+
+  Status = DNSHostsReserve((VOID**) &Hosts->Records, &RecordsBytes, Hosts->RecordCount * sizeof(DNS_HOSTS_RECORD), sizeof(DNS_HOSTS_RECORD), DNS_HOSTS_INITIAL_SLOTS * sizeof(DNS_HOSTS_RECORD));
+
+  Hosts->RecordsSize = RecordsBytes / sizeof(DNS_HOSTS_RECORD);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  if(Slot->Count == 0) {
+    Status = DNSHostsReserve((VOID**) &Hosts->Names, &Hosts->NamesSize, Hosts->NamesUsed, NameLength, DNS_HOSTS_CHUNK_SIZE);
+
+    if(EFI_ERROR(Status)) {
+      return Status;
+    }
+
+    for(i = 0; i < NameLength; ++i) {
+      Hosts->Names[Hosts->NamesUsed + i] = DNSHostsToLower(Name[i]);
+    }
+
+    Slot->Hash       = Hash;
+    Slot->Name       = (UINT32) Hosts->NamesUsed;
+    Slot->NameLength = (UINT16) NameLength;
+    Slot->QType      = QType;
+    Slot->First      = (UINT32) Hosts->RecordCount;
+
+    Hosts->NamesUsed += NameLength;
+    ++(Hosts->Count);
+  } else {
+    Hosts->Records[Slot->Last].Next = (UINT32) Hosts->RecordCount;
+  }
+
+  Record = &Hosts->Records[Hosts->RecordCount];
+
+  CopyMem(&Record->Address, Address, sizeof(EFI_IP_ADDRESS));
+  Record->Next = DNS_HOSTS_NO_RECORD;
+
+  Slot->Last = (UINT32) Hosts->RecordCount;
+  ++(Slot->Count);
+  ++(Hosts->RecordCount);
+
+  return EFI_SUCCESS;
+} // End of DNSHostsAdd
+
+
+/**
+  Parses one line of a hosts file and adds its names.  The line is split up
+  in place.
+
+  @param[in] Hosts       The table.
+  @param[in] Line        The line, without its line break.  Line[Length] must be writable.
+  @param[in] Length      Length of Line in bytes.
+
+  @retval EFI_SUCCESS            The line has been added, or was blank, a comment or malformed.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.
+  */
+STATIC EFI_STATUS DNSHostsParseLine(DNS_HOSTS *Hosts, CHAR8 *Line, UINTN Length) {
+  EFI_STATUS       Status;
+  EFI_IP_ADDRESS   Address;
+  UINT16           QType;
+  UINTN            Start;
+  UINTN            End;
+  UINTN            i;
+
+  ++(Hosts->Lines);
+
+  //
+  // Everything from a '#' on is a comment.
+  //
+  for(i = 0; i < Length && Line[i] != '#'; ++i);
+
+  Length = i;
+
+  for(Start = 0; Start < Length && DNSHostsIsBlank(Line[Start]); ++Start);
+
+  if(Start == Length) {
+    return EFI_SUCCESS;
+  }
+
+  for(End = Start; End < Length && !DNSHostsIsBlank(Line[End]); ++End);
+
+  Line[End] = '\0';
+
+  ZeroMem(&Address, sizeof(EFI_IP_ADDRESS));
+
+  if(!EFI_ERROR(NetLibAsciiStrToIp4(Line + Start, &Address.v4))) {
+    QType = 1;
+  } else if(!EFI_ERROR(NetLibAsciiStrToIp6(Line + Start, &Address.v6))) {
+    QType = 28;
+  } else {
+    ++(Hosts->Skipped);
+    return EFI_SUCCESS;
+  }
+
+  //
+  // Every remaining field is a name for the address.
+  //
+  for(Start = End + 1; Start < Length; Start = End + 1) {
+    for(; Start < Length && DNSHostsIsBlank(Line[Start]); ++Start);
+    for(End = Start; End < Length && !DNSHostsIsBlank(Line[End]); ++End);
+
+    i = End - Start;
+
+    if(i > 1 && Line[End - 1] == '.') {
+      --i;
+    }
+
+    if(i == 0 || i > DNS_HOSTS_MAX_NAME) {
+      continue;
+    }
+
+    Status = DNSHostsAdd(Hosts, Line + Start, i, QType, &Address);
+
+    if(EFI_ERROR(Status)) {
+      return Status;
+    }
+  }
+
+  return EFI_SUCCESS;
+} // End of DNSHostsParseLine
+
+
+/**
+  Initalizes an empty hosts table.
+
+  @param[in] Hosts         The table to initalize.
+  */
+VOID EFIAPI DNSHostsInit(DNS_HOSTS *Hosts) {
+  if(Hosts != NULL) {
+    ZeroMem(Hosts, sizeof(DNS_HOSTS));
+  }
+} // End of DNSHostsInit
+
+
+/**
+  Frees everything the table holds and leaves it empty.
+
+  @param[in] Hosts         The table to free.
+  */
+VOID EFIAPI DNSHostsFree(DNS_HOSTS *Hosts) {
+  if(Hosts == NULL) {
+    return;
+  }
+
+  if(Hosts->Slots != NULL) {
+    FreePool(Hosts->Slots);
+  }
+
+  if(Hosts->Names != NULL) {
+    FreePool(Hosts->Names);
+  }
+
+  if(Hosts->Records != NULL) {
+    FreePool(Hosts->Records);
+  }
+
+  DNSHostsInit(Hosts);
+} // End of DNSHostsFree
+
+
+/**
+  Reads a hosts format file into the table, adding to whatever it already
+  holds.  Lines which cannot be parsed are counted in Hosts->Skipped and
+  otherwise ignored.
+
+  The file is read DNS_HOSTS_CHUNK_SIZE bytes at a time.  Complete lines are
+  parsed straight out of the buffer and only the partial line at its end is
+  moved to the front before the next read, so each byte is looked at once.  A
+  UCS-2 file (as the shell's editor saves) is narrowed to ASCII as it is read.
+
+  @param[in] Hosts         The table to fill.
+  @param[in] File          The file, opened for reading.  Read from its current position to its end.
+
+  @retval EFI_SUCCESS            The whole file has been read.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.  The table holds the lines read so far.
+  @retval other                  Reading the file failed.  The table holds the lines read so far.
+  */
+EFI_STATUS EFIAPI DNSHostsLoad(DNS_HOSTS *Hosts, EFI_FILE_PROTOCOL *File) {
+  EFI_STATUS   Status;
+  CHAR8        *Buffer;
+  UINTN        Used;
+  UINTN        Size;
+  UINTN        Start;
+  UINTN        i;
+  BOOLEAN      Unicode;
+  BOOLEAN      First;
+  BOOLEAN      Overlong;
+
+  if(Hosts == NULL || File == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // One spare byte so the last line can always be terminated in place.
+  //
+  Buffer = AllocatePool(DNS_HOSTS_CHUNK_SIZE + 1);
+
+  if(Buffer == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status   = EFI_SUCCESS;
+  Used     = 0;
+  Unicode  = FALSE;
+  First    = TRUE;
+  Overlong = FALSE;
+
+  for(;;) {
+    //
+    // Always read an even number of bytes so UCS-2 characters never straddle
+    // two reads.
+    //
+    Size   = (DNS_HOSTS_CHUNK_SIZE - Used) & ~((UINTN) 1);
+    Status = File->Read(File, &Size, Buffer + Used);
+
+    if(EFI_ERROR(Status)) {
+      break;
+    }
+
+    if(First && Size >= 2 && (UINT8) Buffer[0] == 0xFF && (UINT8) Buffer[1] == 0xFE) {
+      Unicode = TRUE;
+    }
+
+    if(Unicode) {
+      for(i = 0; i < Size / 2; ++i) {
+        Buffer[Used + i] = (Buffer[Used + i * 2 + 1] == 0) ? Buffer[Used + i * 2] : '?';
+      }
+
+      Size /= 2;
+
+      //
+      // Drop the byte order mark.
+      //
+      if(First && Size != 0) {
+        CopyMem(Buffer + Used, Buffer + Used + 1, --Size);
+      }
+    }
+
+    First = FALSE;
+
+    //
+    // The end of the file ends the last line too.
+    //
+    if(Size == 0) {
+      if(Overlong) {
+        ++(Hosts->Lines);
+        ++(Hosts->Skipped);
+      } else if(Used != 0) {
+        Status = DNSHostsParseLine(Hosts, Buffer, Used);
+      }
+
+      break;
+    }
+
+    Start = 0;
+
+    for(i = Used; i < Used + Size; ++i) {
+      if(Buffer[i] != '\n') {
+        continue;
+      }
+
+      if(Overlong) {
+        ++(Hosts->Lines);
+        ++(Hosts->Skipped);
+        Overlong = FALSE;
+      } else {
+        Status = DNSHostsParseLine(Hosts, Buffer + Start, i - Start);
+
+        if(EFI_ERROR(Status)) {
+          break;
+        }
+      }
+
+      Start = i + 1;
+    }
+
+    if(EFI_ERROR(Status)) {
+      break;
+    }
+
+    Used += Size;
+
+    //
+    // A line filling the whole buffer is skipped up to its line break.  It
+    // has to be caught before there is no room left for another read, or the
+    // empty read would look like the end of the file.
+    //
+    if(Start == 0 && Used + 2 > DNS_HOSTS_CHUNK_SIZE) {
+      Overlong = TRUE;
+      Used     = 0;
+      continue;
+    }
+
+    Used -= Start;
+
+    CopyMem(Buffer, Buffer + Start, Used);
+  }
+
+  FreePool(Buffer);
+
+  return Status;
+} // End of DNSHostsLoad
+
+
+/**
+  Looks up the addresses listed for a name.
+
+  @param[in]  Hosts         The table to search.
+  @param[in]  Name          Dotted hostname, a trailing dot is ignored.
+  @param[in]  QType         1 for IPv4 addresses or 28 for IPv6 addresses.
+  @param[out] Addresses     Receives up to MaxAddresses EFI_IPv4_ADDRESS or EFI_IPv6_ADDRESS, as QType says.  May be NULL if MaxAddresses is 0.
+  @param[in]  MaxAddresses  Number of entries Addresses has room for.
+
+  @retval 0                The name is not listed with addresses of that type.
+  @retval other            Number of addresses listed for the name.  Only the first MaxAddresses are copied.
+  */
+UINTN EFIAPI DNSHostsLookup(DNS_HOSTS *Hosts, CONST CHAR8 *Name, UINT16 QType, VOID *Addresses, UINTN MaxAddresses) {
+  DNS_HOSTS_SLOT   *Slot;
+  UINTN            NameLength;
+  UINT32           Index;
+  UINTN            i;
+
+  if(Hosts == NULL || Name == NULL || Hosts->Count == 0) {
+    return 0;
+  }
+
+  NameLength = AsciiStrLen(Name);
+
+  if(NameLength > 1 && Name[NameLength - 1] == '.') {
+    --NameLength;
+  }
+
+  if(NameLength == 0 || NameLength > DNS_HOSTS_MAX_NAME) {
+    return 0;
+  }
+
+  Slot = DNSHostsFind(Hosts, Name, NameLength, QType, DNSHostsHash(Name, NameLength, QType));
+
+  if(Slot->Count == 0) {
+    ++(Hosts->Misses);
+    return 0;
+  }
+
+  ++(Hosts->Hits);
+
+  for(Index = Slot->First, i = 0; Index != DNS_HOSTS_NO_RECORD && i < MaxAddresses; Index = Hosts->Records[Index].Next, ++i) {
+    CopyMem((UINT8*) Addresses + i * DNSHostsAddressSize(QType), &Hosts->Records[Index].Address, DNSHostsAddressSize(QType));
+  }
+
+  return Slot->Count;
+} // End of DNSHostsLookup
@@ -0,0 +1,125 @@
+/** @file DNSClientHosts.h
+  Static hosts table used by the DNSClient ahead of any query on the wire.
+
+  The table is read from a hosts format file on the ESP (PcdDnsClientHostsFile,
+  \EFI\hosts by default): one address per line followed by the names it
+  belongs to, with anything after a '#' ignored.
+
+    10.0.0.5      deploy.lab deploy
+    fd00::5       deploy.lab
+
+  The file is streamed through a small fixed buffer in a single pass and every
+  (name, QTYPE) pair goes into an open-addressed hash table with linear
+  probing, so a lookup costs one hash and usually one compare however many
+  lines the file has.  Names are stored lower case and compared without regard
+  to case.  A name listed on several lines collects all of their addresses.
+
+  Copyright (c) 2015, Caleb Bartholomew
+ */
+
+#ifndef __DNSClientHosts_h__
+#define __DNSClientHosts_h__
+
+#include <Uefi.h>
+
+#include <Protocol/SimpleFileSystem.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/NetLib.h>
+
+//
+// Bytes read from the hosts file at a time.  Also bounds the length of a
+// line, longer lines are skipped.
+//
+#define DNS_HOSTS_CHUNK_SIZE             4096
+
+//
+// Slots the table starts with once the first name is added.  Must be a power
+// of two, the table doubles whenever it gets three quarters full.
+//
+#define DNS_HOSTS_INITIAL_SLOTS          256
+
+//
+// Index of no record, ends the address list of a slot.
+//
+#define DNS_HOSTS_NO_RECORD              MAX_UINT32
+
+typedef struct _DNS_HOSTS_SLOT {
+  UINT32                         Hash;
+  UINT32                         Name;        // Offset of the name in DNS_HOSTS.Names.
+  UINT16                         NameLength;
+  UINT16                         QType;       // 1 (A) or 28 (AAAA).
+  UINT32                         Count;       // Addresses of the name.  0 marks an empty slot.
+  UINT32                         First;       // Index of the first address in DNS_HOSTS.Records.
+  UINT32                         Last;
+} DNS_HOSTS_SLOT;
+
+typedef struct _DNS_HOSTS_RECORD {
+  EFI_IP_ADDRESS                 Address;
+  UINT32                         Next;        // Next address of the same slot, or DNS_HOSTS_NO_RECORD.
+} DNS_HOSTS_RECORD;
+
+typedef struct _DNS_HOSTS {
+  DNS_HOSTS_SLOT                 *Slots;
+  UINTN                          SlotCount;   // Power of two, or 0 while the table is empty.
+  UINTN                          Count;       // Slots in use.
+
+  CHAR8                          *Names;      // Lower case names, back to back without terminators.
+  UINTN                          NamesUsed;
+  UINTN                          NamesSize;
+
+  DNS_HOSTS_RECORD               *Records;
+  UINTN                          RecordCount;
+  UINTN                          RecordsSize; // Records allocated.
+
+  UINT64                         Lines;       // Lines read from the file, including comments.
+  UINT64                         Skipped;     // Lines which could not be parsed.
+  UINT64                         LoadTime;    // Time (ns) taken to read the file.
+  UINT64                         Hits;
+  UINT64                         Misses;
+} DNS_HOSTS;
+
+/**
+  Initalizes an empty hosts table.
+
+  @param[in] Hosts         The table to initalize.
+  */
+VOID EFIAPI DNSHostsInit(DNS_HOSTS *Hosts);
+
+/**
+  Frees everything the table holds and leaves it empty.
+
+  @param[in] Hosts         The table to free.
+  */
+VOID EFIAPI DNSHostsFree(DNS_HOSTS *Hosts);
+
+/**
+  Reads a hosts format file into the table, adding to whatever it already
+  holds.  Lines which cannot be parsed are counted in Hosts->Skipped and
+  otherwise ignored.
+
+  @param[in] Hosts         The table to fill.
+  @param[in] File          The file, opened for reading.  Read from its current position to its end.
+
+  @retval EFI_SUCCESS            The whole file has been read.
+  @retval EFI_OUT_OF_RESOURCES   Out of memory.  The table holds the lines read so far.
+  @retval other                  Reading the file failed.  The table holds the lines read so far.
+  */
+EFI_STATUS EFIAPI DNSHostsLoad(DNS_HOSTS *Hosts, EFI_FILE_PROTOCOL *File);
+
+/**
+  Looks up the addresses listed for a name.
+
+  @param[in]  Hosts         The table to search.
+  @param[in]  Name          Dotted hostname, a trailing dot is ignored.
+  @param[in]  QType         1 for IPv4 addresses or 28 for IPv6 addresses.
+  @param[out] Addresses     Receives up to MaxAddresses EFI_IPv4_ADDRESS or EFI_IPv6_ADDRESS, as QType says.  May be NULL if MaxAddresses is 0.
+  @param[in]  MaxAddresses  Number of entries Addresses has room for.
+
+  @retval 0                The name is not listed with addresses of that type.
+  @retval other            Number of addresses listed for the name.  Only the first MaxAddresses are copied.
+  */
+UINTN EFIAPI DNSHostsLookup(DNS_HOSTS *Hosts, CONST CHAR8 *Name, UINT16 QType, VOID *Addresses, UINTN MaxAddresses);
+#endif
@@ -1,330 +1,4505 @@
 #include "DNSClientImpl.h"
 
+/**
+  Lower cases a single ASCII character.
+ */
+#define DNSImplToLower(c)   ((((c) >= 'A') && ((c) <= 'Z')) ? ((c) + ('a' - 'A')) : (c))
+
+/**
+  Polls an interface's Udp4 or Udp6 child.
+
+  @param[in] Interface  The interface.
+  */
+STATIC VOID DNSImplUdpPoll(DNS_INTERFACE *Interface) {
+  if(Interface->IsIp6) {
+    Interface->Udp6->Poll(Interface->Udp6);
+  } else {
+    Interface->Udp4->Poll(Interface->Udp4);
+  }
+} // End of DNSImplUdpPoll
+
+
+/**
+  Cancels a transmit or receive posted on an interface's Udp4 or Udp6 child.
+
+  @param[in] Interface  The interface the token was posted on.
+  @param[in] Token      The token.
+  */
+STATIC VOID DNSImplUdpCancel(DNS_INTERFACE *Interface, DNS_UDP_TOKEN *Token) {
+  if(Interface->IsIp6) {
+    Interface->Udp6->Cancel(Interface->Udp6, &Token->Udp6);
+  } else {
+    Interface->Udp4->Cancel(Interface->Udp4, &Token->Udp4);
+  }
+} // End of DNSImplUdpCancel
+
+
+/**
+  Signaled when a transmit from the ring completes.  Frees the buffer for
+  reuse and closes its DNSCLIENT_PERF_TRANSMIT measurement.  If a query is
+  waiting on a buffer the engine is run to send it.
+
+  @param[in] Event     The transmit token's event.
+  @param[in] Context   The DNS_TX_BUFFER the transmit was made from.
+  */
+STATIC VOID EFIAPI DNSImplTransmitCallback(IN EFI_EVENT Event, IN VOID *Context) {
+  DNS_TX_BUFFER   *TxBuffer;
+
+  TxBuffer = (DNS_TX_BUFFER*) Context;
+
+  TxBuffer->IsDone = TRUE;
+
+  PERF_END(TxBuffer, DNSCLIENT_PERF_TRANSMIT, NULL, 0);
+
+  if(TxBuffer->Interface->Instance->TxWaiting) {
+    gBS->SignalEvent(TxBuffer->Interface->Instance->Engine);
+  }
+} // End of DNSImplTransmitCallback
+
+
+/**
+  Creates the events of the transmit ring.  Every buffer starts out free.
+
+  @param[in] Instance  The Private data to be used.
+
+  @retval EFI_SUCCESS  The ring is ready.
+  @retval other        An event could not be created.
+  */
+STATIC EFI_STATUS DNSImplCreateTxRing(DNSCLIENT_PRIVATE_DATA *Instance) {
+  EFI_STATUS      Status;
+  DNS_TX_BUFFER   *TxBuffer;
+  UINTN           i;
+
+  for(i = 0; i < DNSCLIENT_TX_RING_SIZE; ++i) {
+    TxBuffer = &Instance->TxRing[i];
+
+    ZeroMem(TxBuffer, sizeof(DNS_TX_BUFFER));
+
+    TxBuffer->IsDone = TRUE;
+
+    Status = gBS->CreateEvent(
+      EVT_NOTIFY_SIGNAL,
+      DNSCLIENT_TOKEN_TPL,
+      DNSImplTransmitCallback,
+      (VOID*) TxBuffer,
+      &TxBuffer->Token.Udp4.Event
+    );
+
+    if(EFI_ERROR(Status)) {
+      return Status;
+    }
+  }
+
+  Instance->TxNext = 0;
+
+  return EFI_SUCCESS;
+} // End of DNSImplCreateTxRing
+
+
+/**
+  Cancels any transmit still in flight and closes the events of the transmit ring.
+
+  @param[in] Instance  The Private data to be used.
+  */
+STATIC VOID DNSImplDestroyTxRing(DNSCLIENT_PRIVATE_DATA *Instance) {
+  DNS_TX_BUFFER   *TxBuffer;
+  UINTN           i;
+
+  for(i = 0; i < DNSCLIENT_TX_RING_SIZE; ++i) {
+    TxBuffer = &Instance->TxRing[i];
+
+    if(TxBuffer->Token.Udp4.Event == NULL) {
+      continue;
+    }
+
+    if(!TxBuffer->IsDone && TxBuffer->Interface != NULL) {
+      DNSImplUdpCancel(TxBuffer->Interface, &TxBuffer->Token);
+    }
+
+    gBS->CloseEvent(TxBuffer->Token.Udp4.Event);
+
+    TxBuffer->Token.Udp4.Event = NULL;
+    TxBuffer->IsDone      = TRUE;
+  }
+} // End of DNSImplDestroyTxRing
+
+
+/**
+  Starts a round trip time estimate off at PcdDnsClientInitialRto.
+
+  @param[in] Rtt       The estimate to initalize.
+  */
+STATIC VOID DNSImplInitRtt(DNS_RTT *Rtt) {
+  ZeroMem(Rtt, sizeof(DNS_RTT));
+
+  Rtt->Rto = MultU64x32(NS_PER_MS, PcdGet32(PcdDnsClientInitialRto));
+  Rtt->Rto = MAX(Rtt->Rto, DNSCLIENT_MIN_RTO_MS * NS_PER_MS);
+  Rtt->Rto = MIN(Rtt->Rto, DNSCLIENT_MAX_RTO_MS * NS_PER_MS);
+} // End of DNSImplInitRtt
+
+
+/**
+  Finds a server on the failover list by address.
+
+  @param[in] Instance  The Private data to be used.
+  @param[in] Address   The address to look for.
+  @param[in] IsIp6     TRUE if Address is an IPv6 address.
+
+  @retval DNSCLIENT_MAX_SERVERS  The address is not one of our servers.
+  @retval other                  Index of the server.
+  */
+STATIC UINTN DNSImplFindServer(DNSCLIENT_PRIVATE_DATA *Instance, EFI_IP_ADDRESS *Address, BOOLEAN IsIp6) {
+  DNS_SERVER   *Server;
+  UINTN        i;
+
+  for(i = 0; i < Instance->ServerCount; ++i) {
+    Server = &Instance->Servers[i];
+
+    if(Server->IsIp6 != IsIp6) {
+      continue;
+    }
+
+    if(IsIp6 ? EFI_IP6_EQUAL(&Server->Address.v6, &Address->v6) : EFI_IP4_EQUAL(&Server->Address.v4, &Address->v4)) {
+      return i;
+    }
+  }
+
+  return DNSCLIENT_MAX_SERVERS;
+} // End of DNSImplFindServer
+
+
+/**
+  Takes a server off the failover list.  The servers behind it move up one
+  place.
+
+  Must not be called while queries are pending, as it moves servers around.
+
+  @param[in] Instance    The Private data to be used.
+  @param[in] Index       The server's position on the list.
+  */
+STATIC VOID DNSImplRemoveServer(DNSCLIENT_PRIVATE_DATA *Instance, UINTN Index) {
+  --(Instance->ServerCount);
+
+  CopyMem(&Instance->Servers[Index], &Instance->Servers[Index + 1], sizeof(DNS_SERVER) * (Instance->ServerCount - Index));
+
+  if(Instance->ActiveServer == Index) {
+    Instance->ActiveServer = 0;
+  } else if(Instance->ActiveServer > Index) {
+    --(Instance->ActiveServer);
+  }
+} // End of DNSImplRemoveServer
+
+
+/**
+  Adds a server to the failover list.  Servers handed out by DHCP go after the
+  other DHCP servers but ahead of the fallback servers, and push the last
+  fallback server which AddDNSServer holds no reference on off a full list.
+  A server already on the list stays where it is, and is only marked as
+  listed in its own right.
+
+  Must not be called while queries are pending, as it moves servers around.
+
+  @param[in] Instance    The Private data to be used.
+  @param[in] Address     The server's address.
+  @param[in] IsIp6       TRUE if Address is an IPv6 address.
+  @param[in] Discovered  TRUE for a server handed out by DHCP.
+
+  @retval EFI_SUCCESS           The server is on the list.
+  @retval EFI_OUT_OF_RESOURCES  The list is full.
+  */
+STATIC EFI_STATUS DNSImplAddServer(DNSCLIENT_PRIVATE_DATA *Instance, EFI_IP_ADDRESS *Address, BOOLEAN IsIp6, BOOLEAN Discovered) {
+  DNS_SERVER   *Server;
+  UINTN        Position;
+
+  if(IsIp6) {
+    if(NetIp6IsUnspecifiedAddr(&Address->v6) || IP6_IS_MULTICAST(&Address->v6)) {
+      return EFI_SUCCESS;
+    }
+  } else if(Address->v4.Addr[0] == 0 || Address->v4.Addr[0] == 255) {
+    return EFI_SUCCESS;
+  }
+
+  Position = DNSImplFindServer(Instance, Address, IsIp6);
+
+  if(Position != DNSCLIENT_MAX_SERVERS) {
+    Instance->Servers[Position].Listed = TRUE;
+    return EFI_SUCCESS;
+  }
+
+  if(Instance->ServerCount == DNSCLIENT_MAX_SERVERS) {
+    if(!Discovered) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    //
+    // A server added with AddDNSServer stays until it is removed the same
+    // way, so only a fallback server nobody holds on to makes room.
+    //
+    for(Position = Instance->ServerCount; Position > 0; --Position) {
+      if(!Instance->Servers[Position - 1].Discovered && Instance->Servers[Position - 1].References == 0) {
+        break;
+      }
+    }
+
+    if(Position == 0) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    DNSImplRemoveServer(Instance, Position - 1);
+  }
+
+  Position = Instance->ServerCount;
+
+  if(Discovered) {
+    for(Position = 0; Position < Instance->ServerCount && Instance->Servers[Position].Discovered; ++Position);
+
+    CopyMem(&Instance->Servers[Position + 1], &Instance->Servers[Position], sizeof(DNS_SERVER) * (Instance->ServerCount - Position));
+
+    if(Instance->ActiveServer >= Position && Instance->ActiveServer < Instance->ServerCount) {
+      ++(Instance->ActiveServer);
+    }
+  }
+
+  ++(Instance->ServerCount);
+
+  Server = &Instance->Servers[Position];
+
+  ZeroMem(Server, sizeof(DNS_SERVER));
+  CopyMem(&Server->Address, Address, IsIp6 ? sizeof(EFI_IPv6_ADDRESS) : sizeof(EFI_IPv4_ADDRESS));
+
+  Server->IsIp6      = IsIp6;
+  Server->Discovered = Discovered;
+  Server->Listed     = TRUE;
+
+  DNSImplInitRtt(&Server->Rtt);
+
+  return EFI_SUCCESS;
+} // End of DNSImplAddServer
+
+
+/**
+  Adds the servers of PcdDnsClientFallbackServers, a list of IPv4 and IPv6
+  addresses separated by spaces or commas, to the end of the failover list.
+  Servers of an address family the client has no interface for are left out,
+  so failing over never wastes an attempt on them.
+
+  @param[in] Instance  The Private data to be used.
+  */
+STATIC VOID DNSImplAddFallbackServers(DNSCLIENT_PRIVATE_DATA *Instance) {
+  CONST CHAR16     *List;
+  CHAR16           Buffer[46];
+  EFI_IP_ADDRESS   Address;
+  BOOLEAN          HasIp4;
+  BOOLEAN          HasIp6;
+  UINTN            Length;
+  UINTN            i;
+
+  HasIp4 = FALSE;
+  HasIp6 = FALSE;
+
+  for(i = 0; i < Instance->InterfaceCount; ++i) {
+    if(Instance->Interfaces[i].IsIp6) {
+      HasIp6 = TRUE;
+    } else {
+      HasIp4 = TRUE;
+    }
+  }
+
+  List = (CONST CHAR16*) PcdGetPtr(PcdDnsClientFallbackServers);
+
+  while(*List != L'\0') {
+    if(*List == L' ' || *List == L',') {
+      ++List;
+      continue;
+    }
+
+    for(Length = 0; List[Length] != L'\0' && List[Length] != L' ' && List[Length] != L','; ++Length);
+
+    if(Length < ARRAY_SIZE(Buffer)) {
+      CopyMem(Buffer, List, Length * sizeof(CHAR16));
+      Buffer[Length] = L'\0';
+
+      ZeroMem(&Address, sizeof(EFI_IP_ADDRESS));
+
+      if(!EFI_ERROR(NetLibStrToIp4(Buffer, &Address.v4))) {
+        if(HasIp4) {
+          DNSImplAddServer(Instance, &Address, FALSE, FALSE);
+        }
+      } else if(!EFI_ERROR(NetLibStrToIp6(Buffer, &Address.v6))) {
+        if(HasIp6) {
+          DNSImplAddServer(Instance, &Address, TRUE, FALSE);
+        }
+      }
+    }
+
+    List += Length;
+  }
+} // End of DNSImplAddFallbackServers
+
+
+/**
+  Folds a round trip time sample into a retransmission timeout as described by
+  RFC 6298 section 2.
+
+  @param[in] Rtt       The estimate of the server or interface that answered.
+  @param[in] Sample    The measured round trip time in ns.
+  */
+STATIC VOID DNSImplSampleRtt(DNS_RTT *Rtt, UINT64 Sample) {
+  UINT64   Delta;
+
+  if(Rtt->Srtt == 0) {
+    Rtt->Srtt   = Sample;
+    Rtt->RttVar = Sample >> 1;
+  } else {
+    Delta = (Rtt->Srtt > Sample) ? (Rtt->Srtt - Sample) : (Sample - Rtt->Srtt);
+
+    Rtt->RttVar = Rtt->RttVar - (Rtt->RttVar >> 2) + (Delta >> 2);
+    Rtt->Srtt   = Rtt->Srtt   - (Rtt->Srtt   >> 3) + (Sample >> 3);
+  }
+
+  Rtt->Rto = Rtt->Srtt + (Rtt->RttVar << 2);
+  Rtt->Rto = MAX(Rtt->Rto, DNSCLIENT_MIN_RTO_MS * NS_PER_MS);
+  Rtt->Rto = MIN(Rtt->Rto, DNSCLIENT_MAX_RTO_MS * NS_PER_MS);
+} // End of DNSImplSampleRtt
+
+
+/**
+  Compares two round trip time estimates.  The lower retransmission timeout
+  wins, as it tracks both the measured round trip time and recent timeouts.
+  Timeouts clamped to DNSCLIENT_MIN_RTO_MS are told apart by the smoothed
+  round trip time, an unmeasured estimate losing.
+
+  @param[in] A         An estimate.
+  @param[in] B         Another estimate.
+
+  @retval TRUE         A is faster than B.
+  */
+STATIC BOOLEAN DNSImplFaster(DNS_RTT *A, DNS_RTT *B) {
+  if(A->Rto != B->Rto) {
+    return A->Rto < B->Rto;
+  }
+
+  return A->Srtt != 0 && (B->Srtt == 0 || A->Srtt < B->Srtt);
+} // End of DNSImplFaster
+
+
+/**
+  Backs a retransmission timeout off after a timeout, as RFC 6298 section 5.5
+  describes.
+
+  @param[in] Rtt       The estimate of the server or interface that did not answer.
+  */
+STATIC VOID DNSImplBackOffRtt(DNS_RTT *Rtt) {
+  Rtt->Rto = MIN(Rtt->Rto << 1, DNSCLIENT_MAX_RTO_MS * NS_PER_MS);
+} // End of DNSImplBackOffRtt
+
+
+/**
+  Counts a round trip time sample in a server's histogram.
+
+  @param[in] Server    The server which answered.
+  @param[in] Sample    The round trip time in nanoseconds.
+  */
+STATIC VOID DNSImplRecordRtt(DNS_SERVER *Server, UINT64 Sample) {
+  UINT64   Micro;
+  UINTN    Bucket;
+
+  Micro  = DivU64x32(Sample, 1000);
+  Bucket = 0;
+
+  if(Micro >> DNSCLIENT_RTT_BUCKET_SHIFT != 0) {
+    Bucket = (UINTN) HighBitSet64(Micro >> DNSCLIENT_RTT_BUCKET_SHIFT) + 1;
+  }
+
+  ++(Server->RttHistogram[MIN(Bucket, DNSCLIENT_RTT_BUCKETS - 1)]);
+} // End of DNSImplRecordRtt
+
+
+/**
+  Polls the Udp4, Udp6 and Tcp4 children until a completion flag is set or a timeout elapses.
+  The wait is bounded by the client's EVT_TIMER event rather than by counting
+  polls, so it does not depend on how fast the driver polls.
+
+  @param[in] Instance  The Private data to be used.
+  @param[in] IsDone    The flag set by the completion event.
+  @param[in] Timeout   Longest time to wait, in nanoseconds.
+
+  @retval EFI_SUCCESS  IsDone has been set.
+  @retval EFI_TIMEOUT  Timeout elapsed first.
+  @retval other        The timer could not be armed.
+  */
+STATIC EFI_STATUS DNSImplWaitFor(DNSCLIENT_PRIVATE_DATA *Instance, BOOLEAN *IsDone, UINT64 Timeout) {
+  EFI_STATUS   Status;
+  UINTN        i;
+
+  if(*IsDone) {
+    return EFI_SUCCESS;
+  }
+
+  //
+  // Clear a signal left over from an earlier wait before arming the timer.
+  // Timer periods are in 100ns units.
+  //
+  gBS->CheckEvent(Instance->Timer);
+
+  Status = gBS->SetTimer(Instance->Timer, TimerRelative, DivU64x32(Timeout, 100) + 1);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  Status = EFI_TIMEOUT;
+
+  while(!*IsDone) {
+    for(i = 0; i < Instance->InterfaceCount && !*IsDone; ++i) {
+      if(Instance->Interfaces[i].Started) {
+        DNSImplUdpPoll(&Instance->Interfaces[i]);
+      }
+    }
+
+    for(i = 0; i < DNSCLIENT_MAX_TCP_CONNECTIONS && !*IsDone; ++i) {
+      if(Instance->TcpConnections[i].Tcp4 != NULL) {
+        Instance->TcpConnections[i].Tcp4->Poll(Instance->TcpConnections[i].Tcp4);
+      }
+    }
+
+    if(gBS->CheckEvent(Instance->Timer) == EFI_SUCCESS) {
+      break;
+    }
+  }
+
+  gBS->SetTimer(Instance->Timer, TimerCancel, 0);
+
+  return *IsDone ? EFI_SUCCESS : Status;
+} // End of DNSImplWaitFor
+
+
+/**
+  Signaled when a receive posted on an interface completes.  Marks both the
+  slot and the client, so a wait can cover every interface at once, and has
+  the engine pick the datagram up.
+
+  @param[in] Event     The receive token's event.
+  @param[in] Context   The DNS_RX_SLOT the receive was posted from.
+  */
+STATIC VOID EFIAPI DNSImplReceiveCallback(IN EFI_EVENT Event, IN VOID *Context) {
+  DNS_RX_SLOT   *Slot;
+
+  Slot = (DNS_RX_SLOT*) Context;
+
+  Slot->Done                         = TRUE;
+  Slot->Interface->Instance->RxReady = TRUE;
+
+  gBS->SignalEvent(Slot->Interface->Instance->Engine);
+} // End of DNSImplReceiveCallback
+
+
+/**
+  Posts the receive of one slot of an interface's receive ring.  A slot gets
+  its event the first time it is posted, so a shallow ring costs no more
+  than it uses.
+
+  @param[in] Interface  The interface.
+  @param[in] Slot       A slot of its ring which is not posted.
+
+  @retval EFI_SUCCESS     The receive is posted.
+  @retval EFI_NO_MAPPING  The interface has lost its address.  It is marked unconfigured.
+  @retval other           The event could not be created, or as the Udp4 or Udp6 Receive returns.
+  */
+STATIC EFI_STATUS DNSImplPostReceive(DNS_INTERFACE *Interface, DNS_RX_SLOT *Slot) {
+  EFI_STATUS   Status;
+
+  if(Slot->Token.Udp4.Event == NULL) {
+    Slot->Interface = Interface;
+
+    Status = gBS->CreateEvent(
+      EVT_NOTIFY_SIGNAL,
+      DNSCLIENT_TOKEN_TPL,
+      DNSImplReceiveCallback,
+      (VOID*) Slot,
+      &Slot->Token.Udp4.Event
+    );
+
+    if(EFI_ERROR(Status)) {
+      return Status;
+    }
+  }
+
+  Slot->Done              = FALSE;
+  Slot->Token.Udp4.Status = EFI_SUCCESS;
+
+  if(Interface->IsIp6) {
+    Slot->Token.Udp6.Packet.RxData = NULL;
+
+    Status = Interface->Udp6->Receive(Interface->Udp6, &Slot->Token.Udp6);
+  } else {
+    Slot->Token.Udp4.Packet.RxData = NULL;
+
+    Status = Interface->Udp4->Receive(Interface->Udp4, &Slot->Token.Udp4);
+  }
+
+  if(Status == EFI_NO_MAPPING) {
+    Interface->Configured = FALSE;
+  }
+
+  Slot->Posted = !EFI_ERROR(Status);
+
+  return Status;
+} // End of DNSImplPostReceive
+
+
+/**
+  Hands the buffer of a completed receive back to the driver.
+
+  @param[in] Interface  The interface.
+  @param[in] Slot       A slot of its ring whose receive has completed.
+  */
+STATIC VOID DNSImplRecycleReceive(DNS_INTERFACE *Interface, DNS_RX_SLOT *Slot) {
+  if(EFI_ERROR(Slot->Token.Udp4.Status)) {
+    return;
+  }
+
+  if(Interface->IsIp6 && Slot->Token.Udp6.Packet.RxData != NULL) {
+    gBS->SignalEvent(Slot->Token.Udp6.Packet.RxData->RecycleSignal);
+  } else if(!Interface->IsIp6 && Slot->Token.Udp4.Packet.RxData != NULL) {
+    gBS->SignalEvent(Slot->Token.Udp4.Packet.RxData->RecycleSignal);
+  }
+} // End of DNSImplRecycleReceive
+
+
+/**
+  Closes the events the slots of an interface's receive ring were given.
+  Every receive must have been cancelled already.
+
+  @param[in] Interface  The interface.
+  */
+STATIC VOID DNSImplCloseRxRing(DNS_INTERFACE *Interface) {
+  UINTN   i;
+
+  for(i = 0; i < DNSCLIENT_MAX_RX_DEPTH; ++i) {
+    if(Interface->RxRing[i].Token.Udp4.Event != NULL) {
+      gBS->CloseEvent(Interface->RxRing[i].Token.Udp4.Event);
+      Interface->RxRing[i].Token.Udp4.Event = NULL;
+    }
+  }
+} // End of DNSImplCloseRxRing
+
+
+/**
+  Configures an interface's Udp4 or Udp6 child if that has not been done yet,
+  and checks whether it has an address.  The first Configure of an interface
+  still waiting on DHCP (or on IPv6 address autoconfiguration) returns
+  EFI_NO_MAPPING, in which case the driver is asked again here until the
+  address shows up.
+
+  @param[in] Interface  The interface.
+
+  @retval TRUE          Queries can be sent on the interface.
+  */
+STATIC BOOLEAN DNSImplRefreshInterface(DNS_INTERFACE *Interface) {
+  EFI_STATUS          Status;
+  EFI_IP4_MODE_DATA   Ip4ModeData;
+  EFI_IP6_MODE_DATA   Ip6ModeData;
+
+  if(Interface->Configured) {
+    return TRUE;
+  }
+
+  if(!Interface->Started) {
+    PERF_START(Interface->Instance->Image, DNSCLIENT_PERF_CONFIGURE, NULL, 0);
+
+    if(Interface->IsIp6) {
+      Status = Interface->Udp6->Configure(Interface->Udp6, &Interface->Udp6CfgData);
+    } else {
+      Status = Interface->Udp4->Configure(Interface->Udp4, &Interface->Udp4CfgData);
+    }
+
+    PERF_END(Interface->Instance->Image, DNSCLIENT_PERF_CONFIGURE, NULL, 0);
+
+    if(Status == EFI_SUCCESS) {
+      Interface->Started    = TRUE;
+      Interface->Configured = TRUE;
+      return TRUE;
+    }
+
+    if(Status != EFI_NO_MAPPING) {
+      return FALSE;
+    }
+
+    Interface->Started = TRUE;
+  }
+
+  if(Interface->IsIp6) {
+    ZeroMem(&Ip6ModeData, sizeof(EFI_IP6_MODE_DATA));
+
+    Status = Interface->Udp6->GetModeData(Interface->Udp6, NULL, &Ip6ModeData, NULL, NULL);
+
+    if(!EFI_ERROR(Status)) {
+      Interface->Configured = Ip6ModeData.IsConfigured;
+
+      //
+      // Unlike the Ip4 one, the Ip6 mode data comes with tables the caller
+      // has to free.
+      //
+      SafeRelease(Ip6ModeData.AddressList);
+      SafeRelease(Ip6ModeData.GroupTable);
+      SafeRelease(Ip6ModeData.RouteTable);
+      SafeRelease(Ip6ModeData.NeighborCache);
+      SafeRelease(Ip6ModeData.PrefixTable);
+      SafeRelease(Ip6ModeData.IcmpTypeList);
+    }
+
+    return Interface->Configured;
+  }
+
+  Status = Interface->Udp4->GetModeData(Interface->Udp4, NULL, &Ip4ModeData, NULL, NULL);
+
+  if(!EFI_ERROR(Status) && Ip4ModeData.IsConfigured) {
+    Interface->Configured = TRUE;
+  }
+
+  return Interface->Configured;
+} // End of DNSImplRefreshInterface
+
+
+/**
+  Reads the DNS servers Ip4Config2 holds for an interface.  These come from
+  DHCP option 6, or from the manual configuration of a static interface.
+
+  @param[in] Instance   The Private data to be used.
+  @param[in] Interface  The interface.
+
+  @retval EFI_SUCCESS   The servers have been added.
+  @retval other         The interface has no Ip4Config2 protocol or no DNS servers.
+  */
+STATIC EFI_STATUS DNSImplReadIp4Config2Servers(DNSCLIENT_PRIVATE_DATA *Instance, DNS_INTERFACE *Interface) {
+  EFI_STATUS                 Status;
+  EFI_IP4_CONFIG2_PROTOCOL   *Ip4Config2;
+  EFI_IPv4_ADDRESS           *Servers;
+  EFI_IP_ADDRESS             Address;
+  UINTN                      DataSize;
+  UINTN                      i;
+
+  Status = gBS->OpenProtocol(
+    Interface->ServiceHandle,
+    &gEfiIp4Config2ProtocolGuid,
+    (VOID **) &Ip4Config2,
+    Instance->Image,
+    Interface->ServiceHandle,
+    EFI_OPEN_PROTOCOL_GET_PROTOCOL
+  );
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  DataSize = 0;
+  Status   = Ip4Config2->GetData(Ip4Config2, Ip4Config2DataTypeDnsServer, &DataSize, NULL);
+
+  if(Status != EFI_BUFFER_TOO_SMALL) {
+    return EFI_NOT_FOUND;
+  }
+
+  Servers = AllocatePool(DataSize);
+
+  if(Servers == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status = Ip4Config2->GetData(Ip4Config2, Ip4Config2DataTypeDnsServer, &DataSize, Servers);
+
+  if(!EFI_ERROR(Status)) {
+    ZeroMem(&Address, sizeof(EFI_IP_ADDRESS));
+
+    for(i = 0; i < DataSize / sizeof(EFI_IPv4_ADDRESS); ++i) {
+      CopyMem(&Address.v4, &Servers[i], sizeof(EFI_IPv4_ADDRESS));
+      DNSImplAddServer(Instance, &Address, FALSE, TRUE);
+    }
+  }
+
+  SafeRelease(Servers);
+
+  return Status;
+} // End of DNSImplReadIp4Config2Servers
+
+
+/**
+  Reads the DNS servers Ip6Config holds for an interface.  These come from
+  DHCPv6, from router advertisements, or from the manual configuration of
+  the interface.
+
+  @param[in] Instance   The Private data to be used.
+  @param[in] Interface  The interface.
+
+  @retval EFI_SUCCESS   The servers have been added.
+  @retval other         The interface has no Ip6Config protocol or no DNS servers.
+  */
+STATIC EFI_STATUS DNSImplReadIp6ConfigServers(DNSCLIENT_PRIVATE_DATA *Instance, DNS_INTERFACE *Interface) {
+  EFI_STATUS                 Status;
+  EFI_IP6_CONFIG_PROTOCOL    *Ip6Config;
+  EFI_IPv6_ADDRESS           *Servers;
+  EFI_IP_ADDRESS             Address;
+  UINTN                      DataSize;
+  UINTN                      i;
+
+  Status = gBS->OpenProtocol(
+    Interface->ServiceHandle,
+    &gEfiIp6ConfigProtocolGuid,
+    (VOID **) &Ip6Config,
+    Instance->Image,
+    Interface->ServiceHandle,
+    EFI_OPEN_PROTOCOL_GET_PROTOCOL
+  );
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  DataSize = 0;
+  Status   = Ip6Config->GetData(Ip6Config, Ip6ConfigDataTypeDnsServer, &DataSize, NULL);
+
+  if(Status != EFI_BUFFER_TOO_SMALL) {
+    return EFI_NOT_FOUND;
+  }
+
+  Servers = AllocatePool(DataSize);
+
+  if(Servers == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status = Ip6Config->GetData(Ip6Config, Ip6ConfigDataTypeDnsServer, &DataSize, Servers);
+
+  if(!EFI_ERROR(Status)) {
+    for(i = 0; i < DataSize / sizeof(EFI_IPv6_ADDRESS); ++i) {
+      CopyMem(&Address.v6, &Servers[i], sizeof(EFI_IPv6_ADDRESS));
+      DNSImplAddServer(Instance, &Address, TRUE, TRUE);
+    }
+  }
+
+  SafeRelease(Servers);
+
+  return Status;
+} // End of DNSImplReadIp6ConfigServers
+
+
+/**
+  Reads the DNS server option out of the DHCP lease of an interface.  Used
+  where Ip4Config2 is not available.  The mode data of a Dhcp4 child
+  describes the interface's lease, so a child is created just to read it.
+
+  @param[in] Instance   The Private data to be used.
+  @param[in] Interface  The interface.
+
+  @retval EFI_SUCCESS   The servers have been added.
+  @retval other         The interface has no DHCP lease or no DNS server option.
+  */
+STATIC EFI_STATUS DNSImplReadDhcp4Servers(DNSCLIENT_PRIVATE_DATA *Instance, DNS_INTERFACE *Interface) {
+  EFI_STATUS                     Status;
+  EFI_SERVICE_BINDING_PROTOCOL   *Dhcp4Sb;
+  EFI_DHCP4_PROTOCOL             *Dhcp4;
+  EFI_HANDLE                     Dhcp4Child;
+  EFI_DHCP4_MODE_DATA            Dhcp4ModeData;
+  EFI_DHCP4_PACKET_OPTION        *Options[DNSCLIENT_MAX_DHCP_OPTIONS];
+  EFI_IP_ADDRESS                 Address;
+  UINT32                         OptionCount;
+  UINTN                          i, j;
+
+  Dhcp4Child = NULL;
+
+  Status = gBS->OpenProtocol(
+    Interface->ServiceHandle,
+    &gEfiDhcp4ServiceBindingProtocolGuid,
+    (VOID **) &Dhcp4Sb,
+    Instance->Image,
+    Interface->ServiceHandle,
+    EFI_OPEN_PROTOCOL_GET_PROTOCOL
+  );
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  Status = Dhcp4Sb->CreateChild(Dhcp4Sb, &Dhcp4Child);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  Status = gBS->OpenProtocol(
+    Dhcp4Child,
+    &gEfiDhcp4ProtocolGuid,
+    (VOID **) &Dhcp4,
+    Instance->Image,
+    Interface->ServiceHandle,
+    EFI_OPEN_PROTOCOL_GET_PROTOCOL
+  );
+
+  if(EFI_ERROR(Status)) {
+    goto CLEANUP;
+  }
+
+  Status = Dhcp4->GetModeData(Dhcp4, &Dhcp4ModeData);
+
+  if(EFI_ERROR(Status)) {
+    goto CLEANUP;
+  }
+
+  if(Dhcp4ModeData.State != Dhcp4Bound || Dhcp4ModeData.ReplyPacket == NULL) {
+    GotoStatus(CLEANUP, EFI_NOT_FOUND);
+  }
+
+  OptionCount = DNSCLIENT_MAX_DHCP_OPTIONS;
+  Status      = Dhcp4->Parse(Dhcp4, Dhcp4ModeData.ReplyPacket, &OptionCount, Options);
+
+  if(EFI_ERROR(Status)) {
+    goto CLEANUP;
+  }
+
+  Status = EFI_NOT_FOUND;
+
+  ZeroMem(&Address, sizeof(EFI_IP_ADDRESS));
+
+  for(i = 0; i < OptionCount; ++i) {
+    if(Options[i]->OpCode != DHCP4_TAG_DNS_SERVERS) {
+      continue;
+    }
+
+    //
+    // The option data is not aligned, so each address is copied out.
+    //
+    for(j = 0; j + sizeof(EFI_IPv4_ADDRESS) <= Options[i]->Length; j += sizeof(EFI_IPv4_ADDRESS)) {
+      CopyMem(&Address.v4, &Options[i]->Data[j], sizeof(EFI_IPv4_ADDRESS));
+      DNSImplAddServer(Instance, &Address, FALSE, TRUE);
+
+      Status = EFI_SUCCESS;
+    }
+  }
+
+ CLEANUP:
+
+  Dhcp4Sb->DestroyChild(Dhcp4Sb, Dhcp4Child);
+
+  return Status;
+} // End of DNSImplReadDhcp4Servers
+
+
+/**
+  Brings up every interface which has gained an address since it was last
+  looked at, and adds the DNS servers it was handed to the failover list.
+  Must not be called while queries are pending.
+
+  @param[in] Instance  The Private data to be used.
+
+  @retval UINTN        Number of interfaces queries can be sent on.
+  */
+STATIC UINTN DNSImplRefreshInterfaces(DNSCLIENT_PRIVATE_DATA *Instance) {
+  DNS_INTERFACE   *Interface;
+  UINTN           Configured;
+  UINTN           i;
+
+  Configured = 0;
+
+  for(i = 0; i < Instance->InterfaceCount; ++i) {
+    Interface = &Instance->Interfaces[i];
+
+    if(!DNSImplRefreshInterface(Interface)) {
+      continue;
+    }
+
+    ++Configured;
+
+    if(!Interface->Discovered) {
+      Interface->Discovered = TRUE;
+
+      if(Interface->IsIp6) {
+        DNSImplReadIp6ConfigServers(Instance, Interface);
+      } else if(EFI_ERROR(DNSImplReadIp4Config2Servers(Instance, Interface))) {
+        DNSImplReadDhcp4Servers(Instance, Interface);
+      }
+    }
+  }
+
+  return Configured;
+} // End of DNSImplRefreshInterfaces
+
+
+/**
+  Creates a Udp4 or Udp6 child on a service binding handle.  The child is
+  configured right away if the interface already has an address.
+
+  @param[in] Instance       The Private data to be used.
+  @param[in] Interface      The interface to initalize.
+  @param[in] ServiceHandle  A handle supporting the Udp4ServiceBindingProtocol, or the Udp6 one.
+  @param[in] IsIp6          TRUE to create a Udp6 child.
+
+  @retval EFI_SUCCESS  The child has been created.
+  @retval other        An error occured.  Nothing is left allocated.
+  */
+STATIC EFI_STATUS DNSImplOpenInterface(DNSCLIENT_PRIVATE_DATA *Instance, DNS_INTERFACE *Interface, EFI_HANDLE ServiceHandle, BOOLEAN IsIp6) {
+  EFI_STATUS   Status;
+
+  ZeroMem(Interface, sizeof(DNS_INTERFACE));
+
+  Interface->Instance      = Instance;
+  Interface->ServiceHandle = ServiceHandle;
+  Interface->IsIp6         = IsIp6;
+
+  DNSImplInitRtt(&Interface->Rtt);
+
+  //
+  // Open the Udp4 (or Udp6) ServiceBindingProtocol so we can create child handles.
+  //
+  Status = gBS->OpenProtocol(
+    Interface->ServiceHandle,
+    IsIp6 ? &gEfiUdp6ServiceBindingProtocolGuid : &gEfiUdp4ServiceBindingProtocolGuid,
+    (VOID **) &Interface->UdpSb,
+    Instance->Image,
+    Interface->ServiceHandle,
+    EFI_OPEN_PROTOCOL_GET_PROTOCOL
+  );
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  //
+  // Crate a Udp4Protocol (or Udp6Protocol) handle for reading.
+  //
+  PERF_START(Instance->Image, DNSCLIENT_PERF_CHILD, NULL, 0);
+
+  Status = Interface->UdpSb->CreateChild(Interface->UdpSb, &Interface->Child);
+
+  if(EFI_ERROR(Status)) {
+    PERF_END(Instance->Image, DNSCLIENT_PERF_CHILD, NULL, 0);
+    return Status;
+  }
+
+  //
+  // Open our Udp4Protocol (or Udp6Protocol) read handle.
+  //
+  Status = gBS->OpenProtocol(
+    Interface->Child,
+    IsIp6 ? &gEfiUdp6ProtocolGuid : &gEfiUdp4ProtocolGuid,
+    IsIp6 ? (VOID **) &Interface->Udp6 : (VOID **) &Interface->Udp4,
+    Instance->Image,
+    &Interface->ServiceHandle,
+    EFI_OPEN_PROTOCOL_GET_PROTOCOL
+  );
+
+  PERF_END(Instance->Image, DNSCLIENT_PERF_CHILD, NULL, 0);
+
+  if(EFI_ERROR(Status)) {
+    goto ON_ERROR;
+  }
+
+  // For details on what these following values mean see the related 
+  // definition section of EFI_UDP4_PROTOCOL.GetModeData() of the
+  // UEFI spec document (pg 1408 in UEFI_2_4_Errata_B.pdf of April, 2014).
+  ZeroMem (&Interface->Udp4CfgData, sizeof (EFI_UDP4_CONFIG_DATA));
+  Interface->Udp4CfgData.AcceptBroadcast    = FALSE;
+  Interface->Udp4CfgData.AcceptPromiscuous  = FALSE;
+  Interface->Udp4CfgData.AcceptAnyPort      = FALSE;
+  Interface->Udp4CfgData.AllowDuplicatePort = TRUE;
+  Interface->Udp4CfgData.TypeOfService      = 0;
+  Interface->Udp4CfgData.TimeToLive         = 16;
+  Interface->Udp4CfgData.DoNotFragment      = FALSE;
+  Interface->Udp4CfgData.ReceiveTimeout     = 50000;
+  Interface->Udp4CfgData.UseDefaultAddress  = TRUE;
+  Interface->Udp4CfgData.StationPort        = 53;
+  Interface->Udp4CfgData.RemotePort         = 53;
+
+  //
+  // The Udp6 child takes an ephemeral port and whatever source address the
+  // driver picks for each destination.
+  //
+  ZeroMem (&Interface->Udp6CfgData, sizeof (EFI_UDP6_CONFIG_DATA));
+  Interface->Udp6CfgData.AcceptPromiscuous  = FALSE;
+  Interface->Udp6CfgData.AcceptAnyPort      = FALSE;
+  Interface->Udp6CfgData.AllowDuplicatePort = TRUE;
+  Interface->Udp6CfgData.TrafficClass       = 0;
+  Interface->Udp6CfgData.HopLimit           = 64;
+  Interface->Udp6CfgData.ReceiveTimeout     = 50000;
+  Interface->Udp6CfgData.StationPort        = 0;
+  Interface->Udp6CfgData.RemotePort         = 53;
+
+  //
+  // A link without carrier or lease is kept, it is tried again before
+  // every lookup.
+  //
+  DNSImplRefreshInterface(Interface);
+
+  return EFI_SUCCESS;
+
+ ON_ERROR:
+
+  Interface->UdpSb->DestroyChild(Interface->UdpSb, Interface->Child);
+  Interface->Child = NULL;
+
+  return Status;
+} // End of DNSImplOpenInterface
+
+
+/**
+  Resets and destroys an interface's Udp4 or Udp6 child.  Any receive must have been
+  cancelled already.
+
+  @param[in] Interface  The interface.
+  */
+STATIC VOID DNSImplCloseInterface(DNS_INTERFACE *Interface) {
+  EFI_STATUS   Status;
+
+  DNSImplCloseRxRing(Interface);
+
+  if(Interface->Child != NULL) {
+    Status = EFI_SUCCESS;
+
+    if(Interface->Started) {
+      // These are hainging at the moment... not sure why...
+      if(Interface->IsIp6) {
+        Status = Interface->Udp6->Configure(Interface->Udp6, NULL);
+      } else {
+        Status = Interface->Udp4->Configure(Interface->Udp4, NULL);
+      }
+    }
+
+    if(!EFI_ERROR(Status)) {
+      Interface->UdpSb->DestroyChild(Interface->UdpSb, Interface->Child);
+    }
+
+    Interface->Child = NULL;
+  }
+
+  Interface->Started    = FALSE;
+  Interface->Configured = FALSE;
+} // End of DNSImplCloseInterface
+
+
+/**
+  Opens an interface on every handle supporting a Udp service binding
+  protocol, until DNSCLIENT_MAX_INTERFACES is reached.  Open every handle
+  rather than just the first, which on a multi port machine is as likely as
+  not a link without carrier.  A handle we can not create a child on is
+  skipped.
+
+  @param[in] Instance  The Private data to be used.
+  @param[in] IsIp6     TRUE for the Udp6 service binding handles, FALSE for the Udp4 ones.
+
+  @retval EFI_SUCCESS  At least one interface has been opened.
+  @retval other        No interface has been opened.
+  */
+STATIC EFI_STATUS DNSImplOpenInterfaces(DNSCLIENT_PRIVATE_DATA *Instance, BOOLEAN IsIp6) {
+  EFI_STATUS   Status;
+  EFI_HANDLE   *HandleBuffer;
+  UINTN        HandleCount;
+  UINTN        Opened;
+  UINTN        i;
+
+  HandleBuffer = NULL;
+  HandleCount  = 0;
+  Opened       = 0;
+
+  PERF_START(Instance->Image, DNSCLIENT_PERF_LOCATE, NULL, 0);
+
+  Status = gBS->LocateHandleBuffer(
+    ByProtocol,
+    IsIp6 ? &gEfiUdp6ServiceBindingProtocolGuid : &gEfiUdp4ServiceBindingProtocolGuid,
+    NULL,
+    &HandleCount,
+    &HandleBuffer
+  );
+
+  PERF_END(Instance->Image, DNSCLIENT_PERF_LOCATE, NULL, 0);
+
+  if(EFI_ERROR(Status) || (HandleCount == 0) || (HandleBuffer == NULL)) {
+    return EFI_NOT_FOUND;
+  }
+
+  for(i = 0; i < HandleCount && Instance->InterfaceCount < DNSCLIENT_MAX_INTERFACES; ++i) {
+    Status = DNSImplOpenInterface(Instance, &Instance->Interfaces[Instance->InterfaceCount], HandleBuffer[i], IsIp6);
+
+    if(!EFI_ERROR(Status)) {
+      ++(Instance->InterfaceCount);
+      ++Opened;
+    }
+  }
+
+  SafeRelease(HandleBuffer);
+
+  return (Opened != 0) ? EFI_SUCCESS : Status;
+} // End of DNSImplOpenInterfaces
+
+
+/**
+  Signaled when a receive posted on a TCP connection completes.  Marks both
+  the connection and the client, so it ends a wait on the interfaces too,
+  and has the engine pick the bytes up.
+
+  @param[in] Event     The receive token's event.
+  @param[in] Context   The DNS_TCP_CONNECTION the receive was posted on.
+  */
+STATIC VOID EFIAPI DNSImplTcpReceiveCallback(IN EFI_EVENT Event, IN VOID *Context) {
+  DNS_TCP_CONNECTION   *Connection;
+
+  Connection = (DNS_TCP_CONNECTION*) Context;
+
+  Connection->RxDone            = TRUE;
+  Connection->Instance->RxReady = TRUE;
+
+  gBS->SignalEvent(Connection->Instance->Engine);
+} // End of DNSImplTcpReceiveCallback
+
+
+/**
+  Signaled when a TCP connection is established or fails to be, and when a
+  graceful close completes.  Has the engine send the queries waiting on it.
+
+  @param[in] Event     The connection token's event.
+  @param[in] Context   The DNS_TCP_CONNECTION.
+  */
+STATIC VOID EFIAPI DNSImplTcpConnectCallback(IN EFI_EVENT Event, IN VOID *Context) {
+  DNS_TCP_CONNECTION   *Connection;
+
+  Connection = (DNS_TCP_CONNECTION*) Context;
+
+  Connection->ConnectDone = TRUE;
+
+  gBS->SignalEvent(Connection->Instance->Engine);
+} // End of DNSImplTcpConnectCallback
+
+
+/**
+  Signaled when a write to a TCP connection completes.  Frees the buffer for
+  reuse, and runs the engine if a query is waiting on one.
+
+  @param[in] Event     The transmit token's event.
+  @param[in] Context   The DNS_TCP_TX_BUFFER the write was made from.
+  */
+STATIC VOID EFIAPI DNSImplTcpTransmitCallback(IN EFI_EVENT Event, IN VOID *Context) {
+  DNS_TCP_TX_BUFFER   *TxBuffer;
+
+  TxBuffer = (DNS_TCP_TX_BUFFER*) Context;
+
+  TxBuffer->IsDone = TRUE;
+
+  if(TxBuffer->Instance->TxWaiting) {
+    gBS->SignalEvent(TxBuffer->Instance->Engine);
+  }
+} // End of DNSImplTcpTransmitCallback
+
+
+/**
+  Closes a TCP connection and destroys its Tcp4 child.  Resetting the child
+  flushes every token still queued on it, so nothing is left in flight.
+
+  @param[in] Instance    The Private data to be used.
+  @param[in] Connection  The connection.  Its slot is free afterwards.
+  @param[in] Graceful    TRUE to send a FIN and give the server a moment to
+                         acknowledge it, FALSE to just reset the connection.
+  */
+STATIC VOID DNSImplCloseTcp(DNSCLIENT_PRIVATE_DATA *Instance, DNS_TCP_CONNECTION *Connection, BOOLEAN Graceful) {
+  EFI_TCP4_CLOSE_TOKEN   CloseToken;
+  UINTN                  i;
+
+  if(Connection->Child == NULL) {
+    return;
+  }
+
+  if(Connection->Tcp4 != NULL) {
+    if(Graceful && Connection->Connected && Connection->ConnectToken.CompletionToken.Event != NULL) {
+      ZeroMem(&CloseToken, sizeof(CloseToken));
+
+      Connection->ConnectDone = FALSE;
+
+      CloseToken.CompletionToken.Event = Connection->ConnectToken.CompletionToken.Event;
+      CloseToken.AbortOnClose          = FALSE;
+
+      if(!EFI_ERROR(Connection->Tcp4->Close(Connection->Tcp4, &CloseToken))) {
+        DNSImplWaitFor(Instance, &Connection->ConnectDone, DNSCLIENT_TX_TIMEOUT_MS * NS_PER_MS);
+      }
+    }
+
+    Connection->Tcp4->Configure(Connection->Tcp4, NULL);
+  }
+
+  if(Connection->ConnectToken.CompletionToken.Event != NULL) {
+    gBS->CloseEvent(Connection->ConnectToken.CompletionToken.Event);
+    Connection->ConnectToken.CompletionToken.Event = NULL;
+  }
+
+  if(Connection->RxToken.CompletionToken.Event != NULL) {
+    gBS->CloseEvent(Connection->RxToken.CompletionToken.Event);
+    Connection->RxToken.CompletionToken.Event = NULL;
+  }
+
+  for(i = 0; i < DNSCLIENT_TCP_TX_RING_SIZE; ++i) {
+    if(Connection->TxRing[i].Token.CompletionToken.Event != NULL) {
+      gBS->CloseEvent(Connection->TxRing[i].Token.CompletionToken.Event);
+      Connection->TxRing[i].Token.CompletionToken.Event = NULL;
+    }
+  }
+
+  Connection->TcpSb->DestroyChild(Connection->TcpSb, Connection->Child);
+
+  SafeRelease(Connection->Buffer);
+
+  Connection->Child     = NULL;
+  Connection->Tcp4      = NULL;
+  Connection->Connected = FALSE;
+  Connection->RxPosted  = FALSE;
+} // End of DNSImplCloseTcp
+
+
+/**
+  Starts opening a TCP connection to a server on port 53.  The Tcp4 child is
+  created on the service binding handle of an interface.  The connection is
+  not waited on: DNSImplTcpFinishConnect picks up the result, and gives up
+  on it after DNSCLIENT_TCP_CONNECT_TIMEOUT_MS.
+
+  @param[in] Instance    The Private data to be used.
+  @param[in] Connection  A free connection slot.
+  @param[in] Address     The server's address.
+  @param[in] Interface   Index of the Udp4 interface whose handle the child is created on.
+
+  @retval EFI_SUCCESS           The connection is being established.
+  @retval EFI_UNSUPPORTED       The handle has no Tcp4 service binding protocol.
+  @retval EFI_OUT_OF_RESOURCES  Out of memory.
+  @retval other                 An error occured.  The slot is left free.
+  */
+STATIC EFI_STATUS DNSImplOpenTcp(DNSCLIENT_PRIVATE_DATA *Instance, DNS_TCP_CONNECTION *Connection, EFI_IPv4_ADDRESS *Address, UINTN Interface) {
+  EFI_STATUS             Status;
+  EFI_TCP4_CONFIG_DATA   CfgData;
+  EFI_HANDLE             ServiceHandle;
+  DNS_TCP_TX_BUFFER      *TxBuffer;
+  UINTN                  i;
+
+  ZeroMem(Connection, sizeof(DNS_TCP_CONNECTION));
+
+  Connection->Instance  = Instance;
+  Connection->Interface = Interface;
+
+  CopyMem(&Connection->Address, Address, sizeof(EFI_IPv4_ADDRESS));
+
+  ServiceHandle = Instance->Interfaces[Interface].ServiceHandle;
+
+  //
+  // The Tcp4 service binding protocol sits on the same handle as the Udp4 one.
+  //
+  Status = gBS->OpenProtocol(
+    ServiceHandle,
+    &gEfiTcp4ServiceBindingProtocolGuid,
+    (VOID **) &Connection->TcpSb,
+    Instance->Image,
+    ServiceHandle,
+    EFI_OPEN_PROTOCOL_GET_PROTOCOL
+  );
+
+  if(EFI_ERROR(Status)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  Status = Connection->TcpSb->CreateChild(Connection->TcpSb, &Connection->Child);
+
+  if(EFI_ERROR(Status)) {
+    Connection->Child = NULL;
+    return Status;
+  }
+
+  Status = gBS->OpenProtocol(
+    Connection->Child,
+    &gEfiTcp4ProtocolGuid,
+    (VOID **) &Connection->Tcp4,
+    Instance->Image,
+    ServiceHandle,
+    EFI_OPEN_PROTOCOL_GET_PROTOCOL
+  );
+
+  if(EFI_ERROR(Status)) {
+    Connection->Tcp4 = NULL;
+    goto ON_ERROR;
+  }
+
+  Connection->Buffer = DNSAllocatePool(DNS_TCP_BUFFER_SIZE);
+
+  if(Connection->Buffer == NULL) {
+    GotoStatus(ON_ERROR, EFI_OUT_OF_RESOURCES);
+  }
+
+  Status = gBS->CreateEvent(
+    EVT_NOTIFY_SIGNAL,
+    DNSCLIENT_TOKEN_TPL,
+    DNSImplTcpConnectCallback,
+    (VOID*) Connection,
+    &Connection->ConnectToken.CompletionToken.Event
+  );
+
+  if(EFI_ERROR(Status)) {
+    goto ON_ERROR;
+  }
+
+  Status = gBS->CreateEvent(
+    EVT_NOTIFY_SIGNAL,
+    DNSCLIENT_TOKEN_TPL,
+    DNSImplTcpReceiveCallback,
+    (VOID*) Connection,
+    &Connection->RxToken.CompletionToken.Event
+  );
+
+  if(EFI_ERROR(Status)) {
+    goto ON_ERROR;
+  }
+
+  for(i = 0; i < DNSCLIENT_TCP_TX_RING_SIZE; ++i) {
+    TxBuffer           = &Connection->TxRing[i];
+    TxBuffer->Instance = Instance;
+    TxBuffer->IsDone   = TRUE;
+
+    Status = gBS->CreateEvent(
+      EVT_NOTIFY_SIGNAL,
+      DNSCLIENT_TOKEN_TPL,
+      DNSImplTcpTransmitCallback,
+      (VOID*) TxBuffer,
+      &TxBuffer->Token.CompletionToken.Event
+    );
+
+    if(EFI_ERROR(Status)) {
+      goto ON_ERROR;
+    }
+  }
+
+  //
+  // An active open from an ephemeral port, with the driver's default
+  // options.
+  //
+  ZeroMem(&CfgData, sizeof(EFI_TCP4_CONFIG_DATA));
+  CfgData.TypeOfService                 = 0;
+  CfgData.TimeToLive                    = 64;
+  CfgData.AccessPoint.UseDefaultAddress = TRUE;
+  CfgData.AccessPoint.StationPort       = 0;
+  CfgData.AccessPoint.RemotePort        = 53;
+  CfgData.AccessPoint.ActiveFlag        = TRUE;
+  CfgData.ControlOption                 = NULL;
+
+  CopyMem(&CfgData.AccessPoint.RemoteAddress, Address, sizeof(EFI_IPv4_ADDRESS));
+
+  Status = Connection->Tcp4->Configure(Connection->Tcp4, &CfgData);
+
+  if(EFI_ERROR(Status)) {
+    goto ON_ERROR;
+  }
+
+  Connection->ConnectDone                         = FALSE;
+  Connection->ConnectToken.CompletionToken.Status = EFI_SUCCESS;
+  Connection->ConnectBy                           = DNSImplGetTimeNs() + DNSCLIENT_TCP_CONNECT_TIMEOUT_MS * NS_PER_MS;
+  Connection->LastUsed                            = DNSImplGetTimeNs();
+
+  Status = Connection->Tcp4->Connect(Connection->Tcp4, &Connection->ConnectToken);
+
+  if(EFI_ERROR(Status)) {
+    goto ON_ERROR;
+  }
+
+  return EFI_SUCCESS;
+
+ ON_ERROR:
+
+  DNSImplCloseTcp(Instance, Connection, FALSE);
+
+  return Status;
+} // End of DNSImplOpenTcp
+
+
+/**
+  Opens a file on the volume the client's image was loaded from, normally the
+  ESP.
+
+  @param[in]  Instance  The Private data to be used.
+  @param[in]  Path      Path of the file from the root of the volume.
+  @param[in]  Mode      EFI_FILE_MODE_* flags to open the file with.
+  @param[out] File      Receives the open file.  Close it with File->Close.
+
+  @retval EFI_SUCCESS   The file is open.
+  @retval other         The image has no volume or the file could not be opened.
+  */
+STATIC EFI_STATUS DNSImplOpenImageFile(DNSCLIENT_PRIVATE_DATA *Instance, CONST CHAR16 *Path, UINT64 Mode, EFI_FILE_PROTOCOL **File) {
+  EFI_STATUS                         Status;
+  EFI_LOADED_IMAGE_PROTOCOL          *LoadedImage;
+  EFI_SIMPLE_FILE_SYSTEM_PROTOCOL    *FileSystem;
+  EFI_FILE_PROTOCOL                  *Root;
+
+  *File = NULL;
+
+  Status = gBS->HandleProtocol(Instance->Image, &gEfiLoadedImageProtocolGuid, (VOID**) &LoadedImage);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  Status = gBS->HandleProtocol(LoadedImage->DeviceHandle, &gEfiSimpleFileSystemProtocolGuid, (VOID**) &FileSystem);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  Status = FileSystem->OpenVolume(FileSystem, &Root);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  Status = Root->Open(Root, File, (CHAR16*) Path, Mode, 0);
+
+  Root->Close(Root);
+
+  return Status;
+} // End of DNSImplOpenImageFile
+
+
+/**
+  Reads PcdDnsClientHostsFile into the hosts table.  A missing file is not an
+  error, the table is simply left empty.
+
+  @param[in] Instance  The Private data to be used.
+  */
+STATIC VOID DNSImplLoadHosts(DNSCLIENT_PRIVATE_DATA *Instance) {
+  CONST CHAR16         *Path;
+  EFI_FILE_PROTOCOL    *File;
+  UINT64               Start;
+
+  DNSHostsInit(&Instance->Hosts);
+
+  Path = (CONST CHAR16*) PcdGetPtr(PcdDnsClientHostsFile);
+
+  if(Path == NULL || *Path == L'\0') {
+    return;
+  }
+
+  PERF_START(Instance->Image, DNSCLIENT_PERF_HOSTS, NULL, 0);
+
+  Start = DNSImplGetTimeNs();
+
+  if(!EFI_ERROR(DNSImplOpenImageFile(Instance, Path, EFI_FILE_MODE_READ, &File))) {
+    //
+    // Whatever was read before a failure is still used.
+    //
+    DNSHostsLoad(&Instance->Hosts, File);
+    File->Close(File);
+  }
+
+  Instance->Hosts.LoadTime = DNSImplGetTimeNs() - Start;
+
+  PERF_END(Instance->Image, DNSCLIENT_PERF_HOSTS, NULL, 0);
+} // End of DNSImplLoadHosts
+
+
+/**
+  Answers a lookup from the hosts table.
+
+  @param[in]  Instance   The Private data to be used.
+  @param[out] Lookup     The lookup.  Receives the listed addresses.
+
+  @retval TRUE           The name is listed and the addresses have been set.
+  @retval FALSE          The name has to be looked up in the cache or on the wire.
+  */
+STATIC BOOLEAN DNSImplLookupHosts(DNSCLIENT_PRIVATE_DATA *Instance, DNS_LOOKUP *Lookup) {
+  UINTN   Count;
+
+  if(!Instance->UseHosts || Lookup->Hostname == NULL || (Lookup->QType != 1 && Lookup->QType != 28) || (Lookup->Addresses == NULL && Lookup->MaxAddresses != 0)) {
+    return FALSE;
+  }
+
+  Count = DNSHostsLookup(&Instance->Hosts, Lookup->Hostname, Lookup->QType, Lookup->Addresses, Lookup->MaxAddresses);
+
+  if(Count == 0) {
+    return FALSE;
+  }
+
+  Lookup->AddressCount = MIN(Count, Lookup->MaxAddresses);
+  Lookup->Status       = EFI_SUCCESS;
+
+  return TRUE;
+} // End of DNSImplLookupHosts
+
+
+//
+// Days of a non-leap year before the first of each month.
+//
+STATIC CONST UINT16 mDaysBeforeMonth[] = { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+
+#define DNSImplIsLeapYear(Year)   ((((Year) % 4) == 0 && ((Year) % 100) != 0) || ((Year) % 400) == 0)
+
+/**
+  Reads the real time clock as seconds since 1970, corrected to UTC when the
+  firmware knows its time zone.  Unlike DNSImplGetTimeNs this carries on
+  across a reboot, so it is what the expiry times of a cache snapshot are
+  kept in.
+
+  @param[out] Seconds  Receives the time.
+
+  @retval EFI_SUCCESS       Seconds has been set.
+  @retval EFI_DEVICE_ERROR  The clock is not set.
+  @retval other             GetTime failed.
+  */
+STATIC EFI_STATUS DNSImplGetWallClock(UINT64 *Seconds) {
+  EFI_STATUS   Status;
+  EFI_TIME     Time;
+  UINT64       Days;
+  UINTN        Year;
+
+  Status = gRT->GetTime(&Time, NULL);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  if(Time.Year < 1970 || Time.Month < 1 || Time.Month > 12 || Time.Day < 1) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  Days = 0;
+
+  for(Year = 1970; Year < Time.Year; ++Year) {
+    Days += DNSImplIsLeapYear(Year) ? 366 : 365;
+  }
+
+  Days += mDaysBeforeMonth[Time.Month - 1] + Time.Day - 1;
+
+  if(Time.Month > 2 && DNSImplIsLeapYear(Time.Year)) {
+    ++Days;
+  }
+
+  *Seconds = MultU64x32(Days, 86400) + Time.Hour * 3600 + Time.Minute * 60 + Time.Second;
+
+  //
+  // Local time is UTC minus TimeZone minutes.
+  //
+  if(Time.TimeZone != EFI_UNSPECIFIED_TIMEZONE) {
+    *Seconds = (UINT64)((INT64) *Seconds + Time.TimeZone * 60);
+  }
+
+  return EFI_SUCCESS;
+} // End of DNSImplGetWallClock
+
+
+/**
+  Restores the answer cache from PcdDnsClientCacheFile, if there is one.
+  The file is left in place, it is replaced when the client is destroyed.
+
+  @param[in] Instance  The Private data to be used.
+  */
+STATIC VOID DNSImplLoadCacheSnapshot(DNSCLIENT_PRIVATE_DATA *Instance) {
+  CONST CHAR16         *Path;
+  EFI_FILE_PROTOCOL    *File;
+  UINT64               WallClock;
+
+  Path = (CONST CHAR16*) PcdGetPtr(PcdDnsClientCacheFile);
+
+  if(Path == NULL || *Path == L'\0' || Instance->Cache.Budget == 0) {
+    return;
+  }
+
+  if(EFI_ERROR(DNSImplGetWallClock(&WallClock))) {
+    return;
+  }
+
+  PERF_START(Instance->Image, DNSCLIENT_PERF_SNAPSHOT, NULL, 0);
+
+  if(!EFI_ERROR(DNSImplOpenImageFile(Instance, Path, EFI_FILE_MODE_READ, &File))) {
+    DNSCacheLoad(&Instance->Cache, File, DNSImplGetTimeNs(), WallClock);
+    File->Close(File);
+  }
+
+  PERF_END(Instance->Image, DNSCLIENT_PERF_SNAPSHOT, NULL, 0);
+} // End of DNSImplLoadCacheSnapshot
+
+
+/**
+  Writes the answer cache to PcdDnsClientCacheFile, replacing the previous
+  snapshot.
+
+  @param[in] Instance  The Private data to be used.
+
+  @retval EFI_SUCCESS  The snapshot has been written, or snapshots are turned off.
+  @retval other        The snapshot could not be written.
+  */
+EFI_STATUS EFIAPI SaveDNSCache(DNSCLIENT_PRIVATE_DATA *Instance) {
+  EFI_STATUS           Status;
+  CONST CHAR16         *Path;
+  EFI_FILE_PROTOCOL    *File;
+  UINT64               WallClock;
+
+  Path = (CONST CHAR16*) PcdGetPtr(PcdDnsClientCacheFile);
+
+  if(Path == NULL || *Path == L'\0' || Instance->Cache.Budget == 0 || Instance->Cache.Lru.ForwardLink == NULL) {
+    return EFI_SUCCESS;
+  }
+
+  Status = DNSImplGetWallClock(&WallClock);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  //
+  // Opening with EFI_FILE_MODE_CREATE does not truncate, so the old snapshot
+  // is deleted first.
+  //
+  if(!EFI_ERROR(DNSImplOpenImageFile(Instance, Path, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, &File))) {
+    File->Delete(File);
+  }
+
+  Status = DNSImplOpenImageFile(Instance, Path, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, &File);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  Status = DNSCacheSave(&Instance->Cache, File, DNSImplGetTimeNs(), WallClock);
+
+  File->Close(File);
+
+  return Status;
+} // End of SaveDNSCache
+
+
 /**
   Creates and initalizes the DNSClient's private data.
 
-  @param[in] Instance  The Private data to be used.
+  A Udp4 child is created on every Udp4 service binding handle and a Udp6
+  child on every Udp6 one, up to DNSCLIENT_MAX_INTERFACES, whether or not the
+  interface has an address yet.  The DNS servers of each interface with an
+  address are read from its DHCP lease (or its Ip6Config data) and put ahead
+  of PcdDnsClientFallbackServers.
+
+  PcdDnsClientHostsFile is read from the volume the image was loaded from
+  before any interface is opened.  A client whose hosts file lists names is
+  created even when there is no network interface at all, so it can still
+  answer from the file.
+
+  The answer cache starts out with whatever PcdDnsClientCacheFile holds from
+  the last run that destroyed its client, less anything which has expired
+  since.  DestroyDNSClient writes it back.
+
+  @param[in] Instance  The Private data to be used.
+
+  @retval EFI_SUCCESS  The Private variable has been initalized successfully.
+  @retval other        An error occured. Private is unitalized.
+  */
+EFI_STATUS EFIAPI CreateDNSClient(DNSCLIENT_PRIVATE_DATA *Instance) {
+  EFI_STATUS                               Status;
+  UINTN                                    i;
+
+  Status = EFI_ABORTED;
+
+  if(Instance == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  PERF_START(Instance->Image, DNSCLIENT_PERF_CREATE, NULL, 0);
+
+  Instance->InterfaceCount  = 0;
+  Instance->FanOut          = PcdGetBool(PcdDnsClientFanOut);
+  Instance->IdIterator      = 0;
+  Instance->ServerCount     = 0;
+  Instance->ActiveServer    = 0;
+  Instance->RaceWidth       = PcdGet32(PcdDnsClientRaceWidth);
+  Instance->RaceStagger     = MultU64x32(NS_PER_MS, PcdGet32(PcdDnsClientRaceStagger));
+  Instance->Timer           = NULL;
+  Instance->Engine          = NULL;
+  Instance->RxReady         = FALSE;
+  Instance->RxDepth         = MIN(MAX(PcdGet32(PcdDnsClientRxDepth), 1), DNSCLIENT_MAX_RX_DEPTH);
+  Instance->UseTcp          = FALSE;
+  Instance->EdnsPayloadSize = PcdGet16(PcdDnsClientEdnsPayloadSize);
+  Instance->Network         = DnsNetworkIdle;
+  Instance->PendingCount    = 0;
+  Instance->ProbeCount      = 0;
+  Instance->Window          = DNSCLIENT_MAX_PENDING;
+  Instance->IssueInterval   = 0;
+  Instance->NextIssue       = 0;
+  Instance->UseHosts        = TRUE;
+
+  InitializeListHead(&Instance->Requests);
+
+  ZeroMem(Instance->TcpConnections, sizeof(Instance->TcpConnections));
+  ZeroMem(Instance->Pending, sizeof(Instance->Pending));
+
+  if(Instance->EdnsPayloadSize != 0 && Instance->EdnsPayloadSize < DNS_EDNS_MIN_PAYLOAD) {
+    Instance->EdnsPayloadSize = DNS_EDNS_MIN_PAYLOAD;
+  }
+
+  DNSCacheInit(&Instance->Cache, PcdGet32(PcdDnsClientCacheBudget));
+
+  DNSImplLoadCacheSnapshot(Instance);
+
+  DNSImplLoadHosts(Instance);
+
+  //
+  // The Udp4 interfaces go first, so an IPv4 only firmware behaves as it
+  // always has.  Either family on its own is enough.
+  //
+  Status = DNSImplOpenInterfaces(Instance, FALSE);
+
+  if(!EFI_ERROR(DNSImplOpenInterfaces(Instance, TRUE))) {
+    Status = EFI_SUCCESS;
+  }
+
+  if(Instance->InterfaceCount == 0 && Instance->Hosts.Count == 0) {
+    DNSCacheFlush(&Instance->Cache);
+    PERF_END(Instance->Image, DNSCLIENT_PERF_CREATE, NULL, 0);
+    return (Status == EFI_NOT_FOUND) ? EFI_ABORTED : Status;
+  }
+
+  //
+  // Servers handed out by DHCP are added ahead of these as each interface
+  // gets its address.
+  //
+  DNSImplAddFallbackServers(Instance);
+
+  DNSImplRefreshInterfaces(Instance);
+
+  //
+  // Every wait on the network is bounded by this timer.
+  //
+  Status = gBS->CreateEvent(EVT_TIMER, TPL_CALLBACK, NULL, NULL, &Instance->Timer);
+
+  if(EFI_ERROR(Status)) {
+    goto ON_ERROR;
+  }
+
+  Status = gBS->CreateEvent(EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_CALLBACK, DNSImplEngineNotify, (VOID*) Instance, &Instance->Engine);
+
+  if(EFI_ERROR(Status)) {
+    goto ON_ERROR;
+  }
+
+  Status = DNSImplCreateTxRing(Instance);
+
+  if(EFI_ERROR(Status)) {
+    goto ON_ERROR;
+  }
+
+  PERF_END(Instance->Image, DNSCLIENT_PERF_CREATE, NULL, 0);
+
+  return EFI_SUCCESS;
+
+ ON_ERROR:
+
+  DNSImplDestroyTxRing(Instance);
+
+  if(Instance->Timer != NULL) {
+    gBS->CloseEvent(Instance->Timer);
+    Instance->Timer = NULL;
+  }
+
+  for(i = 0; i < Instance->InterfaceCount; ++i) {
+    DNSImplCloseInterface(&Instance->Interfaces[i]);
+  }
+
+  Instance->InterfaceCount = 0;
+
+  if(Instance->Engine != NULL) {
+    gBS->CloseEvent(Instance->Engine);
+    Instance->Engine = NULL;
+  }
+
+  DNSCacheFlush(&Instance->Cache);
+  DNSHostsFree(&Instance->Hosts);
+
+  PERF_END(Instance->Image, DNSCLIENT_PERF_CREATE, NULL, 0);
+
+  return Status;
+} // End of DNSClient
+
+
+/**
+  Cleans up and destroys the DNSClient's private data.
+
+  @param[in] Instance  The Private data to be used.
+
+  @retval EFI_SUCCESS     The private variable has been destroyed successfully.
+  @retval other           An error occured.  The private variable may not have been properly destroyed.
+  */
+EFI_STATUS EFIAPI DestroyDNSClient(DNSCLIENT_PRIVATE_DATA *Instance) {
+  UINTN   i;
+
+  if(Instance == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // Anything still running is stopped before the network goes away.
+  //
+  while(!IsListEmpty(&Instance->Requests)) {
+    CancelDNSLookups(Instance, DNS_RESOLVE_TOKEN_FROM_LINK(GetFirstNode(&Instance->Requests)));
+  }
+
+  SaveDNSCache(Instance);
+
+  DNSCacheFlush(&Instance->Cache);
+
+  DNSHostsFree(&Instance->Hosts);
+
+  CancelDNSReceive(Instance);
+
+  DNSImplDestroyTxRing(Instance);
+
+  for(i = 0; i < DNSCLIENT_MAX_TCP_CONNECTIONS; ++i) {
+    DNSImplCloseTcp(Instance, &Instance->TcpConnections[i], TRUE);
+  }
+
+  if(Instance->Timer != NULL) {
+    gBS->CloseEvent(Instance->Timer);
+    Instance->Timer = NULL;
+  }
+
+  for(i = 0; i < Instance->InterfaceCount; ++i) {
+    DNSImplCloseInterface(&Instance->Interfaces[i]);
+  }
+
+  Instance->InterfaceCount = 0;
+
+  //
+  // Closing the children completes their tokens, which signal the engine.
+  //
+  if(Instance->Engine != NULL) {
+    gBS->CloseEvent(Instance->Engine);
+    Instance->Engine = NULL;
+  }
+
+  return EFI_SUCCESS;
+} // End of DestoryDNSClient
+
+
+/**
+  Get's an ip address by a host name.  A name listed in the hosts file is
+  answered from it without any network I/O.
+
+  @param[in]      Instance   The Private data to be used.
+  @param[in]      Hostname   A null terminated string of the hostname to look up.
+  @param[in/out]  IpAddress  The address of the hostname.
+
+  @retval EFI_SUCCESS        The request completed successfully.
+  @retval other              An error occured.
+  */
+EFI_STATUS EFIAPI GetHostByName(DNSCLIENT_PRIVATE_DATA *Instance, CHAR8 *Hostname, EFI_IPv4_ADDRESS *IpAddress) {
+  EFI_STATUS   Status;
+  DNS_LOOKUP   Lookup;
+
+  if(Instance == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+  
+  if(Hostname == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if(IpAddress == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  ZeroMem(&Lookup, sizeof(DNS_LOOKUP));
+
+  Lookup.Hostname     = Hostname;
+  Lookup.QType        = 1;
+  Lookup.Addresses    = IpAddress;
+  Lookup.MaxAddresses = 1;
+
+  Status = ResolveDNSLookups(Instance, &Lookup, 1);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  return Lookup.Status;
+} // End of GetHostByName
+
+
+/**
+  Takes the next free buffer from the transmit ring.  If they are all busy
+  the oldest is cancelled once it has been in flight for
+  DNSCLIENT_TX_TIMEOUT_MS, and until then the caller has to wait for it.
+  Completed transmits signal the engine from then on.
+
+  @param[in]  Instance  The Private data to be used.
+  @param[out] TxBuffer  Receives the free buffer, or the busy one to wait for.
+
+  @retval EFI_SUCCESS     *TxBuffer is free.
+  @retval EFI_NOT_READY   Every buffer is busy.  (*TxBuffer)->Expires is when the oldest is cancelled.
+  */
+STATIC EFI_STATUS DNSImplGetTxBuffer(DNSCLIENT_PRIVATE_DATA *Instance, DNS_TX_BUFFER **TxBuffer) {
+  DNS_TX_BUFFER   *Candidate;
+  UINTN           i;
+
+  for(i = 0; i < DNSCLIENT_TX_RING_SIZE; ++i) {
+    Candidate        = &Instance->TxRing[Instance->TxNext];
+    Instance->TxNext = (Instance->TxNext + 1) % DNSCLIENT_TX_RING_SIZE;
+
+    if(Candidate->IsDone) {
+      Candidate->Query = NULL;
+      *TxBuffer        = Candidate;
+      return EFI_SUCCESS;
+    }
+  }
+
+  //
+  // TxNext has wrapped back around to the oldest buffer.  The flag goes up
+  // before the buffer is looked at again, so a transmit completing in
+  // between still runs the engine.
+  //
+  Candidate           = &Instance->TxRing[Instance->TxNext];
+  *TxBuffer           = Candidate;
+  Instance->TxWaiting = TRUE;
+
+  if(!Candidate->IsDone && DNSImplGetTimeNs() < Candidate->Expires) {
+    return EFI_NOT_READY;
+  }
+
+  if(!Candidate->IsDone) {
+    DNSImplUdpCancel(Candidate->Interface, &Candidate->Token);
+    Candidate->IsDone = TRUE;
+  }
+
+  Instance->TxNext = (Instance->TxNext + 1) % DNSCLIENT_TX_RING_SIZE;
+  Candidate->Query = NULL;
+
+  return EFI_SUCCESS;
+} // End of DNSImplGetTxBuffer
+
+
+/**
+  Cancels any transmit still sending the name of a query, so the query's slot
+  can be reused.
+
+  @param[in] Instance  The Private data to be used.
+  @param[in] Query     The query being released.
+  */
+STATIC VOID DNSImplCancelTransmits(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PENDING_QUERY *Query) {
+  DNS_TX_BUFFER   *TxBuffer;
+  UINTN           i;
+
+  for(i = 0; i < DNSCLIENT_TX_RING_SIZE; ++i) {
+    TxBuffer = &Instance->TxRing[i];
+
+    if(TxBuffer->Query == Query && !TxBuffer->IsDone) {
+      DNSImplUdpCancel(TxBuffer->Interface, &TxBuffer->Token);
+      TxBuffer->IsDone = TRUE;
+    }
+
+    if(TxBuffer->Query == Query) {
+      TxBuffer->Query = NULL;
+    }
+  }
+} // End of DNSImplCancelTransmits
+
+
+/**
+  UDP payload size to advertise to a server, or 0 if its queries go out
+  without an OPT record.
+ */
+#define DNSImplEdnsPayload(Instance, Server)   ((Instance)->Servers[(Server)].NoEdns ? 0 : (Instance)->EdnsPayloadSize)
+
+
+/**
+  Transmits a pending query from the transmit ring without waiting for the
+  transmit to complete.  The header and fixed question fields are written into
+  the ring buffer and the name goes out straight from the pending query through
+  the fragment table, so nothing is allocated or concatenated.
+
+  @param[in]  Instance   The Private data to be used.
+  @param[in]  Query      The query to send.  Query->Id must be set.
+  @param[in]  Server     Index of the server to send to.
+  @param[in]  Interface  The interface to send on.
+
+  @retval EFI_SUCCESS    The query has been handed to the Udp4 or Udp6 child.
+  @retval EFI_NOT_READY  Every transmit buffer is busy.  Query->Wait and Query->WaitUntil say until when.
+  @retval other          An error occured.
+  */
+STATIC EFI_STATUS DNSImplSendQuery(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PENDING_QUERY *Query, UINTN Server, DNS_INTERFACE *Interface) {
+  EFI_STATUS               Status;
+  DNS_TX_BUFFER            *TxBuffer;
+  EFI_UDP4_FRAGMENT_DATA   *Fragments;
+  UINT64                   Allocations;
+  UINT16                   PayloadSize;
+  UINT32                   OptLength;
+
+  Allocations = gDNSClientAllocations;
+
+  if(DNSImplGetTxBuffer(Instance, &TxBuffer) == EFI_NOT_READY) {
+    Query->Wait      = DnsWaitTransmit;
+    Query->WaitUntil = TxBuffer->Expires;
+
+    return EFI_NOT_READY;
+  }
+
+  PERF_START(Instance->Image, DNSCLIENT_PERF_ENCODE, NULL, 0);
+
+  PayloadSize = DNSImplEdnsPayload(Instance, Server);
+  OptLength   = (PayloadSize != 0) ? DNS_OPT_LENGTH : 0;
+
+  //
+  // The OPT record sits right after the fixed question fields, so both go
+  // out in the same fragment.
+  //
+  DNSWriteHeader(TxBuffer->Data, Query->Id, 1, (OptLength != 0) ? 1 : 0);
+  DNSWriteQuestionTail(TxBuffer->Data + DNS_HEADER_LENGTH, Query->QType);
+
+  if(OptLength != 0) {
+    DNSWriteOpt(TxBuffer->Data + DNS_HEADER_LENGTH + 4, PayloadSize);
+  }
+
+  ZeroMem(&TxBuffer->Session, sizeof(TxBuffer->Session));
+
+  //
+  // EFI_UDP6_FRAGMENT_DATA is laid out the same as EFI_UDP4_FRAGMENT_DATA, so
+  // the fragment table is filled in the same way for either.
+  //
+  if(Interface->IsIp6) {
+    Fragments = (EFI_UDP4_FRAGMENT_DATA*) TxBuffer->TxData.Udp6.TxData.FragmentTable;
+
+    CopyMem(&TxBuffer->Session.Udp6.DestinationAddress, &Instance->Servers[Server].Address.v6, sizeof(EFI_IPv6_ADDRESS));
+    TxBuffer->Session.Udp6.DestinationPort = 53;
+
+    TxBuffer->TxData.Udp6.TxData.UdpSessionData = &TxBuffer->Session.Udp6;
+    TxBuffer->TxData.Udp6.TxData.FragmentCount  = 3;
+    TxBuffer->TxData.Udp6.TxData.DataLength     = DNS_HEADER_LENGTH + (UINT32) Query->QNameLength + 4 + OptLength;
+    TxBuffer->Token.Udp6.Packet.TxData          = &TxBuffer->TxData.Udp6.TxData;
+  } else {
+    Fragments = TxBuffer->TxData.Udp4.TxData.FragmentTable;
+
+    TxBuffer->Session.Udp4.SourcePort         = 53;
+    TxBuffer->Session.Udp4.DestinationAddress = Instance->Servers[Server].Address.v4;
+    TxBuffer->Session.Udp4.DestinationPort    = 53;
+
+    TxBuffer->TxData.Udp4.TxData.UdpSessionData = &TxBuffer->Session.Udp4;
+    TxBuffer->TxData.Udp4.TxData.GatewayAddress = NULL;
+    TxBuffer->TxData.Udp4.TxData.FragmentCount  = 3;
+    TxBuffer->TxData.Udp4.TxData.DataLength     = DNS_HEADER_LENGTH + (UINT32) Query->QNameLength + 4 + OptLength;
+    TxBuffer->Token.Udp4.Packet.TxData          = &TxBuffer->TxData.Udp4.TxData;
+  }
+
+  Fragments[0].FragmentLength = DNS_HEADER_LENGTH;
+  Fragments[0].FragmentBuffer = TxBuffer->Data;
+  Fragments[1].FragmentLength = (UINT32) Query->QNameLength;
+  Fragments[1].FragmentBuffer = Query->QName;
+  Fragments[2].FragmentLength = 4 + OptLength;
+  Fragments[2].FragmentBuffer = TxBuffer->Data + DNS_HEADER_LENGTH;
+
+  TxBuffer->Token.Udp4.Status = EFI_SUCCESS;
+  TxBuffer->IsDone             = FALSE;
+  TxBuffer->Query              = Query;
+  TxBuffer->Interface          = Interface;
+  TxBuffer->Expires            = DNSImplGetTimeNs() + DNSCLIENT_TX_TIMEOUT_MS * NS_PER_MS;
+
+  PERF_END(Instance->Image, DNSCLIENT_PERF_ENCODE, NULL, 0);
+
+  //
+  // Closed by DNSImplTransmitCallback once the driver is done with the buffer.
+  //
+  PERF_START(TxBuffer, DNSCLIENT_PERF_TRANSMIT, NULL, 0);
+
+  if(Interface->IsIp6) {
+    Status = Interface->Udp6->Transmit(Interface->Udp6, &TxBuffer->Token.Udp6);
+  } else {
+    Status = Interface->Udp4->Transmit(Interface->Udp4, &TxBuffer->Token.Udp4);
+  }
+
+  if(EFI_ERROR(Status)) {
+    PERF_END(TxBuffer, DNSCLIENT_PERF_TRANSMIT, NULL, 0);
+
+    TxBuffer->IsDone = TRUE;
+    TxBuffer->Query  = NULL;
+
+    //
+    // The interface lost its address.  It is left alone until a later
+    // refresh finds it configured again.
+    //
+    if(Status == EFI_NO_MAPPING) {
+      Interface->Configured = FALSE;
+    }
+
+    return Status;
+  }
+
+  if(OptLength != 0) {
+    Query->EdnsTo |= 1 << Server;
+  } else {
+    Query->EdnsTo &= ~(1 << Server);
+  }
+
+  ++(Interface->Sent);
+  ++(Instance->Servers[Server].Sent);
+  ++(Instance->Stats.QueriesSent);
+  Instance->Stats.SendAllocations += gDNSClientAllocations - Allocations;
+
+  return EFI_SUCCESS;
+} // End of DNSImplSendQuery
+
+
+/**
+  Size of the RDATA of an A or an AAAA record, and of a character of the name
+  a PTR lookup receives.
+ */
+#define DNSImplAddressSize(QType)   (((QType) == 28) ? sizeof(EFI_IPv6_ADDRESS) : ((QType) == 12) ? sizeof(CHAR8) : sizeof(EFI_IPv4_ADDRESS))
+
+/**
+  Copies packed addresses into a lookup, as many as it has room for.  For a
+  PTR lookup RData is the target name in wire format, as it is cached, and
+  is decoded into the lookup's buffer if it fits.
+
+  @param[in]  Lookup       The lookup.
+  @param[in]  RData        Packed RDATA of A or AAAA records, or a wire format name, as Lookup->QType says.
+  @param[in]  RDataLength  Length of RData in bytes.
+  @param[in]  RecordCount  Number of records packed in RData.
+  */
+STATIC VOID DNSImplSetAddresses(DNS_LOOKUP *Lookup, CONST VOID *RData, UINTN RDataLength, UINTN RecordCount) {
+  EFI_UDP4_FRAGMENT_DATA   Fragment;
+  DNS_CURSOR               Cursor;
+  UINTN                    Length;
+
+  //
+  // The decoder is held to the RDATA, a name running past it is rejected
+  // rather than read beyond.
+  //
+  if(Lookup->QType == 12) {
+    Fragment.FragmentLength = (UINT32) RDataLength;
+    Fragment.FragmentBuffer = (VOID*) RData;
+
+    DNSCursorInit(&Cursor, &Fragment, 1);
+
+    Lookup->AddressCount = EFI_ERROR(DecodeDNSName(&Cursor, Lookup->Addresses, Lookup->MaxAddresses, &Length)) ? 0 : 1;
+    return;
+  }
+
+  Lookup->AddressCount = MIN(MIN(RecordCount, RDataLength / DNSImplAddressSize(Lookup->QType)), Lookup->MaxAddresses);
+
+  CopyMem(Lookup->Addresses, RData, Lookup->AddressCount * DNSImplAddressSize(Lookup->QType));
+} // End of DNSImplSetAddresses
+
+
+/**
+  Answers a query from the cache, following any cached aliases.  If the chain
+  of aliases is cached but the addresses at its end are not, the query is
+  moved along to the name the chain ends at, so only the missing part of the
+  chain is asked for on the wire.
+
+  @param[in]  Instance   The Private data to be used.
+  @param[in]  Query      The query to answer.
+  @param[out] Lookup     The lookup the query belongs to.  Receives the cached addresses.
+
+  @retval TRUE           The name was cached and the addresses have been set.
+  @retval FALSE          The name has to be looked up on the wire.
+  */
+STATIC BOOLEAN DNSImplLookupCache(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PENDING_QUERY *Query, DNS_LOOKUP *Lookup) {
+  DNS_CACHE_ENTRY   *Entry;
+  UINT64            Now;
+
+  Now = DNSImplGetTimeNs();
+
+  for(;;) {
+    Entry = DNSCacheLookup(&Instance->Cache, Query->QName, Query->QNameLength, Query->QType, Now);
+
+    if(Entry != NULL && Entry->RecordCount != 0) {
+      DNSImplSetAddresses(Lookup, Entry->RData, Entry->RDataLength, Entry->RecordCount);
+      Lookup->Ttl = DNSCacheRemainingTtl(Entry, Now);
+      return TRUE;
+    }
+
+    Entry = DNSCacheLookup(&Instance->Cache, Query->QName, Query->QNameLength, 5, Now);
+
+    if(Entry == NULL || Entry->RDataLength > sizeof(Query->QName) || Query->Links >= DNS_MAX_CNAME_CHAIN) {
+      return FALSE;
+    }
+
+    CopyMem(Query->QName, Entry->RData, Entry->RDataLength);
+
+    Query->QNameLength = Entry->RDataLength;
+    ++(Query->Links);
+  }
+} // End of DNSImplLookupCache
+
+
+/**
+  Caches the records of one RRset under the name they belong to.
+
+  @param[in]  Instance     The Private data to be used.
+  @param[in]  Name         Owner of the records, as a dotted hostname.
+  @param[in]  QType        Type of the records.
+  @param[in]  Ttl          Smallest TTL of the records.
+  @param[in]  RData        Packed RDATA of the records.
+  @param[in]  RDataLength  Length of RData in bytes.
+  @param[in]  RecordCount  Number of records packed in RData.
+  */
+STATIC VOID DNSImplCacheRecords(DNSCLIENT_PRIVATE_DATA *Instance, CONST CHAR8 *Name, UINT16 QType, UINT32 Ttl, CONST VOID *RData, UINTN RDataLength, UINT16 RecordCount) {
+  UINT8   WireName[DNS_MAX_NAME_LENGTH];
+  UINTN   WireLength;
+
+  if(EFI_ERROR(EncodeDNSName(Name, WireName, sizeof(WireName), &WireLength))) {
+    return;
+  }
+
+  DNSCacheInsert(&Instance->Cache, WireName, WireLength, QType, Ttl, RData, RDataLength, RecordCount, DNSImplGetTimeNs());
+} // End of DNSImplCacheRecords
+
+
+/**
+  Compares two dotted hostnames without regard to case.
+
+  @retval TRUE         The names are the same.
+  */
+STATIC BOOLEAN DNSImplSameName(CONST CHAR8 *A, CONST CHAR8 *B) {
+  for(; *A != '\0' && DNSImplToLower(*A) == DNSImplToLower(*B); ++A, ++B);
+
+  return (BOOLEAN)(*A == *B);
+} // End of DNSImplSameName
+
+
+/**
+  Follows the chain of CNAME records in a response from the name that was
+  asked for to its A, AAAA or PTR records.  Every link of the chain and the addresses at
+  its end are cached, each under its own TTL.  Of PTR records only the first
+  is kept.  A chain which leaves the
+  response before reaching any address is continued by moving the query along
+  to the name the chain ends at.
+
+  @param[in]  Instance   The Private data to be used.
+  @param[in]  Query      The query the response answers.
+  @param[in]  Response   The decoded response.
+  @param[out] Lookup     The lookup the query belongs to.  Receives the addresses at the end of the chain.
+
+  @retval EFI_SUCCESS        The addresses have been set.
+  @retval EFI_NOT_READY      The chain is incomplete.  Query->QName is now the name it ends at.
+  @retval EFI_NOT_FOUND      The name does not exist or the response holds no record of the type asked for.
+  @retval EFI_PROTOCOL_ERROR The server responded with an error or the chain is too long.
+  */
+STATIC EFI_STATUS DNSImplFollowChain(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PENDING_QUERY *Query, DNS_PACKET *Response, DNS_LOOKUP *Lookup) {
+  DNS_ANSWER         *Answers;
+  EFI_IPv6_ADDRESS   Addresses[DNS_CACHE_MAX_RECORDS];  // Packed, 4 or 16 bytes each.
+  UINT8              Target[DNS_MAX_NAME_LENGTH];
+  UINTN              TargetLength;
+  UINTN              RecordSize;
+  CONST CHAR8        *Owner;
+  CHAR8              *Alias;
+  UINT32             AliasTtl;
+  UINT32             Ttl;
+  UINTN              Count;
+  UINTN              i;
+
+  RecordSize = DNSImplAddressSize(Query->QType);
+
+  if(Response->ExtendedRCode == 3) {
+    return EFI_NOT_FOUND;
+  }
+
+  if(Response->ExtendedRCode != 0) {
+    return EFI_PROTOCOL_ERROR;
+  }
+
+  Answers = (DNS_ANSWER*)(Response->Data + sizeof(DNS_QUESTION) * Response->Header.QdCount);
+  Owner   = ((DNS_QUESTION*) Response->Data)->QName;
+
+  for(;;) {
+    Alias    = NULL;
+    AliasTtl = 0;
+    Ttl      = 0xFFFFFFFF;
+    Count    = 0;
+
+    for(i = 0; i < Response->Header.AnCount; ++i) {
+      if(Answers[i].RData == NULL || !DNSImplSameName(Answers[i].Name, Owner)) {
+        continue;
+      }
+
+      //
+      // The name a PTR record points to is packed in wire format, which
+      // EncodeDNSName checks is no longer than a name may be.  RecordSize
+      // becomes its length, so the RDATA cached below is Count * RecordSize
+      // bytes as it is for addresses.
+      //
+      if(Answers[i].Type == Query->QType && Query->QType == 12) {
+        if(Count == 0 && !EFI_ERROR(EncodeDNSName(((PTR_RECORD*)Answers[i].RData)->Name, (UINT8*) Addresses, sizeof(Addresses), &RecordSize))) {
+          Count = 1;
+          Ttl   = Answers[i].TTL;
+        }
+
+        continue;
+      }
+
+      //
+      // A_RECORD and AAAA_RECORD hold nothing but the address.
+      //
+      if(Answers[i].Type == Query->QType && Count < DNS_CACHE_MAX_RECORDS) {
+        CopyMem((UINT8*) Addresses + Count++ * RecordSize, Answers[i].RData, RecordSize);
+        Ttl = MIN(Ttl, Answers[i].TTL);
+      } else if(Answers[i].Type == 5) {
+        Alias    = ((CNAME_RECORD*)Answers[i].RData)->Name;
+        AliasTtl = Answers[i].TTL;
+      }
+    }
+
+    if(Count != 0) {
+      DNSImplCacheRecords(Instance, Owner, Query->QType, Ttl, Addresses, Count * RecordSize, (UINT16) Count);
+      DNSImplSetAddresses(Lookup, Addresses, Count * RecordSize, Count);
+      Lookup->Ttl = Ttl;
+
+      return EFI_SUCCESS;
+    }
+
+    if(Alias == NULL) {
+      break;
+    }
+
+    //
+    // A chain that never ends, or loops back on itself, is cut off.
+    //
+    if(++(Query->Links) > DNS_MAX_CNAME_CHAIN ||
+       EFI_ERROR(EncodeDNSName(Alias, Target, sizeof(Target), &TargetLength))) {
+      return EFI_PROTOCOL_ERROR;
+    }
+
+    DNSImplCacheRecords(Instance, Owner, 5, AliasTtl, Target, TargetLength, 1);
+
+    Owner = Alias;
+  }
+
+  if(Owner == ((DNS_QUESTION*) Response->Data)->QName) {
+    return EFI_NOT_FOUND;
+  }
+
+  CopyMem(Query->QName, Target, TargetLength);
+  Query->QNameLength = TargetLength;
+
+  return EFI_NOT_READY;
+} // End of DNSImplFollowChain
+
+
+/**
+  Frees a pending query's slot, cancelling any transmit still using its name.
+
+  @param[in] Instance  The Private data to be used.
+  @param[in] Query     The query to release.
+  */
+STATIC VOID DNSImplReleaseQuery(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PENDING_QUERY *Query) {
+  DNSImplCancelTransmits(Instance, Query);
+
+  if(Query->State == DnsQueryProbe) {
+    --(Instance->ProbeCount);
+  }
+
+  Query->State = DnsQueryFree;
+  --(Instance->PendingCount);
+} // End of DNSImplReleaseQuery
+
+
+/**
+  Finds the fastest configured interface of one address family, as
+  DNSImplFaster ranks them.
+
+  @param[in] Instance  The Private data to be used.
+  @param[in] IsIp6     TRUE for the Udp6 interfaces, FALSE for the Udp4 ones.
+
+  @retval DNSCLIENT_MAX_INTERFACES  No interface has an address.
+  @retval other                     Index of the interface.
+  */
+STATIC UINTN DNSImplFastestInterface(DNSCLIENT_PRIVATE_DATA *Instance, BOOLEAN IsIp6) {
+  DNS_RTT   *Best;
+  DNS_RTT   *Rtt;
+  UINTN     Fastest;
+  UINTN     i;
+
+  Fastest = DNSCLIENT_MAX_INTERFACES;
+  Best    = NULL;
+
+  for(i = 0; i < Instance->InterfaceCount; ++i) {
+    if(!Instance->Interfaces[i].Configured || Instance->Interfaces[i].IsIp6 != IsIp6) {
+      continue;
+    }
+
+    Rtt = &Instance->Interfaces[i].Rtt;
+
+    if(Best == NULL || DNSImplFaster(Rtt, Best)) {
+      Fastest = i;
+      Best    = Rtt;
+    }
+  }
+
+  return Fastest;
+} // End of DNSImplFastestInterface
+
+
+/**
+  Drops a TCP connection which has broken, been closed by the server or has
+  to make room for another.  Queries waiting on an answer over it are due
+  again at once rather than when their round times out.
+
+  @param[in] Instance    The Private data to be used.
+  @param[in] Connection  The connection.
+  @param[in] Reason      Reported for those queries if nothing else answers them.
+  */
+STATIC VOID DNSImplTcpLost(DNSCLIENT_PRIVATE_DATA *Instance, DNS_TCP_CONNECTION *Connection, EFI_STATUS Reason) {
+  DNS_PENDING_QUERY   *Query;
+  EFI_IP_ADDRESS      Address;
+  UINTN               Server;
+  UINTN               i;
+
+  ZeroMem(&Address, sizeof(EFI_IP_ADDRESS));
+  CopyMem(&Address.v4, &Connection->Address, sizeof(EFI_IPv4_ADDRESS));
+
+  DNSImplCloseTcp(Instance, Connection, FALSE);
+
+  Server = DNSImplFindServer(Instance, &Address, FALSE);
+
+  if(Server == DNSCLIENT_MAX_SERVERS) {
+    return;
+  }
+
+  for(i = 0; i < DNSCLIENT_MAX_PENDING; ++i) {
+    Query = &Instance->Pending[i];
+
+    if(Query->State != DnsQueryActive || !Query->OverTcp || (Query->Outstanding & (1 << Server)) == 0) {
+      continue;
+    }
+
+    Query->Outstanding &= ~(1 << Server);
+    Query->LastError    = Reason;
+
+    if(Query->Outstanding == 0) {
+      Query->RetryAt = DNSImplGetTimeNs();
+    }
+  }
+} // End of DNSImplTcpLost
+
+
+/**
+  Picks up the result of opening a TCP connection.  A server which refuses
+  the connection, or does not accept it within DNSCLIENT_TCP_CONNECT_TIMEOUT_MS,
+  is not tried over TCP again.
+
+  @param[in] Instance    The Private data to be used.
+  @param[in] Connection  A connection being established.
+
+  @retval EFI_SUCCESS    The connection is established.
+  @retval EFI_NOT_READY  The connection is still being established.
+  @retval other          The connection failed and has been closed.
+  */
+STATIC EFI_STATUS DNSImplTcpFinishConnect(DNSCLIENT_PRIVATE_DATA *Instance, DNS_TCP_CONNECTION *Connection) {
+  EFI_STATUS       Status;
+  EFI_IP_ADDRESS   Address;
+  UINTN            Server;
+
+  if(Connection->ConnectDone) {
+    Status = Connection->ConnectToken.CompletionToken.Status;
+  } else if(DNSImplGetTimeNs() >= Connection->ConnectBy) {
+    Status = EFI_TIMEOUT;
+  } else {
+    return EFI_NOT_READY;
+  }
+
+  if(!EFI_ERROR(Status)) {
+    Connection->Connected = TRUE;
+
+    ++(Instance->Stats.TcpConnects);
+
+    return EFI_SUCCESS;
+  }
+
+  ZeroMem(&Address, sizeof(EFI_IP_ADDRESS));
+  CopyMem(&Address.v4, &Connection->Address, sizeof(EFI_IPv4_ADDRESS));
+
+  Server = DNSImplFindServer(Instance, &Address, FALSE);
+
+  if(Server != DNSCLIENT_MAX_SERVERS && (Status == EFI_TIMEOUT || Status == EFI_CONNECTION_REFUSED || Status == EFI_CONNECTION_RESET)) {
+    Instance->Servers[Server].NoTcp = TRUE;
+    ++(Instance->Stats.TcpResets);
+  }
+
+  DNSImplCloseTcp(Instance, Connection, FALSE);
+
+  return Status;
+} // End of DNSImplTcpFinishConnect
+
+
+/**
+  Picks up a completed connect or receive on a TCP connection.  The bytes
+  received are added to the stream in its buffer.  A receive which failed,
+  or which completed empty, means the server has closed the connection.
+
+  @param[in] Instance    The Private data to be used.
+  @param[in] Connection  The connection.
+  */
+STATIC VOID DNSImplTcpService(DNSCLIENT_PRIVATE_DATA *Instance, DNS_TCP_CONNECTION *Connection) {
+  EFI_STATUS   Status;
+
+  if(Connection->Child != NULL && !Connection->Connected) {
+    DNSImplTcpFinishConnect(Instance, Connection);
+    return;
+  }
+
+  if(!Connection->RxPosted || !Connection->RxDone) {
+    return;
+  }
+
+  Connection->RxPosted = FALSE;
+
+  Status = Connection->RxToken.CompletionToken.Status;
+
+  if(EFI_ERROR(Status) || Connection->RxData.DataLength == 0) {
+    ++(Instance->Stats.TcpResets);
+
+    DNSImplTcpLost(Instance, Connection, EFI_ERROR(Status) ? Status : EFI_ABORTED);
+    return;
+  }
+
+  Connection->Length += Connection->RxData.DataLength;
+} // End of DNSImplTcpService
+
+
+/**
+  Posts a receive on a TCP connection into the free end of its buffer,
+  unless one is posted already.  What is left of the stream after the
+  messages already handed out is moved to the front of the buffer first.
+
+  @param[in] Instance    The Private data to be used.
+  @param[in] Connection  The connection.
+  */
+STATIC VOID DNSImplTcpPostReceive(DNSCLIENT_PRIVATE_DATA *Instance, DNS_TCP_CONNECTION *Connection) {
+  EFI_STATUS   Status;
+
+  if(Connection->RxPosted || !Connection->Connected) {
+    return;
+  }
+
+  if(Connection->Consumed != 0) {
+    CopyMem(Connection->Buffer, Connection->Buffer + Connection->Consumed, Connection->Length - Connection->Consumed);
+
+    Connection->Length  -= Connection->Consumed;
+    Connection->Consumed = 0;
+  }
+
+  if(Connection->Length == DNS_TCP_BUFFER_SIZE) {
+    return;
+  }
+
+  Connection->RxDone                         = FALSE;
+  Connection->RxToken.CompletionToken.Status = EFI_SUCCESS;
+  Connection->RxToken.Packet.RxData          = &Connection->RxData;
+
+  Connection->RxData.UrgentFlag                      = FALSE;
+  Connection->RxData.DataLength                      = (UINT32)(DNS_TCP_BUFFER_SIZE - Connection->Length);
+  Connection->RxData.FragmentCount                   = 1;
+  Connection->RxData.FragmentTable[0].FragmentLength = Connection->RxData.DataLength;
+  Connection->RxData.FragmentTable[0].FragmentBuffer = Connection->Buffer + Connection->Length;
+
+  Status = Connection->Tcp4->Receive(Connection->Tcp4, &Connection->RxToken);
+
+  if(EFI_ERROR(Status)) {
+    ++(Instance->Stats.TcpResets);
+
+    DNSImplTcpLost(Instance, Connection, Status);
+    return;
+  }
+
+  Connection->RxPosted = TRUE;
+} // End of DNSImplTcpPostReceive
+
+
+/**
+  Finds the open TCP connection to a server, opening one if there is none.
+  When every slot is taken the connection used least recently is dropped.
+  A server which refuses the connection, or does not accept it in time, is
+  not tried over TCP again.
+
+  @param[in]  Instance    The Private data to be used.
+  @param[in]  Server      Index of an IPv4 server.
+  @param[out] Connection  Receives the connection.
+
+  @retval EFI_SUCCESS     The connection is established.
+  @retval EFI_NOT_READY   The connection is still being established.  (*Connection)->ConnectBy is when it is given up on.
+  @retval EFI_NO_MAPPING  No Udp4 interface has an address.
+  @retval EFI_UNSUPPORTED The server has just failed to accept a connection.
+  @retval other           The connection could not be opened.
+  */
+STATIC EFI_STATUS DNSImplGetTcpConnection(DNSCLIENT_PRIVATE_DATA *Instance, UINTN Server, DNS_TCP_CONNECTION **Connection) {
+  EFI_STATUS           Status;
+  DNS_TCP_CONNECTION   *Candidate;
+  DNS_TCP_CONNECTION   *Free;
+  DNS_TCP_CONNECTION   *Oldest;
+  EFI_IPv4_ADDRESS     *Address;
+  UINTN                Via;
+  UINTN                i;
+
+  Address = &Instance->Servers[Server].Address.v4;
+  Free    = NULL;
+  Oldest  = NULL;
+
+  for(i = 0; i < DNSCLIENT_MAX_TCP_CONNECTIONS; ++i) {
+    Candidate = &Instance->TcpConnections[i];
+
+    //
+    // Notice a connection the server has closed since it was last used.
+    //
+    DNSImplTcpService(Instance, Candidate);
+
+    if(Candidate->Child == NULL) {
+      if(Free == NULL) {
+        Free = Candidate;
+      }
+
+      continue;
+    }
+
+    if(EFI_IP4_EQUAL(&Candidate->Address, Address)) {
+      *Connection = Candidate;
+      return Candidate->Connected ? EFI_SUCCESS : EFI_NOT_READY;
+    }
+
+    if(Oldest == NULL || Candidate->LastUsed < Oldest->LastUsed) {
+      Oldest = Candidate;
+    }
+  }
+
+  //
+  // Its connection may have been given up on just now.
+  //
+  if(Instance->Servers[Server].NoTcp) {
+    return EFI_UNSUPPORTED;
+  }
+
+  Via = DNSImplFastestInterface(Instance, FALSE);
+
+  if(Via == DNSCLIENT_MAX_INTERFACES) {
+    return EFI_NO_MAPPING;
+  }
+
+  if(Free == NULL) {
+    Free = Oldest;
+
+    DNSImplTcpLost(Instance, Oldest, EFI_ABORTED);
+  }
+
+  Status = DNSImplOpenTcp(Instance, Free, Address, Via);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  //
+  // A driver may complete the connect before returning from it.
+  //
+  *Connection = Free;
+
+  return DNSImplTcpFinishConnect(Instance, Free);
+} // End of DNSImplGetTcpConnection
+
+
+/**
+  Takes the next free buffer from a TCP connection's transmit ring.  If they
+  are all busy the caller has to wait for the oldest.  A write can not be
+  cancelled halfway through a stream, so a connection whose oldest write has
+  not completed within DNSCLIENT_TX_TIMEOUT_MS is given up on.
+
+  @param[in]  Instance    The Private data to be used.
+  @param[in]  Connection  The connection.
+  @param[out] TxBuffer    Receives the free buffer, or the busy one to wait for.
+
+  @retval EFI_SUCCESS     *TxBuffer is free.
+  @retval EFI_NOT_READY   Every buffer is busy.  (*TxBuffer)->Expires is when the connection is given up on.
+  @retval EFI_TIMEOUT     The connection is stuck.
+  */
+STATIC EFI_STATUS DNSImplGetTcpTxBuffer(DNSCLIENT_PRIVATE_DATA *Instance, DNS_TCP_CONNECTION *Connection, DNS_TCP_TX_BUFFER **TxBuffer) {
+  DNS_TCP_TX_BUFFER   *Candidate;
+  UINTN               i;
+
+  for(i = 0; i < DNSCLIENT_TCP_TX_RING_SIZE; ++i) {
+    Candidate          = &Connection->TxRing[Connection->TxNext];
+    Connection->TxNext = (Connection->TxNext + 1) % DNSCLIENT_TCP_TX_RING_SIZE;
+
+    if(Candidate->IsDone) {
+      *TxBuffer = Candidate;
+      return EFI_SUCCESS;
+    }
+  }
+
+  Candidate           = &Connection->TxRing[Connection->TxNext];
+  *TxBuffer           = Candidate;
+  Instance->TxWaiting = TRUE;
+
+  if(Candidate->IsDone) {
+    Connection->TxNext = (Connection->TxNext + 1) % DNSCLIENT_TCP_TX_RING_SIZE;
+    return EFI_SUCCESS;
+  }
+
+  return (DNSImplGetTimeNs() < Candidate->Expires) ? EFI_NOT_READY : EFI_TIMEOUT;
+} // End of DNSImplGetTcpTxBuffer
+
+
+/**
+  Writes a query to the TCP connection of an IPv4 server without waiting for
+  the write to complete, let alone for the answer.  Any number of queries can
+  be outstanding on the connection at once (RFC 7766 section 6.2.1.1).
+
+  @param[in] Instance  The Private data to be used.
+  @param[in] Query     The query to send.  Query->Id must be set.
+  @param[in] Server    Index of the server to send to.
+
+  @retval EFI_SUCCESS    The query has been handed to the Tcp4 child.
+  @retval EFI_NOT_READY  The connection is being established or its buffers are busy.  Query->Wait and Query->WaitUntil say until when.
+  @retval other          The connection could not be opened or has broken.
+  */
+STATIC EFI_STATUS DNSImplTcpSendQuery(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PENDING_QUERY *Query, UINTN Server) {
+  EFI_STATUS           Status;
+  DNS_TCP_CONNECTION   *Connection;
+  DNS_TCP_TX_BUFFER    *TxBuffer;
+  UINT8                *Message;
+  UINTN                Length;
+  UINT64               Allocations;
+  UINT16               PayloadSize;
+
+  Allocations = gDNSClientAllocations;
+
+  Status = DNSImplGetTcpConnection(Instance, Server, &Connection);
+
+  //
+  // Opening the connection allocated its receive buffer.
+  //
+  if(Status == EFI_NOT_READY) {
+    Query->Wait      = DnsWaitConnect;
+    Query->WaitUntil = Connection->ConnectBy;
+
+    Instance->Stats.SendAllocations += gDNSClientAllocations - Allocations;
+
+    return EFI_NOT_READY;
+  }
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  Status = DNSImplGetTcpTxBuffer(Instance, Connection, &TxBuffer);
+
+  if(Status == EFI_NOT_READY) {
+    Query->Wait      = DnsWaitTransmit;
+    Query->WaitUntil = TxBuffer->Expires;
+
+    return EFI_NOT_READY;
+  }
+
+  if(EFI_ERROR(Status)) {
+    ++(Instance->Stats.TcpResets);
+
+    DNSImplTcpLost(Instance, Connection, EFI_TIMEOUT);
+    return EFI_TIMEOUT;
+  }
+
+  //
+  // The message goes out in a single write, length prefix and all, so the
+  // server never has to wait on a second segment to start parsing it.
+  //
+  PayloadSize = DNSImplEdnsPayload(Instance, Server);
+  Length      = DNS_HEADER_LENGTH + Query->QNameLength + 4 + ((PayloadSize != 0) ? DNS_OPT_LENGTH : 0);
+  Message     = TxBuffer->Data + DNS_TCP_LENGTH_PREFIX;
+
+  TxBuffer->Data[0] = (UINT8)(Length >> 8);
+  TxBuffer->Data[1] = (UINT8) Length;
+
+  DNSWriteHeader(Message, Query->Id, 1, (PayloadSize != 0) ? 1 : 0);
+  CopyMem(Message + DNS_HEADER_LENGTH, Query->QName, Query->QNameLength);
+  DNSWriteQuestionTail(Message + DNS_HEADER_LENGTH + Query->QNameLength, Query->QType);
+
+  //
+  // The server can tell it is talking EDNS from the OPT record, even though
+  // the payload size means nothing over TCP.
+  //
+  if(PayloadSize != 0) {
+    DNSWriteOpt(Message + DNS_HEADER_LENGTH + Query->QNameLength + 4, PayloadSize);
+  }
+
+  TxBuffer->TxData.Push                            = TRUE;
+  TxBuffer->TxData.Urgent                          = FALSE;
+  TxBuffer->TxData.DataLength                      = (UINT32)(DNS_TCP_LENGTH_PREFIX + Length);
+  TxBuffer->TxData.FragmentCount                   = 1;
+  TxBuffer->TxData.FragmentTable[0].FragmentLength = TxBuffer->TxData.DataLength;
+  TxBuffer->TxData.FragmentTable[0].FragmentBuffer = TxBuffer->Data;
+
+  TxBuffer->Token.Packet.TxData          = &TxBuffer->TxData;
+  TxBuffer->Token.CompletionToken.Status = EFI_SUCCESS;
+  TxBuffer->IsDone                       = FALSE;
+  TxBuffer->Expires                      = DNSImplGetTimeNs() + DNSCLIENT_TX_TIMEOUT_MS * NS_PER_MS;
+
+  Status = Connection->Tcp4->Transmit(Connection->Tcp4, &TxBuffer->Token);
+
+  if(EFI_ERROR(Status)) {
+    TxBuffer->IsDone = TRUE;
+
+    ++(Instance->Stats.TcpResets);
+
+    DNSImplTcpLost(Instance, Connection, Status);
+    return Status;
+  }
+
+  Connection->LastUsed = DNSImplGetTimeNs();
+
+  Query->SentVia  |= 1 << Connection->Interface;
+  Query->RoundVia |= 1 << Connection->Interface;
+
+  if(PayloadSize != 0) {
+    Query->EdnsTo |= 1 << Server;
+  } else {
+    Query->EdnsTo &= ~(1 << Server);
+  }
+
+  ++(Instance->Interfaces[Connection->Interface].Sent);
+  ++(Instance->Servers[Server].Sent);
+  ++(Instance->Stats.QueriesSent);
+  ++(Instance->Stats.TcpQueries);
+  Instance->Stats.SendAllocations += gDNSClientAllocations - Allocations;
+
+  return EFI_SUCCESS;
+} // End of DNSImplTcpSendQuery
+
+
+/**
+  Sends a query to a server on one interface and records that it went out there.
+
+  @param[in]      Instance   The Private data to be used.
+  @param[in]      Query      The query to send.
+  @param[in]      Server     Index of the server to send to.
+  @param[in]      Interface  Index of the interface to send on.
+  @param[in/out]  Status     Set to EFI_SUCCESS once any interface has sent the
+                             query, otherwise to the first error, or to
+                             EFI_NOT_READY if the query has to wait.
+
+  @retval EFI_STATUS         The result of this transmission.
+  */
+STATIC EFI_STATUS DNSImplSendVia(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PENDING_QUERY *Query, UINTN Server, UINTN Interface, EFI_STATUS *Status) {
+  EFI_STATUS   SendStatus;
+
+  SendStatus = DNSImplSendQuery(Instance, Query, Server, &Instance->Interfaces[Interface]);
+
+  if(EFI_ERROR(SendStatus)) {
+    if(*Status == EFI_NO_MAPPING || (EFI_ERROR(*Status) && SendStatus == EFI_NOT_READY)) {
+      *Status = SendStatus;
+    }
+
+    return SendStatus;
+  }
+
+  Query->SentVia  |= 1 << Interface;
+  Query->RoundVia |= 1 << Interface;
+  *Status          = EFI_SUCCESS;
+
+  return EFI_SUCCESS;
+} // End of DNSImplSendVia
+
+
+/**
+  Sends one attempt at a query to a server and extends the current round's
+  timeout to cover it.  The query goes out on every configured interface of
+  the server's address family when Instance->FanOut is set, otherwise on the
+  fastest one.  An interface which has not been sent on yet is tried as well,
+  so a faster link than the one in use gets noticed.
+
+  A query marked OverTcp is written to the server's TCP connection instead,
+  if it is an IPv4 server.  Should that fail the query goes out over UDP
+  after all, and whatever comes back is taken as it is, truncated or not.
+
+  A query which can not be transmitted at all, with nothing else outstanding,
+  is due again at once so it moves straight on to the next server.  One which
+  has to wait for its TCP connection or a transmit buffer is left with
+  Query->Wait set, and DNSImplRetransmit makes the attempt again.
+
+  @param[in] Instance  The Private data to be used.
+  @param[in] Query     The query to send.
+  @param[in] Server    Index of the server to send to.
+  @param[in] Now       Current monotonic time in ns.
+  */
+STATIC VOID DNSImplAttemptQuery(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PENDING_QUERY *Query, UINTN Server, UINT64 Now) {
+  EFI_STATUS      Status;
+  DNS_INTERFACE   *Interface;
+  BOOLEAN         IsIp6;
+  BOOLEAN         Stream;
+  UINT64          Expires;
+  UINT32          Probed;
+  UINTN           Fastest;
+  UINTN           i;
+
+  ++(Query->Attempts);
+
+  IsIp6 = Instance->Servers[Server].IsIp6;
+
+  Query->Server         = Server;
+  Query->SentAt[Server] = Now;
+
+  Status = EFI_NO_MAPPING;
+  Stream = FALSE;
+  Probed = 0;
+
+  if(Query->OverTcp && !IsIp6 && !Instance->Servers[Server].NoTcp) {
+    Status = DNSImplTcpSendQuery(Instance, Query, Server);
+    Stream = !EFI_ERROR(Status);
+  }
+
+  if(!Stream && Status != EFI_NOT_READY) {
+    Status = EFI_NO_MAPPING;
+
+    for(i = 0; i < Instance->InterfaceCount; ++i) {
+      Interface = &Instance->Interfaces[i];
+
+      if(Interface->Configured && Interface->IsIp6 == IsIp6 && (Instance->FanOut || Interface->Sent == 0)) {
+        DNSImplSendVia(Instance, Query, Server, i, &Status);
+        Probed |= 1 << i;
+      }
+    }
+
+    //
+    // An interface which turns out to have lost its address is dropped by
+    // DNSImplSendQuery, so the next fastest is tried rather than failing the
+    // attempt over to another server.
+    //
+    while(!Instance->FanOut) {
+      Fastest = DNSImplFastestInterface(Instance, IsIp6);
+
+      if(Fastest == DNSCLIENT_MAX_INTERFACES || (Probed & (1 << Fastest)) != 0) {
+        break;
+      }
+
+      if(DNSImplSendVia(Instance, Query, Server, Fastest, &Status) != EFI_NO_MAPPING) {
+        break;
+      }
+    }
+  }
+
+  //
+  // The attempt is counted once, when it finally goes out.
+  //
+  if(Status == EFI_NOT_READY) {
+    --(Query->Attempts);
+    return;
+  }
+
+  Query->Wait = DnsWaitNone;
+
+  //
+  // Once a server has been reached, what it did (or did not) send back is
+  // worth more than an attempt which never left for want of an interface.
+  //
+  if(EFI_ERROR(Status)) {
+    if(Status != EFI_NO_MAPPING || Query->SentTo == 0) {
+      Query->LastError = Status;
+    }
+
+    if(Query->Outstanding == 0) {
+      Query->RetryAt = Now;
+    }
+  } else {
+    //
+    // An answer over TCP may take several segments, and the driver does its
+    // own retransmitting underneath, so it is given twice as long.
+    //
+    Expires = Now + (Stream ? (Instance->Servers[Server].Rtt.Rto << 1) : Instance->Servers[Server].Rtt.Rto);
+
+    if(Query->Outstanding == 0 || Query->RetryAt < Expires) {
+      Query->RetryAt = Expires;
+    }
+
+    Query->SentTo      |= 1 << Server;
+    Query->Outstanding |= 1 << Server;
+    Query->LastError    = EFI_TIMEOUT;
+  }
+
+  Query->RetryAt = MIN(Query->RetryAt, Query->Deadline);
+} // End of DNSImplAttemptQuery
+
+
+/**
+  Picks the server a query goes to next: Server itself, or failing that the
+  first one after it on the list with a configured interface of its address
+  family.  An IPv6 server is no use without a Udp6 child to reach it by.
+
+  @param[in] Instance  The Private data to be used.
+  @param[in] Server    The server next in line.
+
+  @retval UINTN        The server to use.  Server if none can be reached.
+  */
+STATIC UINTN DNSImplReachableServer(DNSCLIENT_PRIVATE_DATA *Instance, UINTN Server) {
+  UINTN   Candidate;
+  UINTN   i, j;
+
+  for(i = 0; i < Instance->ServerCount; ++i) {
+    Candidate = (Server + i) % Instance->ServerCount;
+
+    for(j = 0; j < Instance->InterfaceCount; ++j) {
+      if(Instance->Interfaces[j].Configured && Instance->Interfaces[j].IsIp6 == Instance->Servers[Candidate].IsIp6) {
+        return Candidate;
+      }
+    }
+  }
+
+  return Server;
+} // End of DNSImplReachableServer
+
+
+/**
+  Orders the servers fastest first, as DNSImplFaster ranks them.  Servers
+  which are just as fast keep their order on the list.
+
+  @param[in]  Instance  The Private data to be used.
+  @param[out] Order     Receives ServerCount server indices.
+  */
+STATIC VOID DNSImplRankServers(DNSCLIENT_PRIVATE_DATA *Instance, UINT8 *Order) {
+  UINTN   i, j;
+  UINT8   Server;
+
+  for(i = 0; i < Instance->ServerCount; ++i) {
+    Server = (UINT8) i;
+
+    for(j = i; j > 0 && DNSImplFaster(&Instance->Servers[Server].Rtt, &Instance->Servers[Order[j - 1]].Rtt); --j) {
+      Order[j] = Order[j - 1];
+    }
+
+    Order[j] = Server;
+  }
+} // End of DNSImplRankServers
+
+
+/**
+  Sends the next leg of a raced query.
+
+  @param[in] Instance  The Private data to be used.
+  @param[in] Query     The raced query.
+  @param[in] Now       Current monotonic time in ns.
+  */
+STATIC VOID DNSImplRaceLeg(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PENDING_QUERY *Query, UINT64 Now) {
+  UINTN   Server;
+
+  Server = Query->RaceOrder[Query->RaceNext++];
+
+  ++(Instance->Servers[Server].Races);
+
+  DNSImplAttemptQuery(Instance, Query, Server, Now);
+
+  Query->RaceAt = Now + Instance->RaceStagger;
+} // End of DNSImplRaceLeg
+
+
+/**
+  Makes the first round of attempts at a new query.  Normally that is a single
+  transmission to the preferred server.  When racing, the query goes to the
+  RaceWidth fastest servers at once, or RaceStagger apart.
+
+  @param[in] Instance  The Private data to be used.
+  @param[in] Query     The query to start.  Query->Id must be set.
+  @param[in] Now       Current monotonic time in ns.
+  */
+STATIC VOID DNSImplStartQuery(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PENDING_QUERY *Query, UINT64 Now) {
+  Query->Attempts    = 0;
+  Query->SentTo      = 0;
+  Query->EdnsTo      = 0;
+  Query->Outstanding = 0;
+  Query->SentVia     = 0;
+  Query->RoundVia    = 0;
+  Query->Retried     = FALSE;
+  Query->FirstSent   = Now;
+  Query->RetryAt     = Now;
+  Query->Deadline    = Now + MultU64x32(NS_PER_MS, PcdGet32(PcdDnsClientMaxLookupTime));
+  Query->RaceCount   = 0;
+  Query->RaceNext    = 0;
+  Query->Wait        = DnsWaitNone;
+  Query->OverTcp     = Instance->UseTcp;
+
+  if(Instance->RaceWidth < 2 || Instance->ServerCount < 2) {
+    DNSImplAttemptQuery(Instance, Query, DNSImplReachableServer(Instance, Instance->ActiveServer), Now);
+    return;
+  }
+
+  DNSImplRankServers(Instance, Query->RaceOrder);
+
+  Query->RaceCount = MIN(Instance->RaceWidth, Instance->ServerCount);
+
+  do {
+    DNSImplRaceLeg(Instance, Query, Now);
+  } while(Instance->RaceStagger == 0 && Query->RaceNext < Query->RaceCount);
+} // End of DNSImplStartQuery
+
+
+/**
+  Returns when a query next needs attention: the wait of its attempt running
+  out, its round timing out or the next leg of a staggered race.
+
+  @param[in] Query     The query.
+
+  @retval UINT64       Monotonic time in ns.
+  */
+STATIC UINT64 DNSImplQueryWake(DNS_PENDING_QUERY *Query) {
+  if(Query->Wait != DnsWaitNone) {
+    return Query->WaitUntil;
+  }
+
+  if(Query->RaceNext < Query->RaceCount && Query->RaceAt < Query->RetryAt) {
+    return Query->RaceAt;
+  }
+
+  return Query->RetryAt;
+} // End of DNSImplQueryWake
+
+
+/**
+  Sends any staggered race legs which are due, retransmits every pending query
+  whose round has timed out to the next server on the list which can be
+  reached, and gives up on those which are out of attempts or time.  A probe
+  which has gone unanswered until its deadline has its server's timeout
+  backed off.
+
+  @param[in]      Instance   The Private data to be used.
+  @param[in]      Now        Current monotonic time in ns.
+  */
+STATIC VOID DNSImplRetransmit(DNSCLIENT_PRIVATE_DATA *Instance, UINT64 Now) {
+  DNS_PENDING_QUERY   *Query;
+  DNS_SERVER          *Server;
+  DNS_INTERFACE       *Interface;
+  UINTN               Next;
+  UINTN               i, j;
+
+  //
+  // Raised again below by any query which is still waiting on a buffer.
+  //
+  Instance->TxWaiting = FALSE;
+
+  for(i = 0; i < DNSCLIENT_MAX_PENDING; ++i) {
+    Query = &Instance->Pending[i];
+
+    if(Query->State == DnsQueryFree || Query->State == DnsQueryHeld) {
+      continue;
+    }
+
+    //
+    // An attempt which had to wait is made again.  Nothing else happens to
+    // the query until it has gone out, which it does once its wait runs out
+    // at the latest, one way or another.
+    //
+    if(Query->Wait != DnsWaitNone) {
+      DNSImplAttemptQuery(Instance, Query, Query->Server, Now);
+
+      if(Query->Wait != DnsWaitNone) {
+        continue;
+      }
+
+      if(Query->State == DnsQueryProbe) {
+        Query->RetryAt = (Query->Outstanding != 0) ? Query->Deadline : Now;
+      }
+    }
+
+    if(Query->State == DnsQueryProbe) {
+      if(Query->RetryAt <= Now) {
+        ++(Instance->Servers[Query->Server].Timeouts);
+        DNSImplBackOffRtt(&Instance->Servers[Query->Server].Rtt);
+
+        DNSImplReleaseQuery(Instance, Query);
+      }
+
+      continue;
+    }
+
+    if(Query->RaceNext < Query->RaceCount && Query->RaceAt <= Now) {
+      DNSImplRaceLeg(Instance, Query, Now);
+    }
+
+    if(Query->RetryAt > Now) {
+      continue;
+    }
+
+    //
+    // Every server of the round which went unanswered, and every interface
+    // the round went out on without an answer coming back, has its timeout
+    // backed off as RFC 6298 section 5.5 describes.
+    //
+    for(j = 0; j < Instance->ServerCount; ++j) {
+      if((Query->Outstanding & (1 << j)) == 0) {
+        continue;
+      }
+
+      Server = &Instance->Servers[j];
+
+      ++(Server->Timeouts);
+      DNSImplBackOffRtt(&Server->Rtt);
+    }
+
+    for(j = 0; j < Instance->InterfaceCount; ++j) {
+      if((Query->RoundVia & (1 << j)) == 0) {
+        continue;
+      }
+
+      Interface = &Instance->Interfaces[j];
+
+      ++(Interface->Timeouts);
+      DNSImplBackOffRtt(&Interface->Rtt);
+    }
+
+    Query->Outstanding = 0;
+    Query->RoundVia    = 0;
+    Query->RaceNext    = Query->RaceCount;
+
+    if(Query->Attempts >= PcdGet32(PcdDnsClientMaxAttempts) || Now >= Query->Deadline) {
+      Query->Lookup->Status  = Query->LastError;
+      Query->Lookup->Elapsed = Now - Query->Lookup->Started;
+
+      //
+      // Only a query no server answered in time has timed out.  One which
+      // was refused, or never got out, has failed.
+      //
+      if(Query->LastError == EFI_TIMEOUT) {
+        ++(Instance->Stats.Timeouts);
+      } else {
+        ++(Instance->Stats.Failures);
+      }
+      ++(Query->Token->Completed);
+
+      DNSImplReleaseQuery(Instance, Query);
+      continue;
+    }
+
+    Query->Retried = TRUE;
+
+    Next = DNSImplReachableServer(Instance, (Query->Server + 1) % Instance->ServerCount);
+
+    ++(Instance->Stats.Retransmits);
+    ++(Instance->Servers[Next].Retries);
+
+    DNSImplAttemptQuery(Instance, Query, Next, Now);
+  }
+} // End of DNSImplRetransmit
+
+
+/**
+  Checks that a response carries the question a query asked.  Names are
+  compared without regard to case.
+
+  @param[in] Query     The query.
+  @param[in] Response  The decoded response.
+
+  @retval TRUE         The response answers Query.
+  */
+STATIC BOOLEAN DNSImplMatchQuestion(DNS_PENDING_QUERY *Query, DNS_PACKET *Response) {
+  DNS_QUESTION   *Question;
+  UINT8          Name[DNS_MAX_NAME_LENGTH];
+  UINTN          NameLength;
+  UINTN          i;
+
+  if(Response->Header.QdCount != 1) {
+    return FALSE;
+  }
+
+  Question = (DNS_QUESTION*) Response->Data;
+
+  if(Question->QType != Query->QType) {
+    return FALSE;
+  }
+
+  if(EFI_ERROR(EncodeDNSName(Question->QName, Name, sizeof(Name), &NameLength)) || NameLength != Query->QNameLength) {
+    return FALSE;
+  }
+
+  for(i = 0; i < NameLength; ++i) {
+    if(DNSImplToLower(Name[i]) != DNSImplToLower(Query->QName[i])) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+} // End of DNSImplMatchQuestion
+
+
+/**
+  Checks whether a server turned down the OPT record a query carried: it
+  answered FORMERR or NOTIMP without an OPT record of its own, or BADVERS
+  (RFC 6891 section 7).  The server is marked NoEdns, so from now on its
+  queries go out without one.
+
+  @param[in] Instance  The Private data to be used.
+  @param[in] Query     The query answered.
+  @param[in] Response  The answer.
+  @param[in] Server    Index of the server which answered.
+
+  @retval TRUE         The OPT record was rejected.  The query should be sent again.
+  @retval FALSE        The answer stands as it is.
+  */
+STATIC BOOLEAN DNSImplEdnsRejected(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PENDING_QUERY *Query, DNS_PACKET *Response, UINTN Server) {
+  if((Query->EdnsTo & (1 << Server)) == 0) {
+    return FALSE;
+  }
+
+  if(Response->HasOpt) {
+    if(Response->ExtendedRCode != 16) {
+      return FALSE;
+    }
+  } else if(Response->ExtendedRCode != 1 && Response->ExtendedRCode != 4) {
+    return FALSE;
+  }
+
+  if(!Instance->Servers[Server].NoEdns) {
+    Instance->Servers[Server].NoEdns = TRUE;
+    ++(Instance->Stats.EdnsFallbacks);
+  }
+
+  return TRUE;
+} // End of DNSImplEdnsRejected
+
+
+/**
+  Starts measuring the round trip time of every server which has not been
+  probed yet, with a query for the root name servers sent to all of them at
+  once.  Each probe takes a free pending slot and is answered, or given up
+  on after DNSCLIENT_PROBE_TIMEOUT_MS, by the engine.  A server which no
+  interface of its address family can reach has its timeout backed off
+  straight away.
+
+  @param[in] Instance  The Private data to be used.
+
+  @retval TRUE         A round of probes has been started, some may already be over.
+  @retval FALSE        Every server has been probed already, or no interface has an address.
+  */
+STATIC BOOLEAN DNSImplStartProbes(DNSCLIENT_PRIVATE_DATA *Instance) {
+  DNS_PENDING_QUERY   *Query;
+  UINT64              Now, Deadline;
+  UINTN               Slot;
+  UINTN               i;
+
+  for(i = 0; i < Instance->ServerCount && Instance->Servers[i].Probed; ++i);
+
+  if(i == Instance->ServerCount) {
+    return FALSE;
+  }
+
+  if(DNSImplFastestInterface(Instance, FALSE) == DNSCLIENT_MAX_INTERFACES &&
+     DNSImplFastestInterface(Instance, TRUE) == DNSCLIENT_MAX_INTERFACES) {
+    return FALSE;
+  }
+
+  Now      = DNSImplGetTimeNs();
+  Deadline = Now + DNSCLIENT_PROBE_TIMEOUT_MS * NS_PER_MS;
+  Slot     = 0;
+
+  for(i = 0; i < Instance->ServerCount; ++i) {
+    if(Instance->Servers[i].Probed) {
+      continue;
+    }
+
+    Instance->Servers[i].Probed = TRUE;
+
+    //
+    // There are fewer servers than slots, and at most one lookup is held
+    // while the probes run.
+    //
+    while(Instance->Pending[Slot].State != DnsQueryFree) {
+      ++Slot;
+    }
+
+    Query = &Instance->Pending[Slot];
+
+    ZeroMem(Query, sizeof(DNS_PENDING_QUERY));
+
+    Query->QName[0]    = 0;
+    Query->QNameLength = 1;
+    Query->QType       = 2;               // NS
+    Query->Id          = ++(Instance->IdIterator);
+    Query->State       = DnsQueryProbe;
+    Query->FirstSent   = Now;
+    Query->Deadline    = Deadline;
+
+    ++(Instance->PendingCount);
+    ++(Instance->ProbeCount);
+
+    DNSImplAttemptQuery(Instance, Query, i, Now);
+
+    if(Query->Outstanding == 0 && Query->Wait == DnsWaitNone) {
+      DNSImplBackOffRtt(&Instance->Servers[i].Rtt);
+      DNSImplReleaseQuery(Instance, Query);
+      continue;
+    }
+
+    //
+    // A probe is sent once and waited on until the deadline.
+    //
+    Query->RetryAt = Deadline;
+  }
+
+  return TRUE;
+} // End of DNSImplStartProbes
+
+
+/**
+  Puts a lookup on the wire under a new id.
+
+  @param[in] Instance  The Private data to be used.
+  @param[in] Query     The lookup's query, encoded.
+  @param[in] Now       Current monotonic time in ns.
+  */
+STATIC VOID DNSImplLaunchQuery(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PENDING_QUERY *Query, UINT64 Now) {
+  Query->Id    = ++(Instance->IdIterator);
+  Query->State = DnsQueryActive;
+
+  DNSImplStartQuery(Instance, Query, Now);
+} // End of DNSImplLaunchQuery
+
+
+/**
+  Marks the network ready and sends the lookups which were held while it
+  was being brought up.  Their time is counted from now, so the probes do
+  not count against them.
+
+  @param[in] Instance  The Private data to be used.
+  */
+STATIC VOID DNSImplNetworkUp(DNSCLIENT_PRIVATE_DATA *Instance) {
+  DNS_PENDING_QUERY   *Query;
+  UINT64              Now;
+  UINTN               i;
+
+  Now = DNSImplGetTimeNs();
+
+  Instance->Network   = DnsNetworkReady;
+  Instance->NextIssue = Now + Instance->IssueInterval;
+
+  for(i = 0; i < DNSCLIENT_MAX_PENDING; ++i) {
+    Query = &Instance->Pending[i];
+
+    if(Query->State == DnsQueryHeld) {
+      Query->Lookup->Started = Now;
+
+      DNSImplLaunchQuery(Instance, Query, Now);
+    }
+  }
+} // End of DNSImplNetworkUp
+
+
+/**
+  Ends a round of probes once the last of them has been answered or given
+  up on.  The fastest server to answer becomes the preferred one.
+
+  @param[in] Instance  The Private data to be used.
+  */
+STATIC VOID DNSImplEndProbes(DNSCLIENT_PRIVATE_DATA *Instance) {
+  UINT8   Order[DNSCLIENT_MAX_SERVERS];
+
+  DNSImplRankServers(Instance, Order);
+
+  Instance->ActiveServer = Order[0];
+
+  DNSImplNetworkUp(Instance);
+} // End of DNSImplEndProbes
+
+
+/**
+  Gets the network ready for the first query of the current requests which
+  has to go on the wire.  Interfaces which have gained an address since the
+  last request are picked up, and servers which are new (all of them, the
+  first time) are probed.  Queries are held until the probes are over.
+
+  @param[in] Instance    The Private data to be used.
+
+  @retval EFI_SUCCESS    Queries can be sent, or will be once the probes are over.
+  @retval EFI_NO_MAPPING No interface has an address.
+  @retval EFI_NOT_READY  No DNS server is known.
+  */
+STATIC EFI_STATUS DNSImplPrepareNetwork(DNSCLIENT_PRIVATE_DATA *Instance) {
+  if(DNSImplRefreshInterfaces(Instance) == 0) {
+    return EFI_NO_MAPPING;
+  }
+
+  if(Instance->ServerCount == 0) {
+    return EFI_NOT_READY;
+  }
+
+  if(!DNSImplStartProbes(Instance)) {
+    DNSImplNetworkUp(Instance);
+  } else if(Instance->ProbeCount == 0) {
+    DNSImplEndProbes(Instance);
+  } else {
+    Instance->Network = DnsNetworkProbing;
+  }
+
+  return EFI_SUCCESS;
+} // End of DNSImplPrepareNetwork
+
+
+/**
+  Returns the oldest request which still has lookups to start.
+
+  @param[in] Instance  The Private data to be used.
+
+  @retval NULL         Every lookup of every request has been started.
+  */
+STATIC DNS_RESOLVE_TOKEN* DNSImplNextToken(DNSCLIENT_PRIVATE_DATA *Instance) {
+  LIST_ENTRY          *Link;
+  DNS_RESOLVE_TOKEN   *Token;
+
+  for(Link = GetFirstNode(&Instance->Requests); !IsNull(&Instance->Requests, Link); Link = GetNextNode(&Instance->Requests, Link)) {
+    Token = DNS_RESOLVE_TOKEN_FROM_LINK(Link);
+
+    if(Token->Next < Token->Count) {
+      return Token;
+    }
+  }
+
+  return NULL;
+} // End of DNSImplNextToken
+
+
+/**
+  Finishes a request.  Its queries are released, lookups which did not
+  complete are set to Status if that is an error, and the caller's event is
+  signaled.  Once no request is left the receives are taken back, and the
+  network is brought up afresh for the next one.
+
+  @param[in] Instance  The Private data to be used.
+  @param[in] Token     The request, on Instance->Requests.
+  @param[in] Status    Result of the request.
+  */
+STATIC VOID DNSImplEndRequest(DNSCLIENT_PRIVATE_DATA *Instance, DNS_RESOLVE_TOKEN *Token, EFI_STATUS Status) {
+  DNS_PENDING_QUERY   *Query;
+  UINTN               i;
+
+  for(i = 0; i < DNSCLIENT_MAX_PENDING; ++i) {
+    Query = &Instance->Pending[i];
+
+    if(Query->State != DnsQueryFree && Query->Token == Token) {
+      DNSImplReleaseQuery(Instance, Query);
+    }
+  }
+
+  if(EFI_ERROR(Status)) {
+    for(i = 0; i < Token->Count; ++i) {
+      if(Token->Lookups[i].Status == EFI_NOT_READY) {
+        Token->Lookups[i].Status = Status;
+      }
+    }
+  }
+
+  RemoveEntryList(&Token->Link);
+
+  Token->Status = Status;
+
+  if(Token->Event != NULL) {
+    gBS->SignalEvent(Token->Event);
+  }
+
+  if(!IsListEmpty(&Instance->Requests)) {
+    return;
+  }
+
+  //
+  // Probes still running are abandoned, and their servers probed again
+  // with the next request.
+  //
+  for(i = 0; i < DNSCLIENT_MAX_PENDING; ++i) {
+    Query = &Instance->Pending[i];
+
+    if(Query->State == DnsQueryProbe) {
+      Instance->Servers[Query->Server].Probed = FALSE;
+
+      DNSImplReleaseQuery(Instance, Query);
+    }
+  }
+
+  CancelDNSReceive(Instance);
+
+  Instance->Network = DnsNetworkIdle;
+
+  gBS->SetTimer(Instance->Engine, TimerCancel, 0);
+} // End of DNSImplEndRequest
+
+
+/**
+  Takes lookups off the requests, oldest first, for as long as the window
+  of outstanding queries and the issue rate allow.  Lookups the cache
+  answers complete here.  The first which has to go on the wire brings the
+  network up, so requests answered entirely from the cache send nothing.
+
+  @param[in] Instance  The Private data to be used.
+  */
+STATIC VOID DNSImplIssueLookups(DNSCLIENT_PRIVATE_DATA *Instance) {
+  EFI_STATUS          Status;
+  DNS_RESOLVE_TOKEN   *Token;
+  DNS_PENDING_QUERY   *Query;
+  DNS_LOOKUP          *Lookup;
+  UINT64              Now;
+  UINTN               Window;
+  UINTN               i;
+
+  Window = MAX(1, MIN(Instance->Window, DNSCLIENT_MAX_PENDING));
+  Now    = DNSImplGetTimeNs();
+
+  while(Instance->Network != DnsNetworkProbing && Instance->PendingCount < Window && Instance->NextIssue <= Now) {
+    Token = DNSImplNextToken(Instance);
+
+    if(Token == NULL) {
+      break;
+    }
+
+    Lookup = &Token->Lookups[Token->Next++];
+
+    if(Lookup->Status != EFI_NOT_READY) {
+      continue;
+    }
+
+    for(i = 0; Instance->Pending[i].State != DnsQueryFree; ++i);
+
+    Instance->NextIssue += Instance->IssueInterval;
+
+    //
+    // The name is encoded once, straight into the pending query, and is
+    // used from there as the cache key and the QNAME on the wire.
+    //
+    Query = &Instance->Pending[i];
+
+    Query->QType    = Lookup->QType;
+    Query->Links    = 0;
+    Query->Token    = Token;
+    Query->Lookup   = Lookup;
+    Lookup->Status  = EFI_INVALID_PARAMETER;
+    Lookup->Started = Now;
+
+    if(Lookup->Hostname != NULL && (Lookup->QType == 1 || Lookup->QType == 28 || Lookup->QType == 12) && (Lookup->Addresses != NULL || Lookup->MaxAddresses == 0)) {
+      PERF_START(Instance->Image, DNSCLIENT_PERF_ENCODE, NULL, 0);
+      Lookup->Status = EncodeDNSName(Lookup->Hostname, Query->QName, sizeof(Query->QName), &Query->QNameLength);
+      PERF_END(Instance->Image, DNSCLIENT_PERF_ENCODE, NULL, 0);
+    }
 
-  @retval EFI_SUCCESS  The Private variable has been initalized successfully.
-  @retval other        An error occured. Private is unitalized.
+    if(EFI_ERROR(Lookup->Status)) {
+      ++(Token->Completed);
+      continue;
+    }
+
+    //
+    // Names we already know never touch the wire.
+    //
+    if(DNSImplLookupCache(Instance, Query, Lookup)) {
+      Lookup->Status = EFI_SUCCESS;
+      ++(Token->Completed);
+      continue;
+    }
+
+    Lookup->Status = EFI_NOT_READY;
+    Query->State   = DnsQueryHeld;
+
+    ++(Instance->PendingCount);
+
+    if(Instance->Network == DnsNetworkIdle) {
+      Status = DNSImplPrepareNetwork(Instance);
+
+      if(EFI_ERROR(Status)) {
+        DNSImplEndRequest(Instance, Token, Status);
+        continue;
+      }
+
+      Now = DNSImplGetTimeNs();
+    }
+
+    if(Instance->Network == DnsNetworkReady && Query->State == DnsQueryHeld) {
+      DNSImplLaunchQuery(Instance, Query, Now);
+    }
+  }
+} // End of DNSImplIssueLookups
+
+
+/**
+  Matches a response to the query or probe it answers and moves that along.
+  Anything we are not waiting on (a late duplicate, a stray datagram, a
+  response from a server the query never went to, on an interface it was
+  not sent on or to a different question) is dropped.
+
+  @param[in] Instance  The Private data to be used.
+  @param[in] Response  The decoded response.
+  @param[in] Source    Address the response came from.
+  @param[in] Via       Index of the interface it arrived on.
   */
-EFI_STATUS EFIAPI CreateDNSClient(DNSCLIENT_PRIVATE_DATA *Instance) {
-  EFI_STATUS                               Status;
-  EFI_HANDLE                               *HandleBuffer;
-  UINTN                                    HandleCount;
+STATIC VOID DNSImplHandleResponse(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PACKET *Response, EFI_IP_ADDRESS *Source, UINTN Via) {
+  DNS_PENDING_QUERY   *Query;
+  DNS_LOOKUP          *Lookup;
+  DNS_INTERFACE       *Interface;
+  UINT64              Now;
+  UINTN               Server;
+  UINTN               i;
+
+  Query  = NULL;
+  Server = DNSImplFindServer(Instance, Source, Instance->Interfaces[Via].IsIp6);
+
+  for(i = 0; i < DNSCLIENT_MAX_PENDING && Server < DNSCLIENT_MAX_SERVERS; ++i) {
+    if((Instance->Pending[i].State == DnsQueryActive || Instance->Pending[i].State == DnsQueryProbe) && Instance->Pending[i].Id == Response->Header.Id) {
+      Query = &Instance->Pending[i];
+      break;
+    }
+  }
 
-  HandleBuffer = NULL;
-  HandleCount  = 0;
-  Status       = EFI_ABORTED;
+  if(Query == NULL || Response->Header.Qr != 1 || (Query->SentTo & (1 << Server)) == 0 || (Query->SentVia & (1 << Via)) == 0 || !DNSImplMatchQuestion(Query, Response)) {
+    return;
+  }
 
-  if(Instance == NULL) {
-    return EFI_INVALID_PARAMETER;
+  Now       = DNSImplGetTimeNs();
+  Interface = &Instance->Interfaces[Via];
+
+  ++(Instance->Servers[Server].Answered);
+  ++(Interface->Answered);
+
+  if(Query->State == DnsQueryProbe) {
+    DNSImplSampleRtt(&Instance->Servers[Server].Rtt, Now - Query->SentAt[Server]);
+    DNSImplSampleRtt(&Interface->Rtt, Now - Query->SentAt[Server]);
+    DNSImplRecordRtt(&Instance->Servers[Server], Now - Query->SentAt[Server]);
+
+    //
+    // A server which rejects the probe's OPT record still answered in
+    // time.  Its real queries just go without one.
+    //
+    DNSImplEdnsRejected(Instance, Query, Response, Server);
+
+    DNSImplReleaseQuery(Instance, Query);
+    return;
+  }
+
+  if(Response->HasOpt) {
+    ++(Instance->Stats.EdnsAnswers);
   }
 
-  Instance->Udp4Sb     = NULL;
-  Instance->IdIterator = 0;
+  Query->Outstanding &= ~(1 << Server);
+  Query->RoundVia    &= ~(1 << Via);
 
   //
-  // Retrieve the list of handles that support the Udp4ServiceBindingProtocol.
+  // Karn's algorithm: once a round has been retransmitted there is no
+  // telling which transmission was answered, so only first rounds are timed.
+  // Answers over TCP are not timed either, they say little about how
+  // quickly a datagram comes back.
   //
-  Status = gBS->LocateHandleBuffer(
-    ByProtocol,
-    &gEfiUdp4ServiceBindingProtocolGuid,
-    NULL,
-    &HandleCount,
-    &HandleBuffer
-  );
+  if(!Query->Retried && !Query->OverTcp) {
+    DNSImplSampleRtt(&Instance->Servers[Server].Rtt, Now - Query->SentAt[Server]);
+    DNSImplSampleRtt(&Interface->Rtt, Now - Query->SentAt[Server]);
+    DNSImplRecordRtt(&Instance->Servers[Server], Now - Query->SentAt[Server]);
+  }
 
   //
-  // Exit if there was an error, or we don't have any handles.
+  // A server which is failing or refusing us is skipped as soon as no
+  // other server of the round is still expected to answer, rather than
+  // waiting for a timeout.
   //
-  if(EFI_ERROR(Status) || (HandleCount == 0) || (HandleBuffer == NULL)) {
-    return EFI_ABORTED;
+  if(DNSImplEdnsRejected(Instance, Query, Response, Server)) {
+    //
+    // The server does not understand EDNS.  It is asked again straight
+    // away without an OPT record.
+    //
+    DNSImplAttemptQuery(Instance, Query, Server, Now);
+    return;
+  }
+
+  if(Response->ExtendedRCode == 2 || Response->ExtendedRCode == 5) {
+    Query->LastError = EFI_PROTOCOL_ERROR;
+
+    if(Query->Outstanding == 0 && Query->RaceNext >= Query->RaceCount) {
+      Query->RetryAt = Now;
+    }
+
+    return;
+  }
+
+  if(Response->Header.Tc && !Query->OverTcp && !Instance->Servers[Server].IsIp6 && !Instance->Servers[Server].NoTcp) {
+    //
+    // The answer did not fit in a datagram.  The same server is asked
+    // again over TCP, and any legs of a race still to be sent are not.
+    //
+    ++(Instance->Stats.Truncated);
+
+    Query->OverTcp  = TRUE;
+    Query->RaceNext = Query->RaceCount;
+
+    DNSImplAttemptQuery(Instance, Query, Server, Now);
+    return;
+  }
+
+  if(Response->Header.Tc) {
+    ++(Instance->Stats.Truncated);
+  }
+
+  Lookup         = Query->Lookup;
+  Lookup->Status = DNSImplFollowChain(Instance, Query, Response, Lookup);
+
+  if(Query->RaceCount > 1) {
+    ++(Instance->Servers[Server].Wins);
+  }
+
+  if((Query->SentVia & (Query->SentVia - 1)) != 0) {
+    ++(Interface->Wins);
   }
 
   //
-  // Select the first handle then release the buffer.
+  // The preferred server had its chance and another answered instead,
+  // so new queries start with the server that is responding.
   //
-  Instance->Udp4ServiceHandle = HandleBuffer[0];
-
-  SafeRelease(HandleBuffer);
+  if(Server != Instance->ActiveServer && Query->Retried) {
+    Instance->ActiveServer = Server;
+    ++(Instance->Stats.Failovers);
+  }
 
   //
-  // Open the Udp4ServiceBindingProtocol so we can create child handles.
+  // The CNAME chain left the response before reaching an address.  The
+  // rest of it is asked for in the same slot under a new id, unless the
+  // cache already knows it.
   //
-  Status = gBS->OpenProtocol(
-    Instance->Udp4ServiceHandle,
-    &gEfiUdp4ServiceBindingProtocolGuid,
-    (VOID **) &Instance->Udp4Sb,
-    Instance->Image,
-    Instance->Udp4ServiceHandle,
-    EFI_OPEN_PROTOCOL_GET_PROTOCOL
-  );
+  if(Lookup->Status == EFI_NOT_READY) {
+    DNSImplCancelTransmits(Instance, Query);
 
-  if(EFI_ERROR(Status)) {
-    goto ON_ERROR;
+    if(DNSImplLookupCache(Instance, Query, Lookup)) {
+      Lookup->Status = EFI_SUCCESS;
+    } else {
+      ++(Instance->Stats.ChainQueries);
+
+      Query->Id = ++(Instance->IdIterator);
+      DNSImplStartQuery(Instance, Query, Now);
+    }
   }
 
   //
-  // Crate a Udp4Protocol handle for reading.
+  // Releasing the query cancels any legs of a race still being sent.
+  // Answers from the losing servers no longer match and are dropped.
   //
-  Status = Instance->Udp4Sb->CreateChild(Instance->Udp4Sb, &Instance->Udp4Child);
+  if(Lookup->Status != EFI_NOT_READY) {
+    Lookup->Elapsed = Now - Lookup->Started;
 
-  if(EFI_ERROR(Status)) {
-    goto ON_ERROR;
+    //
+    // A name which does not exist is an answer like any other.
+    //
+    if(EFI_ERROR(Lookup->Status) && Lookup->Status != EFI_NOT_FOUND) {
+      ++(Instance->Stats.Failures);
+    }
+
+    ++(Query->Token->Completed);
+    DNSImplReleaseQuery(Instance, Query);
+  }
+} // End of DNSImplHandleResponse
+
+
+/**
+  Records a receive which completed with an error on an interface against
+  the queries which have been sent through it and are still waiting, as the
+  error to report should no answer arrive.
+
+  @param[in] Instance   The Private data to be used.
+  @param[in] Via        Index of the interface.
+  @param[in] Status     The error the receive completed with.
+  */
+STATIC VOID DNSImplReceiveFailed(DNSCLIENT_PRIVATE_DATA *Instance, UINTN Via, EFI_STATUS Status) {
+  DNS_PENDING_QUERY   *Query;
+  UINTN               i;
+
+  ++(Instance->Interfaces[Via].RxErrors);
+
+  for(i = 0; i < DNSCLIENT_MAX_PENDING; ++i) {
+    Query = &Instance->Pending[i];
+
+    if(Query->State == DnsQueryActive && (Query->RoundVia & (1 << Via)) != 0 && Query->LastError == EFI_TIMEOUT) {
+      Query->LastError = Status;
+    }
+  }
+} // End of DNSImplReceiveFailed
+
+
+/**
+  Moves every request along: finishes those which have completed, starts
+  lookups, retransmits, and handles the responses which have arrived.  Then
+  arms the engine event for the next time something is due.  Nothing here
+  waits for the network: a query whose TCP connection is still being opened,
+  or which finds every transmit buffer busy, is left waiting and made again
+  by DNSImplRetransmit.
+
+  @param[in] Instance  The Private data to be used.
+  */
+STATIC VOID DNSImplRunEngine(DNSCLIENT_PRIVATE_DATA *Instance) {
+  EFI_STATUS          Status;
+  EFI_TPL             OldTpl;
+  DNS_PACKET          *Response;
+  DNS_RESOLVE_TOKEN   *Token;
+  LIST_ENTRY          *Link, *NextLink;
+  EFI_IP_ADDRESS      Source;
+  UINT64              Now, Wake;
+  UINTN               Window;
+  UINTN               Via;
+  UINTN               Failures;
+  UINTN               i;
+
+  OldTpl   = gBS->RaiseTPL(TPL_CALLBACK);
+  Window   = MAX(1, MIN(Instance->Window, DNSCLIENT_MAX_PENDING));
+  Failures = 0;
+
+  for(;;) {
+    if(Instance->Network == DnsNetworkProbing && Instance->ProbeCount == 0) {
+      DNSImplEndProbes(Instance);
+    }
+
+    for(Link = GetFirstNode(&Instance->Requests); !IsNull(&Instance->Requests, Link); Link = NextLink) {
+      NextLink = GetNextNode(&Instance->Requests, Link);
+      Token    = DNS_RESOLVE_TOKEN_FROM_LINK(Link);
+
+      if(Token->Completed == Token->Count) {
+        DNSImplEndRequest(Instance, Token, EFI_SUCCESS);
+      }
+    }
+
+    if(IsListEmpty(&Instance->Requests)) {
+      break;
+    }
+
+    DNSImplIssueLookups(Instance);
+
+    //
+    // Nothing is outstanding but the next lookup is not due yet.
+    //
+    if(Instance->PendingCount == 0) {
+      if(DNSImplNextToken(Instance) == NULL) {
+        continue;
+      }
+
+      Now = DNSImplGetTimeNs();
+
+      if(Instance->NextIssue <= Now) {
+        continue;
+      }
+
+      gBS->SetTimer(Instance->Engine, TimerRelative, DivU64x32(Instance->NextIssue - Now, 100) + 1);
+      break;
+    }
+
+    Now = DNSImplGetTimeNs();
+
+    DNSImplRetransmit(Instance, Now);
+
+    if(Instance->PendingCount == 0 || (Instance->Network == DnsNetworkProbing && Instance->ProbeCount == 0)) {
+      continue;
+    }
+
+    //
+    // Take whatever has arrived, or otherwise sleep until the next
+    // retransmission, probe deadline or lookup is due.
+    //
+    Wake = Now + DNSCLIENT_MAX_RTO_MS * NS_PER_MS;
+
+    for(i = 0; i < DNSCLIENT_MAX_PENDING; ++i) {
+      if((Instance->Pending[i].State == DnsQueryActive || Instance->Pending[i].State == DnsQueryProbe) && DNSImplQueryWake(&Instance->Pending[i]) < Wake) {
+        Wake = DNSImplQueryWake(&Instance->Pending[i]);
+      }
+    }
+
+    if(Instance->Network != DnsNetworkProbing && Instance->PendingCount < Window && Instance->NextIssue < Wake && DNSImplNextToken(Instance) != NULL) {
+      Wake = Instance->NextIssue;
+    }
+
+    if(Wake <= Now) {
+      continue;
+    }
+
+    Via    = DNSCLIENT_MAX_INTERFACES;
+    Status = ReceiveDNSPacket(Instance, &Response, 0, &Source, &Via);
+
+    if(Status == EFI_TIMEOUT) {
+      gBS->SetTimer(Instance->Engine, TimerRelative, DivU64x32(Wake - Now, 100) + 1);
+      break;
+    }
+
+    //
+    // A datagram which is not a DNS message does not stop the other queries.
+    //
+    if(Status == EFI_PROTOCOL_ERROR) {
+      continue;
+    }
+
+    //
+    // Neither does a receive which failed on its own, an ICMP port or host
+    // unreachable from a dead server say.  Udp4 and Udp6 do not tell which
+    // server it came from, so the queries sent through the interface are
+    // left for their retransmission timer to fail over, and keep the error
+    // to report if no answer ever arrives.  A driver which keeps failing
+    // receives gets the rest of this run to itself only so many times.
+    //
+    if(EFI_ERROR(Status) && Via < Instance->InterfaceCount && Status != EFI_NOT_STARTED && Status != EFI_ACCESS_DENIED) {
+      DNSImplReceiveFailed(Instance, Via, Status);
+
+      if(++Failures < DNSCLIENT_MAX_PENDING) {
+        continue;
+      }
+
+      gBS->SetTimer(Instance->Engine, TimerRelative, DivU64x32(Wake - Now, 100) + 1);
+      break;
+    }
+
+    if(EFI_ERROR(Status)) {
+      while(!IsListEmpty(&Instance->Requests)) {
+        DNSImplEndRequest(Instance, DNS_RESOLVE_TOKEN_FROM_LINK(GetFirstNode(&Instance->Requests)), Status);
+      }
+
+      break;
+    }
+
+    DNSImplHandleResponse(Instance, Response, &Source, Via);
+
+    ReleaseDNSPacket(Response);
+  }
+
+  gBS->RestoreTPL(OldTpl);
+} // End of DNSImplRunEngine
+
+
+/**
+  Notify function of the engine event.  See DNSClientImpl.h.
+
+  @param[in] Event     The engine event.
+  @param[in] Context   The DNSCLIENT_PRIVATE_DATA.
+  */
+VOID EFIAPI DNSImplEngineNotify(IN EFI_EVENT Event, IN VOID *Context) {
+  DNSImplRunEngine((DNSCLIENT_PRIVATE_DATA*) Context);
+} // End of DNSImplEngineNotify
+
+
+/**
+  Starts a batch of lookups and returns without waiting for any of them.
+  See DNSClientImpl.h.
+
+  @param[in]      Instance     The Private data to be used.
+  @param[in/out]  Token        The batch.  Event, Lookups and Count must be filled in.
+
+  @retval EFI_SUCCESS            The batch has been started.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL, or a lookup has room for addresses but no Addresses.
+  */
+EFI_STATUS EFIAPI ResolveDNSLookupsAsync(DNSCLIENT_PRIVATE_DATA *Instance, DNS_RESOLVE_TOKEN *Token) {
+  EFI_TPL      OldTpl;
+  DNS_LOOKUP   *Lookups;
+  UINTN        i;
+
+  if(Instance == NULL || Token == NULL || (Token->Lookups == NULL && Token->Count != 0)) {
+    return EFI_INVALID_PARAMETER;
   }
 
+  Lookups = Token->Lookups;
+
   //
-  // Open our Udp4Protocol read handle.
+  // Nothing is touched until every lookup has been checked.
   //
-  Status = gBS->OpenProtocol(
-    Instance->Udp4Child,
-    &gEfiUdp4ProtocolGuid,
-    (VOID **) &Instance->Udp4,
-    Instance->Image,
-    &Instance->Udp4ServiceHandle,
-    EFI_OPEN_PROTOCOL_GET_PROTOCOL
-  );
+  for(i = 0; i < Token->Count; ++i) {
+    if(Lookups[i].Addresses == NULL && Lookups[i].MaxAddresses != 0) {
+      return EFI_INVALID_PARAMETER;
+    }
+  }
 
-  if(EFI_ERROR(Status)) {
-    goto ON_ERROR;
+  Token->Status    = EFI_NOT_READY;
+  Token->Next      = 0;
+  Token->Completed = 0;
+
+  //
+  // Names listed in the hosts file are answered before the network is
+  // touched at all.
+  //
+  for(i = 0; i < Token->Count; ++i) {
+    Lookups[i].AddressCount = 0;
+    Lookups[i].Ttl          = 0;
+    Lookups[i].Status       = EFI_NOT_READY;
+    Lookups[i].Started      = 0;
+    Lookups[i].Elapsed      = 0;
+
+    if(Lookups[i].MaxAddresses != 0) {
+      ZeroMem(Lookups[i].Addresses, Lookups[i].MaxAddresses * DNSImplAddressSize(Lookups[i].QType));
+    }
+
+    if(DNSImplLookupHosts(Instance, &Lookups[i])) {
+      ++(Token->Completed);
+    }
   }
 
-  // For details on what these following values mean see the related 
-  // definition section of EFI_UDP4_PROTOCOL.GetModeData() of the
-  // UEFI spec document (pg 1408 in UEFI_2_4_Errata_B.pdf of April, 2014).
-  ZeroMem (&Instance->Udp4CfgData, sizeof (EFI_UDP4_CONFIG_DATA));
-  Instance->Udp4CfgData.AcceptBroadcast    = FALSE;
-  Instance->Udp4CfgData.AcceptPromiscuous  = FALSE;
-  Instance->Udp4CfgData.AcceptAnyPort      = FALSE;
-  Instance->Udp4CfgData.AllowDuplicatePort = TRUE;
-  Instance->Udp4CfgData.TypeOfService      = 0;
-  Instance->Udp4CfgData.TimeToLive         = 16;
-  Instance->Udp4CfgData.DoNotFragment      = FALSE;
-  Instance->Udp4CfgData.ReceiveTimeout     = 50000;
-  Instance->Udp4CfgData.UseDefaultAddress  = TRUE;
-  Instance->Udp4CfgData.StationPort        = 53;
-  Instance->Udp4CfgData.RemotePort         = 53;
-
-  Status = Instance->Udp4->Configure(Instance->Udp4, &Instance->Udp4CfgData);
-
-  if(EFI_ERROR(Status)){
-    goto ON_ERROR;
+  OldTpl = gBS->RaiseTPL(TPL_CALLBACK);
+
+  if(IsListEmpty(&Instance->Requests)) {
+    Instance->NextIssue = DNSImplGetTimeNs();
   }
 
+  InsertTailList(&Instance->Requests, &Token->Link);
+
+  DNSImplRunEngine(Instance);
+
+  gBS->RestoreTPL(OldTpl);
+
   return EFI_SUCCESS;
+} // End of ResolveDNSLookupsAsync
 
- ON_ERROR:
 
-  SafeRelease(HandleBuffer);
+/**
+  Stops a batch submitted with ResolveDNSLookupsAsync.
+
+  @param[in] Instance            The Private data to be used.
+  @param[in] Token               The batch.
+
+  @retval EFI_SUCCESS            The batch has been stopped.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL.
+  @retval EFI_NOT_FOUND          Token is not running.
+  */
+EFI_STATUS EFIAPI CancelDNSLookups(DNSCLIENT_PRIVATE_DATA *Instance, DNS_RESOLVE_TOKEN *Token) {
+  EFI_STATUS   Status;
+  EFI_TPL      OldTpl;
+  LIST_ENTRY   *Link;
+
+  if(Instance == NULL || Token == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  OldTpl = gBS->RaiseTPL(TPL_CALLBACK);
+  Status = EFI_NOT_FOUND;
 
-  if((Instance->Udp4Sb != NULL)  && (Instance->Udp4Child != NULL)) {
-    Instance->Udp4Sb->DestroyChild(Instance->Udp4Sb, Instance->Udp4Child);
+  for(Link = GetFirstNode(&Instance->Requests); !IsNull(&Instance->Requests, Link); Link = GetNextNode(&Instance->Requests, Link)) {
+    if(Link == &Token->Link) {
+      DNSImplEndRequest(Instance, Token, EFI_ABORTED);
+
+      Status = EFI_SUCCESS;
+      break;
+    }
   }
 
+  gBS->RestoreTPL(OldTpl);
+
   return Status;
-} // End of DNSClient
+} // End of CancelDNSLookups
 
 
 /**
-  Cleans up and destroys the DNSClient's private data.
+  Polls every interface and TCP connection the client has open, then runs
+  the engine.
 
-  @param[in] Instance  The Private data to be used.
+  @param[in] Instance            The Private data to be used.
 
-  @retval EFI_SUCCESS     The private variable has been destroyed successfully.
-  @retval other           An error occured.  The private variable may not have been properly destroyed.
+  @retval EFI_SUCCESS            The client has been polled.
+  @retval EFI_INVALID_PARAMETER  Instance is NULL.
+  @retval EFI_NOT_STARTED        Nothing is open to poll yet.
   */
-EFI_STATUS EFIAPI DestroyDNSClient(DNSCLIENT_PRIVATE_DATA *Instance) {
-  EFI_STATUS   Status;
+EFI_STATUS EFIAPI PollDNSClient(DNSCLIENT_PRIVATE_DATA *Instance) {
+  BOOLEAN   Polled;
+  UINTN     i;
 
   if(Instance == NULL) {
     return EFI_INVALID_PARAMETER;
   }
 
-  if(Instance->Udp4Child != NULL) {
-    // These are hainging at the moment... not sure why...
-    Status = Instance->Udp4->Configure(Instance->Udp4, NULL);
+  Polled = FALSE;
 
-    if(!EFI_ERROR(Status)) {
-      Instance->Udp4Sb->DestroyChild(Instance->Udp4Sb, Instance->Udp4Child);
+  for(i = 0; i < Instance->InterfaceCount; ++i) {
+    if(Instance->Interfaces[i].Started) {
+      DNSImplUdpPoll(&Instance->Interfaces[i]);
+      Polled = TRUE;
     }
   }
 
-  return EFI_SUCCESS;
-} // End of DestoryDNSClient
+  for(i = 0; i < DNSCLIENT_MAX_TCP_CONNECTIONS; ++i) {
+    if(Instance->TcpConnections[i].Tcp4 != NULL) {
+      Instance->TcpConnections[i].Tcp4->Poll(Instance->TcpConnections[i].Tcp4);
+      Polled = TRUE;
+    }
+  }
+
+  DNSImplRunEngine(Instance);
+
+  return Polled ? EFI_SUCCESS : EFI_NOT_STARTED;
+} // End of PollDNSClient
+
+
+/**
+  Looks up several names, each for one type of address, at once.
+
+  Up to DNSCLIENT_MAX_PENDING queries are kept outstanding and responses are
+  matched back to their lookup by DNS_HEADER.Id, so resolving N lookups costs
+  roughly one round trip instead of N.  The A and AAAA lookups of a name go
+  out together, and either can travel over IPv4 or IPv6 depending on which
+  server is asked.
+
+  Queries go out on every interface of the server's address family with an
+  address when Instance->FanOut is set, otherwise on the one with the best
+  measured round trip time.  Before the first query goes on the wire every
+  server is probed and the fastest one is preferred.
+
+  Names listed in the hosts file are answered from it first, then from the
+  cache.  If every lookup is answered that way no interface or server is
+  touched.
+
+  A query which goes unanswered for its server's retransmission timeout is sent
+  again to the next server on the list, up to PcdDnsClientMaxAttempts times and
+  for no longer than PcdDnsClientMaxLookupTime in total.
+
+  If Instance->RaceWidth is 2 or more each query is first sent to that many
+  of the fastest servers, and the first matching answer wins.
+
+  The lookups are submitted with ResolveDNSLookupsAsync, and the client is
+  polled until they have completed.
+
+  @param[in]      Instance     The Private data to be used.
+  @param[in/out]  Lookups      Array of lookups.  AddressCount and Status are filled in.
+  @param[in]      Count        Number of entries in Lookups.
+
+  @retval EFI_SUCCESS            Every lookup has been processed, see their Status for the result of each.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL.
+  @retval EFI_NO_MAPPING         No interface has an address.
+  @retval other                  Receiving failed.  Lookups which did not complete are set to this status.
+  */
+EFI_STATUS EFIAPI ResolveDNSLookups(DNSCLIENT_PRIVATE_DATA *Instance, DNS_LOOKUP *Lookups, UINTN Count) {
+  EFI_STATUS          Status;
+  DNS_RESOLVE_TOKEN   Token;
+  UINT64              Now;
+
+  if(Instance == NULL || Lookups == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  ZeroMem(&Token, sizeof(DNS_RESOLVE_TOKEN));
+
+  Token.Lookups = Lookups;
+  Token.Count   = Count;
+
+  Status = ResolveDNSLookupsAsync(Instance, &Token);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  PERF_START(Instance->Image, DNSCLIENT_PERF_WAIT, NULL, 0);
+
+  while(Token.Status == EFI_NOT_READY) {
+    //
+    // With nothing open yet the only thing to wait for is the issue rate.
+    //
+    if(PollDNSClient(Instance) == EFI_NOT_STARTED) {
+      Now = DNSImplGetTimeNs();
+
+      if(Token.Status == EFI_NOT_READY && Instance->NextIssue > Now) {
+        gBS->Stall((UINTN) DivU64x32(Instance->NextIssue - Now + 999, 1000));
+      }
+    }
+  }
 
+  PERF_END(Instance->Image, DNSCLIENT_PERF_WAIT, NULL, 0);
 
-/**
-  Get's an ip address by a host name.
+  return Token.Status;
+} // End of ResolveDNSLookups
 
-  @param[in]      Instance   The Private data to be used.
-  @param[in]      Hostname   A null terminated string of the hostname to look up.
-  @param[in/out]  IpAddress  The address of the hostname.
 
-  @retval EFI_SUCCESS        The request completed successfully.
-  @retval other              An error occured.
+/**
+  Get's the ip addresses of several host names at once.
+
+  Up to DNSCLIENT_MAX_PENDING queries are kept outstanding and responses are
+  matched back to their hostname by DNS_HEADER.Id, so resolving N names costs
+  roughly one round trip instead of N.  See ResolveDNSLookups.
+
+  @param[in]      Instance     The Private data to be used.
+  @param[in]      Hostnames    Array of null terminated hostnames to look up.
+  @param[in]      Count        Number of entries in Hostnames.
+  @param[in/out]  IpAddresses  Array of Count addresses, one per hostname.
+  @param[in/out]  Statuses     Array of Count statuses, one per hostname.
+
+  @retval EFI_SUCCESS            Every hostname has been processed, see Statuses for the result of each.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL.
+  @retval EFI_NO_MAPPING         No interface has an address.
+  @retval other                  Receiving failed.  Hostnames which did not complete are set to this status.
   */
-EFI_STATUS EFIAPI GetHostByName(DNSCLIENT_PRIVATE_DATA *Instance, CHAR8 *Hostname, EFI_IPv4_ADDRESS *IpAddress) {
+EFI_STATUS EFIAPI GetHostsByName(DNSCLIENT_PRIVATE_DATA *Instance, CHAR8 **Hostnames, UINTN Count, EFI_IPv4_ADDRESS *IpAddresses, EFI_STATUS *Statuses) {
   EFI_STATUS   Status;
-  DNS_PACKET   *Request;
-  DNS_PACKET   *Response;
-  DNS_ANSWER   *Answer;
-  DNS_QUESTION Questions[0];
+  DNS_LOOKUP   *Lookups;
+  UINTN        i;
 
-  if(Instance == NULL) {
+  if(Instance == NULL || Hostnames == NULL || IpAddresses == NULL || Statuses == NULL) {
     return EFI_INVALID_PARAMETER;
   }
-  
-  if(Hostname == NULL) {
-    return EFI_INVALID_PARAMETER;
+
+  Lookups = AllocateZeroPool(sizeof(DNS_LOOKUP) * Count);
+
+  if(Lookups == NULL) {
+    return EFI_OUT_OF_RESOURCES;
   }
 
-  if(IpAddress == NULL) {
-    return EFI_INVALID_PARAMETER;
+  for(i = 0; i < Count; ++i) {
+    Lookups[i].Hostname     = Hostnames[i];
+    Lookups[i].QType        = 1;
+    Lookups[i].Addresses    = &IpAddresses[i];
+    Lookups[i].MaxAddresses = 1;
   }
 
-  ZeroMem(IpAddress, sizeof(IpAddress));
+  Status = ResolveDNSLookups(Instance, Lookups, Count);
 
-  ZeroMem(&Questions[0], sizeof(DNS_QUESTION));
+  for(i = 0; i < Count; ++i) {
+    Statuses[i] = Lookups[i].Status;
+  }
 
-  Questions[0].QName  = HostnameToLabelFormat(Hostname, AsciiStrnLenS(Hostname, 255));
-  Questions[0].QType  = HTONS(1);
-  Questions[0].QClass = HTONS(1);
+  SafeRelease(Lookups);
 
-  Request = CreateDNSPacket(Questions, 1);
+  return Status;
+} // End of GetHostsByName
 
-  if(Request == NULL) {
-    return EFI_ABORTED;
-  }
 
-  Request->Header.Id = HTONS(++(Instance->IdIterator));
-  Request->Header.Rd = 1;
-  Request->Header.Ad = 1;
+/**
+  Get's both the IPv4 and the IPv6 addresses of a host name.  The A and AAAA
+  queries are sent at the same time, so this costs one round trip.
+
+  @param[in]      Instance      The Private data to be used.
+  @param[in]      Hostname      A null terminated string of the hostname to look up.
+  @param[out]     Ip4Addresses  Optional.  Receives the IPv4 addresses.  NULL skips the A query.
+  @param[in/out]  Ip4Count      Entries Ip4Addresses has room for on input, addresses found on output.
+  @param[out]     Ip6Addresses  Optional.  Receives the IPv6 addresses.  NULL skips the AAAA query.
+  @param[in/out]  Ip6Count      Entries Ip6Addresses has room for on input, addresses found on output.
+
+  @retval EFI_SUCCESS            At least one address has been found.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL, or both address arrays are.
+  @retval EFI_NOT_FOUND          The name has no address of either type.
+  @retval other                  Neither query succeeded.  The error of the A query is preferred.
+  */
+EFI_STATUS EFIAPI GetHostAddresses(DNSCLIENT_PRIVATE_DATA *Instance, CHAR8 *Hostname, EFI_IPv4_ADDRESS *Ip4Addresses, UINTN *Ip4Count, EFI_IPv6_ADDRESS *Ip6Addresses, UINTN *Ip6Count) {
+  EFI_STATUS   Status;
+  DNS_LOOKUP   Lookups[2];
+  UINTN        Count;
+  UINTN        i;
 
-  // Send request
-  Status = SendDNSPacket(Instance, Request, L"8.8.8.8");
+  if(Instance == NULL || Hostname == NULL || (Ip4Addresses == NULL && Ip6Addresses == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
 
-  if(EFI_ERROR(Status)) {
-    goto CLEANUP;
+  if((Ip4Addresses != NULL && Ip4Count == NULL) || (Ip6Addresses != NULL && Ip6Count == NULL)) {
+    return EFI_INVALID_PARAMETER;
   }
 
-  // ReceiveResponse
-  Status = ReceiveDNSPacket(Instance, &Response);
+  ZeroMem(Lookups, sizeof(Lookups));
 
-  if(EFI_ERROR(Status)) {
-    goto CLEANUP;
-  }
+  Count = 0;
 
-  if(Response->Header.AnCount == 0) {
-    GotoStatus(CLEANUP, EFI_ABORTED);
+  if(Ip4Addresses != NULL) {
+    Lookups[Count].Hostname     = Hostname;
+    Lookups[Count].QType        = 1;
+    Lookups[Count].Addresses    = Ip4Addresses;
+    Lookups[Count].MaxAddresses = *Ip4Count;
+    ++Count;
   }
 
-  Answer = (DNS_ANSWER*)(Response->Data + sizeof(DNS_QUESTION) * Response->Header.QdCount);
+  if(Ip6Addresses != NULL) {
+    Lookups[Count].Hostname     = Hostname;
+    Lookups[Count].QType        = 28;
+    Lookups[Count].Addresses    = Ip6Addresses;
+    Lookups[Count].MaxAddresses = *Ip6Count;
+    ++Count;
+  }
 
-  switch(Answer->Type) {
-    case 1:
-      CopyMem(IpAddress, &(((A_RECORD*)Answer->RData)->IpAddress), sizeof(A_RECORD));
-    break;
+  Status = ResolveDNSLookups(Instance, Lookups, Count);
 
-    default:
-      Print(L"Default \n");
-    break;
+  if(EFI_ERROR(Status)) {
+    return Status;
   }
-  
-
-  Status = EFI_SUCCESS;
 
- CLEANUP:
+  //
+  // The name resolves if either family has an address.  Otherwise a real
+  // error is more telling than a missing record type.
+  //
+  Status = EFI_NOT_FOUND;
 
-  SafeRelease(Questions[0].QName);
+  for(i = 0; i < Count; ++i) {
+    if(Lookups[i].QType == 1) {
+      *Ip4Count = Lookups[i].AddressCount;
+    } else {
+      *Ip6Count = Lookups[i].AddressCount;
+    }
 
-  if(Request != NULL) {
-    ReleaseDNSPacket(Request);
+    if(!EFI_ERROR(Lookups[i].Status) && Lookups[i].AddressCount != 0) {
+      Status = EFI_SUCCESS;
+    } else if(Status == EFI_NOT_FOUND && EFI_ERROR(Lookups[i].Status)) {
+      Status = Lookups[i].Status;
+    }
   }
 
   return Status;
-} // End of GetHostByName
+} // End of GetHostAddresses
 
 
 /**
-  Creates a DNS_PACKET based off of the parameters provided.  Must call ReleaseDNSPacket to free up used memory.
-
-  @param[in] Questions     Array of Questions in the dns request.
-  @param[in] NumQuestions  Number of Questions in the array.
-
-  @retval EFI_SUCCESS      Packet data has been successfully created.
-  @retval other            An error occured.
+  Adds a server to the end of the failover list, behind those handed out by
+  DHCP, as though it had been listed in PcdDnsClientFallbackServers.  Each
+  call takes a reference on the server which RemoveDNSServer gives back.
+  Must not be called while a lookup is running.
+
+  @param[in] Instance             The Private data to be used.
+  @param[in] Address              The server's address.
+  @param[in] IsIp6                TRUE if Address is an IPv6 address.
+
+  @retval EFI_SUCCESS             The server is on the list.
+  @retval EFI_INVALID_PARAMETER   A parameter is NULL.
+  @retval EFI_OUT_OF_RESOURCES    The list is full.
   */
-DNS_PACKET* EFIAPI CreateDNSPacket(DNS_QUESTION Questions[], UINTN NumQuestions) {
-  DNS_PACKET  *Packet;
-  UINTN       TotalStringSizes;
-  UINTN       i, len;
-
-  Packet      = AllocateZeroPool(sizeof(DNS_PACKET));
-
-  if(Packet == NULL) {
-    return NULL;
-    //return EFI_OUT_OF_RESOURCES;
-  }
-
-  TotalStringSizes = 0;
+EFI_STATUS EFIAPI AddDNSServer(DNSCLIENT_PRIVATE_DATA *Instance, EFI_IP_ADDRESS *Address, BOOLEAN IsIp6) {
+  EFI_STATUS   Status;
+  UINTN        Index;
 
-  for(i = 0; i < NumQuestions; ++i) {
-    TotalStringSizes += Questions[i].QName[0];
+  if(Instance == NULL || Address == NULL) {
+    return EFI_INVALID_PARAMETER;
   }
 
-  Packet->DataLength = TotalStringSizes + (sizeof(DNS_QUESTION) - sizeof(CHAR8*)) * NumQuestions;
+  Index = DNSImplFindServer(Instance, Address, IsIp6);
 
-  Packet->Data = AllocateZeroPool(Packet->DataLength);
+  if(Index == DNSCLIENT_MAX_SERVERS) {
+    Status = DNSImplAddServer(Instance, Address, IsIp6, FALSE);
 
-  if(Packet->Data == NULL) {
-    SafeRelease(Packet);
-
-    return NULL;
-    //return EFI_OUT_OF_RESOURCES;
-  }
+    if(EFI_ERROR(Status)) {
+      return Status;
+    }
 
-  len = 0;
+    Index = DNSImplFindServer(Instance, Address, IsIp6);
 
-  for(i = 0; i < NumQuestions; ++i) {
-    CopyMem(Packet->Data + len, &Questions[i].QName[1], Questions[i].QName[0]);
-    len += Questions[i].QName[0];
+    //
+    // Addresses which cannot be a server are quietly left off the list.
+    //
+    if(Index == DNSCLIENT_MAX_SERVERS) {
+      return EFI_SUCCESS;
+    }
 
-    CopyMem(Packet->Data + len, &Questions[i].QType, sizeof(DNS_QUESTION) - sizeof(Questions[i].QName));
-    len += sizeof(DNS_QUESTION) - sizeof(Questions[i].QName); 
+    Instance->Servers[Index].Listed = FALSE;
   }
 
-  Packet->Header.QdCount = HTONS(NumQuestions);
+  ++(Instance->Servers[Index].References);
 
-  return Packet;
-} // End of CreateDNSPacket
+  return EFI_SUCCESS;
+} // End of AddDNSServer
 
 
 /**
-  Release a DNS_PACKET.
-
-  @param[in] Packet        The Packet to free data on.
-
-  @retval EFI_SUCCESS      Data has been freed.
-  @retval other            An error occured.
+  Undoes one AddDNSServer of a server.  The server leaves the failover list
+  once every AddDNSServer of it has been undone, unless DHCP or
+  PcdDnsClientFallbackServers put it there as well.  Must not be called
+  while a lookup is running.
+
+  @param[in] Instance             The Private data to be used.
+  @param[in] Address              The server's address.
+  @param[in] IsIp6                TRUE if Address is an IPv6 address.
+
+  @retval EFI_SUCCESS             The server has been released.
+  @retval EFI_INVALID_PARAMETER   A parameter is NULL.
+  @retval EFI_NOT_FOUND           The server was not added with AddDNSServer.
   */
-EFI_STATUS EFIAPI ReleaseDNSPacket(DNS_PACKET *Packet) {
-  if(Packet == NULL) {
+EFI_STATUS EFIAPI RemoveDNSServer(DNSCLIENT_PRIVATE_DATA *Instance, EFI_IP_ADDRESS *Address, BOOLEAN IsIp6) {
+  DNS_SERVER   *Server;
+  UINTN        Index;
+
+  if(Instance == NULL || Address == NULL) {
     return EFI_INVALID_PARAMETER;
   }
 
-  if(Packet->Data != NULL) {
-    FreePool(Packet->Data);
+  Index = DNSImplFindServer(Instance, Address, IsIp6);
+
+  if(Index == DNSCLIENT_MAX_SERVERS || Instance->Servers[Index].References == 0) {
+    return EFI_NOT_FOUND;
   }
 
-  FreePool(Packet);
+  Server = &Instance->Servers[Index];
+
+  --(Server->References);
+
+  if(Server->References == 0 && !Server->Listed) {
+    DNSImplRemoveServer(Instance, Index);
+  }
 
   return EFI_SUCCESS;
-} // End of ReleaseDNSPacket
+} // End of RemoveDNSServer
 
 
 /**
-  Sends a DNS_PACKET synchronously.
+  Sends a DNS_PACKET synchronously on the fastest interface with an address.
 
   @param[in] Instance             Pointer to a DNSClient instance.
   @param[in] Packet               A pointer to the DNS packet to send.
@@ -332,19 +4507,21 @@ EFI_STATUS EFIAPI ReleaseDNSPacket(DNS_PACKET *Packet) {
 
   @retval EFI_SUCCESS             Packet sent successfully.
   @retval EFI_INVALID_PARAMETER   Instance or Packet is NULL.
+  @retval EFI_NO_MAPPING          No interface has an address.
   @retval EFI_OUT_OF_RESOURCES    Out of memory.
+  @retval EFI_TIMEOUT             The transmit did not complete within DNSCLIENT_TX_TIMEOUT_MS and was cancelled.
   @retval other                   The packet could not be received for some other reason.  Most likely do to a error that bubbled up from another function.
  */
 EFI_STATUS EFIAPI SendDNSPacket(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PACKET *Packet, CHAR16* Dst) {
   EFI_STATUS                    Status;
   EFI_UDP4_COMPLETION_TOKEN     TransmitToken;
-  EFI_UDP4_TRANSMIT_DATA        TransmitData;
+  DNS_UDP4_TRANSMIT_DATA        TransmitData;
+  EFI_UDP4_FRAGMENT_DATA        *Fragments;
   EFI_UDP4_SESSION_DATA         SessionData;
-  EFI_IPv4_ADDRESS              DstAddress, SrcAddress;
-  EFI_UDP4_FRAGMENT_DATA        FragmentData;
+  EFI_IPv4_ADDRESS              DstAddress;
+  DNS_INTERFACE                 *Interface;
+  UINTN                         Fastest;
   BOOLEAN                       IsDone;
-  UINT8                         *Buffer;
-  UINTN                         i;
 
   if(Instance == NULL) {
     return EFI_INVALID_PARAMETER;
@@ -354,20 +4531,20 @@ EFI_STATUS EFIAPI SendDNSPacket(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PACKET *Pa
     return EFI_INVALID_PARAMETER;
   }
 
-  Buffer = AllocateZeroPool(sizeof(DNS_HEADER) + Packet->DataLength);
+  DNSImplRefreshInterfaces(Instance);
 
-  if(Packet == NULL) {
-    GotoStatus(CLEANUP, EFI_OUT_OF_RESOURCES);
+  Fastest = DNSImplFastestInterface(Instance, FALSE);
+
+  if(Fastest == DNSCLIENT_MAX_INTERFACES) {
+    return EFI_NO_MAPPING;
   }
 
-  CopyMem(Buffer, Packet, sizeof(DNS_HEADER));
-  CopyMem(Buffer + sizeof(DNS_HEADER), Packet->Data, Packet->DataLength);
+  Interface = &Instance->Interfaces[Fastest];
 
-  ZeroMem(&SrcAddress,    sizeof(EFI_IPv4_ADDRESS));
-  ZeroMem(&DstAddress,   sizeof(EFI_IPv4_ADDRESS));
+  ZeroMem(&DstAddress,    sizeof(EFI_IPv4_ADDRESS));
   ZeroMem(&TransmitToken, sizeof(EFI_UDP4_COMPLETION_TOKEN));
   ZeroMem(&SessionData,   sizeof(EFI_UDP4_SESSION_DATA));
-  ZeroMem(&TransmitData,  sizeof(EFI_UDP4_TRANSMIT_DATA));
+  ZeroMem(&TransmitData,  sizeof(DNS_UDP4_TRANSMIT_DATA));
 
   Status = NetLibStrToIp4(Dst, &DstAddress);
 
@@ -378,26 +4555,29 @@ EFI_STATUS EFIAPI SendDNSPacket(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PACKET *Pa
   //
   // Prepare session data for transmission.
   //
-  SessionData.SourceAddress      = SrcAddress;
   SessionData.SourcePort         = 53;
   SessionData.DestinationAddress = DstAddress;
   SessionData.DestinationPort    = 53;
 
   //
-  // Prepare fragment data for transmission.
+  // The header and the data are sent as two fragments rather than being
+  // copied together into one buffer first.
   //
-  FragmentData.FragmentLength    = sizeof(DNS_HEADER) + Packet->DataLength;
-  FragmentData.FragmentBuffer    = (VOID *) Buffer;
+  Fragments = TransmitData.TxData.FragmentTable;
+
+  Fragments[0].FragmentLength    = sizeof(DNS_HEADER);
+  Fragments[0].FragmentBuffer    = (VOID *) &Packet->Header;
+  Fragments[1].FragmentLength    = Packet->DataLength;
+  Fragments[1].FragmentBuffer    = (VOID *) Packet->Data;
 
   //
   // Setup transmit data.
   //
-  TransmitData.UdpSessionData    = &SessionData;
-  TransmitData.FragmentCount     = 1;
-  TransmitData.FragmentTable[0]  = FragmentData;
-  TransmitData.DataLength        = FragmentData.FragmentLength;
+  TransmitData.TxData.UdpSessionData = &SessionData;
+  TransmitData.TxData.FragmentCount  = 2;
+  TransmitData.TxData.DataLength     = sizeof(DNS_HEADER) + Packet->DataLength;
 
-  TransmitToken.Packet.TxData    = &TransmitData;
+  TransmitToken.Packet.TxData    = &TransmitData.TxData;
 
   Status = gBS->CreateEvent(
     EVT_NOTIFY_SIGNAL,
@@ -413,390 +4593,496 @@ EFI_STATUS EFIAPI SendDNSPacket(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PACKET *Pa
 
   IsDone = FALSE;
 
-  Status = Instance->Udp4->Transmit(Instance->Udp4, &TransmitToken);
+  Status = Interface->Udp4->Transmit(Interface->Udp4, &TransmitToken);
 
-  //
-  // Potential infinate loop.  Need some sort of check here.
-  //
-  while(!IsDone) {
-    Status = Instance->Udp4->Poll(Instance->Udp4);
+  if(EFI_ERROR(Status)) {
+    goto CLEANUP;
   }
 
+  Status = DNSImplWaitFor(Instance, &IsDone, DNSCLIENT_TX_TIMEOUT_MS * NS_PER_MS);
+
+  if(EFI_ERROR(Status)) {
+    Interface->Udp4->Cancel(Interface->Udp4, &TransmitToken);
+    goto CLEANUP;
+  }
+
+  Status = TransmitToken.Status;
+
  CLEANUP:
-  SafeRelease(Buffer);
 
   if(TransmitToken.Event != NULL) {
     gBS->CloseEvent(TransmitToken.Event);
   }
 
-  // CLEAN UP STUFF MADE HERE!
-
   return Status;
 } // End of SendDNSPacket
 
 
 /**
-  Recieves a DNS_PACKET synchronously.
-  Must call ReleaseDNSPacket when done.
-
-  @param[in] Instance             Pointer to a DNSClient instance.
-  @param[in] Packet               A pointer to the vairable that will contain the address of the received packet.
- 
-  @retval EFI_SUCCESS             Packet received successfully.
-  @retval EFI_INVALID_PARAMETER   Instance or Packet is NULL.
-  @retval EFI_OUT_OF_RESOURCES    Out of memory.
-  @retval other                   The packet could not be received for some other reason.  Most likely do to a error that bubbled up from another function.
- */
-EFI_STATUS EFIAPI ReceiveDNSPacket(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PACKET **Packet) {
-  EFI_STATUS                    Status;
-  EFI_UDP4_COMPLETION_TOKEN     ReceiveToken;
-  DNS_PACKET_DATA               *PacketData;
-  DNS_QUESTION                  *Questions;
-  DNS_ANSWER                    *Answers;
-  UINT8                         *Buffer;
-  UINT8                         *BufferIterator;
-  BOOLEAN                       IsDone;
-  UINTN                         i, len;
+  Records how much of its arena a decoded packet used, so the arena estimate
+  can be tuned.
 
-  Buffer = NULL;
+  @param[in] Instance   Pointer to a DNSClient instance.
+  @param[in] Arena      The arena of a decoded packet.
+  */
+STATIC VOID DNSImplRecordArena(DNSCLIENT_PRIVATE_DATA *Instance, DNS_ARENA *Arena) {
+  if(Arena->Used > Instance->Stats.ArenaHighWater) {
+    Instance->Stats.ArenaHighWater = Arena->Used;
+  }
 
-  if(Instance == NULL) {
-    return EFI_INVALID_PARAMETER;
+  if(Arena->Size > Instance->Stats.ArenaReserved) {
+    Instance->Stats.ArenaReserved = Arena->Size;
   }
 
-  if(Packet == NULL) {
-    return EFI_INVALID_PARAMETER;
+  if(Arena->Overflow != NULL) {
+    ++(Instance->Stats.ArenaOverflows);
   }
+} // End of DNSImplRecordArena
 
-  ZeroMem(&ReceiveToken,  sizeof(EFI_UDP4_COMPLETION_TOKEN));
 
-  IsDone = FALSE;
+/**
+  Hands out the next complete message waiting in any TCP connection's
+  stream, picking up completed receives and posting new ones on the way.
+  A message is decoded straight out of the connection's buffer.
+
+  @param[in]      Instance   Pointer to a DNSClient instance.
+  @param[out]     Packet     Receives the decoded message.
+  @param[out]     Source     Optional.  Receives the server's address.
+  @param[out]     Interface  Optional.  Receives the index of the interface the connection was opened on.
+  @param[in/out]  Listening  Incremented for every connection with a receive posted.
+
+  @retval EFI_NOT_READY      No complete message is waiting.
+  @retval other              The result of decoding the message which was.
+  */
+STATIC EFI_STATUS DNSImplTcpReceive(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PACKET **Packet, EFI_IP_ADDRESS *Source, UINTN *Interface, UINTN *Listening) {
+  EFI_STATUS               Status;
+  DNS_TCP_CONNECTION       *Connection;
+  EFI_UDP4_FRAGMENT_DATA   Fragment;
+  DNS_CURSOR               Cursor;
+  UINT8                    *Message;
+  UINTN                    Available;
+  UINTN                    Length;
+  UINT64                   Allocations;
+  UINTN                    i;
+
+  for(i = 0; i < DNSCLIENT_MAX_TCP_CONNECTIONS; ++i) {
+    Connection = &Instance->TcpConnections[i];
+
+    DNSImplTcpService(Instance, Connection);
+
+    if(!Connection->Connected) {
+      continue;
+    }
 
-  Status = gBS->CreateEvent(
-    EVT_NOTIFY_SIGNAL,
-    TPL_CALLBACK,
-    DNSImplGenericCallback,
-    (VOID*) &IsDone,
-    &ReceiveToken.Event
-  );
+    Available = Connection->Length - Connection->Consumed;
+    Message   = Connection->Buffer + Connection->Consumed;
+    Length    = (Available < DNS_TCP_LENGTH_PREFIX) ? 0 : ((UINTN) Message[0] << 8) | Message[1];
 
-  if(EFI_ERROR(Status)) {
-    goto CLEANUP;
-  }
+    if(Available >= DNS_TCP_LENGTH_PREFIX + Length) {
+      Connection->Consumed += DNS_TCP_LENGTH_PREFIX + Length;
 
-  Status = Instance->Udp4->Receive(Instance->Udp4, &ReceiveToken);
+      if(Source != NULL) {
+        ZeroMem(Source, sizeof(EFI_IP_ADDRESS));
+        CopyMem(&Source->v4, &Connection->Address, sizeof(EFI_IPv4_ADDRESS));
+      }
 
-  if(EFI_ERROR(Status)) {
-    goto CLEANUP;
-  }
+      if(Interface != NULL) {
+        *Interface = Connection->Interface;
+      }
 
-  //
-  // Need to have some sort of timeout and retry if
-  // we don't get a response.  Also we need to do
-  // Instance->Udp4->Cancel(Private->Udp4, &receiveToken);
-  //
-  while(!IsDone) {
-    //
-    // Try to receive a packet.
-    //
-    Status = Instance->Udp4->Poll(Instance->Udp4);
+      Fragment.FragmentLength = (UINT32) Length;
+      Fragment.FragmentBuffer = Message + DNS_TCP_LENGTH_PREFIX;
+
+      Allocations = gDNSClientAllocations;
+
+      DNSCursorInit(&Cursor, &Fragment, 1);
 
-    if(EFI_ERROR(Status) && Status != EFI_NOT_READY) {
-      Print(L"  Poll failed!\n");
-      goto CLEANUP;
+      PERF_START(Instance->Image, DNSCLIENT_PERF_DECODE, NULL, 0);
+      Status = DecodeDNSPacket(&Cursor, Packet);
+      PERF_END(Instance->Image, DNSCLIENT_PERF_DECODE, NULL, 0);
+
+      Instance->Stats.ReceiveAllocations += gDNSClientAllocations - Allocations;
+
+      if(!EFI_ERROR(Status)) {
+        DNSImplRecordArena(Instance, &(*Packet)->Arena);
+      }
+
+      return Status;
+    }
+
+    DNSImplTcpPostReceive(Instance, Connection);
+
+    if(Connection->RxPosted) {
+      ++(*Listening);
     }
   }
 
-  Status = EFI_SUCCESS;
+  return EFI_NOT_READY;
+} // End of DNSImplTcpReceive
 
-  Buffer = AllocateZeroPool(sizeof(DNS_HEADER) + ReceiveToken.Packet.RxData->DataLength);
 
-  if(Buffer == NULL) {
-    gBS->SignalEvent(ReceiveToken.Packet.RxData->RecycleSignal);
-    GotoStatus(CLEANUP, EFI_OUT_OF_RESOURCES);
-  }
+/**
+  Finds the oldest completed receive of an interface's receive ring, and
+  keeps track of how many completed receives have piled up on it.
 
-  len = 0;
+  @param[in] Instance   The Private data to be used.
+  @param[in] Interface  The interface.
 
-  //
-  // Copy our token data into our new buffer.
-  //
+  @retval NULL          No receive of the interface has completed.
+  @retval DNS_RX_SLOT*  The slot to pick the datagram up from.
+  */
+STATIC DNS_RX_SLOT* DNSImplNextReceive(DNSCLIENT_PRIVATE_DATA *Instance, DNS_INTERFACE *Interface) {
+  DNS_RX_SLOT   *Slot;
+  DNS_RX_SLOT   *Oldest;
+  UINTN         Backlog;
+  UINTN         i;
+
+  Oldest  = NULL;
+  Backlog = 0;
 
-  for(i = 0; i < ReceiveToken.Packet.RxData->FragmentCount; ++i) {
-    UINTN j;
+  for(i = 0; i < Instance->RxDepth; ++i) {
+    Slot = &Interface->RxRing[(Interface->RxNext + i) % Instance->RxDepth];
 
-    for(j = 0; j < ReceiveToken.Packet.RxData->FragmentTable[i].FragmentLength; ++j, ++len) {
-      Buffer[len] = ((UINT8*)ReceiveToken.Packet.RxData->FragmentTable[i].FragmentBuffer)[j];
+    if(Slot->Posted && Slot->Done) {
+      if(Oldest == NULL) {
+        Oldest = Slot;
+      }
+
+      ++Backlog;
     }
   }
 
-  gBS->SignalEvent(ReceiveToken.Packet.RxData->RecycleSignal);
+  Interface->RxBacklog = MAX(Interface->RxBacklog, Backlog);
+
+  return Oldest;
+} // End of DNSImplNextReceive
+
+
+/**
+  Recieves a DNS_PACKET synchronously.
+  Must call ReleaseDNSPacket when done.
+
+  The response is decoded directly out of the Udp4 or Udp6 receive fragments
+  and the receive buffer is only handed back to the driver once decoding is done.
+
+  Instance->RxDepth receives are kept posted on every configured interface,
+  and the oldest datagram to have arrived on any of them is returned.  Its
+  receive is posted again as soon as it has been decoded, so datagrams
+  arriving between calls land in the other slots rather than being dropped.
+  The receives are left posted when the call returns, so a later call picks
+  up where this one stopped.  CancelDNSReceive takes them back.
+
+  Messages arriving on an open TCP connection are returned the same way, one
+  at a time, once all of a message has arrived.
+
+  @param[in]  Instance            Pointer to a DNSClient instance.
+  @param[out] Packet              A pointer to the vairable that will contain the address of the received packet.
+  @param[in]  Timeout             Longest time to wait, in nanoseconds.
+  @param[out] Source              Optional.  Receives the address the datagram came from.  An IPv6
+                                  address if the interface it arrived on is a Udp6 one.
+  @param[out] Interface           Optional.  Receives the index of the interface it arrived on, or
+                                  the TCP connection was opened on.
+ 
+  @retval EFI_SUCCESS             Packet received successfully.
+  @retval EFI_INVALID_PARAMETER   Instance or Packet is NULL.
+  @retval EFI_TIMEOUT             Nothing was received within Timeout.
+  @retval EFI_NO_MAPPING          No interface has an address to receive on.
+  @retval EFI_OUT_OF_RESOURCES    Out of memory.
+  @retval EFI_PROTOCOL_ERROR      The datagram is not a well formed DNS message.
+  @retval other                   The packet could not be received for some other reason.  Most likely do to a error that bubbled up from another function.
+                                  *Interface is only set if the error belongs to a single datagram or receive,
+                                  such as an ICMP error, and the other interfaces and servers are unaffected.
+ */
+EFI_STATUS EFIAPI ReceiveDNSPacket(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PACKET **Packet, UINT64 Timeout, EFI_IP_ADDRESS *Source, UINTN *Interface) {
+  EFI_STATUS                    Status;
+  EFI_UDP4_RECEIVE_DATA         *RxData;
+  EFI_UDP6_RECEIVE_DATA         *Rx6Data;
+  EFI_EVENT                     RecycleSignal;
+  DNS_INTERFACE                 *Receiver;
+  DNS_RX_SLOT                   *Slot;
+  DNS_CURSOR                    Cursor;
+  UINT64                        Allocations;
+  UINT64                        Now, Deadline;
+  UINTN                         Posted;
+  UINTN                         Listening;
+  UINTN                         i, j;
 
-  *Packet = AllocateZeroPool(sizeof(DNS_PACKET));
+  if(Instance == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
 
-  if(*Packet == NULL) {
-    GotoStatus(CLEANUP, EFI_OUT_OF_RESOURCES);
+  if(Packet == NULL) {
+    return EFI_INVALID_PARAMETER;
   }
 
-  CopyMem(*Packet, Buffer, sizeof(DNS_HEADER));
+  *Packet  = NULL;
+  Receiver = NULL;
+  Slot     = NULL;
+  Posted   = 0;
 
   //
-  // If errors occur here, FreePool(*Packet) and set *Packet = NULL
+  // Top up the receive ring of every configured interface, oldest slot
+  // first, so the driver completes the slots in ring order.
   //
+  for(i = 0; i < Instance->InterfaceCount; ++i) {
+    Receiver  = &Instance->Interfaces[i];
+    Listening = 0;
 
-  (*Packet)->Header.Id      = HTONS((*Packet)->Header.Id);
-  (*Packet)->Header.QdCount = HTONS((*Packet)->Header.QdCount);
-  (*Packet)->Header.AnCount = HTONS((*Packet)->Header.AnCount);
-  (*Packet)->Header.NsCount = HTONS((*Packet)->Header.NsCount);
-  (*Packet)->Header.ArCount = HTONS((*Packet)->Header.ArCount);
+    for(j = 0; j < Instance->RxDepth; ++j) {
+      Slot = &Receiver->RxRing[(Receiver->RxNext + j) % Instance->RxDepth];
 
-  PacketData = AllocateZeroPool(
-    sizeof(DNS_QUESTION) * (*Packet)->Header.QdCount +
-    sizeof(DNS_ANSWER)   * (*Packet)->Header.AnCount
-  );
-
-  if(PacketData == NULL) {
-    SafeRelease(*Packet);
-    GotoStatus(CLEANUP, EFI_OUT_OF_RESOURCES);
-  }
+      if(!Slot->Posted && Receiver->Configured) {
+        DNSImplPostReceive(Receiver, Slot);
+      }
 
-  (*Packet)->Data = PacketData;
+      if(Slot->Posted) {
+        ++Listening;
+      }
+    }
 
-  Questions = (DNS_QUESTION*)(PacketData);
-  Answers   = (DNS_ANSWER*)(PacketData + (*Packet)->Header.QdCount * sizeof(DNS_QUESTION));
+    if(Listening != 0) {
+      ++Posted;
+    }
+  }
 
-  BufferIterator = Buffer + sizeof(DNS_HEADER);
+  Deadline = DNSImplGetTimeNs() + Timeout;
+  Slot     = NULL;
 
-  for(i = 0; i < (*Packet)->Header.QdCount; ++i) {
+  while(Slot == NULL) {
     //
-    // Check to see if the name is using pointer format.
+    // RxReady is cleared before looking, so a receive which completes after
+    // the look still ends the wait.
     //
-    if( (*BufferIterator & 0xC0) == 0xC0 ) {
-      UINT16 namePtr = (((*BufferIterator << 8) ^ 0xC0) | *(BufferIterator+1));
+    Instance->RxReady = FALSE;
+    Listening         = Posted;
 
-      //
-      // Name uses pointer format
-      //
-      Questions[i].QName = LabelFormatToHostname((CHAR8*)(Buffer + namePtr));
-      
-      //
-      // Skip past the pointer format name.
-      //
-      BufferIterator += 2;
-    } else {
-      //
-      // Name uses label format.
-      //
-      Questions[i].QName = LabelFormatToHostname((CHAR8*)BufferIterator);
+    Status = DNSImplTcpReceive(Instance, Packet, Source, Interface, &Listening);
 
-      //
-      // Skip past the label format name.
-      //
-      while(*(BufferIterator++) != (CHAR8) 0);
+    if(Status != EFI_NOT_READY) {
+      return Status;
     }
 
-    if(Questions[i].QName == NULL) {
-      SafeRelease(*Packet);
-      GotoStatus(CLEANUP, EFI_OUT_OF_RESOURCES);
+    if(Listening == 0) {
+      return EFI_NO_MAPPING;
     }
 
-    Questions[i].QType = HTONS(*((UINT16*)BufferIterator));
-    BufferIterator += 2;
+    for(i = 0; i < Instance->InterfaceCount && Slot == NULL; ++i) {
+      Slot = DNSImplNextReceive(Instance, &Instance->Interfaces[i]);
+    }
 
-    Questions[i].QClass = HTONS(*((UINT16*)BufferIterator));
-    BufferIterator += 2;
-  }
+    if(Slot != NULL) {
+      break;
+    }
 
-  for(i = 0; i < (*Packet)->Header.AnCount; ++i) {
     //
-    // Check to see if the name is using pointer format.
+    // Part of a TCP message arriving ends the wait too, so it is waited on
+    // again for what is left of Timeout.
     //
-    if( (*BufferIterator & 0xC0) == 0xC0 ) {
-      UINT16 namePtr = (((*BufferIterator << 8)) | *(BufferIterator+1));
+    Now = DNSImplGetTimeNs();
 
-      namePtr = namePtr ^ 0xC000;
+    if(Now >= Deadline) {
+      return EFI_TIMEOUT;
+    }
 
-      //
-      // Name uses pointer format.
-      //
-      Answers[i].Name = LabelFormatToHostname((CHAR8*)(Buffer + namePtr));
-      
-      //
-      // Skip past the pointer format name.
-      //
-      BufferIterator += 2;
-    } else {
-      //
-      // Name uses label format.
-      //
-      Answers[i].Name = LabelFormatToHostname((CHAR8*)BufferIterator);
+    PERF_START(Instance->Image, DNSCLIENT_PERF_WAIT, NULL, 0);
+    Status = DNSImplWaitFor(Instance, &Instance->RxReady, Deadline - Now);
+    PERF_END(Instance->Image, DNSCLIENT_PERF_WAIT, NULL, 0);
 
-      //
-      // Skip past the label format name.
-      //
-      while(*(BufferIterator++) != (CHAR8) 0);
+    if(EFI_ERROR(Status)) {
+      return Status;
     }
+  }
 
-    if(Answers[i].Name == NULL) {
-      SafeRelease(*Packet);
-      GotoStatus(CLEANUP, EFI_OUT_OF_RESOURCES);
-    }
+  Receiver         = Slot->Interface;
+  Receiver->RxNext = ((UINTN)(Slot - Receiver->RxRing) + 1) % Instance->RxDepth;
+  Slot->Posted     = FALSE;
 
-    Answers[i].Type = HTONS(*((UINT16*)BufferIterator));
-    BufferIterator += 2;
+  if(Interface != NULL) {
+    *Interface = (UINTN)(Receiver - Instance->Interfaces);
+  }
 
-    Answers[i].Class = HTONS(*((UINT16*)BufferIterator));
-    BufferIterator += 2;
+  //
+  // A receive which completed with an error (an ICMP error for a datagram
+  // sent to some server, say) is posted again straight away.  One which
+  // found the interface without an address is left for the next refresh.
+  //
+  Status = Slot->Token.Udp4.Status;
 
-    Answers[i].TTL = HTONS(*((UINT32*)BufferIterator));
-    BufferIterator += 4;
+  if(EFI_ERROR(Status)) {
+    if(Status == EFI_NO_MAPPING) {
+      Receiver->Configured = FALSE;
+    } else if(Receiver->Configured) {
+      DNSImplPostReceive(Receiver, Slot);
+    }
 
-    Answers[i].RdLength = HTONS(*((UINT16*)BufferIterator));
-    BufferIterator += 2;
+    return Status;
+  }
 
+  ++(Receiver->Received);
 
-    // Handle RDATA based off of type.
-    // Right now we're only going ot support A records.
-    switch(Answers[i].Type) {
-      case 1:
-        Answers[i].RData = AllocateZeroPool(sizeof(A_RECORD));
+  Allocations = gDNSClientAllocations;
 
-        if(Answers[i].RData == NULL) {
-          SafeRelease(*Packet);
-          GotoStatus(CLEANUP, EFI_OUT_OF_RESOURCES);
-        }
+  if(Source != NULL) {
+    ZeroMem(Source, sizeof(EFI_IP_ADDRESS));
+  }
 
-        CopyMem(Answers[i].RData, BufferIterator, sizeof(A_RECORD));
-      break;
+  //
+  // EFI_UDP6_FRAGMENT_DATA is laid out the same as EFI_UDP4_FRAGMENT_DATA,
+  // so the cursor walks either fragment table.
+  //
+  if(Receiver->IsIp6) {
+    Rx6Data       = Slot->Token.Udp6.Packet.RxData;
+    RecycleSignal = Rx6Data->RecycleSignal;
 
-      default:
-      break;
+    if(Source != NULL) {
+      CopyMem(&Source->v6, &Rx6Data->UdpSession.SourceAddress, sizeof(EFI_IPv6_ADDRESS));
+    }
+
+    DNSCursorInit(&Cursor, (EFI_UDP4_FRAGMENT_DATA*) Rx6Data->FragmentTable, Rx6Data->FragmentCount);
+  } else {
+    RxData        = Slot->Token.Udp4.Packet.RxData;
+    RecycleSignal = RxData->RecycleSignal;
+
+    if(Source != NULL) {
+      CopyMem(&Source->v4, &RxData->UdpSession.SourceAddress, sizeof(EFI_IPv4_ADDRESS));
     }
+
+    DNSCursorInit(&Cursor, RxData->FragmentTable, RxData->FragmentCount);
   }
 
-  Status = EFI_SUCCESS;
+  PERF_START(Instance->Image, DNSCLIENT_PERF_DECODE, NULL, 0);
+  Status = DecodeDNSPacket(&Cursor, Packet);
+  PERF_END(Instance->Image, DNSCLIENT_PERF_DECODE, NULL, 0);
 
- CLEANUP:
+  Instance->Stats.ReceiveAllocations += gDNSClientAllocations - Allocations;
 
- if(ReceiveToken.Event != NULL) {
-    gBS->CloseEvent(ReceiveToken.Event);
+  //
+  // Everything we need has been copied out, hand the buffer back and post
+  // the slot again straight away.
+  //
+  gBS->SignalEvent(RecycleSignal);
+
+  if(Receiver->Configured) {
+    DNSImplPostReceive(Receiver, Slot);
   }
 
-  SafeRelease(Buffer);
+  if(!EFI_ERROR(Status)) {
+    DNSImplRecordArena(Instance, &(*Packet)->Arena);
+
+    Instance->Stats.LargestAnswer = MAX(Instance->Stats.LargestAnswer, Cursor.Length);
+  }
 
   return Status;
 } // End of ReceiveDNSPacket
 
 
 /**
-  Sets a boolean to true.
-  This function should not be called directly, but is intended to be used
-  with the UEFI event system.
+  Cancels the receives left posted by ReceiveDNSPacket, if there are any.
 
-  @param[in] Event        The event that was triggered.
-  @param[in] Context      The boolean to set.
+  @param[in] Instance             Pointer to a DNSClient instance.
  */
-VOID EFIAPI DNSImplGenericCallback(IN EFI_EVENT Event, IN VOID *Context) {
-  *((BOOLEAN*)Context) = TRUE;
-} // End of DNSImplGenericCallback
+VOID EFIAPI CancelDNSReceive(DNSCLIENT_PRIVATE_DATA *Instance) {
+  DNS_INTERFACE   *Interface;
+  DNS_RX_SLOT     *Slot;
+  UINTN           i, j;
 
+  if(Instance == NULL) {
+    return;
+  }
 
-/**
-  Converts a hostname to DNS label format.
-  Must call FreePool when done with the string.
-
-  @param[in] Hostname     The hostname string to convert.
-  @param[in] Length       The length of the Hostname string.
+  for(i = 0; i < Instance->InterfaceCount; ++i) {
+    Interface = &Instance->Interfaces[i];
 
-  @retval NULL            Hostname is NULL or out of memory.
-  @retval CHAR8*          Pointer to newly created label format string.
-  */
-CHAR8* EFIAPI HostnameToLabelFormat(CHAR8* Hostname, UINTN Length) {
-  CHAR8* LabelFormat;
-  UINT8  i, len;
+    for(j = 0; j < DNSCLIENT_MAX_RX_DEPTH; ++j) {
+      Slot = &Interface->RxRing[j];
 
-  if(Hostname == NULL) {
-    return NULL;
-  }
+      if(!Slot->Posted) {
+        continue;
+      }
 
-  LabelFormat = AllocateZeroPool(sizeof(CHAR8) * (Length+3));
+      if(!Slot->Done) {
+        DNSImplUdpCancel(Interface, &Slot->Token);
+      }
 
-  if(LabelFormat == NULL) {
-    return NULL;
-  }
+      //
+      // The datagram may have landed before the cancel did.  Its buffer
+      // still has to go back to the driver.
+      //
+      if(Slot->Done) {
+        DNSImplRecycleReceive(Interface, Slot);
+      }
 
-  for(i = Length, len = 0; i > 0; --i) {
-    if(Hostname[i-1] == '.') {
-      LabelFormat[i+1] = len;
-      len = 0;
-      continue;
+      Slot->Posted = FALSE;
     }
 
-    ++len;
-    LabelFormat[i+1] = Hostname[i-1];
+    Interface->RxNext = 0;
   }
+} // End of CancelDNSReceive
 
-  LabelFormat[Length+2] = (CHAR8)  0;
-  LabelFormat[0]        = Length + 2;
-  LabelFormat[1]        = len;
-
-  return LabelFormat;
-}
 
+//
+// State of the monotonic clock.  The performance counter may count in either
+// direction and may wrap, so elapsed ticks are accumulated between calls.
+//
+STATIC BOOLEAN   mClockStarted = FALSE;
+STATIC UINT64    mCounterStart;
+STATIC UINT64    mCounterEnd;
+STATIC UINT64    mLastCounter;
+STATIC UINT64    mElapsedTicks;
 
 /**
-  Converts a DNS label format to a Hostname string.  
-  Must call FreePool when done with the string.
+  Returns a monotonic time stamp in nanoseconds.  Only differences between two
+  time stamps are meaningful.
 
-  @param[in] LabelFormat  The label format string to convert.
-
-  @retval NULL            LabelFormat is NULL or out of memory.
-  @retval CHAR8*          Pointer to newly created string.
+  @retval UINT64          Nanoseconds since the first call.
   */
-CHAR8* EFIAPI LabelFormatToHostname(CHAR8* LabelFormat) {
-  CHAR8  *Hostname;
-  CHAR8  *Label;
-  UINTN  Length, NumLables, LabelSize;
-  UINTN  i, j, k;
-
-  if(LabelFormat == NULL) {
-    return NULL;
-  }
-
-  Length    = 0;
-  NumLables = 0;
-  
-  i = 0;
-  do {
-    ++NumLables;
+UINT64 EFIAPI DNSImplGetTimeNs(VOID) {
+  UINT64   Counter;
 
-    Length += LabelFormat[i];
+  Counter = GetPerformanceCounter();
 
-    i += LabelFormat[i] + 1;
-  } while(LabelFormat[i] != (CHAR8) 0);
+  if(!mClockStarted) {
+    GetPerformanceCounterProperties(&mCounterStart, &mCounterEnd);
 
-  Hostname = AllocateZeroPool(Length + NumLables);
-
-  if(Hostname == NULL) {
-    return NULL;
+    mLastCounter  = Counter;
+    mElapsedTicks = 0;
+    mClockStarted = TRUE;
   }
 
-  Hostname[Length] = (CHAR8) 0;
+  if(mCounterEnd >= mCounterStart) {
+    //
+    // Counting up, wrapping from End back to Start.
+    //
+    if(Counter >= mLastCounter) {
+      mElapsedTicks += Counter - mLastCounter;
+    } else {
+      mElapsedTicks += (mCounterEnd - mLastCounter) + (Counter - mCounterStart);
+    }
+  } else {
+    //
+    // Counting down, wrapping from End back to Start.
+    //
+    if(Counter <= mLastCounter) {
+      mElapsedTicks += mLastCounter - Counter;
+    } else {
+      mElapsedTicks += (mLastCounter - mCounterEnd) + (mCounterStart - Counter);
+    }
+  }
 
-  Label = LabelFormat;
-  for(i = 0, j = -1; i < NumLables; ++i) {
-    LabelSize = Label[0];
+  mLastCounter = Counter;
 
-    if(i != 0) {
-      Hostname[++j] = '.';
-    }
+  return GetTimeInNanoSecond(mElapsedTicks);
+} // End of DNSImplGetTimeNs
 
-    for(k = 0; k < LabelSize; ++k) {
-      Hostname[++j] = Label[k + 1];
-    }
 
-    Label += LabelSize + 1;
-  }
+/**
+  Sets a boolean to true.
+  This function should not be called directly, but is intended to be used
+  with the UEFI event system.
 
-  return Hostname;
-}
\ No newline at end of file
+  @param[in] Event        The event that was triggered.
+  @param[in] Context      The boolean to set.
+ */
+VOID EFIAPI DNSImplGenericCallback(IN EFI_EVENT Event, IN VOID *Context) {
+  *((BOOLEAN*)Context) = TRUE;
+} // End of DNSImplGenericCallback
@@ -1,231 +1,7 @@
 /** @file DNSClientImpl.h
-  Defines all the functions and structures needed to send and receive DNS packets.
-
-  ************************
-  * DNS Packet Structure *
-  ************************
-
-  +--------------------+
-  |       Header       |
-  +--------------------+
-  |      Question      |
-  +--------------------+
-  |       Answer       |
-  +--------------------+
-  |     Authority      |
-  +--------------------+
-  |     Additional     |
-  +--------------------+
-
-  Header      Message Header.  See following section for details.
-
-  Question    The DNS question being asked (aka Question Section).
-
-  Answer      The Resource Record(s) which answer the question (aka Answer Section)
-
-  Authority   The Resource Record(s) which point to the domain authority (aka Authority Section).
-
-  Additional  The Resource Records(s) which may hod additional information (aka Additional Section).
-
-
-  ************************
-  * DNS Header Structure *
-  ************************
-
-    0  1  2  3  4  5  6  7  8  9 10 11 12 13 14 15
-  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-  |                      ID                       |
-  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-  |QR|   OPCODE  |AA|TC|RD|RA| Z|AD|CD|   RCODE   |
-  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-  |                    QDCOUNT                    |
-  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-  |                    ANCOUNT                    |
-  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-  |                    NSCOUNT                    |
-  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-  |                    ARCOUNT                    |
-  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-
-  ID        A 16 bit identifier assigned by the requesition (the questioner) and reflected
-            back unchanged by the responder (answerer).  Identifies the transaction.
-
-  QR        Query - Response bit.  Set to 0 by the questioner (query) an dto 1 in the response
-            (answer).
-
-  OPCODE    Identifies the request/operation type.  Currently assigned values are:
-              0 - QUERY.  Standard query.
-              1 - IQUERY. Inverse query.  Optional support by DNS.
-              2 - STATUS.  DNS status request.
-
-  AA        Authoritative Answer.  Valid in responses only.  Because of aliases multiple owners
-            may exist so the AA bit corresponds to the name which matches the query name, OR
-            the first owner name in the answer section.
-
-  TC        TrunCation - Specifies taht this message was truncated due to length grater than that
-            permitted on the transmission channel.  Set on all truncated messages except the last
-            one.
-
-  RD        Recursion Desired - This bit may be sest in a query and is copied into the response
-            if recursion supported.  If rejected the resopnse (answer) does not have this bit set.
-            Recursive query support is optional.
-
-  RA        Recursion Available - This bit is valid in a response (answer) and denotes whether
-            recursive support is available (1) or not (0) in the name server.
-
-  Z         Rezerved for future use.  Must be 0.
-
-  RCODE     Response Code - This 4 bit field is set as part of responses.  The values are:
-              0 - No error condition
-              1 - Format error. The name server was unable to interpret the query.
-              2 - Server failure. The name server was unable to process this query due to a
-                  problem with the name server.
-              3 - Name Error.  Meaningful only for responses from an authoritative name server.
-                  This code signifies that the domain name referenced in the query does not exist.
-              4 - Not Implemented.  The name server does not support the requested kind of query.
-              5 - Refused.  The name server refuses to perform the specified operation for policy
-                  reasons.
-
-  QDCOUNT   Unsigned 16 bit integer specifying the nubmer of resource records in the Question Section.
-
-  ANCOUNT   Unsigned 16 bit integer specifying the number of resource records in the Answer Section.
-            May be 0 in which case no answer record is present in the message.
-
-  NSCOUNT   Unsigned 16 bit ingerger specifying the number of name server resource records in the
-            Authority Section.  May be 0 in which case no authority record(s) is(are) present in the
-            message.
-
-  ARCOUNT   Unsigned 16 bit integer specifying the number of name server resource records in the
-            Additional Section.  May be 0 in which case no additional record(s) is(are) present in
-            the message.
-
-
-
-  ************************
-  *     DNS Questions    *
-  ************************
-
-  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-  |                                               |
-  /                     QNAME                     /
-  /                                               /
-  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-  |                     QTYPE                     |
-  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-  |                     QCLASS                    |
-  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-
-  QNAME   A domain name represented as a sequence of labels, where each label
-          consists of a length octet followed by that number of octets.  The
-          domain name terminates with the zero length octet for the null label
-          of the root.
-
-  QTYPE   A two octet code whcich specifies the type of the query.
-
-  QCLASS  A two octet code taht specifies the class of the query.
-
-
-
-  ************************
-  *      DNS Answers     *
-  ************************
-
-    0  1  2  3  4  5  6  7  8  9 10 11 12 13 14 15
-  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-  |                                               |
-  /                                               /
-  /                      NAME                     /
-  |                                               |
-  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-  |                      TYPE                     |
-  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-  |                     CLASS                     |
-  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-  |                      TTL                      |
-  |                                               |
-  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-  |                    RDLENGTH                   |
-  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--|
-  /                     RDATA                     /
-  /                                               /
-  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-
-
-  NAME        The domain name taht was queried.  May take one of TWO formats.
-              The first format is the label format defined for QNAME above.
-              The second format is a pointer (in the interests of data
-              compression which to be fair to the original authors was far
-              more important then than now).  A pointer is an unsigned 16-bit
-              value with the following format (the top two bits of 11 indicate
-              the pointer format):
-
-                  0   1   2   3   4   5   6   7   8   9   10  11  12  13  14  15
-                +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
-                | 1 | 1 |    Offset in bytes from the start of the message.     |
-                +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
-
-              Must point to a label format record to derive name length.
-
-  TYPE        Unsigned 16 bit value.  The resource record types - determines the
-              content of the RDATA field.  These values are assigned by IANA and
-              a complete list of values may be obtained from them.  The following
-              are the most commonly used values:
-                x'0001  (1) = An A record for the domain name
-                x'0002  (2) = A NS record for the domain name
-                x'0005  (5) = A CNAME record for the domain name
-                x'0006  (6) = A SOA record for the domain name
-                x'000B (11) = A WKS record for the domain name
-                x'000C (12) = A PTR record for the domain name
-                x'000F (15) = A MX record for the domain name
-                x'0021 (33) = A SRV record for the domain name
-                x'0026 (38) = An A6 record for the domain name
-
-  CLASS       Unsigned 16 bit value.  The CLASS of resource records be requested,
-              for example, Internet, CHAOS etc.  These values are assigned by IANA
-              and a complete list of values may be obtained from them.  The following
-              are the most commonly used values:
-                x'0001 (1) - IN or Internet
-
-  TTL         Unsigned 32 bit value.  The time in seconds that the record may be
-              cached.  A value of 0 indicates the record should not be cached.
-
-  RDLENGTH    Unsigned 16 bit value that defines the length in bytes of the RDATA
-              record.
-
-  RDATA       Each (or rather most) resoruce record types have a specific RDATA
-              format which reflect their resource record format as defined below:
-                -------------------------------------------------------------------------------
-                SOA
-                  Primary NS       - Variable length.  The name of the Primary Master for
-                                     the domain.  May be a label, pointer or any combination.
-                  Admin MB         - Variable length.  The administrator's mailbox.  May be a
-                                     label, pointer or any combination.
-                  Serial Number    - Unsigned 32-bit integer.
-                  Refresh Interval - Unsigned 32-bit integer.
-                  Retry Interval   - Unsigned 32-bit integer.
-                  Expiration Limit - Unsigned 32-bit integer.
-                  Minimum TTL      - Unsigned 32-bit integer.
-                -------------------------------------------------------------------------------
-                MX
-                  Preference       - A 16-bit integer.
-                  Mail Exchanger   - The name host name that provides the service.  May be a
-                                     label, pointer or any combination.
-                -------------------------------------------------------------------------------
-                A
-                  IP Address       - Unsigned 32-bit value representing the IP address.
-                -------------------------------------------------------------------------------
-                PTR, NS
-                  Name             - The host name that represents the supplied IP address (in 
-                                     the case of a PTR) or the NS name for the supplied domain
-                                     (in the case of NS).  May be a label, pointer or any 
-                                     combintaiton.
-
-
-
-  References:
-  http://www.ccs.neu.edu/home/amislove/teaching/cs4700/fall09/handouts/project1-primer.pdf
-  https://www.ietf.org/rfc/rfc1035.txt
-  http://www.zytrax.com/books/dns/ch15/
+  Defines the functions and structures the DNSClient uses to send queries to
+  its servers and match up their responses.  The message format itself lives
+  in DNSClientCodec.h.
  */
 
 #ifndef __DNSClientImpl_h__
@@ -238,124 +14,530 @@ typedef struct _DNSCLIENT_PRIVATE_DATA DNSCLIENT_PRIVATE_DATA;
 #include <Protocol/LoadedImage.h>
 #include <Protocol/Dhcp4.h>
 #include <Protocol/Udp4.h>
+#include <Protocol/Udp6.h>
+#include <Protocol/Tcp4.h>
 #include <Protocol/Ip4.h>
 #include <Protocol/Ip4Config.h>
+#include <Protocol/Ip4Config2.h>
+#include <Protocol/Ip6Config.h>
 #include <Protocol/NetworkInterfaceIdentifier.h>
 #include <Protocol/ServiceBinding.h>
+#include <Protocol/SimpleFileSystem.h>
 
 #include <Library/DebugLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/MemoryAllocationLib.h>
-#include <Library/UefiApplicationEntryPoint.h>
 #include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiRuntimeServicesTableLib.h>
 #include <Library/UefiLib.h>
 #include <Library/BaseLib.h>
 #include <Library/NetLib.h>
+#include <Library/PcdLib.h>
+#include <Library/PerformanceLib.h>
+#include <Library/TimerLib.h>
+
+#include "DNSClientCache.h"
+#include "DNSClientCodec.h"
+#include "DNSClientHosts.h"
 
 #define DNSCLIENT_PRIVATE_DATA_SIGNATURE SIGNATURE_64 ('C','A','B','D','N','S','C','l')
 
+//
+// Maximum number of queries GetHostsByName will keep outstanding at once.
+//
+#define DNSCLIENT_MAX_PENDING            32
+
+//
+// Most servers a client will fail over between: those handed out by DHCP on
+// each interface followed by PcdDnsClientFallbackServers.
+//
+#define DNSCLIENT_MAX_SERVERS            8
+
+//
+// Longest the startup round trip probe waits for the servers, in milliseconds.
+//
+#define DNSCLIENT_PROBE_TIMEOUT_MS       500
+
+//
+// Most options of a DHCP reply searched for the DNS server option.
+//
+#define DNSCLIENT_MAX_DHCP_OPTIONS       64
+
+//
+// DHCP option carrying the DNS servers (RFC 2132 section 3.8).
+//
+#define DHCP4_TAG_DNS_SERVERS            6
+
+//
+// Most network interfaces (Udp4 and Udp6 service binding handles) a client
+// will use.  A dual stack port counts twice.
+//
+#define DNSCLIENT_MAX_INTERFACES         16
+
+//
+// Bounds on the retransmission timeout of a server or interface, in
+// milliseconds.  The initial timeout comes from PcdDnsClientInitialRto.
+//
+#define DNSCLIENT_MIN_RTO_MS             100
+#define DNSCLIENT_MAX_RTO_MS             8000
+
+//
+// Longest the client will wait for a transmit to complete before cancelling
+// it, in milliseconds.
+//
+#define DNSCLIENT_TX_TIMEOUT_MS          1000
+
+//
+// TPL of the events of every token handed to a Udp4, Udp6 or Tcp4 child.
+// The engine never waits on a token, but SendDNSPacket and DestroyDNSClient
+// do and may be called at TPL_CALLBACK, so their notify functions have to
+// run above it.  They only ever set flags and signal the engine.
+//
+#define DNSCLIENT_TOKEN_TPL              TPL_NOTIFY
+
+#define NS_PER_MS                        1000000ULL
+#define NS_PER_S                         1000000000ULL
+
+//
+// Buckets of each server's round trip time histogram.  Bucket 0 counts the
+// samples under 32us, bucket i those from 2^(i+4) up to 2^(i+5) us, and the
+// last one everything from about half a second up.
+//
+#define DNSCLIENT_RTT_BUCKETS            16
+#define DNSCLIENT_RTT_BUCKET_SHIFT       5
+
+//
+// PERF_START/PERF_END tokens of the phases of a lookup, as the shell's dp
+// command lists them.  Transmits are measured against their DNS_TX_BUFFER so
+// the completion pairs up with its own start, everything else against the
+// image handle.
+//
+#define DNSCLIENT_PERF_CREATE            "DnsCreate"
+#define DNSCLIENT_PERF_LOCATE            "DnsLocate"
+#define DNSCLIENT_PERF_CHILD             "DnsChild"
+#define DNSCLIENT_PERF_CONFIGURE         "DnsConfigure"
+#define DNSCLIENT_PERF_ENCODE            "DnsEncode"
+#define DNSCLIENT_PERF_TRANSMIT          "DnsTransmit"
+#define DNSCLIENT_PERF_WAIT              "DnsWait"
+#define DNSCLIENT_PERF_DECODE            "DnsDecode"
+#define DNSCLIENT_PERF_HOSTS             "DnsHosts"
+#define DNSCLIENT_PERF_SNAPSHOT          "DnsSnapshot"
+
+//
+// Most CNAME records followed to answer one name, across every response and
+// the cache.  Longer chains (or loops) fail with EFI_PROTOCOL_ERROR.
+//
+#define DNS_MAX_CNAME_CHAIN              8
+
+//
+// Number of transmit buffers owned by the client.  A buffer is reused as soon
+// as the Udp4 or Udp6 driver signals its transmit complete.
+//
+#define DNSCLIENT_TX_RING_SIZE           8
+
+//
+// Most receives kept posted on one interface (see PcdDnsClientRxDepth).
+// Each completed receive is posted again as soon as its datagram has been
+// decoded.  There are never more answers on their way than queries in
+// flight, so a ring this deep can take them all arriving at once.
+//
+#define DNSCLIENT_MAX_RX_DEPTH           DNSCLIENT_MAX_PENDING
+
+//
+// Most fragments a single query is transmitted from.
+//
+#define DNS_TX_MAX_FRAGMENTS             4
+
+//
+// Most TCP connections a client keeps open at once, one per IPv4 server.
+//
+#define DNSCLIENT_MAX_TCP_CONNECTIONS    4
+
+//
+// Number of queries which can be written to one TCP connection before the
+// oldest write has to complete.
+//
+#define DNSCLIENT_TCP_TX_RING_SIZE       8
+
+//
+// Longest the client waits for a TCP connection to be established, in
+// milliseconds.
+//
+#define DNSCLIENT_TCP_CONNECT_TIMEOUT_MS 3000
+
+//
+// Size of the two byte length prefixing every message sent over TCP
+// (RFC 1035 section 4.2.2).
+//
+#define DNS_TCP_LENGTH_PREFIX            2
+
+//
+// Receive buffer of a TCP connection.  Holds the largest message that can be
+// sent over TCP along with its length.
+//
+#define DNS_TCP_BUFFER_SIZE              (DNS_TCP_LENGTH_PREFIX + 0xFFFF)
+
 /**
-  Safely destroys a pointer if the pointer is not null.
+  One name to look up for one type of address, and where the addresses go.
+  A PTR lookup names an in-addr.arpa or ip6.arpa name, and receives the
+  dotted name the first PTR record points to in place of addresses.
+ */
+typedef struct _DNS_LOOKUP {
+  CHAR8                          *Hostname;
+  UINT16                         QType;        // 1 (A), 28 (AAAA) or 12 (PTR).
+  VOID                           *Addresses;   // EFI_IPv4_ADDRESS array for A, EFI_IPv6_ADDRESS array for AAAA, CHAR8 array for PTR.
+  UINTN                          MaxAddresses; // Entries Addresses has room for.
+  UINTN                          AddressCount; // Entries filled in.  1 for a PTR lookup whose name fitted.
+  UINT32                         Ttl;          // Seconds the addresses may be kept.  0 for the hosts file.
+  EFI_STATUS                     Status;
+  UINT64                         Started;      // Time (ns) the lookup was taken off the list.
+  UINT64                         Elapsed;      // Time (ns) from Started until it completed.  0 for a cache hit.
+} DNS_LOOKUP;
 
-  @param  x  Pointer to free.
+/**
+  A batch of lookups submitted with ResolveDNSLookupsAsync.  The caller fills
+  in Event, Lookups and Count and keeps the token, and the lookups, in place
+  until Event has been signaled.  The remaining fields belong to the client.
  */
-#define SafeRelease(x)   if(x != NULL){ FreePool(x); x = NULL;}
+typedef struct _DNS_RESOLVE_TOKEN {
+  EFI_EVENT                      Event;        // Optional.  Signaled once every lookup has completed, or the batch has failed.
+  EFI_STATUS                     Status;       // EFI_NOT_READY until then, afterwards as ResolveDNSLookups would return.
+  DNS_LOOKUP                     *Lookups;
+  UINTN                          Count;
+
+  LIST_ENTRY                     Link;         // On DNSCLIENT_PRIVATE_DATA.Requests while running.
+  UINTN                          Next;         // Next entry of Lookups to start.
+  UINTN                          Completed;    // Entries of Lookups which have completed.
+} DNS_RESOLVE_TOKEN;
+
+#define DNS_RESOLVE_TOKEN_FROM_LINK(a)   BASE_CR(a, DNS_RESOLVE_TOKEN, Link)
 
 /**
-  Set status to y and goto x.
+  Where a pending query slot is in its life.  A query is only ever moved
+  along by the client's engine, from a receive completing or its timer.
+ */
+typedef enum {
+  DnsQueryFree,                                // The slot is unused.
+  DnsQueryHeld,                                // Encoded, waiting for the servers to be probed before it goes on the wire.
+  DnsQueryProbe,                               // A round trip probe of one server, see DNSImplStartProbes.
+  DnsQueryActive                               // On the wire, waiting for an answer or for its round to time out.
+} DNS_QUERY_STATE;
 
-  @param  x  Label to go to.
-  @param  y  EFI_STATUS to set Status to.
+/**
+  What the latest attempt of an active query or a probe is waiting on before
+  it can go out.  The engine makes the attempt again when the connection or
+  transmit completes, or once the wait has run out.
  */
-#define GotoStatus(x,y) {Status = y; goto x;}
+typedef enum {
+  DnsWaitNone,                                 // The attempt has been made.
+  DnsWaitConnect,                              // The TCP connection to the server is being established.
+  DnsWaitTransmit                              // Every transmit buffer it could go out from is busy.
+} DNS_QUERY_WAIT;
 
-struct _DNSCLIENT_PRIVATE_DATA {
-  UINT64                         Signature;
-  EFI_HANDLE                     Image;
+/**
+  How far the client has got bringing up the network for the requests it is
+  serving.  It goes back to DnsNetworkIdle once none are left, so interfaces
+  which gain an address and servers which are added in between are picked
+  up by the next request.
+ */
+typedef enum {
+  DnsNetworkIdle,                              // Nothing has been sent for the current requests yet.
+  DnsNetworkProbing,                           // New servers are having their round trip time measured.
+  DnsNetworkReady                              // Queries can be sent.
+} DNS_NETWORK_STATE;
+
+/**
+  A query which has been transmitted and is waiting for a response carrying
+  the same DNS_HEADER.Id.  The name is kept in wire format so it can be
+  transmitted (and retransmitted) straight out of this structure.
+ */
+typedef struct _DNS_PENDING_QUERY {
+  DNS_QUERY_STATE                State;
+  UINT16                         Id;         // Host byte order.
+  UINT16                         QType;      // Host byte order.
+  DNS_RESOLVE_TOKEN              *Token;     // Request the lookup belongs to.  NULL for a probe.
+  DNS_LOOKUP                     *Lookup;    // The lookup being answered.  NULL for a probe.
+  UINTN                          QNameLength;
+  UINT8                          QName[DNS_MAX_NAME_LENGTH];  // Name on the wire, the end of the CNAME chain so far.
+  UINTN                          Links;      // CNAME records followed to reach QName.
+  BOOLEAN                        OverTcp;    // Attempts go over TCP to IPv4 servers: asked for, or a UDP answer came back truncated.
+  UINT32                         EdnsTo;     // Bit per server the query was last sent to with an OPT record.
+
+  UINTN                          Server;     // Server the latest attempt went to.
+  UINTN                          Attempts;   // Transmissions so far, including failed ones.
+  UINT32                         SentTo;     // Bit per server the query has been sent to.
+  UINT32                         Outstanding;// Servers of the current round which have not answered.
+  UINT32                         SentVia;    // Bit per interface the query has been sent on.
+  UINT32                         RoundVia;   // Interfaces the current round went out on.
+  BOOLEAN                        Retried;    // A round timed out and the query was sent again.
+  UINT64                         FirstSent;  // Time (ns) of the first transmission.
+  UINT64                         SentAt[DNSCLIENT_MAX_SERVERS]; // Time (ns) of the latest transmission to each server.
+  UINT64                         RetryAt;    // Time (ns) the current round times out.
+  UINT64                         Deadline;   // Time (ns) the query is given up on.
+  EFI_STATUS                     LastError;  // Reported if no response ever arrives.
+  DNS_QUERY_WAIT                 Wait;       // What the attempt to Server is waiting on.
+  UINT64                         WaitUntil;  // Time (ns) the wait runs out.
+
+  UINTN                          RaceCount;  // Servers raced in the first round.  0 when not racing.
+  UINTN                          RaceNext;   // Next entry of RaceOrder to send to.
+  UINT64                         RaceAt;     // Time (ns) the next staggered leg is due.
+  UINT8                          RaceOrder[DNSCLIENT_MAX_SERVERS];
+} DNS_PENDING_QUERY;
+
+/**
+  Round trip time estimate of a server or interface.  Times are in nanoseconds.
+  The retransmission timeout follows RFC 6298: it is derived from the smoothed
+  round trip time and its variance, and doubles on every timeout.
+ */
+typedef struct _DNS_RTT {
+  UINT64                         Srtt;       // Smoothed round trip time.  0 until measured.
+  UINT64                         RttVar;
+  UINT64                         Rto;        // Current retransmission timeout.
+} DNS_RTT;
+
+/**
+  An upstream server and what the client has learned about it.
+ */
+typedef struct _DNS_SERVER {
+  EFI_IP_ADDRESS                 Address;
+  BOOLEAN                        IsIp6;      // Address is an IPv6 address, reached through a Udp6 interface.
+  BOOLEAN                        Discovered; // Handed out by DHCP rather than taken from the fallback list.
+  BOOLEAN                        Listed;     // Put on the list by DHCP or PcdDnsClientFallbackServers, not only by AddDNSServer.
+  UINTN                          References; // AddDNSServer calls not yet undone by RemoveDNSServer.
+  BOOLEAN                        Probed;     // The startup round trip probe has been sent.
+  BOOLEAN                        NoTcp;      // A TCP connection was refused or timed out, so its truncated answers are taken as they are.
+  BOOLEAN                        NoEdns;     // The server rejected an OPT record, so its queries go out without one.
+
+  DNS_RTT                        Rtt;
+
+  UINT64                         Sent;
+  UINT64                         Answered;
+  UINT64                         Timeouts;
+  UINT64                         Retries;    // Queries sent to the server after a round elsewhere timed out.
+  UINT64                         Races;      // Raced queries the server was sent.
+  UINT64                         Wins;       // Raced queries the server answered first.
+  UINT32                         RttHistogram[DNSCLIENT_RTT_BUCKETS]; // Round trip time samples, see DNSCLIENT_RTT_BUCKETS.
+} DNS_SERVER;
+
+/**
+  A completion token of a Udp4 or a Udp6 child.  Which one is in use follows
+  DNS_INTERFACE.IsIp6 of the interface it is handed to.  Event and Status sit
+  at the same place in both, so they are reached through Udp4 either way.
+ */
+typedef union {
+  EFI_UDP4_COMPLETION_TOKEN      Udp4;
+  EFI_UDP6_COMPLETION_TOKEN      Udp6;
+} DNS_UDP_TOKEN;
+
+/**
+  One entry of an interface's receive ring.
+ */
+typedef struct _DNS_RX_SLOT {
+  struct _DNS_INTERFACE          *Interface; // Interface the receive is posted on, for the receive callback.
+  DNS_UDP_TOKEN                  Token;
+  BOOLEAN                        Done;
+  BOOLEAN                        Posted;
+} DNS_RX_SLOT;
 
-  EFI_HANDLE                     Udp4ServiceHandle;
-  EFI_HANDLE                     Udp4Child;
+/**
+  A network interface: the Udp4 or Udp6 child the client created on one
+  service binding handle, and how well queries sent through it are doing.
+  A dual stack port shows up as two interfaces, one of each.
+
+  An interface without an IP address yet (its Configure returned
+  EFI_NO_MAPPING) is kept and configured again before each batch of lookups.
+ */
+typedef struct _DNS_INTERFACE {
+  DNSCLIENT_PRIVATE_DATA         *Instance;  // Owning client, for the receive callback.
 
-  EFI_SERVICE_BINDING_PROTOCOL   *Udp4Sb;
+  BOOLEAN                        IsIp6;      // Udp6 rather than Udp4.
+  EFI_HANDLE                     ServiceHandle;
+  EFI_HANDLE                     Child;
+  EFI_SERVICE_BINDING_PROTOCOL   *UdpSb;
   EFI_UDP4_PROTOCOL              *Udp4;
-  
   EFI_UDP4_CONFIG_DATA           Udp4CfgData;
+  EFI_UDP6_PROTOCOL              *Udp6;
+  EFI_UDP6_CONFIG_DATA           Udp6CfgData;
+  BOOLEAN                        Started;    // Configure has been accepted, possibly still without an address.
+  BOOLEAN                        Configured; // The child is configured and has an address.
+  BOOLEAN                        Discovered; // The interface's DNS servers have been read.
+
+  DNS_RX_SLOT                    RxRing[DNSCLIENT_MAX_RX_DEPTH]; // Receives kept posted between waits, Instance->RxDepth of them.
+  UINTN                          RxNext;     // Oldest slot, the next to complete.
+
+  DNS_RTT                        Rtt;
+
+  UINT64                         Sent;
+  UINT64                         Answered;
+  UINT64                         Timeouts;
+  UINT64                         Wins;       // Fanned out queries answered through this interface first.
+  UINT64                         Received;   // Datagrams received.
+  UINT64                         RxErrors;   // Receives which completed with an error, ICMP errors mostly.
+  UINTN                          RxBacklog;  // Most completed receives waiting to be picked up at once.
+} DNS_INTERFACE;
+
+/**
+  EFI_UDP4_TRANSMIT_DATA ends in a one entry fragment table.  This gives it
+  room for DNS_TX_MAX_FRAGMENTS entries.
+ */
+typedef struct _DNS_UDP4_TRANSMIT_DATA {
+  EFI_UDP4_TRANSMIT_DATA         TxData;
+  EFI_UDP4_FRAGMENT_DATA         MoreFragments[DNS_TX_MAX_FRAGMENTS - 1];
+} DNS_UDP4_TRANSMIT_DATA;
+
+/**
+  The same for EFI_UDP6_TRANSMIT_DATA.
+ */
+typedef struct _DNS_UDP6_TRANSMIT_DATA {
+  EFI_UDP6_TRANSMIT_DATA         TxData;
+  EFI_UDP6_FRAGMENT_DATA         MoreFragments[DNS_TX_MAX_FRAGMENTS - 1];
+} DNS_UDP6_TRANSMIT_DATA;
+
+/**
+  One entry of the transmit ring.  Data holds the parts of a query which are
+  not already sitting in memory somewhere else (the header and the fixed
+  question fields); the name is sent straight from its DNS_PENDING_QUERY.
+ */
+typedef struct _DNS_TX_BUFFER {
+  BOOLEAN                        IsDone;     // TRUE once the buffer may be reused.
+  DNS_PENDING_QUERY              *Query;     // Query whose name is in flight, or NULL.
+  DNS_INTERFACE                  *Interface; // Interface the buffer was last sent on.
+  UINT64                         Expires;    // Time (ns) a transmit still in flight is cancelled.
+  DNS_UDP_TOKEN                  Token;
+  union {
+    EFI_UDP4_SESSION_DATA        Udp4;
+    EFI_UDP6_SESSION_DATA        Udp6;
+  } Session;
+  union {
+    DNS_UDP4_TRANSMIT_DATA       Udp4;
+    DNS_UDP6_TRANSMIT_DATA       Udp6;
+  } TxData;
+  UINT8                          Data[DNS_HEADER_LENGTH + 4 + DNS_OPT_LENGTH];
+} DNS_TX_BUFFER;
+
+/**
+  One query written to a TCP connection.  The whole message, length prefix
+  and all, is copied in so the pending query can be released or moved along
+  a CNAME chain while the write is still in flight.
+ */
+typedef struct _DNS_TCP_TX_BUFFER {
+  DNSCLIENT_PRIVATE_DATA         *Instance;  // Owning client, for the transmit callback.
+  BOOLEAN                        IsDone;     // TRUE once the buffer may be reused.
+  UINT64                         Expires;    // Time (ns) a write still in flight means the connection is stuck.
+  EFI_TCP4_IO_TOKEN              Token;
+  EFI_TCP4_TRANSMIT_DATA         TxData;
+  UINT8                          Data[DNS_TCP_LENGTH_PREFIX + DNS_HEADER_LENGTH + DNS_MAX_NAME_LENGTH + 4 + DNS_OPT_LENGTH];
+} DNS_TCP_TX_BUFFER;
+
+/**
+  A TCP connection to one IPv4 server, kept open across lookups as RFC 7766
+  recommends.  Queries are written one after another without waiting for
+  earlier answers, and the answers are matched back to their queries by id
+  in whatever order the server sends them.
+
+  The stream is received into Buffer.  Complete messages are handed out
+  from Consumed on, and what is left of a message is moved to the front of
+  Buffer before the next receive is posted.
+ */
+typedef struct _DNS_TCP_CONNECTION {
+  DNSCLIENT_PRIVATE_DATA         *Instance;  // Owning client, for the receive callback.
+
+  EFI_IPv4_ADDRESS               Address;    // Server the connection goes to.
+  UINTN                          Interface;  // Interface whose service binding handle the child was created on.
+  EFI_HANDLE                     Child;      // NULL when the slot is unused.
+  EFI_SERVICE_BINDING_PROTOCOL   *TcpSb;
+  EFI_TCP4_PROTOCOL              *Tcp4;
+  BOOLEAN                        Connected;
+  UINT64                         LastUsed;   // Time (ns) the connection was opened or a query last written.
+
+  EFI_TCP4_CONNECTION_TOKEN      ConnectToken;
+  BOOLEAN                        ConnectDone;
+  UINT64                         ConnectBy;  // Time (ns) a connection not yet established is given up on.
+
+  DNS_TCP_TX_BUFFER              TxRing[DNSCLIENT_TCP_TX_RING_SIZE];
+  UINTN                          TxNext;
+
+  EFI_TCP4_IO_TOKEN              RxToken;    // Receive kept posted while connected.
+  EFI_TCP4_RECEIVE_DATA          RxData;
+  BOOLEAN                        RxDone;
+  BOOLEAN                        RxPosted;
+  UINT8                          *Buffer;    // DNS_TCP_BUFFER_SIZE bytes.
+  UINTN                          Length;     // Bytes of the stream in Buffer.
+  UINTN                          Consumed;   // Bytes of Buffer already handed out.
+} DNS_TCP_CONNECTION;
+
+/**
+  Counters kept over the lifetime of a DNSClient instance.
+ */
+typedef struct _DNSCLIENT_STATS {
+  UINTN                          ArenaHighWater;   // Most arena bytes a single decoded packet has used.
+  UINTN                          ArenaReserved;    // Largest arena reserved up front for a packet.
+  UINTN                          ArenaOverflows;   // Packets which outgrew their initial arena.
+
+  UINT64                         QueriesSent;
+  UINT64                         Retransmits;
+  UINT64                         Timeouts;         // Queries given up on without a response, out of attempts or time.
+  UINT64                         Failures;         // Lookups which failed some other way: every server refused or failed it, or it could not be sent.
+  UINT64                         Failovers;        // Times the preferred server changed.
+  UINT64                         ChainQueries;     // Follow-up queries for CNAME chains which left their response.
+  UINT64                         Truncated;        // UDP answers which came back with the TC bit set.
+  UINT64                         TcpQueries;       // Queries written to a TCP connection.
+  UINT64                         TcpConnects;      // TCP connections established.
+  UINT64                         TcpResets;        // TCP connections lost or refused.
+  UINT64                         EdnsAnswers;      // Answers which carried an OPT record.
+  UINT64                         EdnsFallbacks;    // Servers which rejected an OPT record and were asked again without one.
+  UINTN                          LargestAnswer;    // Largest UDP answer received, in bytes.
+  UINT64                         SendAllocations;    // Heap allocations made while building and sending queries.
+  UINT64                         ReceiveAllocations; // Heap allocations made while receiving and decoding responses.
+} DNSCLIENT_STATS;
+
+struct _DNSCLIENT_PRIVATE_DATA {
+  UINT64                         Signature;
+  EFI_HANDLE                     Image;
+
+  DNS_INTERFACE                  Interfaces[DNSCLIENT_MAX_INTERFACES];
+  UINTN                          InterfaceCount;
+  BOOLEAN                        FanOut;           // Send on every configured interface rather than the fastest.
 
   UINT16                         IdIterator;
-};
 
-typedef UINT8 DNS_PACKET_DATA;
-
-typedef struct _SOA_RECORD {
-  CHAR8                          *PrimaryNS;
-  CHAR8                          *AdminMB;
-  UINT32                         SerialNumber;
-  UINT32                         RefreshInterval;
-  UINT32                         RetryInterval;
-  UINT32                         ExpirationLimit;
-  UINT32                         MinimumTTL;
-} SOA_RECORD;
-
-typedef struct _MX_RECORD {
-  UINT16                         Preference;
-  CHAR8                          *MailExchanger;
-} MX_RECORD;
-
-typedef struct _A_RECORD {
-  EFI_IPv4_ADDRESS               IpAddress;
-} A_RECORD;
-
-typedef struct _PTR_RECORD {
-  CHAR8                          *Name;
-} PTR_RECORD;
-
-typedef struct _NS_RECORD {
-  CHAR8                          *Name;
-} NS_RECORD;
-
-typedef struct _DNS_HEADER {
-  UINT16                         Id;         // 16 bit identifer assigned by the client.
-
-  UINT16                         Rd:1;       //
-  UINT16                         Tc:1;
-  UINT16                         Aa:1;
-  UINT16                         Opcode:4;
-  UINT16                         Qr:1;
-
-  UINT16                         RCode:4;
-  UINT16                         Cd:1;
-  UINT16                         Ad:1;
-  UINT16                         Z:1;
-  UINT16                         Ra:1;
-
-  UINT16                         QdCount;
-  UINT16                         AnCount;
-  UINT16                         NsCount;
-  UINT16                         ArCount;
-} DNS_HEADER;
-
-typedef struct _DNS_PACKET {
-  DNS_HEADER                     Header;
-
-  UINT16                         DataLength;
-
-  DNS_PACKET_DATA                *Data;
-} DNS_PACKET;
-
-typedef struct _DNS_QUESTION {
-  CHAR8                          *QName;
-  UINT16                         QType;
-  UINT16                         QClass;
-} DNS_QUESTION;
-
-typedef struct _DNS_ANSWER {
-  CHAR8                          *Name;
-  UINT16                         Type;
-  UINT16                         Class;
-  UINT32                         TTL;
-  UINT32                         RdLength;
-  VOID*                          RData;
-} DNS_ANSWER;
+  DNS_SERVER                     Servers[DNSCLIENT_MAX_SERVERS];
+  UINTN                          ServerCount;
+  UINTN                          ActiveServer;     // Server new queries go to first.
+  UINTN                          RaceWidth;        // Servers each new query is raced across.  0 or 1 disables racing.
+  UINT64                         RaceStagger;      // Delay (ns) between the legs of a race.
+
+  EFI_EVENT                      Timer;            // EVT_TIMER bounding every wait.
+  EFI_EVENT                      Engine;           // Runs the engine: armed for the next query which needs attention, and signaled by every receive.
+
+  BOOLEAN                        RxReady;          // Set when any interface's or TCP connection's receive completes.
+  UINTN                          RxDepth;          // Receives kept posted on each interface, 1 to DNSCLIENT_MAX_RX_DEPTH.  Only changed while none are.
+
+  DNS_TX_BUFFER                  TxRing[DNSCLIENT_TX_RING_SIZE];
+  UINTN                          TxNext;
+  BOOLEAN                        TxWaiting;        // A query is waiting on a transmit buffer, so completed transmits signal the engine.
+
+  BOOLEAN                        UseTcp;           // Every query goes over TCP to IPv4 servers, not just truncated ones.
+
+  UINT16                         EdnsPayloadSize;  // UDP payload size advertised in an OPT record.  0 sends no OPT record.
+  DNS_TCP_CONNECTION             TcpConnections[DNSCLIENT_MAX_TCP_CONNECTIONS];
+
+  LIST_ENTRY                     Requests;         // DNS_RESOLVE_TOKENs being served, oldest first.
+  DNS_NETWORK_STATE              Network;
+  DNS_PENDING_QUERY              Pending[DNSCLIENT_MAX_PENDING];
+  UINTN                          PendingCount;     // Slots in use, whatever their state.
+  UINTN                          ProbeCount;       // Slots holding a probe.
+  UINTN                          Window;           // Most queries kept outstanding at once, 1 to DNSCLIENT_MAX_PENDING.
+  UINT64                         IssueInterval;    // Least time (ns) between starting lookups.  0 starts them as fast as Window allows.
+  UINT64                         NextIssue;        // Time (ns) the next lookup may be started.
+
+  DNS_CACHE                      Cache;
+
+  DNS_HOSTS                      Hosts;            // Names read from PcdDnsClientHostsFile.
+  BOOLEAN                        UseHosts;         // Answer from Hosts before asking any server.
+
+  DNSCLIENT_STATS                Stats;
+};
 
 /**
   Creates and initalizes the DNSClient's private data.
@@ -378,7 +560,20 @@ EFI_STATUS EFIAPI CreateDNSClient(DNSCLIENT_PRIVATE_DATA *Instance);
 EFI_STATUS EFIAPI DestroyDNSClient(DNSCLIENT_PRIVATE_DATA *Instance);
 
 /**
-  Get's an ip address by a host name.
+  Writes the answer cache to PcdDnsClientCacheFile, replacing the previous
+  snapshot.  DestroyDNSClient does this itself, a client which is never
+  destroyed can call it whenever its cache is worth keeping.
+
+  @param[in] Instance  The Private data to be used.
+
+  @retval EFI_SUCCESS  The snapshot has been written, or snapshots are turned off.
+  @retval other        The snapshot could not be written.
+  */
+EFI_STATUS EFIAPI SaveDNSCache(DNSCLIENT_PRIVATE_DATA *Instance);
+
+/**
+  Get's an ip address by a host name.  A name listed in the hosts file is
+  answered from it without any network I/O.
 
   @param[in]      Instance   The Private data to be used.
   @param[in]      Hostname   A null terminated string of the hostname to look up.
@@ -390,28 +585,173 @@ EFI_STATUS EFIAPI DestroyDNSClient(DNSCLIENT_PRIVATE_DATA *Instance);
 EFI_STATUS EFIAPI GetHostByName(DNSCLIENT_PRIVATE_DATA *Instance, CHAR8 *Hostname, EFI_IPv4_ADDRESS *IpAddress);
 
 /**
-  Creates a DNS_PACKET based off of the parameters provided.  Must call ReleaseDNSPacket to free up used memory.
+  Get's the ip addresses of several host names at once.
+
+  Up to DNSCLIENT_MAX_PENDING queries are kept outstanding and responses are
+  matched back to their hostname by DNS_HEADER.Id, so resolving N names costs
+  roughly one round trip instead of N.  See ResolveDNSLookups.
+
+  @param[in]      Instance     The Private data to be used.
+  @param[in]      Hostnames    Array of null terminated hostnames to look up.
+  @param[in]      Count        Number of entries in Hostnames.
+  @param[in/out]  IpAddresses  Array of Count addresses, one per hostname.
+  @param[in/out]  Statuses     Array of Count statuses, one per hostname.
 
-  @param[in] Questions     Array of Questions in the dns request.
-  @param[in] NumQuestions  Number of Questions in the array.
+  @retval EFI_SUCCESS            Every hostname has been processed, see Statuses for the result of each.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL.
+  @retval other                  Receiving failed.  Hostnames which did not complete are set to this status.
+  */
+EFI_STATUS EFIAPI GetHostsByName(DNSCLIENT_PRIVATE_DATA *Instance, CHAR8 **Hostnames, UINTN Count, EFI_IPv4_ADDRESS *IpAddresses, EFI_STATUS *Statuses);
 
-  @retval EFI_SUCCESS      Packet data has been successfully created.
-  @retval other            An error occured.
+/**
+  Looks up several names, each for one type of address, at once.
+
+  Up to DNSCLIENT_MAX_PENDING queries are kept outstanding and responses are
+  matched back to their lookup by DNS_HEADER.Id, so resolving N lookups costs
+  roughly one round trip instead of N.  The A and AAAA lookups of a name go
+  out together, and either can travel over IPv4 or IPv6 depending on which
+  server is asked.
+
+  Names listed in the hosts file (see PcdDnsClientHostsFile) are answered
+  from it first, then from the cache.  If every lookup is answered that way
+  no interface or server is touched.  Instance->UseHosts turns the hosts
+  file off.
+
+  A query which goes unanswered for its server's retransmission timeout is sent
+  again to the next server on the list, up to PcdDnsClientMaxAttempts times and
+  for no longer than PcdDnsClientMaxLookupTime in total.
+
+  Instance->Window and Instance->IssueInterval bound how many queries are
+  outstanding and how quickly new ones are started, so a load generator can
+  hold a fixed concurrency or rate.  Lookups fall behind the rate only when
+  the window is full, and are then started back to back to catch up.
+
+  If Instance->RaceWidth is 2 or more each query is first sent to that many
+  of the fastest servers, and the first matching answer wins.
+
+  A UDP answer which comes back truncated is asked for again over a TCP
+  connection to the same server.  With Instance->UseTcp set every query to
+  an IPv4 server goes over TCP.  Connections are kept open and queries are
+  pipelined over them.
+
+  This submits the lookups with ResolveDNSLookupsAsync and polls the client
+  until they have completed.  Must be called at or below TPL_CALLBACK.
+
+  @param[in]      Instance     The Private data to be used.
+  @param[in/out]  Lookups      Array of lookups.  AddressCount and Status are filled in.
+  @param[in]      Count        Number of entries in Lookups.
+
+  @retval EFI_SUCCESS            Every lookup has been processed, see their Status for the result of each.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL.
+  @retval EFI_NO_MAPPING         No interface has an address.
+  @retval other                  Receiving failed.  Lookups which did not complete are set to this status.
   */
-DNS_PACKET* EFIAPI CreateDNSPacket(DNS_QUESTION Questions[], UINTN NumQuestions);
+EFI_STATUS EFIAPI ResolveDNSLookups(DNSCLIENT_PRIVATE_DATA *Instance, DNS_LOOKUP *Lookups, UINTN Count);
 
 /**
-  Release a DNS_PACKET.
+  Starts a batch of lookups and returns without waiting for any of them.
+  Token->Event is signaled once every lookup has completed, with the result
+  of the batch in Token->Status and that of each lookup in its Status, just
+  as ResolveDNSLookups leaves them.
+
+  Lookups answered from the hosts file or the cache complete straight away,
+  the rest are moved along from the client's engine event as their answers
+  arrive and their timeouts expire.  Batches submitted while others are
+  running share the window of outstanding queries, oldest batch first.
+  PollDNSClient speeds the engine up, but is not needed for it to make
+  progress.
+
+  Token->Event should have a notify function at TPL_CALLBACK.  It may be
+  signaled before this returns.  Must be called at or below TPL_CALLBACK.
+
+  @param[in]      Instance     The Private data to be used.
+  @param[in/out]  Token        The batch.  Event, Lookups and Count must be filled in.
+
+  @retval EFI_SUCCESS            The batch has been started.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL, or a lookup has room for addresses but no Addresses.
+  */
+EFI_STATUS EFIAPI ResolveDNSLookupsAsync(DNSCLIENT_PRIVATE_DATA *Instance, DNS_RESOLVE_TOKEN *Token);
 
-  @param[in] Packet        The Packet to free data on.
+/**
+  Stops a batch submitted with ResolveDNSLookupsAsync.  Lookups which have
+  not completed are set to EFI_ABORTED, as is Token->Status, and Token->Event
+  is signaled.  Must be called at or below TPL_CALLBACK.
 
-  @retval EFI_SUCCESS      Data has been freed.
-  @retval other            An error occured.
+  @param[in] Instance            The Private data to be used.
+  @param[in] Token               The batch.
+
+  @retval EFI_SUCCESS            The batch has been stopped.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL.
+  @retval EFI_NOT_FOUND          Token is not running, it may have completed already.
   */
-EFI_STATUS EFIAPI ReleaseDNSPacket(DNS_PACKET *Packet);
+EFI_STATUS EFIAPI CancelDNSLookups(DNSCLIENT_PRIVATE_DATA *Instance, DNS_RESOLVE_TOKEN *Token);
 
 /**
-  Sends a DNS_PACKET synchronously.
+  Polls every interface and TCP connection the client has open, then lets
+  the engine handle whatever has arrived and whatever is due.  Must be
+  called at or below TPL_CALLBACK.
+
+  @param[in] Instance            The Private data to be used.
+
+  @retval EFI_SUCCESS            The client has been polled.
+  @retval EFI_INVALID_PARAMETER  Instance is NULL.
+  @retval EFI_NOT_STARTED        Nothing is open to poll yet.
+  */
+EFI_STATUS EFIAPI PollDNSClient(DNSCLIENT_PRIVATE_DATA *Instance);
+
+/**
+  Get's both the IPv4 and the IPv6 addresses of a host name.  The A and AAAA
+  queries are sent at the same time, so this costs one round trip.
+
+  @param[in]      Instance      The Private data to be used.
+  @param[in]      Hostname      A null terminated string of the hostname to look up.
+  @param[out]     Ip4Addresses  Optional.  Receives the IPv4 addresses.  NULL skips the A query.
+  @param[in/out]  Ip4Count      Entries Ip4Addresses has room for on input, addresses found on output.
+  @param[out]     Ip6Addresses  Optional.  Receives the IPv6 addresses.  NULL skips the AAAA query.
+  @param[in/out]  Ip6Count      Entries Ip6Addresses has room for on input, addresses found on output.
+
+  @retval EFI_SUCCESS            At least one address has been found.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL, or both address arrays are.
+  @retval EFI_NOT_FOUND          The name has no address of either type.
+  @retval other                  Neither query succeeded.  The error of the A query is preferred.
+  */
+EFI_STATUS EFIAPI GetHostAddresses(DNSCLIENT_PRIVATE_DATA *Instance, CHAR8 *Hostname, EFI_IPv4_ADDRESS *Ip4Addresses, UINTN *Ip4Count, EFI_IPv6_ADDRESS *Ip6Addresses, UINTN *Ip6Count);
+
+/**
+  Adds a server to the end of the failover list, behind those handed out by
+  DHCP, as though it had been listed in PcdDnsClientFallbackServers.  Each
+  call takes a reference on the server which RemoveDNSServer gives back.
+  Must not be called while a lookup is running.
+
+  @param[in] Instance             The Private data to be used.
+  @param[in] Address              The server's address.
+  @param[in] IsIp6                TRUE if Address is an IPv6 address.
+
+  @retval EFI_SUCCESS             The server is on the list.
+  @retval EFI_INVALID_PARAMETER   A parameter is NULL.
+  @retval EFI_OUT_OF_RESOURCES    The list is full.
+  */
+EFI_STATUS EFIAPI AddDNSServer(DNSCLIENT_PRIVATE_DATA *Instance, EFI_IP_ADDRESS *Address, BOOLEAN IsIp6);
+
+/**
+  Undoes one AddDNSServer of a server.  The server leaves the failover list
+  once every AddDNSServer of it has been undone, unless DHCP or
+  PcdDnsClientFallbackServers put it there as well.  Must not be called
+  while a lookup is running.
+
+  @param[in] Instance             The Private data to be used.
+  @param[in] Address              The server's address.
+  @param[in] IsIp6                TRUE if Address is an IPv6 address.
+
+  @retval EFI_SUCCESS             The server has been released.
+  @retval EFI_INVALID_PARAMETER   A parameter is NULL.
+  @retval EFI_NOT_FOUND           The server was not added with AddDNSServer.
+  */
+EFI_STATUS EFIAPI RemoveDNSServer(DNSCLIENT_PRIVATE_DATA *Instance, EFI_IP_ADDRESS *Address, BOOLEAN IsIp6);
+
+
+/**
+  Sends a DNS_PACKET synchronously on the fastest interface with an address.
 
   @param[in] Instance             Pointer to a DNSClient instance.
   @param[in] Packet               A pointer to the DNS packet to send.
@@ -419,6 +759,7 @@ EFI_STATUS EFIAPI ReleaseDNSPacket(DNS_PACKET *Packet);
 
   @retval EFI_SUCCESS             Packet sent successfully.
   @retval EFI_INVALID_PARAMETER   Instance or Packet is NULL.
+  @retval EFI_NO_MAPPING          No interface has an address.
   @retval EFI_OUT_OF_RESOURCES    Out of memory.
   @retval other                   The packet could not be received for some other reason.  Most likely do to a error that bubbled up from another function.
  */
@@ -428,15 +769,48 @@ EFI_STATUS EFIAPI SendDNSPacket(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PACKET *Pa
   Recieves a DNS_PACKET synchronously.
   Must call ReleaseDNSPacket when done.
 
-  @param[in] Instance             Pointer to a DNSClient instance.
-  @param[in] Packet               A pointer to the vairable that will contain the address of the received packet.
+  The response is decoded directly out of the Udp4 or Udp6 receive fragments
+  and the receive buffer is only handed back to the driver once decoding is done.
+
+  A receive is posted on every configured interface and the first datagram to
+  arrive on any of them is returned.  If nothing arrives within Timeout the
+  receives are left posted, so a later call picks up where this one stopped.
+  CancelDNSReceive takes them back.
+
+  Messages arriving on an open TCP connection are returned the same way, one
+  at a time, once all of a message has arrived.
+
+  @param[in]  Instance            Pointer to a DNSClient instance.
+  @param[out] Packet              A pointer to the vairable that will contain the address of the received packet.
+  @param[in]  Timeout             Longest time to wait, in nanoseconds.
+  @param[out] Source              Optional.  Receives the address the datagram came from.  An IPv6
+                                  address if the interface it arrived on is a Udp6 one.
+  @param[out] Interface           Optional.  Receives the index of the interface it arrived on, or
+                                  the TCP connection was opened on.
  
   @retval EFI_SUCCESS             Packet received successfully.
   @retval EFI_INVALID_PARAMETER   Instance or Packet is NULL.
+  @retval EFI_TIMEOUT             Nothing was received within Timeout.
   @retval EFI_OUT_OF_RESOURCES    Out of memory.
+  @retval EFI_PROTOCOL_ERROR      The datagram is not a well formed DNS message.
   @retval other                   The packet could not be received for some other reason.  Most likely do to a error that bubbled up from another function.
  */
-EFI_STATUS EFIAPI ReceiveDNSPacket(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PACKET **Packet);
+EFI_STATUS EFIAPI ReceiveDNSPacket(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PACKET **Packet, UINT64 Timeout, EFI_IP_ADDRESS *Source, UINTN *Interface);
+
+/**
+  Cancels the receives left posted by ReceiveDNSPacket, if there are any.
+
+  @param[in] Instance             Pointer to a DNSClient instance.
+ */
+VOID EFIAPI CancelDNSReceive(DNSCLIENT_PRIVATE_DATA *Instance);
+
+/**
+  Returns a monotonic time stamp in nanoseconds.  Only differences between two
+  time stamps are meaningful.
+
+  @retval UINT64          Nanoseconds since the first call.
+  */
+UINT64 EFIAPI DNSImplGetTimeNs(VOID);
 
 /**
   Sets a boolean to true.
@@ -449,25 +823,14 @@ EFI_STATUS EFIAPI ReceiveDNSPacket(DNSCLIENT_PRIVATE_DATA *Instance, DNS_PACKET
 VOID EFIAPI DNSImplGenericCallback(IN EFI_EVENT Event, IN VOID *Context);
 
 /**
-  Converts a hostname to DNS label format.
-  Must call FreePool when done with the string.
+  Runs the client's engine.  This is the notify function of
+  DNSCLIENT_PRIVATE_DATA.Engine, which every completed receive signals and
+  which arms itself for the next retransmission, probe deadline or lookup.
+  This function should not be called directly.
 
-  @param[in] Hostname     The hostname string to convert.
-  @param[in] Length       The length of the Hostname string.
-
-  @retval NULL            Hostname is NULL or out of memory.
-  @retval CHAR8*          Pointer to newly created label format string.
-  */
-CHAR8* EFIAPI HostnameToLabelFormat(CHAR8* Hostname, UINTN Length);
-
-/**
-  Converts a DNS label format to a Hostname string.  
-  Must call FreePool when done with the string.
-
-  @param[in] LabelFormat  The label formatted string to convert.
+  @param[in] Event        The engine event.
+  @param[in] Context      The DNSCLIENT_PRIVATE_DATA.
+ */
+VOID EFIAPI DNSImplEngineNotify(IN EFI_EVENT Event, IN VOID *Context);
 
-  @retval NULL            LabelFormat is NULL or out of memory.
-  @retval CHAR8*          Pointer to newly created string.
-  */
-CHAR8* EFIAPI LabelFormatToHostname(CHAR8* LabelFormat);
 #endif
\ No newline at end of file
@@ -3,7 +3,43 @@
 //
 // Global Variables
 //
+
+//
+// Most addresses of each family printed per hostname with -dual.
+//
+#define DUAL_MAX_ADDRESSES   4
+
+//
+// Percentiles of the round trip times -bench reports.
+//
+STATIC CONST UINTN mBenchPercentiles[] = { 50, 90, 99 };
+
+//
+// First line of every -out file.
+//
+STATIC CONST CHAR8 mBulkHeader[] = "name,type,ttl,address,rtt_us,status\n";
+
+//
+// First line of the -out file of a -ptr sweep.
+//
+STATIC CONST CHAR8 mPtrHeader[] = "address,name,ttl,rtt_us,status\n";
+
 STATIC CONST SHELL_PARAM_ITEM ParamList[] = {
+  {L"-stats", TypeFlag},
+  {L"-race", TypeValue},
+  {L"-fanout", TypeFlag},
+  {L"-dual", TypeFlag},
+  {L"-tcp", TypeFlag},
+  {L"-edns", TypeValue},
+  {L"-rxdepth", TypeValue},
+  {L"-bench", TypeValue},
+  {L"-qps", TypeValue},
+  {L"-concurrency", TypeValue},
+  {L"-count", TypeValue},
+  {L"-nohosts", TypeFlag},
+  {L"-in", TypeValue},
+  {L"-out", TypeValue},
+  {L"-ptr", TypeValue},
   {NULL, TypeMax}
 };
 
@@ -19,11 +55,62 @@ STATIC CONST SHELL_PARAM_ITEM ParamList[] = {
 EFI_STATUS EFIAPI UefiMain(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE *SystemTable) {
   EFI_STATUS                       Status;                    // Used to get, validate, and return status.
   DNSCLIENT_PRIVATE_DATA           *Private;                  // Stores Session data for this instance.
-  EFI_IPv4_ADDRESS                 IpAddress;
-  CHAR8                            *Hostname;
+  DNSCLIENT_ENGINE_PROTOCOL        *Engine;                   // Runs the lookups, on Private or in DNSClientDxe.
+  DNSCLIENT_LOCAL_ENGINE           LocalEngine;
+  EFI_IPv4_ADDRESS                 *IpAddresses;
+  EFI_IPv6_ADDRESS                 *Ip6Addresses;
+  EFI_STATUS                       *Statuses;
+  DNS_LOOKUP                       *Lookups;
+  CHAR8                            **Hostnames;
+  UINTN                            HostCount;
+  UINTN                            i;
   LIST_ENTRY                       *Package;
   CONST CHAR16                     *Param;
   CHAR16                           *ProblemParam;
+  BOOLEAN                          ShowStats;
+  BOOLEAN                          FanOut;
+  BOOLEAN                          Dual;
+  BOOLEAN                          UseTcp;
+  BOOLEAN                          NoHosts;
+  UINTN                            RaceWidth;
+  UINTN                            EdnsPayloadSize;
+  UINTN                            RxDepth;
+  CONST CHAR16                     *BenchList;
+  CHAR8                            *BenchBuffer;
+  UINTN                            BenchQps;
+  UINTN                            BenchWindow;
+  UINTN                            BenchCount;
+  CONST CHAR16                     *BulkIn;
+  CONST CHAR16                     *BulkOut;
+  CONST CHAR16                     *PtrRange;
+  EFI_IPv4_ADDRESS                 PtrAddress;
+  UINTN                            PtrPrefixLength;
+
+  Private         = NULL;
+  Engine          = NULL;
+  ShowStats       = FALSE;
+  FanOut          = FALSE;
+  Dual            = FALSE;
+  UseTcp          = FALSE;
+  NoHosts         = FALSE;
+  Hostnames       = NULL;
+  IpAddresses     = NULL;
+  Ip6Addresses    = NULL;
+  Statuses        = NULL;
+  Lookups         = NULL;
+  HostCount       = 0;
+  RaceWidth       = 0;
+  EdnsPayloadSize = MAX_UINTN;
+  RxDepth         = 0;
+  BenchList       = NULL;
+  BenchBuffer     = NULL;
+  BenchQps        = 0;
+  BenchWindow     = DNSCLIENT_MAX_PENDING;
+  BenchCount      = 0;
+  BulkIn          = NULL;
+  BulkOut         = NULL;
+  PtrRange        = NULL;
+  PtrPrefixLength = 0;
 
   Status = ShellCommandLineParse (ParamList, &Package, &ProblemParam, TRUE);
 
@@ -38,61 +125,319 @@ EFI_STATUS EFIAPI UefiMain(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE *Syste
     }
   } else {
 
-  if (ShellCommandLineGetCount(Package) < 2) {
+  ShowStats = ShellCommandLineGetFlag(Package, L"-stats");
+
+  //
+  // -fanout sends every query on every interface with an address instead
+  // of only the fastest one.
+  //
+  FanOut = ShellCommandLineGetFlag(Package, L"-fanout");
+
+  //
+  // -dual asks for the AAAA records of every hostname alongside its A
+  // records, and prints every address of both.
+  //
+  Dual = ShellCommandLineGetFlag(Package, L"-dual");
+
+  //
+  // -tcp sends every query to an IPv4 server over a TCP connection which is
+  // kept open for the whole batch, rather than only those whose UDP answer
+  // came back truncated.  Worth it when resolving many names at once.
+  //
+  UseTcp = ShellCommandLineGetFlag(Package, L"-tcp");
+
+  //
+  // -nohosts ignores the hosts file and asks the servers for every name.
+  //
+  NoHosts = ShellCommandLineGetFlag(Package, L"-nohosts");
+
+  //
+  // -race K sends every query to the K fastest servers at once.
+  //
+  Param = ShellCommandLineGetValue(Package, L"-race");
+
+  if(Param != NULL) {
+    RaceWidth = StrDecimalToUintn(Param);
+  }
+
+  //
+  // -edns N advertises an N byte UDP payload in the OPT record of every
+  // query, 1232 or 4096 say.  -edns 0 leaves the OPT record out.
+  //
+  Param = ShellCommandLineGetValue(Package, L"-edns");
+
+  if(Param != NULL) {
+    EdnsPayloadSize = MIN(StrDecimalToUintn(Param), MAX_UINT16);
+
+    if(EdnsPayloadSize != 0) {
+      EdnsPayloadSize = MAX(EdnsPayloadSize, DNS_EDNS_MIN_PAYLOAD);
+    }
+  }
+
+  //
+  // -rxdepth N keeps N receives (1 to 32) posted on every interface.  Fewer
+  // than the queries kept in flight risks dropping a burst of answers.
+  //
+  Param = ShellCommandLineGetValue(Package, L"-rxdepth");
+
+  if(Param != NULL) {
+    RxDepth = MIN(MAX(StrDecimalToUintn(Param), 1), DNSCLIENT_MAX_RX_DEPTH);
+  }
+
+  //
+  // -bench File resolves the names listed in File (one per line) as a load
+  // generator and reports the rate and round trip times achieved.  -qps N
+  // holds the rate at N queries a second, -concurrency N keeps at most N
+  // queries outstanding and -count N sends N queries, cycling through the
+  // list.  By default every name is sent once as fast as the window allows.
+  //
+  BenchList = ShellCommandLineGetValue(Package, L"-bench");
+
+  Param = ShellCommandLineGetValue(Package, L"-qps");
+
+  if(Param != NULL) {
+    BenchQps = StrDecimalToUintn(Param);
+  }
+
+  Param = ShellCommandLineGetValue(Package, L"-concurrency");
+
+  if(Param != NULL) {
+    BenchWindow = MAX(1, MIN(StrDecimalToUintn(Param), DNSCLIENT_MAX_PENDING));
+  }
+
+  Param = ShellCommandLineGetValue(Package, L"-count");
+
+  if(Param != NULL) {
+    BenchCount = StrDecimalToUintn(Param);
+  }
+
+  //
+  // -in File -out File resolves every name listed in the first file and
+  // writes a name,type,ttl,address,rtt_us,status line per address to the
+  // second as each name completes.  -concurrency N keeps at most N names
+  // outstanding and -dual looks up their AAAA records as well.  The file is
+  // streamed, so it may be as long as the volume allows.
+  //
+  BulkIn  = ShellCommandLineGetValue(Package, L"-in");
+  BulkOut = ShellCommandLineGetValue(Package, L"-out");
+
+  //
+  // -ptr Address/PrefixLength looks up the PTR record of every address in
+  // the range, 10.1.0.0/16 say, and prints the names found with the
+  // progress and rate of the sweep.  -concurrency N keeps at most N
+  // addresses outstanding and -out File writes a line per address to File
+  // instead.
+  //
+  PtrRange = ShellCommandLineGetValue(Package, L"-ptr");
+
+  if(BenchList != NULL) {
+    Status = ReadNameList(BenchList, &BenchBuffer, &Hostnames, &HostCount);
+
+    if(EFI_ERROR(Status)) {
+      Print(L"Could not read names from %s.\n", BenchList);
+      goto CLEANUP;
+    }
+
+    if(HostCount == 0) {
+      Print(L"No names in %s.\n", BenchList);
+      GotoStatus(CLEANUP, SHELL_INVALID_PARAMETER);
+    }
+  } else if(PtrRange != NULL) {
+    if(EFI_ERROR(ParseCidr(PtrRange, &PtrAddress, &PtrPrefixLength))) {
+      Print(L"Invalid range %s.", PtrRange);
+      GotoStatus(EXIT, SHELL_INVALID_PARAMETER);
+    }
+  } else if(BulkIn != NULL) {
+    if(BulkOut == NULL) {
+      Print(L"-in needs -out.");
+      GotoStatus(EXIT, SHELL_INVALID_PARAMETER);
+    }
+  } else if (ShellCommandLineGetCount(Package) < 2) {
     Print(L"To few arguments.");
     //ShellPrintHiiEx(-1, -1, NULL, STRING_TOKEN (STR_GEN_TOO_FEW), gShellDebug1HiiHandle);
     GotoStatus(EXIT, SHELL_INVALID_PARAMETER);
-   } else if (ShellCommandLineGetCount(Package) > 2) {
-    Print(L"To many arguments.");
-    //ShellPrintHiiEx(-1, -1, NULL, STRING_TOKEN (STR_GEN_TOO_MANY), gShellDebug1HiiHandle);
-    GotoStatus(EXIT, SHELL_INVALID_PARAMETER);
-   } 
+  } else {
+    //
+    // Every remaining argument is a hostname to resolve.  They are all
+    // resolved together so the lookups overlap on the wire.
+    //
+    HostCount   = ShellCommandLineGetCount(Package) - 1;
+    Hostnames   = AllocateZeroPool(sizeof(CHAR8*) * HostCount);
+    IpAddresses = AllocateZeroPool(sizeof(EFI_IPv4_ADDRESS) * HostCount * (Dual ? DUAL_MAX_ADDRESSES : 1));
+    Statuses    = AllocateZeroPool(sizeof(EFI_STATUS) * HostCount);
 
-    Param = ShellCommandLineGetRawValue(Package, 1);
-    if(Param != NULL) {
-      Hostname = AllocateZeroPool(StrnLenS(Param, 255));
+    if(Hostnames == NULL || IpAddresses == NULL || Statuses == NULL) {
+      GotoStatus(CLEANUP, EFI_OUT_OF_RESOURCES);
+    }
+
+    if(Dual) {
+      Ip6Addresses = AllocateZeroPool(sizeof(EFI_IPv6_ADDRESS) * HostCount * DUAL_MAX_ADDRESSES);
+      Lookups      = AllocateZeroPool(sizeof(DNS_LOOKUP) * HostCount * 2);
 
-      if(Hostname == NULL) {
-        return EFI_OUT_OF_RESOURCES;
+      if(Ip6Addresses == NULL || Lookups == NULL) {
+        GotoStatus(CLEANUP, EFI_OUT_OF_RESOURCES);
       }
+    }
 
-      UnicodeStrToAsciiStr(Param, Hostname);
-    } else {
-      GotoStatus(EXIT, SHELL_INVALID_PARAMETER);
+    for(i = 0; i < HostCount; ++i) {
+      Param = ShellCommandLineGetRawValue(Package, i + 1);
+
+      if(Param == NULL) {
+        GotoStatus(CLEANUP, SHELL_INVALID_PARAMETER);
+      }
+
+      //
+      // Nothing longer than a DNS name can be looked up, and the copy below
+      // is only given room for that much.
+      //
+      if(StrnLenS(Param, DNS_MAX_NAME_LENGTH + 1) > DNS_MAX_NAME_LENGTH) {
+        Print(L"Hostname too long: %s\n", Param);
+        GotoStatus(CLEANUP, SHELL_INVALID_PARAMETER);
+      }
+
+      Hostnames[i] = AllocateZeroPool(StrLen(Param) + 1);
+
+      if(Hostnames[i] == NULL) {
+        GotoStatus(CLEANUP, EFI_OUT_OF_RESOURCES);
+      }
+
+      UnicodeStrToAsciiStr(Param, Hostnames[i]);
     }
   }
+  }
 
-  Private = AllocateZeroPool(sizeof(DNSCLIENT_PRIVATE_DATA));
+  //
+  // A resident DNSClientDxe already has a resolver running, with a warm
+  // cache and its network children open, so plain lookups are run by it
+  // rather than on a resolver of our own.  Anything which changes how the
+  // resolver behaves gets one of its own, so the change does not leak into
+  // the one every other consumer shares, as does -stats, whose counters are
+  // those of our resolver.
+  //
+  if(RaceWidth == 0 && RxDepth == 0 && !FanOut && !UseTcp && !NoHosts && EdnsPayloadSize == MAX_UINTN && BenchList == NULL && !ShowStats) {
+    Status = gBS->LocateProtocol(&gDnsClientEngineProtocolGuid, NULL, (VOID**) &Engine);
 
-  if(Private == NULL) {
-    return EFI_OUT_OF_RESOURCES;
+    if(EFI_ERROR(Status) || Engine->Revision != DNSCLIENT_ENGINE_PROTOCOL_REVISION) {
+      Engine = NULL;
+    }
   }
 
-  Private->Signature = DNSCLIENT_PRIVATE_DATA_SIGNATURE;
-  Private->Image     = ImageHandle;
+  if(Engine == NULL) {
+    Private = AllocateZeroPool(sizeof(DNSCLIENT_PRIVATE_DATA));
 
-  Status = CreateDNSClient(Private);
+    if(Private == NULL) {
+      GotoStatus(CLEANUP, EFI_OUT_OF_RESOURCES);
+    }
 
-  if(EFI_ERROR(Status)) {
-    GotoStatus(CLEANUP, EFI_ABORTED);
+    Private->Signature = DNSCLIENT_PRIVATE_DATA_SIGNATURE;
+    Private->Image     = ImageHandle;
+
+    Status = CreateDNSClient(Private);
+
+    if(EFI_ERROR(Status)) {
+      GotoStatus(CLEANUP, EFI_ABORTED);
+    }
+
+    LocalEngine.Signature       = DNSCLIENT_LOCAL_ENGINE_SIGNATURE;
+    LocalEngine.Engine.Revision = DNSCLIENT_ENGINE_PROTOCOL_REVISION;
+    LocalEngine.Engine.Resolve  = LocalEngineResolve;
+    LocalEngine.Engine.Poll     = LocalEnginePoll;
+    LocalEngine.Engine.Cancel   = LocalEngineCancel;
+    LocalEngine.Private         = Private;
+
+    Engine = &LocalEngine.Engine;
+  }
+
+  if(RaceWidth != 0) {
+    Private->RaceWidth = RaceWidth;
+  }
+
+  if(RxDepth != 0) {
+    Private->RxDepth = RxDepth;
+  }
+
+  if(FanOut) {
+    Private->FanOut = TRUE;
+  }
+
+  if(UseTcp) {
+    Private->UseTcp = TRUE;
+  }
+
+  if(NoHosts) {
+    Private->UseHosts = FALSE;
+  }
+
+  if(EdnsPayloadSize != MAX_UINTN) {
+    Private->EdnsPayloadSize = (UINT16) EdnsPayloadSize;
+  }
+
+  if(BenchList != NULL) {
+    Status = RunLoadBenchmark(Private, Hostnames, HostCount, (BenchCount == 0) ? HostCount : BenchCount, BenchQps, BenchWindow);
+    goto CLEANUP;
+  }
+
+  if(PtrRange != NULL) {
+    Status = RunPtrSweep(Engine, &PtrAddress, PtrPrefixLength, BulkOut, BenchWindow);
+    goto CLEANUP;
+  }
+
+  if(BulkIn != NULL) {
+    Status = RunBulkResolve(Engine, BulkIn, BulkOut, BenchWindow, Dual);
+    goto CLEANUP;
   }
 
-  Status = GetHostByName(Private, Hostname, &IpAddress);
+  if(Dual) {
+    Status = ResolveDual(Engine, Hostnames, HostCount, Lookups, IpAddresses, Ip6Addresses);
+    goto CLEANUP;
+  }
+
+  Status = ResolveNames(Engine, Hostnames, HostCount, IpAddresses, Statuses);
 
   if(EFI_ERROR(Status)) {
     goto CLEANUP;
   }
 
-  Print(L"%a->%d.%d.%d.%d\n", Hostname, IpAddress.Addr[0], IpAddress.Addr[1], IpAddress.Addr[2], IpAddress.Addr[3]);
+  for(i = 0; i < HostCount; ++i) {
+    if(EFI_ERROR(Statuses[i])) {
+      Print(L"%a->(0x%X) ", Hostnames[i], Statuses[i]);
+      PrintStatus(Statuses[i]);
+      Status = Statuses[i];
+      continue;
+    }
+
+    Print(L"%a->%d.%d.%d.%d\n", Hostnames[i], IpAddresses[i].Addr[0], IpAddresses[i].Addr[1], IpAddresses[i].Addr[2], IpAddresses[i].Addr[3]);
+  }
 
-  Status = EFI_SUCCESS;
 CLEANUP:
 
-  Print(L"Destroying private");
-  DestroyDNSClient(Private);
+  if(Private != NULL && ShowStats) {
+    PrintStats(Private);
+  }
+
+  if(Private != NULL) {
+    Print(L"Destroying private");
+    DestroyDNSClient(Private);
+  }
 
   SafeRelease(Private);
-  SafeRelease(Hostname);
+
+  //
+  // The names of a -bench list all point into BenchBuffer.
+  //
+  if(Hostnames != NULL && BenchBuffer == NULL) {
+    for(i = 0; i < HostCount; ++i) {
+      SafeRelease(Hostnames[i]);
+    }
+  }
+
+  SafeRelease(BenchBuffer);
+
+  SafeRelease(Hostnames);
+  SafeRelease(IpAddresses);
+  SafeRelease(Ip6Addresses);
+  SafeRelease(Statuses);
+  SafeRelease(Lookups);
 
   if(EFI_ERROR(Status)) {
   	Print(L"Exiting with status: (0x%X) ", Status);
@@ -103,6 +448,1309 @@ EXIT:
   return Status;
 }
 
+/**
+  DNSCLIENT_ENGINE_PROTOCOL.Resolve of a DNSCLIENT_LOCAL_ENGINE: starts a
+  batch of lookups on the application's own resolver.
+
+  @param[in]      This           The local engine.
+  @param[in/out]  Token          The batch.
+
+  @retval EFI_SUCCESS            The batch has been started.
+  @retval other                  As ResolveDNSLookupsAsync returns.
+ */
+EFI_STATUS EFIAPI LocalEngineResolve(IN DNSCLIENT_ENGINE_PROTOCOL *This, IN OUT DNS_RESOLVE_TOKEN *Token) {
+  return ResolveDNSLookupsAsync(DNSCLIENT_LOCAL_ENGINE_FROM_ENGINE(This)->Private, Token);
+}
+
+/**
+  DNSCLIENT_ENGINE_PROTOCOL.Poll of a DNSCLIENT_LOCAL_ENGINE: polls the
+  application's own resolver.  With nothing open yet the only thing to wait
+  for is the issue rate, so this sleeps until the next query may start.
+
+  @param[in] This                The local engine.
+
+  @retval EFI_SUCCESS            The resolver has been polled.
+  @retval EFI_NOT_STARTED        Nothing is open to poll yet.
+ */
+EFI_STATUS EFIAPI LocalEnginePoll(IN DNSCLIENT_ENGINE_PROTOCOL *This) {
+  EFI_STATUS               Status;
+  DNSCLIENT_PRIVATE_DATA   *Private;
+  UINT64                   Now;
+
+  Private = DNSCLIENT_LOCAL_ENGINE_FROM_ENGINE(This)->Private;
+
+  Status = PollDNSClient(Private);
+
+  if(Status == EFI_NOT_STARTED) {
+    Now = DNSImplGetTimeNs();
+
+    if(Private->NextIssue > Now) {
+      gBS->Stall((UINTN) DivU64x32(Private->NextIssue - Now + 999, 1000));
+    }
+  }
+
+  return Status;
+}
+
+/**
+  DNSCLIENT_ENGINE_PROTOCOL.Cancel of a DNSCLIENT_LOCAL_ENGINE: stops a
+  batch running on the application's own resolver.
+
+  @param[in] This                The local engine.
+  @param[in] Token               The batch.
+
+  @retval EFI_SUCCESS            The batch has been stopped.
+  @retval other                  As CancelDNSLookups returns.
+ */
+EFI_STATUS EFIAPI LocalEngineCancel(IN DNSCLIENT_ENGINE_PROTOCOL *This, IN DNS_RESOLVE_TOKEN *Token) {
+  return CancelDNSLookups(DNSCLIENT_LOCAL_ENGINE_FROM_ENGINE(This)->Private, Token);
+}
+
+/**
+  Runs a batch of lookups on an engine and polls it until they have
+  completed.  The token has no event, so nothing of this image is left with
+  a resident resolver.
+
+  @param[in]     Engine         Runs the lookups.
+  @param[in/out] Lookups        Array of lookups.  AddressCount and Status are filled in.
+  @param[in]     Count          Number of entries in Lookups.
+
+  @retval EFI_SUCCESS     Every lookup has been processed, see their Status for the result of each.
+  @retval other           The batch could not be started or failed, as ResolveDNSLookups would return.
+ */
+EFI_STATUS EFIAPI ResolveLookups(DNSCLIENT_ENGINE_PROTOCOL *Engine, DNS_LOOKUP *Lookups, UINTN Count) {
+  EFI_STATUS          Status;
+  DNS_RESOLVE_TOKEN   Token;
+
+  ZeroMem(&Token, sizeof(DNS_RESOLVE_TOKEN));
+
+  Token.Lookups = Lookups;
+  Token.Count   = Count;
+
+  Status = Engine->Resolve(Engine, &Token);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  while(Token.Status == EFI_NOT_READY) {
+    Engine->Poll(Engine);
+  }
+
+  return Token.Status;
+}
+
+/**
+  Looks up the first IPv4 address of every hostname in one batch, as
+  GetHostsByName does.
+
+  @param[in]     Engine         Runs the lookups.
+  @param[in]     Hostnames      Hostnames to look up.
+  @param[in]     HostCount      Number of entries in Hostnames.
+  @param[in/out] IpAddresses    Array of HostCount addresses, one per hostname.
+  @param[in/out] Statuses       Array of HostCount statuses, one per hostname.
+
+  @retval EFI_SUCCESS     Every hostname has been processed, see Statuses for the result of each.
+  @retval other           The batch could not be started or failed.
+ */
+EFI_STATUS EFIAPI ResolveNames(DNSCLIENT_ENGINE_PROTOCOL *Engine, CHAR8 **Hostnames, UINTN HostCount, EFI_IPv4_ADDRESS *IpAddresses, EFI_STATUS *Statuses) {
+  EFI_STATUS   Status;
+  DNS_LOOKUP   *Lookups;
+  UINTN        i;
+
+  Lookups = AllocateZeroPool(sizeof(DNS_LOOKUP) * HostCount);
+
+  if(Lookups == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  for(i = 0; i < HostCount; ++i) {
+    Lookups[i].Hostname     = Hostnames[i];
+    Lookups[i].QType        = 1;
+    Lookups[i].Addresses    = &IpAddresses[i];
+    Lookups[i].MaxAddresses = 1;
+  }
+
+  Status = ResolveLookups(Engine, Lookups, HostCount);
+
+  for(i = 0; i < HostCount; ++i) {
+    Statuses[i] = Lookups[i].Status;
+  }
+
+  SafeRelease(Lookups);
+
+  return Status;
+}
+
+/**
+  Helper function to print the counters of a DNSClient instance.
+ */
+VOID EFIAPI PrintStats(DNSCLIENT_PRIVATE_DATA *Private) {
+  DNS_SERVER      *Server;
+  DNS_INTERFACE   *Interface;
+  UINTN           i;
+
+  Print(L"Arena:\n");
+  Print(L"  High-water mark:  %ld bytes\n", (UINT64) Private->Stats.ArenaHighWater);
+  Print(L"  Largest reserved: %ld bytes\n", (UINT64) Private->Stats.ArenaReserved);
+  Print(L"  Overflows:        %ld\n", (UINT64) Private->Stats.ArenaOverflows);
+
+  Print(L"Cache:\n");
+  Print(L"  Entries:          %ld (%ld of %ld bytes)\n", (UINT64) Private->Cache.Count, (UINT64) Private->Cache.Used, (UINT64) Private->Cache.Budget);
+  Print(L"  Hits:             %ld\n", Private->Cache.Hits);
+  Print(L"  Misses:           %ld\n", Private->Cache.Misses);
+  Print(L"  Evictions:        %ld\n", Private->Cache.Evictions);
+  Print(L"  Restored:         %ld\n", Private->Cache.Restored);
+
+  Print(L"Hosts file:\n");
+  Print(L"  Names:            %ld (%ld addresses, %ld slots)\n", (UINT64) Private->Hosts.Count, (UINT64) Private->Hosts.RecordCount, (UINT64) Private->Hosts.SlotCount);
+  Print(L"  Lines:            %ld (%ld skipped)\n", Private->Hosts.Lines, Private->Hosts.Skipped);
+  Print(L"  Load time:        %ld us\n", DivU64x32(Private->Hosts.LoadTime, 1000));
+  Print(L"  Hits:             %ld\n", Private->Hosts.Hits);
+  Print(L"  Misses:           %ld\n", Private->Hosts.Misses);
+
+  Print(L"Retransmission:\n");
+  Print(L"  Retransmits:      %ld\n", Private->Stats.Retransmits);
+  Print(L"  Timeouts:         %ld\n", Private->Stats.Timeouts);
+  Print(L"  Failures:         %ld\n", Private->Stats.Failures);
+  Print(L"  Failovers:        %ld\n", Private->Stats.Failovers);
+  Print(L"  Chain follow-ups: %ld\n", Private->Stats.ChainQueries);
+
+  for(i = 0; i < Private->ServerCount; ++i) {
+    Server = &Private->Servers[i];
+
+    Print(L"  Server ");
+
+    if(Server->IsIp6) {
+      PrintIp6Address(&Server->Address.v6);
+    } else {
+      Print(L"%d.%d.%d.%d", Server->Address.v4.Addr[0], Server->Address.v4.Addr[1], Server->Address.v4.Addr[2], Server->Address.v4.Addr[3]);
+    }
+
+    Print(
+      L"%a%a sent %ld, answered %ld, timeouts %ld, retries %ld, srtt %ld us, rto %ld ms, won %ld of %ld races (%ld%%)\n",
+      Server->Discovered ? " (dhcp)" : "",
+      (i == Private->ActiveServer) ? " (active)" : "",
+      Server->Sent,
+      Server->Answered,
+      Server->Timeouts,
+      Server->Retries,
+      DivU64x32(Server->Rtt.Srtt, 1000),
+      DivU64x32(Server->Rtt.Rto, 1000000),
+      Server->Wins,
+      Server->Races,
+      (Server->Races == 0) ? 0 : DivU64x64Remainder(MultU64x32(Server->Wins, 100), Server->Races, NULL)
+    );
+
+    PrintRttHistogram(Server);
+  }
+
+  Print(L"Interfaces:%a (%d receives posted on each)\n", Private->FanOut ? " (fan out)" : "", Private->RxDepth);
+
+  for(i = 0; i < Private->InterfaceCount; ++i) {
+    Interface = &Private->Interfaces[i];
+
+    Print(
+      L"  Interface %d (%a)%a sent %ld, answered %ld, timeouts %ld, srtt %ld us, rto %ld ms, won %ld, received %ld, receive errors %ld, most waiting %d\n",
+      i,
+      Interface->IsIp6 ? "udp6" : "udp4",
+      Interface->Configured ? "" : " (no mapping)",
+      Interface->Sent,
+      Interface->Answered,
+      Interface->Timeouts,
+      DivU64x32(Interface->Rtt.Srtt, 1000),
+      DivU64x32(Interface->Rtt.Rto, 1000000),
+      Interface->Wins,
+      Interface->Received,
+      Interface->RxErrors,
+      Interface->RxBacklog
+    );
+  }
+
+  Print(L"TCP:%a\n", Private->UseTcp ? " (every query)" : "");
+  Print(L"  Truncated:        %ld\n", Private->Stats.Truncated);
+  Print(L"  Queries:          %ld\n", Private->Stats.TcpQueries);
+  Print(L"  Connects:         %ld\n", Private->Stats.TcpConnects);
+  Print(L"  Resets:           %ld\n", Private->Stats.TcpResets);
+
+  if(Private->EdnsPayloadSize == 0) {
+    Print(L"EDNS: (off)\n");
+  } else {
+    Print(L"EDNS: (%d byte payload)\n", (UINTN) Private->EdnsPayloadSize);
+  }
+  Print(L"  Answers with OPT: %ld\n", Private->Stats.EdnsAnswers);
+  Print(L"  Fallbacks:        %ld\n", Private->Stats.EdnsFallbacks);
+  Print(L"  Largest answer:   %ld bytes\n", (UINT64) Private->Stats.LargestAnswer);
+
+  Print(L"Allocations:\n");
+  Print(L"  Queries sent:     %ld\n", Private->Stats.QueriesSent);
+  Print(L"  Send path:        %ld\n", Private->Stats.SendAllocations);
+  Print(L"  Receive path:     %ld\n", Private->Stats.ReceiveAllocations);
+}
+
+/**
+  Helper function to print the non-empty buckets of a server's round trip
+  time histogram, one per line.
+ */
+VOID EFIAPI PrintRttHistogram(DNS_SERVER *Server) {
+  UINTN   i;
+
+  for(i = 0; i < DNSCLIENT_RTT_BUCKETS; ++i) {
+    if(Server->RttHistogram[i] == 0) {
+      continue;
+    }
+
+    if(i == 0) {
+      Print(L"    rtt          < %6ld us: %d\n", (UINT64) 1 << DNSCLIENT_RTT_BUCKET_SHIFT, Server->RttHistogram[i]);
+    } else if(i == DNSCLIENT_RTT_BUCKETS - 1) {
+      Print(L"    rtt %6ld us and up:   %d\n", LShiftU64(1, i + DNSCLIENT_RTT_BUCKET_SHIFT - 1), Server->RttHistogram[i]);
+    } else {
+      Print(
+        L"    rtt %6ld - %6ld us: %d\n",
+        LShiftU64(1, i + DNSCLIENT_RTT_BUCKET_SHIFT - 1),
+        LShiftU64(1, i + DNSCLIENT_RTT_BUCKET_SHIFT),
+        Server->RttHistogram[i]
+      );
+    }
+  }
+}
+
+/**
+  Resolves the A and the AAAA records of every hostname in one batch, so both
+  families of every name are outstanding at the same time, and prints every
+  address found.
+
+  @param[in] Engine        Runs the lookups.
+  @param[in] Hostnames     Hostnames to look up.
+  @param[in] HostCount     Number of entries in Hostnames.
+  @param[in] Lookups       Room for 2 * HostCount lookups.
+  @param[in] Ip4Addresses  Room for DUAL_MAX_ADDRESSES IPv4 addresses per hostname.
+  @param[in] Ip6Addresses  Room for DUAL_MAX_ADDRESSES IPv6 addresses per hostname.
+
+  @retval EFI_SUCCESS      Every hostname has at least one address.
+  @retval other            The error of the last hostname without one.
+ */
+EFI_STATUS EFIAPI ResolveDual(DNSCLIENT_ENGINE_PROTOCOL *Engine, CHAR8 **Hostnames, UINTN HostCount, DNS_LOOKUP *Lookups, EFI_IPv4_ADDRESS *Ip4Addresses, EFI_IPv6_ADDRESS *Ip6Addresses) {
+  EFI_STATUS   Status;
+  DNS_LOOKUP   *A;
+  DNS_LOOKUP   *Aaaa;
+  UINTN        i, j;
+
+  for(i = 0; i < HostCount; ++i) {
+    A    = &Lookups[i * 2];
+    Aaaa = &Lookups[i * 2 + 1];
+
+    A->Hostname        = Hostnames[i];
+    A->QType           = 1;
+    A->Addresses       = &Ip4Addresses[i * DUAL_MAX_ADDRESSES];
+    A->MaxAddresses    = DUAL_MAX_ADDRESSES;
+
+    Aaaa->Hostname     = Hostnames[i];
+    Aaaa->QType        = 28;
+    Aaaa->Addresses    = &Ip6Addresses[i * DUAL_MAX_ADDRESSES];
+    Aaaa->MaxAddresses = DUAL_MAX_ADDRESSES;
+  }
+
+  Status = ResolveLookups(Engine, Lookups, HostCount * 2);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  for(i = 0; i < HostCount; ++i) {
+    A    = &Lookups[i * 2];
+    Aaaa = &Lookups[i * 2 + 1];
+
+    if(A->AddressCount == 0 && Aaaa->AddressCount == 0) {
+      Status = EFI_ERROR(A->Status) && A->Status != EFI_NOT_FOUND ? A->Status : Aaaa->Status;
+      Status = EFI_ERROR(Status) ? Status : EFI_NOT_FOUND;
+
+      Print(L"%a->(0x%X) ", Hostnames[i], Status);
+      PrintStatus(Status);
+      continue;
+    }
+
+    Print(L"%a->", Hostnames[i]);
+
+    for(j = 0; j < A->AddressCount; ++j) {
+      Print(L"%a%d.%d.%d.%d", (j == 0) ? "" : " ",
+        Ip4Addresses[i * DUAL_MAX_ADDRESSES + j].Addr[0], Ip4Addresses[i * DUAL_MAX_ADDRESSES + j].Addr[1],
+        Ip4Addresses[i * DUAL_MAX_ADDRESSES + j].Addr[2], Ip4Addresses[i * DUAL_MAX_ADDRESSES + j].Addr[3]);
+    }
+
+    for(j = 0; j < Aaaa->AddressCount; ++j) {
+      if(j != 0 || A->AddressCount != 0) {
+        Print(L" ");
+      }
+
+      PrintIp6Address(&Ip6Addresses[i * DUAL_MAX_ADDRESSES + j]);
+    }
+
+    Print(L"\n");
+  }
+
+  return Status;
+}
+
+/**
+  Reads a list of names, one per line, from a file.  Blank lines and the rest
+  of a line from a '#' are skipped.  The file may be ASCII or, as the shell's
+  editor saves it, UCS-2.
+
+  @param[in]  Path        Path of the file.
+  @param[out] Buffer      Receives the contents of the file which the names point into.  Must be freed with FreePool.
+  @param[out] Names       Receives an array of the names.  Must be freed with FreePool.
+  @param[out] Count       Receives the number of names.
+
+  @retval EFI_SUCCESS     The list has been read.
+  @retval other           The file could not be read or memory could not be allocated.
+ */
+EFI_STATUS EFIAPI ReadNameList(CONST CHAR16 *Path, CHAR8 **Buffer, CHAR8 ***Names, UINTN *Count) {
+  EFI_STATUS          Status;
+  SHELL_FILE_HANDLE   File;
+  UINT64              FileSize;
+  CHAR8               *Data;
+  UINTN               Size;
+  UINTN               Step;
+  UINTN               i, j;
+  BOOLEAN             Comment;
+
+  *Buffer = NULL;
+  *Names  = NULL;
+  *Count  = 0;
+
+  Status = ShellOpenFileByName(Path, &File, EFI_FILE_MODE_READ, 0);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  Status = ShellGetFileSize(File, &FileSize);
+
+  if(!EFI_ERROR(Status) && FileSize >= MAX_UINT32) {
+    Status = EFI_BAD_BUFFER_SIZE;
+  }
+
+  Data = EFI_ERROR(Status) ? NULL : AllocatePool((UINTN) FileSize + 1);
+  Size = (UINTN) FileSize;
+
+  if(!EFI_ERROR(Status) && Data == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+  }
+
+  if(!EFI_ERROR(Status)) {
+    Status = ShellReadFile(File, &Size, Data);
+  }
+
+  ShellCloseFile(&File);
+
+  if(EFI_ERROR(Status)) {
+    SafeRelease(Data);
+    return Status;
+  }
+
+  //
+  // Names are ASCII, so only the low byte of every UCS-2 character is kept.
+  //
+  i    = 0;
+  Step = 1;
+
+  if(Size >= 2 && (UINT8) Data[0] == 0xFF && (UINT8) Data[1] == 0xFE) {
+    i    = 2;
+    Step = 2;
+  }
+
+  for(j = 0; i < Size; i += Step) {
+    Data[j++] = Data[i];
+  }
+
+  Size = j;
+
+  //
+  // Blank out comments and white space, which leaves every name a run of
+  // non-zero characters, and count the runs.
+  //
+  Comment = FALSE;
+
+  for(i = 0; i < Size; ++i) {
+    if(Data[i] == '\n' || Data[i] == '\r') {
+      Comment = FALSE;
+    } else if(Data[i] == '#') {
+      Comment = TRUE;
+    }
+
+    if(Comment || Data[i] == '\n' || Data[i] == '\r' || Data[i] == ' ' || Data[i] == '\t' || Data[i] == ',') {
+      Data[i] = 0;
+    } else if(i == 0 || Data[i - 1] == 0) {
+      ++(*Count);
+    }
+  }
+
+  Data[Size] = 0;
+
+  *Names = AllocatePool(sizeof(CHAR8*) * MAX(*Count, 1));
+
+  if(*Names == NULL) {
+    *Count = 0;
+    FreePool(Data);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  for(i = 0, j = 0; i < Size; ++i) {
+    if(Data[i] != 0 && (i == 0 || Data[i - 1] == 0)) {
+      (*Names)[j++] = &Data[i];
+    }
+  }
+
+  *Buffer = Data;
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Returns the next name of a -in file, reading the file a buffer at a time.
+  Names are separated as ReadNameList separates them.  A name too long for
+  Name is cut short at NameSize - 1 characters, which is left for resolving
+  to reject.
+
+  @param[in/out] Reader     The file.
+  @param[out]    Name       Receives the name.
+  @param[in]     NameSize   Bytes Name has room for, including the terminator.
+
+  @retval EFI_SUCCESS       Name holds the next name.
+  @retval EFI_END_OF_FILE   There are no more names.
+  @retval other             The file could not be read.
+ */
+EFI_STATUS EFIAPI BulkReadName(BULK_READER *Reader, CHAR8 *Name, UINTN NameSize) {
+  EFI_STATUS   Status;
+  UINTN        Length;
+  CHAR8        c;
+
+  Length = 0;
+
+  for(;;) {
+    if(Reader->Offset >= Reader->Length) {
+      if(Reader->End) {
+        break;
+      }
+
+      //
+      // A UCS-2 character never straddles two reads, as Data is an even
+      // number of bytes long.
+      //
+      Reader->Offset -= Reader->Length;
+      Reader->Length  = sizeof(Reader->Data);
+
+      Status = ShellReadFile(Reader->File, &Reader->Length, Reader->Data);
+
+      if(EFI_ERROR(Status)) {
+        return Status;
+      }
+
+      Reader->End = (BOOLEAN)(Reader->Length < sizeof(Reader->Data));
+
+      if(!Reader->Started) {
+        Reader->Started = TRUE;
+        Reader->Step    = 1;
+
+        if(Reader->Length >= 2 && (UINT8) Reader->Data[0] == 0xFF && (UINT8) Reader->Data[1] == 0xFE) {
+          Reader->Offset = 2;
+          Reader->Step   = 2;
+        }
+      }
+
+      continue;
+    }
+
+    c               = Reader->Data[Reader->Offset];
+    Reader->Offset += Reader->Step;
+
+    if(c == '\n' || c == '\r') {
+      Reader->Comment = FALSE;
+    } else if(c == '#') {
+      Reader->Comment = TRUE;
+    }
+
+    if(Reader->Comment || c == '\n' || c == '\r' || c == ' ' || c == '\t' || c == ',') {
+      if(Length != 0) {
+        break;
+      }
+
+      continue;
+    }
+
+    if(Length < NameSize - 1) {
+      Name[Length++] = c;
+    }
+  }
+
+  Name[Length] = 0;
+
+  return (Length == 0) ? EFI_END_OF_FILE : EFI_SUCCESS;
+}
+
+/**
+  Creates a -out file, replacing any file of the same name.
+
+  @param[in]  Path          Path of the file.
+  @param[out] File          Receives the open file.
+
+  @retval EFI_SUCCESS       The file has been created.
+  @retval other             The file could not be created.
+ */
+EFI_STATUS EFIAPI BulkCreateFile(CONST CHAR16 *Path, SHELL_FILE_HANDLE *File) {
+  //
+  // Opening with EFI_FILE_MODE_CREATE does not truncate, so an older file
+  // is deleted first.
+  //
+  if(!EFI_ERROR(ShellOpenFileByName(Path, File, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0))) {
+    ShellDeleteFile(File);
+  }
+
+  return ShellOpenFileByName(Path, File, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0);
+}
+
+/**
+  Appends a line to a -out file, writing out the lines collected so far
+  first if it does not fit behind them.
+
+  @param[in/out] Writer     The file.
+  @param[in]     Line       The line, newline included.
+  @param[in]     Length     Bytes in Line.
+ */
+VOID EFIAPI BulkWriteLine(BULK_WRITER *Writer, CONST CHAR8 *Line, UINTN Length) {
+  if(Writer->Length + Length > sizeof(Writer->Data)) {
+    BulkFlush(Writer);
+  }
+
+  Length = MIN(Length, sizeof(Writer->Data));
+
+  CopyMem(&Writer->Data[Writer->Length], Line, Length);
+  Writer->Length += Length;
+}
+
+/**
+  Writes out the lines a -out file has collected.  After a failed write
+  nothing more is written, and Writer->Status holds the error.
+
+  @param[in/out] Writer     The file.
+ */
+VOID EFIAPI BulkFlush(BULK_WRITER *Writer) {
+  UINTN   Size;
+
+  Size = Writer->Length;
+
+  if(Size != 0 && !EFI_ERROR(Writer->Status)) {
+    Writer->Status = ShellWriteFile(Writer->File, &Size, Writer->Data);
+
+    if(!EFI_ERROR(Writer->Status) && Size != Writer->Length) {
+      Writer->Status = EFI_VOLUME_FULL;
+    }
+  }
+
+  Writer->Length = 0;
+}
+
+/**
+  Appends the lines for a resolved name to a -out file: one per address, or
+  a single one with the address left empty when a lookup found none.
+
+  @param[in/out] Writer     The file.
+  @param[in]     Slot       The name and its lookups.
+  @param[in]     Count      Number of lookups in Slot.
+ */
+VOID EFIAPI BulkWriteResult(BULK_WRITER *Writer, BULK_SLOT *Slot, UINTN Count) {
+  DNS_LOOKUP         *Lookup;
+  EFI_IPv4_ADDRESS   *Ip4;
+  EFI_IPv6_ADDRESS   *Ip6;
+  CHAR8              Address[48];
+  CHAR8              Line[DNS_MAX_NAME_LENGTH + 128];
+  UINTN              Length;
+  UINTN              i, j, k;
+
+  for(i = 0; i < Count; ++i) {
+    Lookup = &Slot->Lookups[i];
+    j      = 0;
+
+    do {
+      Address[0] = 0;
+
+      if(j < Lookup->AddressCount && Lookup->QType == 1) {
+        Ip4 = &((EFI_IPv4_ADDRESS*) Lookup->Addresses)[j];
+
+        AsciiSPrint(Address, sizeof(Address), "%d.%d.%d.%d", Ip4->Addr[0], Ip4->Addr[1], Ip4->Addr[2], Ip4->Addr[3]);
+      } else if(j < Lookup->AddressCount) {
+        Ip6 = &((EFI_IPv6_ADDRESS*) Lookup->Addresses)[j];
+
+        for(k = 0, Length = 0; k < 16; k += 2) {
+          Length += AsciiSPrint(&Address[Length], sizeof(Address) - Length, "%a%x", (k == 0) ? "" : ":", (Ip6->Addr[k] << 8) | Ip6->Addr[k + 1]);
+        }
+      }
+
+      Length = AsciiSPrint(
+        Line,
+        sizeof(Line),
+        "%a,%a,%u,%a,%ld,%r\n",
+        Slot->Name,
+        (Lookup->QType == 1) ? "A" : "AAAA",
+        Lookup->Ttl,
+        Address,
+        DivU64x32(Lookup->Elapsed, 1000),
+        Lookup->Status
+      );
+
+      BulkWriteLine(Writer, Line, Length);
+    } while(++j < Lookup->AddressCount);
+  }
+}
+
+/**
+  Resolves every name in one file, keeping a window of them outstanding, and
+  writes a name,type,ttl,address,rtt_us,status line per address to another
+  file as each name completes.
+
+  Only Window names are held at a time and both files go through a buffer
+  of BULK_IO_SIZE bytes, so memory use does not grow with the file.  Lines
+  come out in the order names complete, not the order they are listed in.
+  rtt_us is 0 for names answered from the hosts file or the cache.
+
+  @param[in] Engine       Runs the lookups.
+  @param[in] InPath       Path of the file of names.
+  @param[in] OutPath      Path of the file to write.  Replaced if it exists.
+  @param[in] Window       Most names outstanding at once.
+  @param[in] Dual         Look up the AAAA records of every name as well.
+
+  @retval EFI_SUCCESS     Every name has been resolved and written.  Individual failures are written, not returned.
+  @retval other           A file could not be opened, read or written, or resolving failed.
+ */
+EFI_STATUS EFIAPI RunBulkResolve(DNSCLIENT_ENGINE_PROTOCOL *Engine, CONST CHAR16 *InPath, CONST CHAR16 *OutPath, UINTN Window, BOOLEAN Dual) {
+  EFI_STATUS          Status;
+  BULK_READER         *Reader;
+  BULK_WRITER         *Writer;
+  BULK_SLOT           *Slots;
+  BULK_SLOT           *Slot;
+  BOOLEAN             More;
+  UINTN               Busy;
+  UINTN               Names;
+  UINTN               Answered;
+  UINT64              Start;
+  UINTN               i;
+
+  Reader = AllocateZeroPool(sizeof(BULK_READER));
+  Writer = AllocateZeroPool(sizeof(BULK_WRITER));
+  Slots  = AllocateZeroPool(sizeof(BULK_SLOT) * Window);
+
+  if(Reader == NULL || Writer == NULL || Slots == NULL) {
+    GotoStatus(CLEANUP, EFI_OUT_OF_RESOURCES);
+  }
+
+  Status = ShellOpenFileByName(InPath, &Reader->File, EFI_FILE_MODE_READ, 0);
+
+  if(EFI_ERROR(Status)) {
+    Print(L"Could not open %s.\n", InPath);
+    Reader->File = NULL;
+    goto CLEANUP;
+  }
+
+  Status = BulkCreateFile(OutPath, &Writer->File);
+
+  if(EFI_ERROR(Status)) {
+    Print(L"Could not create %s.\n", OutPath);
+    Writer->File = NULL;
+    goto CLEANUP;
+  }
+
+  BulkWriteLine(Writer, mBulkHeader, sizeof(mBulkHeader) - 1);
+
+  More     = TRUE;
+  Busy     = 0;
+  Names    = 0;
+  Answered = 0;
+  Start    = DNSImplGetTimeNs();
+
+  for(;;) {
+    //
+    // Every free slot takes the next name, so the file is read no faster
+    // than names complete.
+    //
+    for(i = 0; i < Window && More; ++i) {
+      Slot = &Slots[i];
+
+      if(Slot->Busy) {
+        continue;
+      }
+
+      Status = BulkReadName(Reader, Slot->Name, sizeof(Slot->Name));
+
+      if(EFI_ERROR(Status)) {
+        Status = (Status == EFI_END_OF_FILE) ? EFI_SUCCESS : Status;
+        More   = FALSE;
+        break;
+      }
+
+      Slot->Lookups[0].Hostname     = Slot->Name;
+      Slot->Lookups[0].QType        = 1;
+      Slot->Lookups[0].Addresses    = Slot->Ip4Addresses;
+      Slot->Lookups[0].MaxAddresses = BULK_MAX_ADDRESSES;
+
+      Slot->Lookups[1].Hostname     = Slot->Name;
+      Slot->Lookups[1].QType        = 28;
+      Slot->Lookups[1].Addresses    = Slot->Ip6Addresses;
+      Slot->Lookups[1].MaxAddresses = BULK_MAX_ADDRESSES;
+
+      Slot->Token.Event   = NULL;
+      Slot->Token.Lookups = Slot->Lookups;
+      Slot->Token.Count   = Dual ? 2 : 1;
+
+      Status = Engine->Resolve(Engine, &Slot->Token);
+
+      if(EFI_ERROR(Status)) {
+        More = FALSE;
+        break;
+      }
+
+      Slot->Busy = TRUE;
+      ++Busy;
+      ++Names;
+    }
+
+    if(Busy == 0) {
+      break;
+    }
+
+    Engine->Poll(Engine);
+
+    //
+    // A failed request, rather than a failed lookup, means the client
+    // itself is in trouble, so no more names are started and the error is
+    // returned once the rest have drained.
+    //
+    for(i = 0; i < Window; ++i) {
+      Slot = &Slots[i];
+
+      if(!Slot->Busy || Slot->Token.Status == EFI_NOT_READY) {
+        continue;
+      }
+
+      Slot->Busy = FALSE;
+      --Busy;
+
+      if(EFI_ERROR(Slot->Token.Status)) {
+        Status = EFI_ERROR(Status) ? Status : Slot->Token.Status;
+        More   = FALSE;
+        continue;
+      }
+
+      BulkWriteResult(Writer, Slot, Slot->Token.Count);
+
+      if(Slot->Lookups[0].Status == EFI_SUCCESS || (Dual && Slot->Lookups[1].Status == EFI_SUCCESS)) {
+        ++Answered;
+      }
+    }
+  }
+
+  BulkFlush(Writer);
+
+  if(!EFI_ERROR(Status)) {
+    Status = Writer->Status;
+  }
+
+  Print(
+    L"Resolved %ld names, %ld with an address, in %ld ms\n",
+    (UINT64) Names,
+    (UINT64) Answered,
+    DivU64x32(DNSImplGetTimeNs() - Start, NS_PER_MS)
+  );
+
+CLEANUP:
+  if(Reader != NULL && Reader->File != NULL) {
+    ShellCloseFile(&Reader->File);
+  }
+
+  if(Writer != NULL && Writer->File != NULL) {
+    ShellCloseFile(&Writer->File);
+  }
+
+  SafeRelease(Reader);
+  SafeRelease(Writer);
+  SafeRelease(Slots);
+
+  return Status;
+}
+
+/**
+  Parses an IPv4 range written as Address/PrefixLength, 10.1.0.0/16 say.  A
+  bare address is a range of one.  Anything after the prefix length, or a
+  slash without one, is rejected.
+
+  @param[in]  Text          The range.
+  @param[out] Address       Receives the address.
+  @param[out] PrefixLength  Receives the prefix length, 0 to 32.
+
+  @retval EFI_SUCCESS            The range has been parsed.
+  @retval EFI_INVALID_PARAMETER  Text is not a range.
+ */
+EFI_STATUS EFIAPI ParseCidr(CONST CHAR16 *Text, EFI_IPv4_ADDRESS *Address, UINTN *PrefixLength) {
+  CHAR16   Buffer[16];
+  UINTN    i;
+
+  for(i = 0; Text[i] != L'\0' && Text[i] != L'/'; ++i) {
+    if(i + 1 >= ARRAY_SIZE(Buffer)) {
+      return EFI_INVALID_PARAMETER;
+    }
+
+    Buffer[i] = Text[i];
+  }
+
+  Buffer[i]     = L'\0';
+  *PrefixLength = 32;
+
+  //
+  // The prefix length is every digit after the slash, and nothing else.
+  //
+  if(Text[i] == L'/') {
+    ++i;
+
+    if(Text[i] == L'\0') {
+      return EFI_INVALID_PARAMETER;
+    }
+
+    for(*PrefixLength = 0; Text[i] >= L'0' && Text[i] <= L'9' && *PrefixLength <= 32; ++i) {
+      *PrefixLength = *PrefixLength * 10 + (Text[i] - L'0');
+    }
+
+    if(Text[i] != L'\0') {
+      return EFI_INVALID_PARAMETER;
+    }
+  }
+
+  if(*PrefixLength > 32) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  return NetLibStrToIp4(Buffer, Address);
+}
+
+/**
+  Looks up the PTR record of every address in an IPv4 range, keeping a
+  window of them outstanding, and prints the names found along with the
+  progress and rate of the sweep every PTR_PROGRESS_INTERVAL.
+
+  Every address in flight has a slot of its own, allocated up front, whose
+  in-addr.arpa name is written in place, so the sweep allocates nothing per
+  address however large the range is.
+
+  @param[in] Engine        Runs the lookups.
+  @param[in] Address       An address in the range.
+  @param[in] PrefixLength  Prefix length of the range.
+  @param[in] OutPath       Path of a file to write an address,name,ttl,rtt_us,status line per address to, or NULL to print the names found.
+  @param[in] Window        Most addresses outstanding at once.
+
+  @retval EFI_SUCCESS     The sweep completed.  Individual failures are counted, not returned.
+  @retval other           The output file could not be written, or resolving failed.
+ */
+EFI_STATUS EFIAPI RunPtrSweep(DNSCLIENT_ENGINE_PROTOCOL *Engine, EFI_IPv4_ADDRESS *Address, UINTN PrefixLength, CONST CHAR16 *OutPath, UINTN Window) {
+  EFI_STATUS    Status;
+  BULK_WRITER   *Writer;
+  PTR_SLOT      *Slots;
+  PTR_SLOT      *Slot;
+  CHAR8         Line[PTR_NAME_SIZE + DNS_MAX_NAME_LENGTH + 64];
+  UINTN         Length;
+  UINT32        First;
+  UINT32        Next;
+  UINT64        Total;
+  UINT64        Started;
+  UINT64        Done;
+  UINT64        Named;
+  UINT64        Start;
+  UINT64        Now;
+  UINT64        Report;
+  UINTN         Busy;
+  UINTN         i;
+
+  Writer = AllocateZeroPool(sizeof(BULK_WRITER));
+  Slots  = AllocateZeroPool(sizeof(PTR_SLOT) * Window);
+
+  if(Writer == NULL || Slots == NULL) {
+    GotoStatus(CLEANUP, EFI_OUT_OF_RESOURCES);
+  }
+
+  if(OutPath != NULL) {
+    Status = BulkCreateFile(OutPath, &Writer->File);
+
+    if(EFI_ERROR(Status)) {
+      Print(L"Could not create %s.\n", OutPath);
+      Writer->File = NULL;
+      goto CLEANUP;
+    }
+
+    BulkWriteLine(Writer, mPtrHeader, sizeof(mPtrHeader) - 1);
+  }
+
+  First = ((UINT32) Address->Addr[0] << 24) | (Address->Addr[1] << 16) | (Address->Addr[2] << 8) | Address->Addr[3];
+  First = (PrefixLength == 0) ? 0 : (First & (MAX_UINT32 << (32 - PrefixLength)));
+  Total = LShiftU64(1, 32 - PrefixLength);
+
+  Print(
+    L"PTR sweep: %d.%d.%d.%d/%d, %ld addresses, %ld outstanding\n",
+    (First >> 24) & 0xFF, (First >> 16) & 0xFF, (First >> 8) & 0xFF, First & 0xFF,
+    PrefixLength,
+    Total,
+    (UINT64) Window
+  );
+
+  Status  = EFI_SUCCESS;
+  Next    = First;
+  Started = 0;
+  Done    = 0;
+  Named   = 0;
+  Busy    = 0;
+  Start   = DNSImplGetTimeNs();
+  Report  = Start + PTR_PROGRESS_INTERVAL;
+
+  for(;;) {
+    //
+    // Every free slot takes the next address of the range.
+    //
+    for(i = 0; i < Window && Started < Total && !EFI_ERROR(Status); ++i) {
+      Slot = &Slots[i];
+
+      if(Slot->Busy) {
+        continue;
+      }
+
+      Slot->Address.Addr[0] = (UINT8)(Next >> 24);
+      Slot->Address.Addr[1] = (UINT8)(Next >> 16);
+      Slot->Address.Addr[2] = (UINT8)(Next >> 8);
+      Slot->Address.Addr[3] = (UINT8) Next;
+
+      AsciiSPrint(
+        Slot->Name,
+        sizeof(Slot->Name),
+        "%d.%d.%d.%d.in-addr.arpa",
+        Slot->Address.Addr[3], Slot->Address.Addr[2], Slot->Address.Addr[1], Slot->Address.Addr[0]
+      );
+
+      Slot->Lookup.Hostname     = Slot->Name;
+      Slot->Lookup.QType        = 12;
+      Slot->Lookup.Addresses    = Slot->Target;
+      Slot->Lookup.MaxAddresses = sizeof(Slot->Target);
+
+      Slot->Token.Event   = NULL;
+      Slot->Token.Lookups = &Slot->Lookup;
+      Slot->Token.Count   = 1;
+
+      Status = Engine->Resolve(Engine, &Slot->Token);
+
+      if(EFI_ERROR(Status)) {
+        break;
+      }
+
+      Slot->Busy = TRUE;
+      ++Busy;
+      ++Started;
+      ++Next;
+    }
+
+    if(Busy == 0) {
+      break;
+    }
+
+    Engine->Poll(Engine);
+
+    //
+    // A failed request, rather than a failed lookup, means the client
+    // itself is in trouble, so no more addresses are started and the error
+    // is returned once the rest have drained.
+    //
+    for(i = 0; i < Window; ++i) {
+      Slot = &Slots[i];
+
+      if(!Slot->Busy || Slot->Token.Status == EFI_NOT_READY) {
+        continue;
+      }
+
+      Slot->Busy = FALSE;
+      --Busy;
+      ++Done;
+
+      if(EFI_ERROR(Slot->Token.Status)) {
+        Status = EFI_ERROR(Status) ? Status : Slot->Token.Status;
+        continue;
+      }
+
+      if(Slot->Lookup.AddressCount != 0) {
+        ++Named;
+      }
+
+      if(OutPath != NULL) {
+        Length = AsciiSPrint(
+          Line,
+          sizeof(Line),
+          "%d.%d.%d.%d,%a,%u,%ld,%r\n",
+          Slot->Address.Addr[0], Slot->Address.Addr[1], Slot->Address.Addr[2], Slot->Address.Addr[3],
+          (Slot->Lookup.AddressCount != 0) ? Slot->Target : "",
+          Slot->Lookup.Ttl,
+          DivU64x32(Slot->Lookup.Elapsed, 1000),
+          Slot->Lookup.Status
+        );
+
+        BulkWriteLine(Writer, Line, Length);
+      } else if(Slot->Lookup.AddressCount != 0) {
+        Print(
+          L"%d.%d.%d.%d->%a\n",
+          Slot->Address.Addr[0], Slot->Address.Addr[1], Slot->Address.Addr[2], Slot->Address.Addr[3],
+          Slot->Target
+        );
+      }
+    }
+
+    Now = DNSImplGetTimeNs();
+
+    if(Now >= Report && Busy != 0) {
+      Print(
+        L"  %ld of %ld (%ld%%), %ld queries/s, %ld named\n",
+        Done,
+        Total,
+        DivU64x64Remainder(MultU64x32(Done, 100), Total, NULL),
+        DivU64x64Remainder(MultU64x32(Done, 1000000), DivU64x32(Now - Start, 1000) + 1, NULL),
+        Named
+      );
+
+      Report = Now + PTR_PROGRESS_INTERVAL;
+    }
+  }
+
+  BulkFlush(Writer);
+
+  if(!EFI_ERROR(Status)) {
+    Status = Writer->Status;
+  }
+
+  Now = DNSImplGetTimeNs();
+
+  Print(
+    L"Swept %ld addresses in %ld ms, %ld queries/s, %ld named\n",
+    Done,
+    DivU64x32(Now - Start, NS_PER_MS),
+    DivU64x64Remainder(MultU64x32(Done, 1000000), DivU64x32(Now - Start, 1000) + 1, NULL),
+    Named
+  );
+
+CLEANUP:
+  if(Writer != NULL && Writer->File != NULL) {
+    ShellCloseFile(&Writer->File);
+  }
+
+  SafeRelease(Writer);
+  SafeRelease(Slots);
+
+  return Status;
+}
+
+/**
+  Sorts an array of round trip times into ascending order.  A heap sort, so
+  a long run neither recurses nor needs scratch space.
+
+  @param[in/out] Values   The times.
+  @param[in]     Count    Number of entries in Values.
+ */
+VOID EFIAPI SortLatencies(UINT64 *Values, UINTN Count) {
+  UINT64   Value;
+  UINTN    Start, End;
+  UINTN    Root, Child;
+
+  if(Count < 2) {
+    return;
+  }
+
+  Start = Count / 2;
+  End   = Count;
+
+  //
+  // Build a max heap, then move its top to the end of the array one at a time.
+  //
+  while(End > 1) {
+    if(Start > 0) {
+      --Start;
+    } else {
+      --End;
+
+      Value       = Values[End];
+      Values[End] = Values[0];
+      Values[0]   = Value;
+    }
+
+    Root = Start;
+
+    while((Child = Root * 2 + 1) < End) {
+      if(Child + 1 < End && Values[Child + 1] > Values[Child]) {
+        ++Child;
+      }
+
+      if(Values[Root] >= Values[Child]) {
+        break;
+      }
+
+      Value         = Values[Root];
+      Values[Root]  = Values[Child];
+      Values[Child] = Value;
+      Root          = Child;
+    }
+  }
+}
+
+/**
+  Drives A queries for a list of names at a fixed rate or concurrency and
+  prints the rate achieved, the number of timeouts and the distribution of
+  the round trip times.
+
+  The cache and the hosts file are bypassed for the run, so every query goes
+  on the wire.  They, the window and the pacing are put back as they were
+  once the run is over.  The times are taken from when a lookup is started
+  until its answer has been decoded, so they include the network stack as
+  well as the client.  Point the client at a local responder (PcdDnsClientFallbackServers,
+  or a DHCP server handing out a loopback or QEMU user networking resolver)
+  to keep the upstream out of the measurement.
+
+  @param[in] Private      The DNSClient instance.
+  @param[in] Hostnames    Names to look up.
+  @param[in] HostCount    Number of entries in Hostnames.
+  @param[in] Total        Number of queries to send, cycling through Hostnames.
+  @param[in] Qps          Queries to start per second.  0 starts them as fast as Window allows.
+  @param[in] Window       Most queries outstanding at once.
+
+  @retval EFI_SUCCESS     The run completed.  Individual failures are counted, not returned.
+  @retval other           The run could not be started or receiving failed.
+ */
+EFI_STATUS EFIAPI RunLoadBenchmark(DNSCLIENT_PRIVATE_DATA *Private, CHAR8 **Hostnames, UINTN HostCount, UINTN Total, UINTN Qps, UINTN Window) {
+  EFI_STATUS   Status;
+  DNS_LOOKUP   *Lookups;
+  UINT64       *Latencies;
+  UINTN        Budget;
+  BOOLEAN      UseHosts;
+  UINTN        SavedWindow;
+  UINT64       SavedInterval;
+  UINT64       Timeouts;
+  UINT64       Start, End;
+  UINT64       Elapsed;
+  UINT64       Achieved;
+  UINTN        Answered;
+  UINTN        Failed;
+  UINTN        i;
+
+  Lookups   = AllocateZeroPool(sizeof(DNS_LOOKUP) * Total);
+  Latencies = AllocatePool(sizeof(UINT64) * Total);
+
+  if(Lookups == NULL || Latencies == NULL) {
+    GotoStatus(CLEANUP, EFI_OUT_OF_RESOURCES);
+  }
+
+  for(i = 0; i < Total; ++i) {
+    Lookups[i].Hostname     = Hostnames[i % HostCount];
+    Lookups[i].QType        = 1;
+    Lookups[i].Addresses    = NULL;
+    Lookups[i].MaxAddresses = 0;
+  }
+
+  Print(L"Bench: %ld queries over %ld names, %ld outstanding", (UINT64) Total, (UINT64) HostCount, (UINT64) Window);
+
+  if(Qps != 0) {
+    Print(L", %ld queries/s\n", (UINT64) Qps);
+  } else {
+    Print(L", unpaced\n");
+  }
+
+  Budget        = Private->Cache.Budget;
+  UseHosts      = Private->UseHosts;
+  SavedWindow   = Private->Window;
+  SavedInterval = Private->IssueInterval;
+  Timeouts      = Private->Stats.Timeouts;
+
+  Private->Cache.Budget  = 0;
+  Private->UseHosts      = FALSE;
+  Private->Window        = Window;
+  Private->IssueInterval = (Qps == 0) ? 0 : DivU64x32(NS_PER_S, (UINT32) MIN(Qps, MAX_UINT32));
+
+  Status = ResolveDNSLookups(Private, Lookups, Total);
+
+  Private->Cache.Budget  = Budget;
+  Private->UseHosts      = UseHosts;
+  Private->Window        = SavedWindow;
+  Private->IssueInterval = SavedInterval;
+  Timeouts               = Private->Stats.Timeouts - Timeouts;
+
+  if(EFI_ERROR(Status)) {
+    goto CLEANUP;
+  }
+
+  //
+  // The run is timed from the first lookup started to the last one finished,
+  // which leaves out the round trip probe ResolveDNSLookups may begin with.
+  // A name without an address (NXDOMAIN) still counts as answered.
+  //
+  Start    = MAX_UINT64;
+  End      = 0;
+  Answered = 0;
+  Failed   = 0;
+
+  for(i = 0; i < Total; ++i) {
+    Start = MIN(Start, Lookups[i].Started);
+    End   = MAX(End, Lookups[i].Started + Lookups[i].Elapsed);
+
+    if(Lookups[i].Status == EFI_SUCCESS || Lookups[i].Status == EFI_NOT_FOUND) {
+      Latencies[Answered++] = Lookups[i].Elapsed;
+    } else {
+      ++Failed;
+    }
+  }
+
+  Elapsed  = MAX(End - Start, 1);
+  Achieved = DivU64x64Remainder(MultU64x32(Answered, 1000000), DivU64x32(Elapsed, 1000) + 1, NULL);
+
+  Print(L"  Elapsed:          %ld ms\n", DivU64x32(Elapsed, NS_PER_MS));
+  Print(L"  Achieved:         %ld queries/s\n", Achieved);
+  Print(L"  Answered:         %ld\n", (UINT64) Answered);
+  Print(L"  Timeouts:         %ld\n", Timeouts);
+  Print(L"  Other failures:   %ld\n", (UINT64)(Failed - MIN(Failed, Timeouts)));
+
+  if(Answered == 0) {
+    goto CLEANUP;
+  }
+
+  SortLatencies(Latencies, Answered);
+
+  //
+  // Nearest rank: the smallest time at least p percent of answers beat or matched.
+  //
+  for(i = 0; i < ARRAY_SIZE(mBenchPercentiles); ++i) {
+    Print(
+      L"  RTT p%-2d:          %ld us\n",
+      mBenchPercentiles[i],
+      DivU64x32(Latencies[(Answered * mBenchPercentiles[i] + 99) / 100 - 1], 1000)
+    );
+  }
+
+  Print(L"  RTT max:          %ld us\n", DivU64x32(Latencies[Answered - 1], 1000));
+
+CLEANUP:
+  SafeRelease(Lookups);
+  SafeRelease(Latencies);
+
+  return Status;
+}
+
+/**
+  Helper function to print an IPv6 address as eight groups of hex digits.
+ */
+VOID EFIAPI PrintIp6Address(EFI_IPv6_ADDRESS *Address) {
+  UINTN   i;
+
+  for(i = 0; i < 16; i += 2) {
+    Print(L"%a%x", (i == 0) ? "" : ":", (Address->Addr[i] << 8) | Address->Addr[i + 1]);
+  }
+}
+
 /**
   Helper function to print EFI Statuses.
  */
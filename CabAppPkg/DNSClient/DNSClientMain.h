@@ -2,8 +2,305 @@
 
 #include <ShellBase.h>
 
+#include <Protocol/DnsClientEngine.h>
+
+#include <Library/UefiApplicationEntryPoint.h>
 #include <Library/ShellCommandLib.h>
 #include <Library/ShellLib.h>
+#include <Library/PrintLib.h>
+
+//
+// Bytes of the input and of the output file -in/-out holds at once.
+//
+#define BULK_IO_SIZE          4096
+
+//
+// Most addresses of each family written per name with -in/-out.
+//
+#define BULK_MAX_ADDRESSES    8
+
+//
+// Reads the names of a -in file a buffer at a time.
+//
+typedef struct {
+  SHELL_FILE_HANDLE   File;
+  CHAR8               Data[BULK_IO_SIZE];
+  UINTN               Length;       // Bytes read into Data.
+  UINTN               Offset;       // Next byte of Data to look at.
+  UINTN               Step;         // 2 for a UCS-2 file, whose high bytes are skipped.
+  BOOLEAN             Started;      // The byte order mark has been looked for.
+  BOOLEAN             Comment;      // Skipping to the end of a line.
+  BOOLEAN             End;          // Data holds the last of the file.
+} BULK_READER;
+
+//
+// Collects the lines of a -out file and writes them a buffer at a time.
+//
+typedef struct {
+  SHELL_FILE_HANDLE   File;
+  CHAR8               Data[BULK_IO_SIZE];
+  UINTN               Length;       // Bytes waiting in Data.
+  EFI_STATUS          Status;       // First write error.  Later lines are dropped.
+} BULK_WRITER;
+
+//
+// One name of a -in file while it is being resolved.
+//
+typedef struct {
+  BOOLEAN             Busy;
+  DNS_RESOLVE_TOKEN   Token;
+  DNS_LOOKUP          Lookups[2];   // A, then AAAA with -dual.
+  CHAR8               Name[DNS_MAX_NAME_LENGTH + 2];
+  EFI_IPv4_ADDRESS    Ip4Addresses[BULK_MAX_ADDRESSES];
+  EFI_IPv6_ADDRESS    Ip6Addresses[BULK_MAX_ADDRESSES];
+} BULK_SLOT;
+
+//
+// Longest in-addr.arpa name, terminator included.
+//
+#define PTR_NAME_SIZE         sizeof("255.255.255.255.in-addr.arpa")
+
+//
+// Time (ns) between the progress lines of a -ptr sweep.
+//
+#define PTR_PROGRESS_INTERVAL NS_PER_S
+
+//
+// One address of a -ptr sweep while its PTR record is being looked up.
+//
+typedef struct {
+  BOOLEAN             Busy;
+  DNS_RESOLVE_TOKEN   Token;
+  DNS_LOOKUP          Lookup;
+  EFI_IPv4_ADDRESS    Address;
+  CHAR8               Name[PTR_NAME_SIZE];
+  CHAR8               Target[DNS_MAX_NAME_LENGTH];
+} PTR_SLOT;
+
+#define DNSCLIENT_LOCAL_ENGINE_SIGNATURE   SIGNATURE_32('D','N','S','l')
+
+//
+// A resolver of the application's own behind the functions
+// DNSCLIENT_ENGINE_PROTOCOL offers, so lookups are run the same way whether
+// they go to it or to DNSClientDxe.
+//
+typedef struct {
+  UINT32                      Signature;
+  DNSCLIENT_ENGINE_PROTOCOL   Engine;
+  DNSCLIENT_PRIVATE_DATA      *Private;
+} DNSCLIENT_LOCAL_ENGINE;
+
+#define DNSCLIENT_LOCAL_ENGINE_FROM_ENGINE(a)  CR(a, DNSCLIENT_LOCAL_ENGINE, Engine, DNSCLIENT_LOCAL_ENGINE_SIGNATURE)
+
+/**
+  DNSCLIENT_ENGINE_PROTOCOL.Resolve of a DNSCLIENT_LOCAL_ENGINE.  See
+  ResolveDNSLookupsAsync.
+ */
+EFI_STATUS EFIAPI LocalEngineResolve(IN DNSCLIENT_ENGINE_PROTOCOL *This, IN OUT DNS_RESOLVE_TOKEN *Token);
+
+/**
+  DNSCLIENT_ENGINE_PROTOCOL.Poll of a DNSCLIENT_LOCAL_ENGINE.  See
+  PollDNSClient.  With nothing open yet this waits for the issue rate.
+ */
+EFI_STATUS EFIAPI LocalEnginePoll(IN DNSCLIENT_ENGINE_PROTOCOL *This);
+
+/**
+  DNSCLIENT_ENGINE_PROTOCOL.Cancel of a DNSCLIENT_LOCAL_ENGINE.  See
+  CancelDNSLookups.
+ */
+EFI_STATUS EFIAPI LocalEngineCancel(IN DNSCLIENT_ENGINE_PROTOCOL *This, IN DNS_RESOLVE_TOKEN *Token);
+
+/**
+  Runs a batch of lookups on an engine and polls it until they have
+  completed.
+
+  @param[in]     Engine         Runs the lookups.
+  @param[in/out] Lookups        Array of lookups.  AddressCount and Status are filled in.
+  @param[in]     Count          Number of entries in Lookups.
+
+  @retval EFI_SUCCESS     Every lookup has been processed, see their Status for the result of each.
+  @retval other           The batch could not be started or failed, as ResolveDNSLookups would return.
+ */
+EFI_STATUS EFIAPI ResolveLookups(DNSCLIENT_ENGINE_PROTOCOL *Engine, DNS_LOOKUP *Lookups, UINTN Count);
+
+/**
+  Looks up the first IPv4 address of every hostname in one batch.
+
+  @param[in]     Engine         Runs the lookups.
+  @param[in]     Hostnames      Hostnames to look up.
+  @param[in]     HostCount      Number of entries in Hostnames.
+  @param[in/out] IpAddresses    Array of HostCount addresses, one per hostname.
+  @param[in/out] Statuses       Array of HostCount statuses, one per hostname.
+
+  @retval EFI_SUCCESS     Every hostname has been processed, see Statuses for the result of each.
+  @retval other           The batch could not be started or failed.
+ */
+EFI_STATUS EFIAPI ResolveNames(DNSCLIENT_ENGINE_PROTOCOL *Engine, CHAR8 **Hostnames, UINTN HostCount, EFI_IPv4_ADDRESS *IpAddresses, EFI_STATUS *Statuses);
+
+/**
+  Helper function to print the counters of a DNSClient instance.
+ */
+VOID EFIAPI PrintStats(DNSCLIENT_PRIVATE_DATA *Private);
+
+/**
+  Helper function to print the non-empty buckets of a server's round trip
+  time histogram, one per line.
+ */
+VOID EFIAPI PrintRttHistogram(DNS_SERVER *Server);
+
+/**
+  Resolves the A and the AAAA records of every hostname in one batch and
+  prints every address found.
+
+  @param[in] Engine        Runs the lookups.
+  @param[in] Hostnames     Hostnames to look up.
+  @param[in] HostCount     Number of entries in Hostnames.
+  @param[in] Lookups       Room for 2 * HostCount lookups.
+  @param[in] Ip4Addresses  Room for DUAL_MAX_ADDRESSES IPv4 addresses per hostname.
+  @param[in] Ip6Addresses  Room for DUAL_MAX_ADDRESSES IPv6 addresses per hostname.
+
+  @retval EFI_SUCCESS      Every hostname has at least one address.
+  @retval other            The error of the last hostname without one.
+ */
+EFI_STATUS EFIAPI ResolveDual(DNSCLIENT_ENGINE_PROTOCOL *Engine, CHAR8 **Hostnames, UINTN HostCount, DNS_LOOKUP *Lookups, EFI_IPv4_ADDRESS *Ip4Addresses, EFI_IPv6_ADDRESS *Ip6Addresses);
+
+/**
+  Reads a list of names, one per line, from a file.
+
+  @param[in]  Path        Path of the file.
+  @param[out] Buffer      Receives the contents of the file which the names point into.  Must be freed with FreePool.
+  @param[out] Names       Receives an array of the names.  Must be freed with FreePool.
+  @param[out] Count       Receives the number of names.
+
+  @retval EFI_SUCCESS     The list has been read.
+  @retval other           The file could not be read or memory could not be allocated.
+ */
+EFI_STATUS EFIAPI ReadNameList(CONST CHAR16 *Path, CHAR8 **Buffer, CHAR8 ***Names, UINTN *Count);
+
+/**
+  Returns the next name of a -in file.
+
+  @param[in/out] Reader     The file.
+  @param[out]    Name       Receives the name.
+  @param[in]     NameSize   Bytes Name has room for, including the terminator.
+
+  @retval EFI_SUCCESS       Name holds the next name.
+  @retval EFI_END_OF_FILE   There are no more names.
+  @retval other             The file could not be read.
+ */
+EFI_STATUS EFIAPI BulkReadName(BULK_READER *Reader, CHAR8 *Name, UINTN NameSize);
+
+/**
+  Creates a -out file, replacing any file of the same name.
+
+  @param[in]  Path          Path of the file.
+  @param[out] File          Receives the open file.
+
+  @retval EFI_SUCCESS       The file has been created.
+  @retval other             The file could not be created.
+ */
+EFI_STATUS EFIAPI BulkCreateFile(CONST CHAR16 *Path, SHELL_FILE_HANDLE *File);
+
+/**
+  Appends a line to a -out file.
+
+  @param[in/out] Writer     The file.
+  @param[in]     Line       The line, newline included.
+  @param[in]     Length     Bytes in Line.
+ */
+VOID EFIAPI BulkWriteLine(BULK_WRITER *Writer, CONST CHAR8 *Line, UINTN Length);
+
+/**
+  Writes out the lines a -out file has collected.
+
+  @param[in/out] Writer     The file.
+ */
+VOID EFIAPI BulkFlush(BULK_WRITER *Writer);
+
+/**
+  Appends the lines for a resolved name to a -out file.
+
+  @param[in/out] Writer     The file.
+  @param[in]     Slot       The name and its lookups.
+  @param[in]     Count      Number of lookups in Slot.
+ */
+VOID EFIAPI BulkWriteResult(BULK_WRITER *Writer, BULK_SLOT *Slot, UINTN Count);
+
+/**
+  Resolves every name in one file, keeping a window of them outstanding, and
+  writes a name,type,ttl,address,rtt_us,status line per address to another
+  file as each name completes.
+
+  @param[in] Engine       Runs the lookups.
+  @param[in] InPath       Path of the file of names.
+  @param[in] OutPath      Path of the file to write.  Replaced if it exists.
+  @param[in] Window       Most names outstanding at once.
+  @param[in] Dual         Look up the AAAA records of every name as well.
+
+  @retval EFI_SUCCESS     Every name has been resolved and written.  Individual failures are written, not returned.
+  @retval other           A file could not be opened, read or written, or resolving failed.
+ */
+EFI_STATUS EFIAPI RunBulkResolve(DNSCLIENT_ENGINE_PROTOCOL *Engine, CONST CHAR16 *InPath, CONST CHAR16 *OutPath, UINTN Window, BOOLEAN Dual);
+
+/**
+  Parses an IPv4 range written as Address/PrefixLength.  A bare address is
+  a range of one.  Anything after the prefix length, or a slash without
+  one, is rejected.
+
+  @param[in]  Text          The range.
+  @param[out] Address       Receives the address.
+  @param[out] PrefixLength  Receives the prefix length, 0 to 32.
+
+  @retval EFI_SUCCESS            The range has been parsed.
+  @retval EFI_INVALID_PARAMETER  Text is not a range.
+ */
+EFI_STATUS EFIAPI ParseCidr(CONST CHAR16 *Text, EFI_IPv4_ADDRESS *Address, UINTN *PrefixLength);
+
+/**
+  Looks up the PTR record of every address in an IPv4 range, keeping a
+  window of them outstanding, and prints the names found along with the
+  progress and rate of the sweep.
+
+  @param[in] Engine        Runs the lookups.
+  @param[in] Address       An address in the range.
+  @param[in] PrefixLength  Prefix length of the range.
+  @param[in] OutPath       Path of a file to write an address,name,ttl,rtt_us,status line per address to, or NULL to print the names found.
+  @param[in] Window        Most addresses outstanding at once.
+
+  @retval EFI_SUCCESS     The sweep completed.  Individual failures are counted, not returned.
+  @retval other           The output file could not be written, or resolving failed.
+ */
+EFI_STATUS EFIAPI RunPtrSweep(DNSCLIENT_ENGINE_PROTOCOL *Engine, EFI_IPv4_ADDRESS *Address, UINTN PrefixLength, CONST CHAR16 *OutPath, UINTN Window);
+
+/**
+  Sorts an array of round trip times into ascending order.
+
+  @param[in/out] Values   The times.
+  @param[in]     Count    Number of entries in Values.
+ */
+VOID EFIAPI SortLatencies(UINT64 *Values, UINTN Count);
+
+/**
+  Drives A queries for a list of names at a fixed rate or concurrency and
+  prints the rate achieved, the number of timeouts and the p50, p90, p99
+  and largest round trip time.
+
+  @param[in] Private      The DNSClient instance.
+  @param[in] Hostnames    Names to look up.
+  @param[in] HostCount    Number of entries in Hostnames.
+  @param[in] Total        Number of queries to send, cycling through Hostnames.
+  @param[in] Qps          Queries to start per second.  0 starts them as fast as Window allows.
+  @param[in] Window       Most queries outstanding at once.
+
+  @retval EFI_SUCCESS     The run completed.
+  @retval other           The run could not be started or receiving failed.
+ */
+EFI_STATUS EFIAPI RunLoadBenchmark(DNSCLIENT_PRIVATE_DATA *Private, CHAR8 **Hostnames, UINTN HostCount, UINTN Total, UINTN Qps, UINTN Window);
+
+/**
+  Helper function to print an IPv6 address as eight groups of hex digits.
+ */
+VOID EFIAPI PrintIp6Address(EFI_IPv6_ADDRESS *Address);
 
 /**
   Helper function to print EFI Statuses.
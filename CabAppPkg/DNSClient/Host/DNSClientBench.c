@@ -0,0 +1,566 @@
+/** @file DNSClientBench.c
+  Host benchmark of the DNSClient wire format codec.
+
+  Times the query encoder, the response decoder and the name conversions
+  against a small corpus of responses, and reports the time and the number
+  of allocations each takes per call.  Any files given on the command line
+  are read as extra raw DNS messages (as saved from a packet capture) and
+  decoded along with the built in corpus.
+
+  Usage: DNSClientBench [-n Iterations] [Message ...]
+
+  Copyright (c) 2015, Caleb Bartholomew
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "DNSClientCodec.h"
+
+//
+// Calls each benchmark makes unless -n says otherwise.
+//
+#define BENCH_DEFAULT_ITERATIONS         200000
+
+//
+// Most messages decoded, built in ones included.
+//
+#define BENCH_MAX_MESSAGES               64
+
+//
+// Largest message read from a file.
+//
+#define BENCH_MAX_MESSAGE_LENGTH         65535
+
+typedef struct _BENCH_MESSAGE {
+  CONST CHAR8                    *Name;
+  CONST UINT8                    *Data;
+  UINT32                         Length;
+} BENCH_MESSAGE;
+
+typedef struct _BENCH_CONTEXT {
+  CONST BENCH_MESSAGE            *Message;
+  UINT32                         Fragments;     // Number of fragments the message is split into.
+  CONST CHAR8                    *Hostname;
+  UINT16                         QType;
+  UINT16                         UdpPayloadSize;
+} BENCH_CONTEXT;
+
+typedef EFI_STATUS (*BENCH_FUNCTION)(BENCH_CONTEXT *Context);
+
+//
+// Responses shaped after real captures: a CDN CNAME chain, a large A pool,
+// AAAA, NXDOMAIN with the SOA in the authority section, MX, SRV and TXT.
+// Every name after the question is compressed as a real server would.
+//
+//
+// CnameChain (213 bytes).
+//
+STATIC CONST UINT8 mCnameChain[] = {
+  0x1a, 0x2b, 0x81, 0x80, 0x00, 0x01, 0x00, 0x04, 0x00, 0x00, 0x00, 0x01,
+  0x03, 0x77, 0x77, 0x77, 0x09, 0x6d, 0x69, 0x63, 0x72, 0x6f, 0x73, 0x6f,
+  0x66, 0x74, 0x03, 0x63, 0x6f, 0x6d, 0x00, 0x00, 0x01, 0x00, 0x01, 0xc0,
+  0x0c, 0x00, 0x05, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x23, 0x03,
+  0x77, 0x77, 0x77, 0x09, 0x6d, 0x69, 0x63, 0x72, 0x6f, 0x73, 0x6f, 0x66,
+  0x74, 0x07, 0x63, 0x6f, 0x6d, 0x2d, 0x63, 0x2d, 0x33, 0x07, 0x65, 0x64,
+  0x67, 0x65, 0x6b, 0x65, 0x79, 0x03, 0x6e, 0x65, 0x74, 0x00, 0xc0, 0x2f,
+  0x00, 0x05, 0x00, 0x01, 0x00, 0x00, 0x03, 0x84, 0x00, 0x37, 0x03, 0x77,
+  0x77, 0x77, 0x09, 0x6d, 0x69, 0x63, 0x72, 0x6f, 0x73, 0x6f, 0x66, 0x74,
+  0x07, 0x63, 0x6f, 0x6d, 0x2d, 0x63, 0x2d, 0x33, 0x07, 0x65, 0x64, 0x67,
+  0x65, 0x6b, 0x65, 0x79, 0x03, 0x6e, 0x65, 0x74, 0x0b, 0x67, 0x6c, 0x6f,
+  0x62, 0x61, 0x6c, 0x72, 0x65, 0x64, 0x69, 0x72, 0x06, 0x61, 0x6b, 0x61,
+  0x64, 0x6e, 0x73, 0xc0, 0x4d, 0xc0, 0x5e, 0x00, 0x05, 0x00, 0x01, 0x00,
+  0x00, 0x03, 0x84, 0x00, 0x19, 0x06, 0x65, 0x31, 0x33, 0x36, 0x37, 0x38,
+  0x04, 0x64, 0x73, 0x63, 0x62, 0x0a, 0x61, 0x6b, 0x61, 0x6d, 0x61, 0x69,
+  0x65, 0x64, 0x67, 0x65, 0xc0, 0x4d, 0xc0, 0xa1, 0x00, 0x01, 0x00, 0x01,
+  0x00, 0x00, 0x00, 0x14, 0x00, 0x04, 0x17, 0x2d, 0xe5, 0x75, 0x00, 0x00,
+  0x29, 0x04, 0xd0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+//
+// AddressPool (169 bytes).
+//
+STATIC CONST UINT8 mAddressPool[] = {
+  0x2b, 0x3c, 0x81, 0x80, 0x00, 0x01, 0x00, 0x08, 0x00, 0x00, 0x00, 0x01,
+  0x04, 0x70, 0x6f, 0x6f, 0x6c, 0x03, 0x6e, 0x74, 0x70, 0x03, 0x6f, 0x72,
+  0x67, 0x00, 0x00, 0x01, 0x00, 0x01, 0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01,
+  0x00, 0x00, 0x00, 0x82, 0x00, 0x04, 0xa2, 0x9f, 0xc8, 0x01, 0xc0, 0x0c,
+  0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x82, 0x00, 0x04, 0xa2, 0x9f,
+  0xc8, 0x7b, 0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x82,
+  0x00, 0x04, 0x2d, 0x4f, 0x6f, 0x72, 0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01,
+  0x00, 0x00, 0x00, 0x82, 0x00, 0x04, 0x68, 0x83, 0x8b, 0xc3, 0xc0, 0x0c,
+  0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x82, 0x00, 0x04, 0x05, 0xa1,
+  0xb8, 0x94, 0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x82,
+  0x00, 0x04, 0x81, 0xfa, 0x23, 0xfa, 0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01,
+  0x00, 0x00, 0x00, 0x82, 0x00, 0x04, 0x48, 0x0e, 0xb7, 0x27, 0xc0, 0x0c,
+  0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x82, 0x00, 0x04, 0x17, 0x96,
+  0x29, 0x7b, 0x00, 0x00, 0x29, 0x04, 0xd0, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00,
+};
+
+//
+// Aaaa (99 bytes).
+//
+STATIC CONST UINT8 mAaaa[] = {
+  0x3c, 0x4d, 0x81, 0x80, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x01,
+  0x03, 0x77, 0x77, 0x77, 0x06, 0x67, 0x6f, 0x6f, 0x67, 0x6c, 0x65, 0x03,
+  0x63, 0x6f, 0x6d, 0x00, 0x00, 0x1c, 0x00, 0x01, 0xc0, 0x0c, 0x00, 0x1c,
+  0x00, 0x01, 0x00, 0x00, 0x01, 0x2c, 0x00, 0x10, 0x26, 0x07, 0xf8, 0xb0,
+  0x40, 0x04, 0x0c, 0x1b, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x67,
+  0xc0, 0x0c, 0x00, 0x1c, 0x00, 0x01, 0x00, 0x00, 0x01, 0x2c, 0x00, 0x10,
+  0x26, 0x07, 0xf8, 0xb0, 0x40, 0x04, 0x0c, 0x1b, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x68, 0x00, 0x00, 0x29, 0x02, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00,
+};
+
+//
+// NxDomain (92 bytes).
+//
+STATIC CONST UINT8 mNxDomain[] = {
+  0x4d, 0x5e, 0x81, 0x83, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+  0x06, 0x6e, 0x6f, 0x73, 0x75, 0x63, 0x68, 0x07, 0x65, 0x78, 0x61, 0x6d,
+  0x70, 0x6c, 0x65, 0x03, 0x63, 0x6f, 0x6d, 0x00, 0x00, 0x01, 0x00, 0x01,
+  0xc0, 0x13, 0x00, 0x06, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x2c,
+  0x02, 0x6e, 0x73, 0x05, 0x69, 0x63, 0x61, 0x6e, 0x6e, 0x03, 0x6f, 0x72,
+  0x67, 0x00, 0x03, 0x6e, 0x6f, 0x63, 0x03, 0x64, 0x6e, 0x73, 0xc0, 0x33,
+  0x78, 0xa5, 0x08, 0x35, 0x00, 0x00, 0x1c, 0x20, 0x00, 0x00, 0x0e, 0x10,
+  0x00, 0x12, 0x75, 0x00, 0x00, 0x00, 0x0e, 0x10,
+};
+
+//
+// Mx (150 bytes).
+//
+STATIC CONST UINT8 mMx[] = {
+  0x5e, 0x6f, 0x81, 0x80, 0x00, 0x01, 0x00, 0x05, 0x00, 0x00, 0x00, 0x00,
+  0x05, 0x67, 0x6d, 0x61, 0x69, 0x6c, 0x03, 0x63, 0x6f, 0x6d, 0x00, 0x00,
+  0x0f, 0x00, 0x01, 0xc0, 0x0c, 0x00, 0x0f, 0x00, 0x01, 0x00, 0x00, 0x0e,
+  0x10, 0x00, 0x1b, 0x00, 0x05, 0x0d, 0x67, 0x6d, 0x61, 0x69, 0x6c, 0x2d,
+  0x73, 0x6d, 0x74, 0x70, 0x2d, 0x69, 0x6e, 0x01, 0x6c, 0x06, 0x67, 0x6f,
+  0x6f, 0x67, 0x6c, 0x65, 0xc0, 0x12, 0xc0, 0x0c, 0x00, 0x0f, 0x00, 0x01,
+  0x00, 0x00, 0x0e, 0x10, 0x00, 0x09, 0x00, 0x0a, 0x04, 0x61, 0x6c, 0x74,
+  0x31, 0xc0, 0x29, 0xc0, 0x0c, 0x00, 0x0f, 0x00, 0x01, 0x00, 0x00, 0x0e,
+  0x10, 0x00, 0x09, 0x00, 0x14, 0x04, 0x61, 0x6c, 0x74, 0x32, 0xc0, 0x29,
+  0xc0, 0x0c, 0x00, 0x0f, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x09,
+  0x00, 0x1e, 0x04, 0x61, 0x6c, 0x74, 0x33, 0xc0, 0x29, 0xc0, 0x0c, 0x00,
+  0x0f, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x09, 0x00, 0x28, 0x04,
+  0x61, 0x6c, 0x74, 0x34, 0xc0, 0x29,
+};
+
+//
+// Srv (89 bytes).
+//
+STATIC CONST UINT8 mSrv[] = {
+  0x6f, 0x70, 0x81, 0x80, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00,
+  0x04, 0x5f, 0x73, 0x69, 0x70, 0x04, 0x5f, 0x74, 0x63, 0x70, 0x07, 0x65,
+  0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x03, 0x63, 0x6f, 0x6d, 0x00, 0x00,
+  0x21, 0x00, 0x01, 0xc0, 0x0c, 0x00, 0x21, 0x00, 0x01, 0x00, 0x00, 0x0e,
+  0x10, 0x00, 0x0d, 0x00, 0x0a, 0x00, 0x3c, 0x13, 0xc4, 0x04, 0x73, 0x69,
+  0x70, 0x31, 0xc0, 0x16, 0xc0, 0x0c, 0x00, 0x21, 0x00, 0x01, 0x00, 0x00,
+  0x0e, 0x10, 0x00, 0x0d, 0x00, 0x14, 0x00, 0x00, 0x13, 0xc4, 0x04, 0x73,
+  0x69, 0x70, 0x32, 0xc0, 0x16,
+};
+
+//
+// Txt (77 bytes).
+//
+STATIC CONST UINT8 mTxt[] = {
+  0x70, 0x81, 0x81, 0x80, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00,
+  0x07, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x03, 0x63, 0x6f, 0x6d,
+  0x00, 0x00, 0x10, 0x00, 0x01, 0xc0, 0x0c, 0x00, 0x10, 0x00, 0x01, 0x00,
+  0x00, 0x0e, 0x10, 0x00, 0x0c, 0x0b, 0x76, 0x3d, 0x73, 0x70, 0x66, 0x31,
+  0x20, 0x2d, 0x61, 0x6c, 0x6c, 0xc0, 0x0c, 0x00, 0x10, 0x00, 0x01, 0x00,
+  0x00, 0x0e, 0x10, 0x00, 0x0c, 0x05, 0x68, 0x65, 0x6c, 0x6c, 0x6f, 0x05,
+  0x77, 0x6f, 0x72, 0x6c, 0x64,
+};
+
+STATIC BENCH_MESSAGE mMessages[BENCH_MAX_MESSAGES] = {
+  { "cname-chain",  mCnameChain,  sizeof(mCnameChain)  },
+  { "address-pool", mAddressPool, sizeof(mAddressPool) },
+  { "aaaa",         mAaaa,        sizeof(mAaaa)        },
+  { "nxdomain",     mNxDomain,    sizeof(mNxDomain)    },
+  { "mx",           mMx,          sizeof(mMx)          },
+  { "srv",          mSrv,         sizeof(mSrv)         },
+  { "txt",          mTxt,         sizeof(mTxt)         },
+};
+
+STATIC UINTN            mMessageCount = 7;
+STATIC volatile UINTN   mSink;
+
+
+/**
+  Returns a monotonic timestamp in nanoseconds.
+  */
+STATIC UINT64 BenchNow(VOID) {
+  struct timespec Now;
+
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+
+  return (UINT64)Now.tv_sec * 1000000000ULL + (UINT64)Now.tv_nsec;
+} // End of BenchNow
+
+
+/**
+  Encodes a whole query into a stack buffer.
+  */
+STATIC EFI_STATUS BenchEncodeQuery(BENCH_CONTEXT *Context) {
+  UINT8       Buffer[DNS_HEADER_LENGTH + DNS_MAX_NAME_LENGTH + 4 + DNS_OPT_LENGTH];
+  UINTN       Length;
+  EFI_STATUS  Status;
+
+  Status = EncodeDNSQuery(Buffer, sizeof(Buffer), 0x1234, Context->Hostname, Context->QType, Context->UdpPayloadSize, &Length);
+  mSink += Length;
+
+  return Status;
+} // End of BenchEncodeQuery
+
+
+/**
+  Encodes a name into wire format.
+  */
+STATIC EFI_STATUS BenchEncodeName(BENCH_CONTEXT *Context) {
+  UINT8       Buffer[DNS_MAX_NAME_LENGTH];
+  UINTN       Length;
+  EFI_STATUS  Status;
+
+  Status = EncodeDNSName(Context->Hostname, Buffer, sizeof(Buffer), &Length);
+  mSink += Length;
+
+  return Status;
+} // End of BenchEncodeName
+
+
+/**
+  Decodes the compressed owner name of the last answer of the CNAME chain.
+  */
+STATIC EFI_STATUS BenchDecodeName(BENCH_CONTEXT *Context) {
+  EFI_UDP4_FRAGMENT_DATA  Fragment;
+  DNS_CURSOR              Cursor;
+  CHAR8                   Buffer[DNS_MAX_NAME_LENGTH];
+  UINTN                   Length;
+  EFI_STATUS              Status;
+
+  Fragment.FragmentLength = Context->Message->Length;
+  Fragment.FragmentBuffer = (VOID*) Context->Message->Data;
+
+  DNSCursorInit(&Cursor, &Fragment, 1);
+  DNSCursorSeek(&Cursor, Context->Message->Length - 11 - 4 - 10 - 2);
+
+  Status = DecodeDNSName(&Cursor, Buffer, sizeof(Buffer), &Length);
+  mSink += Length;
+
+  return Status;
+} // End of BenchDecodeName
+
+
+/**
+  Converts a hostname to label format and frees it again.
+  */
+STATIC EFI_STATUS BenchHostnameToLabel(BENCH_CONTEXT *Context) {
+  CHAR8  *LabelFormat;
+
+  LabelFormat = HostnameToLabelFormat((CHAR8*) Context->Hostname, AsciiStrLen(Context->Hostname));
+
+  if(LabelFormat == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  mSink += (UINT8) LabelFormat[0];
+  FreePool(LabelFormat);
+
+  return EFI_SUCCESS;
+} // End of BenchHostnameToLabel
+
+
+/**
+  Converts a wire format name to a hostname and frees it again.
+  */
+STATIC EFI_STATUS BenchLabelToHostname(BENCH_CONTEXT *Context) {
+  UINT8       Buffer[DNS_MAX_NAME_LENGTH];
+  UINTN       Length;
+  CHAR8       *Hostname;
+
+  //
+  // Encoding the name is part of the cost, BenchEncodeName can be subtracted.
+  //
+  if(EFI_ERROR(EncodeDNSName(Context->Hostname, Buffer, sizeof(Buffer), &Length))) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Hostname = LabelFormatToHostname((CHAR8*) Buffer);
+
+  if(Hostname == NULL) {
+    return EFI_PROTOCOL_ERROR;
+  }
+
+  mSink += (UINT8) Hostname[0];
+  FreePool(Hostname);
+
+  return EFI_SUCCESS;
+} // End of BenchLabelToHostname
+
+
+/**
+  Decodes a whole message, split into Context->Fragments roughly equal
+  fragments, and releases it again.
+  */
+STATIC EFI_STATUS BenchDecodePacket(BENCH_CONTEXT *Context) {
+  EFI_UDP4_FRAGMENT_DATA  Fragments[4];
+  DNS_CURSOR              Cursor;
+  DNS_PACKET              *Packet;
+  UINT32                  Offset;
+  UINT32                  Size;
+  UINT32                  i;
+  EFI_STATUS              Status;
+
+  Offset = 0;
+  Size   = Context->Message->Length / Context->Fragments;
+
+  for(i = 0; i < Context->Fragments; ++i) {
+    Fragments[i].FragmentBuffer = (VOID*)(Context->Message->Data + Offset);
+    Fragments[i].FragmentLength = (i + 1 == Context->Fragments) ? Context->Message->Length - Offset : Size;
+    Offset += Size;
+  }
+
+  DNSCursorInit(&Cursor, Fragments, Context->Fragments);
+
+  Status = DecodeDNSPacket(&Cursor, &Packet);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  mSink += Packet->Header.AnCount;
+  ReleaseDNSPacket(Packet);
+
+  return EFI_SUCCESS;
+} // End of BenchDecodePacket
+
+
+/**
+  Decodes a whole message, split into Context->Fragments roughly equal
+  fragments, reads the RDATA of every answer with a view through
+  DNSReadRDataView, steps through the strings of TXT records, and releases
+  the message again.  Names are left undecoded, as a caller that only wants
+  the fixed fields would leave them.
+  */
+STATIC EFI_STATUS BenchReadViews(BENCH_CONTEXT *Context) {
+  EFI_UDP4_FRAGMENT_DATA  Fragments[4];
+  DNS_CURSOR              Cursor;
+  DNS_PACKET              *Packet;
+  DNS_ANSWER              *Answers;
+  DNS_RDATA_VIEW          View;
+  DNS_STRING_VIEW         String;
+  UINT32                  Position;
+  UINT32                  Offset;
+  UINT32                  Size;
+  UINT32                  i;
+  EFI_STATUS              Status;
+
+  Offset = 0;
+  Size   = Context->Message->Length / Context->Fragments;
+
+  for(i = 0; i < Context->Fragments; ++i) {
+    Fragments[i].FragmentBuffer = (VOID*)(Context->Message->Data + Offset);
+    Fragments[i].FragmentLength = (i + 1 == Context->Fragments) ? Context->Message->Length - Offset : Size;
+    Offset += Size;
+  }
+
+  DNSCursorInit(&Cursor, Fragments, Context->Fragments);
+
+  Status = DecodeDNSPacket(&Cursor, &Packet);
+
+  if(EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  Answers = (DNS_ANSWER*)(Packet->Data + sizeof(DNS_QUESTION) * Packet->Header.QdCount);
+
+  for(i = 0; i < Packet->Header.AnCount && !EFI_ERROR(Status); ++i) {
+    Status = DNSReadRDataView(&Cursor, Answers[i].Type, Answers[i].RDataOffset, (UINT16) Answers[i].RdLength, &View);
+
+    if(Status == EFI_UNSUPPORTED) {
+      Status = EFI_SUCCESS;
+      continue;
+    }
+
+    switch(Answers[i].Type) {
+      case DNS_TYPE_MX:
+        mSink += View.Mx.Preference + View.Mx.Exchange.Offset;
+      break;
+
+      case DNS_TYPE_SRV:
+        mSink += View.Srv.Priority + View.Srv.Weight + View.Srv.Port + View.Srv.Target.Offset;
+      break;
+
+      case DNS_TYPE_TXT:
+        for(Position = 0; DNSViewNextTxtString(&Cursor, &View.Txt, &Position, &String) == EFI_SUCCESS; ) {
+          mSink += String.Length;
+        }
+      break;
+
+      default:
+        mSink += View.Name.Offset;
+      break;
+    }
+  }
+
+  ReleaseDNSPacket(Packet);
+
+  return Status;
+} // End of BenchReadViews
+
+
+/**
+  Runs one benchmark and prints its time and allocations per call.
+
+  @retval EFI_SUCCESS   Every call succeeded.
+  @retval other         The status of the first call that failed.
+  */
+STATIC EFI_STATUS BenchRun(CONST CHAR8 *Label, BENCH_FUNCTION Function, BENCH_CONTEXT *Context, UINTN Iterations) {
+  UINT64      Start;
+  UINT64      Elapsed;
+  UINT64      Allocations;
+  UINT64      Counted;
+  UINTN       i;
+  EFI_STATUS  Status;
+
+  //
+  // One untimed call, both to warm up and to catch a failure once.
+  //
+  Status = Function(Context);
+
+  if(EFI_ERROR(Status)) {
+    printf("%-34s failed (%#zx)\n", Label, (size_t) Status);
+    return Status;
+  }
+
+  Allocations = gDNSClientHostAllocations;
+  Counted     = gDNSClientAllocations;
+  Start       = BenchNow();
+
+  for(i = 0; i < Iterations; ++i) {
+    Function(Context);
+  }
+
+  Elapsed     = BenchNow() - Start;
+  Allocations = gDNSClientHostAllocations - Allocations;
+  Counted     = gDNSClientAllocations - Counted;
+
+  printf(
+    "%-34s %10.1f ns/op %8.2f allocs/op %8.2f counted/op\n",
+    Label,
+    (double) Elapsed / Iterations,
+    (double) Allocations / Iterations,
+    (double) Counted / Iterations
+  );
+
+  return EFI_SUCCESS;
+} // End of BenchRun
+
+
+/**
+  Reads a raw DNS message from a file into the message table.
+
+  @retval 0   The message was added.
+  @retval 1   The file could not be read or the table is full.
+  */
+STATIC int BenchLoadMessage(CONST CHAR8 *Path) {
+  FILE    *File;
+  UINT8   *Data;
+  size_t  Length;
+
+  if(mMessageCount == BENCH_MAX_MESSAGES) {
+    fprintf(stderr, "Too many messages, ignoring %s\n", Path);
+    return 1;
+  }
+
+  File = fopen(Path, "rb");
+
+  if(File == NULL) {
+    perror(Path);
+    return 1;
+  }
+
+  Data   = malloc(BENCH_MAX_MESSAGE_LENGTH);
+  Length = (Data == NULL) ? 0 : fread(Data, 1, BENCH_MAX_MESSAGE_LENGTH, File);
+
+  fclose(File);
+
+  if(Length < DNS_HEADER_LENGTH) {
+    fprintf(stderr, "%s is not a DNS message\n", Path);
+    free(Data);
+    return 1;
+  }
+
+  mMessages[mMessageCount].Name   = Path;
+  mMessages[mMessageCount].Data   = Data;
+  mMessages[mMessageCount].Length = (UINT32) Length;
+  ++mMessageCount;
+
+  return 0;
+} // End of BenchLoadMessage
+
+
+int main(int argc, char **argv) {
+  BENCH_CONTEXT  Context;
+  CHAR8          Label[64];
+  UINTN          Iterations;
+  UINTN          i;
+  int            Failed;
+
+  Iterations = BENCH_DEFAULT_ITERATIONS;
+  Failed     = 0;
+
+  for(i = 1; i < (UINTN) argc; ++i) {
+    if(strcmp(argv[i], "-n") == 0 && i + 1 < (UINTN) argc) {
+      Iterations = strtoul(argv[++i], NULL, 0);
+    } else if(argv[i][0] == '-') {
+      fprintf(stderr, "Usage: %s [-n Iterations] [Message ...]\n", argv[0]);
+      return 2;
+    } else {
+      Failed |= BenchLoadMessage(argv[i]);
+    }
+  }
+
+  if(Iterations == 0) {
+    Iterations = 1;
+  }
+
+  ZeroMem(&Context, sizeof(Context));
+
+  Context.Message  = &mMessages[0];
+  Context.Hostname = "www.microsoft.com-c-3.edgekey.net";
+
+  Context.QType          = 1;
+  Context.UdpPayloadSize = 0;
+  Failed |= EFI_ERROR(BenchRun("EncodeDNSQuery A", BenchEncodeQuery, &Context, Iterations));
+
+  Context.QType          = 28;
+  Context.UdpPayloadSize = 1232;
+  Failed |= EFI_ERROR(BenchRun("EncodeDNSQuery AAAA +OPT", BenchEncodeQuery, &Context, Iterations));
+
+  Failed |= EFI_ERROR(BenchRun("EncodeDNSName", BenchEncodeName, &Context, Iterations));
+  Failed |= EFI_ERROR(BenchRun("DecodeDNSName (compressed)", BenchDecodeName, &Context, Iterations));
+  Failed |= EFI_ERROR(BenchRun("HostnameToLabelFormat", BenchHostnameToLabel, &Context, Iterations));
+  Failed |= EFI_ERROR(BenchRun("LabelFormatToHostname", BenchLabelToHostname, &Context, Iterations));
+
+  for(i = 0; i < mMessageCount; ++i) {
+    Context.Message = &mMessages[i];
+
+    Context.Fragments = 1;
+    snprintf(Label, sizeof(Label), "DecodeDNSPacket %s", mMessages[i].Name);
+    Failed |= EFI_ERROR(BenchRun(Label, BenchDecodePacket, &Context, Iterations));
+
+    Context.Fragments = 3;
+    snprintf(Label, sizeof(Label), "DecodeDNSPacket %s /3", mMessages[i].Name);
+    Failed |= EFI_ERROR(BenchRun(Label, BenchDecodePacket, &Context, Iterations));
+
+    Context.Fragments = 1;
+    snprintf(Label, sizeof(Label), "DecodeDNSPacket+views %s", mMessages[i].Name);
+    Failed |= EFI_ERROR(BenchRun(Label, BenchReadViews, &Context, Iterations));
+  }
+
+  return Failed;
+} // End of main
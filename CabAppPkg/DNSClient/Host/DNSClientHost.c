@@ -0,0 +1,44 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "DNSClientHost.h"
+
+UINT64 gDNSClientHostAllocations = 0;
+
+VOID* EFIAPI CopyMem(VOID *DestinationBuffer, CONST VOID *SourceBuffer, UINTN Length) {
+  return memmove(DestinationBuffer, SourceBuffer, Length);
+} // End of CopyMem
+
+
+VOID* EFIAPI ZeroMem(VOID *Buffer, UINTN Length) {
+  return memset(Buffer, 0, Length);
+} // End of ZeroMem
+
+
+VOID* EFIAPI SetMem(VOID *Buffer, UINTN Length, UINT8 Value) {
+  return memset(Buffer, Value, Length);
+} // End of SetMem
+
+
+VOID* EFIAPI AllocatePool(UINTN AllocationSize) {
+  ++gDNSClientHostAllocations;
+
+  return malloc(AllocationSize);
+} // End of AllocatePool
+
+
+VOID* EFIAPI AllocateZeroPool(UINTN AllocationSize) {
+  ++gDNSClientHostAllocations;
+
+  return calloc(1, AllocationSize);
+} // End of AllocateZeroPool
+
+
+VOID EFIAPI FreePool(VOID *Buffer) {
+  free(Buffer);
+} // End of FreePool
+
+
+UINTN EFIAPI AsciiStrLen(CONST CHAR8 *String) {
+  return strlen(String);
+} // End of AsciiStrLen
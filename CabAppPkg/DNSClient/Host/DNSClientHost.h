@@ -0,0 +1,100 @@
+/** @file DNSClientHost.h
+  Just enough of the UEFI base types and libraries to build the DNSClient
+  codec (DNSClientCodec.c and DNSClientCursor.c) as a normal host program.
+
+  Only used when DNSCLIENT_HOST_BUILD is defined, see GNUmakefile.  The
+  allocation functions are backed by malloc and count every call in
+  gDNSClientHostAllocations, so the bench can report the raw allocations made
+  as well as the ones the codec counts itself.
+
+  Copyright (c) 2015, Caleb Bartholomew
+ */
+
+#ifndef __DNSClientHost_h__
+#define __DNSClientHost_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t                  UINT8;
+typedef uint16_t                 UINT16;
+typedef uint32_t                 UINT32;
+typedef uint64_t                 UINT64;
+typedef int8_t                   INT8;
+typedef int16_t                  INT16;
+typedef int32_t                  INT32;
+typedef int64_t                  INT64;
+typedef size_t                   UINTN;
+typedef ptrdiff_t                INTN;
+typedef char                     CHAR8;
+typedef uint16_t                 CHAR16;
+typedef unsigned char            BOOLEAN;
+typedef void                     VOID;
+
+typedef UINTN                    RETURN_STATUS;
+typedef RETURN_STATUS            EFI_STATUS;
+
+#define EFIAPI
+#define STATIC                   static
+#define CONST                    const
+#define IN
+#define OUT
+#define OPTIONAL
+
+#define TRUE                     ((BOOLEAN)1)
+#define FALSE                    ((BOOLEAN)0)
+
+#define MAX_BIT                  ((UINTN)1 << (sizeof(UINTN) * 8 - 1))
+#define ENCODE_ERROR(a)          ((RETURN_STATUS)(MAX_BIT | (a)))
+
+#define EFI_SUCCESS              ((EFI_STATUS)0)
+#define EFI_INVALID_PARAMETER    ENCODE_ERROR(2)
+#define EFI_UNSUPPORTED          ENCODE_ERROR(3)
+#define EFI_BUFFER_TOO_SMALL     ENCODE_ERROR(5)
+#define EFI_OUT_OF_RESOURCES     ENCODE_ERROR(9)
+#define EFI_NOT_FOUND            ENCODE_ERROR(14)
+#define EFI_PROTOCOL_ERROR       ENCODE_ERROR(24)
+
+#define EFI_ERROR(a)             (((INTN)(RETURN_STATUS)(a)) < 0)
+
+#define MIN(a, b)                (((a) < (b)) ? (a) : (b))
+#define MAX(a, b)                (((a) > (b)) ? (a) : (b))
+#define ALIGN_VALUE(Value, Alignment) ((Value) + (((Alignment) - (Value)) & ((Alignment) - 1)))
+
+#define ASSERT(x)
+
+typedef struct {
+  UINT8                          Addr[4];
+} EFI_IPv4_ADDRESS;
+
+typedef struct {
+  UINT8                          Addr[16];
+} EFI_IPv6_ADDRESS;
+
+typedef struct {
+  UINT32                         FragmentLength;
+  VOID                           *FragmentBuffer;
+} EFI_UDP4_FRAGMENT_DATA;
+
+//
+// The host is assumed to be little endian, as every UEFI target is.
+//
+#define HTONS(x)                 ((UINT16)((((UINT16)(x)) >> 8) | (((UINT16)(x)) << 8)))
+#define NTOHS(x)                 HTONS(x)
+#define HTONL(x)                 ((UINT32)__builtin_bswap32((UINT32)(x)))
+#define NTOHL(x)                 HTONL(x)
+
+//
+// Number of times AllocatePool or AllocateZeroPool has been called.
+//
+extern UINT64 gDNSClientHostAllocations;
+
+VOID*  EFIAPI CopyMem(VOID *DestinationBuffer, CONST VOID *SourceBuffer, UINTN Length);
+VOID*  EFIAPI ZeroMem(VOID *Buffer, UINTN Length);
+VOID*  EFIAPI SetMem(VOID *Buffer, UINTN Length, UINT8 Value);
+VOID*  EFIAPI AllocatePool(UINTN AllocationSize);
+VOID*  EFIAPI AllocateZeroPool(UINTN AllocationSize);
+VOID   EFIAPI FreePool(VOID *Buffer);
+UINTN  EFIAPI AsciiStrLen(CONST CHAR8 *String);
+
+#endif
@@ -0,0 +1,84 @@
+/** @file DnsClientEngine.h
+  Installed by DNSClientDxe next to its EFI_DNS4_SERVICE_BINDING_PROTOCOL.
+  Lets the DNSClient application run its lookups on the resolver the driver
+  keeps for the whole boot (and its warm cache, hosts table and open network
+  children) instead of starting a resolver of its own.
+
+  Every function runs in the driver, on the driver's resolver, so nothing of
+  the caller's image is left behind in it once a batch has completed.  The
+  batches are DNS_RESOLVE_TOKENs laid out as DNSClientImpl.h has them, which
+  are only meaningful to code built from the same DNSClient sources.  The
+  revision changes whenever they do.
+
+  Copyright (c) 2015, Caleb Bartholomew
+ */
+
+#ifndef __DnsClientEngine_h__
+#define __DnsClientEngine_h__
+
+#define DNSCLIENT_ENGINE_PROTOCOL_GUID \
+  { 0x87a2127a, 0x9686, 0x47d6, { 0xa9, 0xea, 0x3a, 0xb0, 0xa7, 0x14, 0x41, 0xc0 }}
+
+#define DNSCLIENT_ENGINE_PROTOCOL_REVISION  0x00020000
+
+typedef struct _DNSCLIENT_ENGINE_PROTOCOL DNSCLIENT_ENGINE_PROTOCOL;
+
+struct _DNS_RESOLVE_TOKEN;
+
+/**
+  Starts a batch of lookups on the driver's resolver, starting the resolver
+  first if nothing has yet, and returns without waiting for any of them.
+  See ResolveDNSLookupsAsync.
+
+  Token->Event should be NULL, or belong to the driver's image, as it may
+  be signaled after the caller has gone.  Token->Status is EFI_NOT_READY
+  until the batch has completed.  Must be called at or below TPL_CALLBACK.
+
+  @param[in]      This           The protocol instance.
+  @param[in/out]  Token          The batch.  Event, Lookups and Count must be filled in.
+
+  @retval EFI_SUCCESS            The batch has been started.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL.
+  @retval EFI_ACCESS_DENIED      Called above TPL_CALLBACK.
+  @retval EFI_NO_MAPPING         There is no network interface to start the resolver on.
+  @retval other                  The resolver could not be started.
+  */
+typedef EFI_STATUS (EFIAPI *DNSCLIENT_ENGINE_RESOLVE)(IN DNSCLIENT_ENGINE_PROTOCOL *This, IN OUT struct _DNS_RESOLVE_TOKEN *Token);
+
+/**
+  Polls the driver's resolver.  See PollDNSClient.  Must be called at or
+  below TPL_CALLBACK.
+
+  @param[in] This                The protocol instance.
+
+  @retval EFI_SUCCESS            The resolver has been polled.
+  @retval EFI_INVALID_PARAMETER  This is NULL.
+  @retval EFI_ACCESS_DENIED      Called above TPL_CALLBACK.
+  @retval EFI_NOT_STARTED        Nothing is open to poll yet.
+  */
+typedef EFI_STATUS (EFIAPI *DNSCLIENT_ENGINE_POLL)(IN DNSCLIENT_ENGINE_PROTOCOL *This);
+
+/**
+  Stops a batch started with Resolve.  See CancelDNSLookups.  Must be called
+  at or below TPL_CALLBACK.
+
+  @param[in] This                The protocol instance.
+  @param[in] Token               The batch.
+
+  @retval EFI_SUCCESS            The batch has been stopped.
+  @retval EFI_INVALID_PARAMETER  A parameter is NULL.
+  @retval EFI_ACCESS_DENIED      Called above TPL_CALLBACK.
+  @retval EFI_NOT_FOUND          Token is not running, it may have completed already.
+  */
+typedef EFI_STATUS (EFIAPI *DNSCLIENT_ENGINE_CANCEL)(IN DNSCLIENT_ENGINE_PROTOCOL *This, IN struct _DNS_RESOLVE_TOKEN *Token);
+
+struct _DNSCLIENT_ENGINE_PROTOCOL {
+  UINT32                         Revision;
+  DNSCLIENT_ENGINE_RESOLVE       Resolve;
+  DNSCLIENT_ENGINE_POLL          Poll;
+  DNSCLIENT_ENGINE_CANCEL        Cancel;
+};
+
+extern EFI_GUID gDnsClientEngineProtocolGuid;
+
+#endif